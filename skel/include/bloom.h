@@ -0,0 +1,58 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#ifndef __LMC_BLOOM
+#define __LMC_BLOOM
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bloom filters of the grams of a group of log lines: every LMC_BLOOM_GRAM
+ * bytes in a row of a token, a run of letters, digits and '_'. The tokens
+ * of a pattern are inside tokens of the lines holding it, so a group whose
+ * filter lacks one of the grams of the pattern holds no line with it and is
+ * not searched. A filter has LMC_BLOOM_BITS bits per distinct gram of the
+ * group and LMC_BLOOM_HASHES bits set per gram, for about 6% of false
+ * positives per gram tested: most patterns have several grams, and a group
+ * is only read if the filter holds all of them.
+ */
+#define LMC_BLOOM_GRAM 4 /* bytes of a gram */
+#define LMC_BLOOM_BITS 6 /* bits of a filter per distinct gram */
+#define LMC_BLOOM_HASHES 4 /* bits set per gram */
+#define LMC_BLOOM_PROBES 32 /* grams of a pattern tested, at most */
+
+/**
+ * Distinct grams of lines a filter is built for. Contains:
+ * @field set: Grams, open addressing, 0 in free entries;
+ * @field size: Number of entries of set, a power of 2;
+ * @field count: Number of grams.
+ */
+struct lmc_bloom_grams {
+	uint32_t *set;
+	size_t size;
+	size_t count;
+};
+
+/**
+ * Grams a filter is tested for. Contains:
+ * @field grams: Distinct grams of the pattern;
+ * @field count: Number of grams.
+ */
+struct lmc_bloom_probe {
+	uint32_t grams[LMC_BLOOM_PROBES];
+	size_t count;
+};
+
+int lmc_bloom_init(struct lmc_bloom_grams *);
+int lmc_bloom_add(struct lmc_bloom_grams *, const char *, size_t);
+size_t lmc_bloom_size(const struct lmc_bloom_grams *);
+void lmc_bloom_build(struct lmc_bloom_grams *, uint8_t *, size_t);
+void lmc_bloom_reset(struct lmc_bloom_grams *);
+void lmc_bloom_free(struct lmc_bloom_grams *);
+
+int lmc_bloom_probe_init(struct lmc_bloom_probe *, const char *, size_t);
+int lmc_bloom_test(const struct lmc_bloom_probe *, const uint8_t *, size_t);
+
+#endif
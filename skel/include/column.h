@@ -0,0 +1,61 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#ifndef __LMC_COLUMN
+#define __LMC_COLUMN
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Column of the times of the log lines held in the log line array of a
+ * cache, kept next to the array: 8 bytes per line instead of the 256 bytes
+ * of a line. Times are stored as keys, the digits of LMC_TIME_FORMAT read as
+ * one number (YYYYmmddHHMMSS), which sort like the time strings do. Interval
+ * filters scan the keys and only read the lines in the interval.
+ */
+#define LMC_TIME_KEY_NONE UINT64_MAX /* time not in LMC_TIME_FORMAT */
+
+/**
+ * Time keys of consecutive log lines. Contains:
+ * @field keys: The keys;
+ * @field max: Number of entries allocated in keys;
+ * @field base: Number of the line keys[0] belongs to, lines are numbered
+ *              like in the cache;
+ * @field ring: Capacity of the ring of the cache, or 0 if it grows. The
+ *              key of line i of a ring is in keys[i % ring];
+ * @field sorted: Number of the oldest line from which the keys of the lines
+ *                do not decrease, and are all in LMC_TIME_FORMAT. Counts
+ *                search those with a binary search.
+ */
+struct lmc_time_column {
+	uint64_t *keys;
+	size_t max;
+	uint64_t base;
+	size_t ring;
+	uint64_t sorted;
+};
+
+/**
+ * Time interval of a query, as keys. Contains:
+ * @field start: Key of the oldest time of interest;
+ * @field end: Key of the newest time of interest;
+ * @field open: The interval has no end.
+ */
+struct lmc_time_range {
+	uint64_t start;
+	uint64_t end;
+	int open;
+};
+
+uint64_t lmc_time_key(const char *);
+int lmc_time_key_value(uint64_t, int64_t *);
+int lmc_column_set(struct lmc_time_column *, uint64_t, uint64_t, uint64_t);
+uint64_t lmc_column_get(struct lmc_time_column *, uint64_t);
+uint64_t lmc_column_search(struct lmc_time_column *, uint64_t, uint64_t, uint64_t);
+void lmc_column_free(struct lmc_time_column *);
+void lmc_time_range(struct lmc_time_range *, const char *, const char *);
+int lmc_time_range_test(const struct lmc_time_range *, uint64_t);
+
+#endif
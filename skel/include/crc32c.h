@@ -0,0 +1,21 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#ifndef __LMC_CRC32C
+#define __LMC_CRC32C
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC-32C (Castagnoli), as used by iSCSI and ext4. The checksum of data split
+ * in several parts is computed by passing the result for the previous parts
+ * as crc; the first call gets 0.
+ */
+void lmc_crc32c_init(void);
+int lmc_crc32c_hw(void);
+uint32_t lmc_crc32c(uint32_t, const void *, size_t);
+uint32_t lmc_crc32c_sw(uint32_t, const void *, size_t);
+
+#endif
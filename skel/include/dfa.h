@@ -0,0 +1,98 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#ifndef __LMC_DFA
+#define __LMC_DFA
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Regular expressions over log lines, matched anywhere in a line, like grep
+ * does. Supported: literals, ".", classes ("[a-z_]", "[^0-9]") and POSIX
+ * classes in them ("[[:digit:]]"), "\d", "\w", "\s" and their negations,
+ * groups, "|", "*", "+", "?", "{m}", "{m,}", "{m,n}", and "^" and "$"
+ * anchors. A pattern is parsed into a Thompson NFA, which is turned into a
+ * DFA over classes of bytes that the pattern does not tell apart; a line is
+ * then matched with one table lookup per byte.
+ *
+ * The DFA is built when compiling, as long as it has at most
+ * LMC_DFA_MAX_STATES states. Patterns needing more states keep the states
+ * built so far, and the missing transitions are built while matching; when
+ * the DFA is full, it is emptied and built again from the current state. A
+ * byte then costs at most one step of the NFA, so matching takes a time
+ * bounded by the length of the line times the number of NFA states, whatever
+ * the pattern.
+ *
+ * The start of a line is the symbol LMC_DFA_BOL, read before the first
+ * byte; its end is the NUL byte after the last one.
+ */
+#define LMC_DFA_NFA_MAX 1024 /* NFA states of a pattern */
+#define LMC_DFA_MAX_STATES 512 /* DFA states held at once */
+#define LMC_DFA_REPEAT_MAX 64 /* largest bound of {m,n} */
+#define LMC_DFA_BOL 256
+#define LMC_DFA_SYMBOLS 257 /* bytes and LMC_DFA_BOL */
+
+/* Transition flags, above the offset of the row of the next state */
+#define LMC_DFA_ACCEPT 0x80000000U /* into an accepting state */
+#define LMC_DFA_END 0x40000000U /* reads the NUL byte */
+#define LMC_DFA_LAZY 0x20000000U /* not built yet */
+#define LMC_DFA_STOP (LMC_DFA_ACCEPT | LMC_DFA_END | LMC_DFA_LAZY)
+
+/**
+ * State of the NFA of a pattern. Contains:
+ * @field type: LMC_NFA_* type of the state;
+ * @field out: Next state;
+ * @field out1: Other next state, for LMC_NFA_SPLIT;
+ * @field set: Symbols leading to out, for LMC_NFA_SET.
+ */
+struct lmc_nfa_state {
+	int type;
+	int out;
+	int out1;
+	uint64_t set[(LMC_DFA_SYMBOLS + 63) / 64];
+};
+
+/**
+ * Compiled pattern. Contains:
+ * @field nfa: States of the NFA;
+ * @field nfa_count: Number of states of the NFA;
+ * @field nfa_start: First state of the NFA;
+ * @field classes: Class of every symbol;
+ * @field symbols: A symbol of every class;
+ * @field class_count: Number of classes;
+ * @field table: Transitions of the DFA, by state and class: the offset in
+ *               table of the row of the next state, with LMC_DFA_* flags;
+ * @field states: Number of states of the DFA;
+ * @field start: Offset of the row of the state after LMC_DFA_BOL;
+ * @field start_accepts: The pattern matches empty lines;
+ * @field complete: The DFA was built whole when compiling;
+ * @field flushes: Number of times the DFA was emptied while matching;
+ * @field sets: Set of NFA states of every DFA state, as a bitmap;
+ * @field words: Size of a set, in 64 bit words;
+ * @field hash: DFA states by set, open addressing.
+ */
+struct lmc_dfa {
+	struct lmc_nfa_state *nfa;
+	int nfa_count;
+	int nfa_start;
+	uint16_t classes[LMC_DFA_SYMBOLS];
+	uint16_t symbols[LMC_DFA_SYMBOLS];
+	int class_count;
+	uint32_t *table;
+	int states;
+	uint32_t start;
+	int start_accepts;
+	int complete;
+	uint64_t flushes;
+	uint64_t *sets;
+	int words;
+	int16_t *hash;
+};
+
+int lmc_dfa_compile(struct lmc_dfa *, const char *, size_t, const char **);
+int lmc_dfa_match(struct lmc_dfa *, const char *, size_t);
+void lmc_dfa_free(struct lmc_dfa *);
+
+#endif
@@ -0,0 +1,79 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#ifndef __LMC_HISTOGRAM
+#define __LMC_HISTOGRAM
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "column.h"
+#include "utils.h"
+
+/*
+ * Number of log lines per interval of time, for the count and histogram
+ * commands. Buckets are width seconds long and start at multiples of width
+ * since the Epoch; only the buckets holding lines are kept, oldest first. A
+ * count is a histogram of a single bucket, of width 0. Lines are counted in
+ * bulk where the time index tells how many fall in a bucket: runs of sorted
+ * keys of the time column, runs of the times of warm segments, and segments
+ * and blocks whose times all fall in one bucket.
+ */
+#define LMC_HISTOGRAM_MAX_WIDTH (366 * 24 * 3600ULL) /* seconds of a bucket, at most */
+
+/**
+ * Lines counted in a bucket. Contains:
+ * @field start: Time value of the start of the bucket;
+ * @field count: Number of lines.
+ */
+struct lmc_bucket {
+	int64_t start;
+	uint64_t count;
+};
+
+/**
+ * Lines counted so far. Contains:
+ * @field width: Seconds of a bucket, or 0 for a count;
+ * @field buckets: Buckets holding lines, oldest first;
+ * @field count: Number of buckets;
+ * @field max: Number of entries allocated in buckets;
+ * @field unplaced: Lines whose time is not in LMC_TIME_FORMAT, so they are
+ *                  in no bucket;
+ * @field ranged: Only lines in an interval are counted;
+ * @field start: Oldest time of interest;
+ * @field end: Newest time of interest, or an empty string for no end;
+ * @field range: Keys of start and end;
+ * @field from: Time value of start;
+ * @field to: Time value of end;
+ * @field cur: Start of the bucket of the last key counted;
+ * @field lo: Key of the start of that bucket;
+ * @field hi: Key of the start of the bucket after it.
+ */
+struct lmc_histogram {
+	uint64_t width;
+	struct lmc_bucket *buckets;
+	size_t count;
+	size_t max;
+	uint64_t unplaced;
+	int ranged;
+	char start[LMC_TIME_SIZE];
+	char end[LMC_TIME_SIZE];
+	struct lmc_time_range range;
+	int64_t from;
+	int64_t to;
+	int64_t cur;
+	uint64_t lo;
+	uint64_t hi;
+};
+
+int lmc_histogram_init(struct lmc_histogram *, uint64_t, const char *, const char *);
+int lmc_histogram_add(struct lmc_histogram *, int64_t, uint64_t);
+int lmc_histogram_add_line(struct lmc_histogram *, const char *, uint64_t);
+int lmc_histogram_add_span(struct lmc_histogram *, int64_t, int64_t, uint64_t);
+int lmc_histogram_add_times(struct lmc_histogram *, const int64_t *, uint64_t);
+int lmc_histogram_add_column(struct lmc_histogram *, struct lmc_time_column *, uint64_t, uint64_t);
+uint64_t lmc_histogram_total(const struct lmc_histogram *);
+void lmc_histogram_free(struct lmc_histogram *);
+
+#endif
@@ -0,0 +1,116 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#ifndef __LMC_INDEX
+#define __LMC_INDEX
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Inverted index of the log lines of a service, built as the lines are
+ * added. Lines are split into tokens, runs of letters, digits and '_'. Every
+ * token of at least LMC_INDEX_TOKEN_MIN bytes is a key of the index, and so
+ * are its first and its last LMC_INDEX_AFFIX bytes, if it has that many. A
+ * key maps to the posting list of the lines holding it: their numbers,
+ * relative to the first line indexed, as varint deltas. A list short enough
+ * is kept in the entry of its key instead of being allocated.
+ *
+ * A search looks its pattern up: the tokens of the pattern with a separator
+ * on both sides must be whole tokens of a matching line, the first token of
+ * the pattern must end a token of the line and the last one must start a
+ * token of the line, so the lines holding all their keys are candidates.
+ * Candidates are then searched like any line, so the index only narrows the
+ * lines a search reads. Once the index holds more memory than its budget, it
+ * is emptied and restarts with the next line added.
+ */
+#define LMC_INDEX_TOKEN_MIN 2 /* shorter tokens are too common to narrow a search */
+#define LMC_INDEX_AFFIX 4 /* bytes of the prefix and suffix keys of a token */
+#define LMC_INDEX_INLINE 8 /* bytes of a posting list kept in its entry */
+#define LMC_INDEX_SKIP 8 /* lists this many times longer than the candidates are not read */
+
+/* Keys of a token */
+enum lmc_index_kind {
+	LMC_INDEX_WHOLE,
+	LMC_INDEX_PREFIX, /* its first LMC_INDEX_AFFIX bytes */
+	LMC_INDEX_SUFFIX, /* its last LMC_INDEX_AFFIX bytes */
+};
+
+/**
+ * Key and its posting list. Contains:
+ * @field hash: Hash of the key, 0 if the entry is free;
+ * @field name: Offset of the text of the key in the names of the index;
+ * @field name_len: Length of the text of the key;
+ * @field kind: LMC_INDEX_* kind of the key;
+ * @field count: Number of lines holding the key;
+ * @field last: Last line holding the key, relative to the first line of the
+ *              index;
+ * @field len: Size of the posting list;
+ * @field bytes: The posting list, if it fits in LMC_INDEX_INLINE bytes;
+ * @field data: The posting list, if it does not.
+ */
+struct lmc_posting {
+	uint32_t hash;
+	uint32_t name;
+	uint16_t name_len;
+	uint16_t kind;
+	uint32_t count;
+	uint32_t last;
+	uint32_t len;
+	union {
+		uint8_t bytes[LMC_INDEX_INLINE];
+		uint8_t *data;
+	} u;
+};
+
+/**
+ * Index of the lines of a service. Contains:
+ * @field slots: Keys, open addressing;
+ * @field slot_count: Number of slots, a power of 2;
+ * @field keys: Number of keys;
+ * @field names: Text of the keys, one after the other;
+ * @field names_len: Size of the text of the keys;
+ * @field names_max: Size allocated for names;
+ * @field first: Number of the first line indexed, lines are numbered like in
+ *               the cache;
+ * @field next: Number of the line after the last one indexed;
+ * @field bytes: Memory held by the index;
+ * @field budget: Memory the index may hold;
+ * @field resets: Number of times the index went over its budget.
+ */
+struct lmc_index {
+	struct lmc_posting *slots;
+	size_t slot_count;
+	size_t keys;
+	char *names;
+	size_t names_len;
+	size_t names_max;
+	uint64_t first;
+	uint64_t next;
+	uint64_t bytes;
+	uint64_t budget;
+	uint64_t resets;
+};
+
+/**
+ * Candidate lines of a search. Contains:
+ * @field lines: Numbers of the lines, relative to base, in order;
+ * @field count: Number of lines;
+ * @field base: Number of the first line of the index;
+ * @field from: Lines before this one are not indexed, they must be searched.
+ */
+struct lmc_index_hits {
+	uint32_t *lines;
+	size_t count;
+	uint64_t base;
+	uint64_t from;
+};
+
+void lmc_index_init(struct lmc_index *, uint64_t);
+void lmc_index_add(struct lmc_index *, uint64_t, const char *);
+void lmc_index_trim(struct lmc_index *, uint64_t);
+int lmc_index_query(struct lmc_index *, const char *, size_t, struct lmc_index_hits *);
+void lmc_index_free(struct lmc_index *);
+
+#endif
@@ -11,15 +11,44 @@
 /**
  * A connection to the server. Contains:
  * @field socket: Connection socket;
- * @field name: An identifier for the client.
+ * @field name: An identifier for the client;
+ * @field durable_seq: Number of log lines of the service on stable storage,
+ *                     as reported by the last flush.
  */
 struct lmc_conn {
 	SOCKET socket;
 	char *name;
+	uint64_t durable_seq;
+};
+
+/**
+ * Logs counted in an interval of time. Contains:
+ * @field start: Beginning of the interval;
+ * @field logs: Number of logs.
+ */
+struct lmc_count_bucket {
+	time_t start;
+	uint64_t logs;
+};
+
+/**
+ * Logs received in one contiguous array. Contains:
+ * @field lines: The logs, oldest first;
+ * @field count: Number of logs in lines;
+ * @field total: Number of logs sent by the server, more than count if they
+ *               did not all fit in the array of the caller;
+ * @field owned: Whether lines was allocated by the library.
+ */
+struct lmc_logs {
+	struct lmc_client_logline *lines;
+	uint64_t count;
+	uint64_t total;
+	int owned;
 };
 
 /* Client API */
 struct lmc_conn *lmc_connect(char *);
+struct lmc_conn *lmc_connect_opts(char *, const char *);
 void lmc_free(struct lmc_conn *);
 int lmc_send_log(struct lmc_conn *, char *);
 int lmc_flush(struct lmc_conn *);
@@ -27,11 +56,34 @@ int lmc_disconnect(struct lmc_conn *);
 int lmc_unsubscribe(struct lmc_conn *);
 struct lmc_client_logline **lmc_get_logs(struct lmc_conn *,
 	time_t, time_t, uint64_t *);
+struct lmc_client_logline **lmc_get_logs_collapsed(struct lmc_conn *,
+	time_t, time_t, uint64_t *);
+struct lmc_client_logline *lmc_get_logs_since(struct lmc_conn *,
+	uint64_t *, uint64_t, uint64_t *, uint64_t *);
+int lmc_get_logs_into(struct lmc_conn *, int, struct lmc_client_logline *,
+	uint64_t, struct lmc_logs *);
+struct lmc_client_service_logline *lmc_get_logs_multi(struct lmc_conn *,
+	const char *, time_t, time_t, uint64_t *);
+void lmc_free_logs(struct lmc_logs *);
 char *lmc_get_stats(struct lmc_conn *);
+char **lmc_get_templates(struct lmc_conn *, uint64_t *);
+struct lmc_client_logline **lmc_search(struct lmc_conn *, const char *,
+	time_t, time_t, uint64_t *);
+struct lmc_client_logline **lmc_get_logs_regex(struct lmc_conn *, const char *,
+	time_t, time_t, uint64_t *);
+int lmc_count_logs(struct lmc_conn *, const char *, time_t, time_t,
+	uint64_t *);
+struct lmc_count_bucket *lmc_get_histogram(struct lmc_conn *, uint64_t,
+	const char *, time_t, time_t, uint64_t *);
+int lmc_follow(struct lmc_conn *, time_t);
+int lmc_follow_next(struct lmc_conn *, struct lmc_client_logline **,
+	uint64_t *, uint64_t *);
+int lmc_unfollow(struct lmc_conn *);
 void lmc_free_buf(void *);
 
 /* OS Specific functions */
 int lmc_conn_init_os(struct lmc_conn *, char *);
 void lmc_conn_free_os(struct lmc_conn *);
+int lmc_recv_lines_os(SOCKET, struct lmc_client_logline *, uint64_t);
 
 #endif
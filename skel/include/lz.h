@@ -0,0 +1,27 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#ifndef __LMC_LZ
+#define __LMC_LZ
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Byte-oriented LZ77 codec for log blocks, in the spirit of LZ4: a stream of
+ * sequences, each made of a token byte (literal count in the high nibble,
+ * match length - LMC_LZ_MIN_MATCH in the low nibble), the literal count
+ * extension bytes, the literals, a 2-byte little endian match offset and the
+ * match length extension bytes. A nibble of 15 is extended by bytes that are
+ * added to it until one of them is smaller than 255. The last sequence only
+ * has literals. Blocks are independent, there is no state between them.
+ */
+#define LMC_LZ_MIN_MATCH 4
+#define LMC_LZ_MAX_OFFSET 65535
+
+size_t lmc_lz_bound(size_t);
+size_t lmc_lz_compress(const void *, size_t, void *, size_t);
+int lmc_lz_decompress(const void *, size_t, void *, size_t);
+
+#endif
@@ -0,0 +1,79 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#ifndef __LMC_MERGE
+#define __LMC_MERGE
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "column.h"
+#include "utils.h"
+
+/*
+ * Merge by time of the log lines of several services, for getlogs_multi.
+ * The lines of every service are read into a run a chunk at a time, with
+ * their time keys; a chunk whose keys decrease somewhere is given the order
+ * of its lines by time, lines of the same time keeping theirs. The runs are
+ * then merged with a binary heap of their next lines, keyed on the time and,
+ * for lines of the same time, on the position of the run, so they come in
+ * the order the services were named. A run is filled again once the merge
+ * has taken all its lines, so lines older than the chunk before them are
+ * merged where they are read. Lines whose time is not in LMC_TIME_FORMAT
+ * come last.
+ */
+
+/**
+ * Lines of a service to merge. Contains:
+ * @field lines: The lines, in the order they were read;
+ * @field keys: Time keys of the lines;
+ * @field copies: Number of times every line is merged, repeats being kept
+ *                as a single line;
+ * @field order: Positions of the lines by time, or NULL if they already are;
+ * @field count: Number of lines;
+ * @field max: Number of entries allocated in lines, keys and copies;
+ * @field next: Number of lines merged so far.
+ */
+struct lmc_merge_run {
+	struct lmc_client_logline *lines;
+	uint64_t *keys;
+	uint64_t *copies;
+	size_t *order;
+	size_t count;
+	size_t max;
+	size_t next;
+};
+
+/**
+ * Fill an empty run with the next lines of its service, none if it has no
+ * more. Called with the run, its position and the argument of the merge.
+ * Returns 0 in case of success, or -1 otherwise.
+ */
+typedef int (*lmc_merge_fill_fn)(struct lmc_merge_run *, size_t, void *);
+
+/**
+ * Runs being merged. Contains:
+ * @field runs: The runs;
+ * @field heap: Runs with lines left, the one whose next line is the oldest
+ *              first;
+ * @field count: Number of runs in heap;
+ * @field fill: Fills the runs, or NULL if they hold all their lines;
+ * @field arg: Passed to fill.
+ */
+struct lmc_merge {
+	struct lmc_merge_run *runs;
+	size_t *heap;
+	size_t count;
+	lmc_merge_fill_fn fill;
+	void *arg;
+};
+
+int lmc_merge_run_add(struct lmc_merge_run *, const struct lmc_client_logline *, uint64_t);
+int lmc_merge_run_sort(struct lmc_merge_run *);
+void lmc_merge_run_free(struct lmc_merge_run *);
+int lmc_merge_init(struct lmc_merge *, struct lmc_merge_run *, size_t, lmc_merge_fill_fn, void *);
+int lmc_merge_next(struct lmc_merge *, const struct lmc_client_logline **, size_t *);
+void lmc_merge_free(struct lmc_merge *);
+
+#endif
@@ -0,0 +1,45 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#ifndef __LMC_POOL
+#define __LMC_POOL
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "server.h"
+
+#define LMC_POOL_MAX 8 /* pools on the server */
+#define LMC_POOL_BATCH 32 /* objects moved between a worker and its pool */
+#define LMC_SLAB_SIZE (64 << 10) /* bytes, objects are carved out of slabs */
+
+/**
+ * Pool of fixed-size objects, carved out of slabs that are never given back.
+ * Every worker thread keeps its own free list of objects of the pool and
+ * only takes the pool lock to exchange LMC_POOL_BATCH objects at once, or
+ * to get a new slab. Contains:
+ * @field size: Size of an object;
+ * @field id: Position of the free list of the pool in the worker lists;
+ * @field lock: Protects the fields below;
+ * @field free: Free objects not held by any worker, linked through their
+ *              first word;
+ * @field slabs: Number of slabs allocated, each with one malloc call;
+ * @field allocs: Number of objects handed out, as reported by the workers.
+ */
+struct lmc_pool {
+	size_t size;
+	int id;
+	lmc_mutex_t lock;
+	void *free;
+	uint64_t slabs;
+	uint64_t allocs;
+};
+
+void lmc_pool_init(struct lmc_pool *, size_t);
+void *lmc_pool_alloc(struct lmc_pool *);
+void lmc_pool_free(struct lmc_pool *, void *);
+void lmc_pool_drain(void);
+void lmc_pool_stats(uint64_t *, uint64_t *);
+
+#endif
@@ -0,0 +1,36 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#ifndef __LMC_SEARCH
+#define __LMC_SEARCH
+
+#include <stddef.h>
+
+#include "utils.h"
+
+/*
+ * Substring search over log lines. On x86 the first and the last byte of the
+ * pattern are compared with 16 (SSE2) or 32 (AVX2) positions of the line at
+ * once, and only the positions where both match are compared in full, so
+ * most of a line is rejected without looking at it byte by byte. Other CPUs
+ * use memchr on the first byte.
+ */
+
+/**
+ * Pattern of a search. Contains:
+ * @field pattern: The pattern, NUL terminated;
+ * @field len: Length of the pattern.
+ */
+struct lmc_search {
+	char pattern[LMC_LOGLINE_SIZE];
+	size_t len;
+};
+
+int lmc_search_init(struct lmc_search *, const char *, size_t);
+const char *lmc_search_find(const struct lmc_search *, const char *, size_t);
+const char *lmc_search_find_sw(const struct lmc_search *, const char *, size_t);
+int lmc_search_line(const struct lmc_search *, const char *);
+const char *lmc_search_kernel(void);
+
+#endif
@@ -0,0 +1,267 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#ifndef __LMC_SEGMENT
+#define __LMC_SEGMENT
+
+#include <stdio.h>
+#include "bloom.h"
+#include "utils.h"
+
+/*
+ * On-disk segment format. All integers are stored in host byte order.
+ *
+ *   segment header | block | block | ... | block index | segment footer
+ *
+ * Every block starts with a block header followed by the stored records.
+ * Records are packed as the timestamp and the log line, each terminated by a
+ * NUL byte, and each block is compressed on its own, so any block can be
+ * decoded without the others. A CRC-32C of each block, header included,
+ * tells torn or corrupted blocks apart from valid ones; readers pass over a
+ * corrupted block and go on with the next one, using the record count the
+ * block index has for it. The block index has one entry per block and
+ * lets readers skip to the blocks covering a time range without reading or
+ * decompressing the others. Files that are still being appended to have no
+ * index and no footer; readers rebuild the index by walking the block
+ * headers. Files without a segment header are plain arrays of
+ * struct lmc_client_logline, as written by older versions.
+ *
+ * Blocks with the LMC_BLOCK_TIMES flag (version 3) store the timestamps as
+ * time values instead of strings, before the log lines:
+ *
+ *   first time (int64) | varint | ... | varint | line\0 | ... | line\0
+ *
+ * with one varint per record after the first: the zigzag encoded difference
+ * between the delta of the record to the one before and the previous delta
+ * (delta-of-delta). Lines logged at a steady rate take one byte each. The
+ * writer only uses it when every timestamp of the block is rebuilt exactly
+ * by formatting its time value with LMC_TIME_FORMAT.
+ *
+ * Blocks may be preceded by a filter block (version 4), of codec
+ * LMC_CODEC_BLOOM and with no records: the Bloom filter of the grams of the
+ * lines of the block after it (see bloom.h), with the same times. Searches
+ * read it first and skip the block if it holds none of the grams of their
+ * pattern. Blocks whose filter would be larger than LMC_BLOOM_MAX have none.
+ */
+#define LMC_SEGMENT_MAGIC "LMCSEG01"
+#define LMC_SEGMENT_VERSION 4
+#define LMC_BLOCK_MAGIC 0x4b4c424cU /* "LBLK" */
+#define LMC_BLOCK_RECORDS 256 /* records per block of LMC_CODEC_RAW */
+#define LMC_BLOCK_SIZE (64 * 1024) /* packed bytes per block */
+#define LMC_BLOCK_CRC 0x1 /* block flag: crc is set */
+#define LMC_BLOCK_TIMES 0x2 /* block flag: timestamps stored as deltas */
+#define LMC_BLOCK_TIMES_MAX (LMC_BLOCK_SIZE / 16) /* records per block of LMC_BLOCK_TIMES */
+#define LMC_BLOOM_MAX (LMC_BLOCK_SIZE / 4) /* bytes of a filter block */
+
+enum lmc_block_codec {
+	LMC_CODEC_RAW, /* array of struct lmc_client_logline */
+	LMC_CODEC_PACKED, /* packed records, stored as is */
+	LMC_CODEC_LZ, /* packed records, compressed with lmc_lz_compress */
+	LMC_CODEC_BLOOM, /* filter of the next block */
+};
+
+#pragma pack(push, 1)
+/**
+ * First bytes of a segment file. Contains:
+ * @field magic: LMC_SEGMENT_MAGIC;
+ * @field version: LMC_SEGMENT_VERSION.
+ */
+struct lmc_segment_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+};
+
+/**
+ * Header of a block. Contains:
+ * @field magic: LMC_BLOCK_MAGIC;
+ * @field codec: How the records are stored (enum lmc_block_codec);
+ * @field flags: LMC_BLOCK_* flags;
+ * @field records: Number of records in the block;
+ * @field raw_len: Size of the records once decoded;
+ * @field stored_len: Size of the data following the header;
+ * @field crc: CRC-32C of the header, with crc set to 0, and of the data;
+ * @field first_time: Oldest timestamp in the block;
+ * @field last_time: Newest timestamp in the block.
+ */
+struct lmc_block_header {
+	uint32_t magic;
+	uint16_t codec;
+	uint16_t flags;
+	uint32_t records;
+	uint32_t raw_len;
+	uint32_t stored_len;
+	uint32_t crc;
+	int64_t first_time;
+	int64_t last_time;
+};
+
+/**
+ * Block index entry. Contains:
+ * @field offset: Offset of the block header in the file;
+ * @field records: Number of records in the block;
+ * @field stored_len: Size of the data following the block header;
+ * @field first_time: Oldest timestamp in the block;
+ * @field last_time: Newest timestamp in the block.
+ */
+struct lmc_block_index {
+	uint64_t offset;
+	uint32_t records;
+	uint32_t stored_len;
+	int64_t first_time;
+	int64_t last_time;
+};
+
+/**
+ * Last bytes of a sealed segment file. Contains:
+ * @field index_offset: Offset of the block index in the file;
+ * @field records: Number of records in the segment;
+ * @field blocks: Number of entries in the block index;
+ * @field version: LMC_SEGMENT_VERSION;
+ * @field magic: LMC_SEGMENT_MAGIC.
+ */
+struct lmc_segment_footer {
+	uint64_t index_offset;
+	uint64_t records;
+	uint32_t blocks;
+	uint32_t version;
+	char magic[8];
+};
+#pragma pack(pop)
+
+/**
+ * Writer for a segment file. Contains:
+ * @field file: File being written;
+ * @field block: Packed records of the block being filled;
+ * @field block_len: Number of bytes used in block;
+ * @field block_records: Number of records in block;
+ * @field first_time: Oldest timestamp in block;
+ * @field last_time: Newest timestamp in block;
+ * @field last_str: Timestamp of the last record, as a string;
+ * @field last_val: Timestamp of the last record, as a time value;
+ * @field last_exact: last_str is rebuilt from last_val;
+ * @field times: Time values of the records in block;
+ * @field times_exact: All the timestamps in block are rebuilt from times;
+ * @field timed: block, with the timestamps stored as deltas;
+ * @field stored: Buffer for the compressed block;
+ * @field grams: Grams of the records in block;
+ * @field bloom: Write a filter block before every block, set by default;
+ * @field index: Index of the blocks written so far;
+ * @field blocks: Number of blocks written;
+ * @field max_blocks: Number of entries allocated in index;
+ * @field records: Number of records written;
+ * @field offset: Current size of the file.
+ */
+struct lmc_segment_writer {
+	FILE *file;
+	char *block;
+	uint32_t block_len;
+	uint32_t block_records;
+	int64_t first_time;
+	int64_t last_time;
+	char last_str[LMC_TIME_SIZE];
+	int64_t last_val;
+	int last_exact;
+	int64_t *times;
+	int times_exact;
+	char *timed;
+	char *stored;
+	struct lmc_bloom_grams grams;
+	int bloom;
+	struct lmc_block_index *index;
+	uint32_t blocks;
+	uint32_t max_blocks;
+	uint64_t records;
+	uint64_t offset;
+};
+
+/**
+ * Reader for a segment file of any format. Contains:
+ * @field file: File being read;
+ * @field legacy: The file is a plain array of records;
+ * @field sealed: The file has a block index and a footer;
+ * @field index: Index of the blocks in the file;
+ * @field blocks: Number of blocks in the file;
+ * @field next_block: Next block to decode;
+ * @field from: Blocks ending before this time are skipped;
+ * @field to: Blocks starting after this time are skipped;
+ * @field probe: Blocks whose filter rules these grams out are skipped, or
+ *               NULL;
+ * @field probed: Number of filters read;
+ * @field skipped: Number of blocks skipped by their filter;
+ * @field skipped_records: Number of records in those blocks;
+ * @field lost: Number of blocks passed over because they could not be read
+ *              back: their checksum does not match, or they do not decode;
+ * @field lost_records: Number of records in those blocks, after the ones
+ *                      skipped with lmc_segment_skip;
+ * @field block: Records of the current block, for LMC_CODEC_RAW;
+ * @field data: Packed records of the current block;
+ * @field data_len: Number of bytes in data;
+ * @field stored: Compressed data of the current block;
+ * @field codec: Codec of the current block;
+ * @field block_records: Number of records in the current block;
+ * @field block_pos: Next record to return from the current block;
+ * @field data_pos: Offset of that record in data;
+ * @field data_start: Offset of the first record in data, after the time
+ *                    values of LMC_BLOCK_TIMES;
+ * @field times: Time values of the records of the current block, for
+ *               LMC_BLOCK_TIMES;
+ * @field flags: Flags of the current block;
+ * @field time_val: Last time value formatted;
+ * @field time_str: time_val, formatted.
+ */
+struct lmc_segment_reader {
+	FILE *file;
+	int legacy;
+	int sealed;
+	struct lmc_block_index *index;
+	uint32_t blocks;
+	uint32_t next_block;
+	int64_t from;
+	int64_t to;
+	const struct lmc_bloom_probe *probe;
+	uint32_t probed;
+	uint32_t skipped;
+	uint64_t skipped_records;
+	uint32_t lost;
+	uint64_t lost_records;
+	struct lmc_client_logline *block;
+	char *data;
+	uint32_t data_len;
+	char *stored;
+	uint16_t codec;
+	uint32_t block_records;
+	uint32_t block_pos;
+	uint32_t data_pos;
+	uint32_t data_start;
+	int64_t *times;
+	uint16_t flags;
+	int64_t time_val;
+	char time_str[LMC_TIME_SIZE];
+};
+
+int lmc_segment_create(struct lmc_segment_writer *, const char *);
+int lmc_segment_append(struct lmc_segment_writer *, const struct lmc_client_logline *);
+int lmc_segment_finish(struct lmc_segment_writer *);
+void lmc_segment_abort(struct lmc_segment_writer *);
+int lmc_segment_open_active(struct lmc_segment_writer *, const char *);
+int lmc_segment_close_active(struct lmc_segment_writer *, int);
+int lmc_segment_seal(const char *);
+int lmc_segment_recover(const char *, uint64_t *);
+
+int lmc_segment_open(struct lmc_segment_reader *, const char *);
+void lmc_segment_range(struct lmc_segment_reader *, time_t, time_t);
+void lmc_segment_filter(struct lmc_segment_reader *, const struct lmc_bloom_probe *);
+int lmc_segment_next(struct lmc_segment_reader *, struct lmc_client_logline *);
+int lmc_segment_skip(struct lmc_segment_reader *, uint64_t);
+int lmc_segment_peek(struct lmc_segment_reader *, struct lmc_block_index *);
+int lmc_segment_times(struct lmc_segment_reader *, const int64_t **);
+void lmc_segment_rewind_block(struct lmc_segment_reader *);
+void lmc_segment_close(struct lmc_segment_reader *);
+int lmc_segment_count(const char *, uint64_t *);
+
+size_t lmc_times_encode(const int64_t *, uint32_t, char *);
+long lmc_times_decode(const char *, size_t, uint32_t, int64_t *);
+
+#endif
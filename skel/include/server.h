@@ -5,34 +5,315 @@
 #ifndef __LMC_SERVER
 #define __LMC_SERVER
 
+#include "bloom.h"
+#include "column.h"
+#include "index.h"
+#include "template.h"
 #include "utils.h"
 #include <sys/types.h>
+#include <time.h>
 
 #ifdef __unix__
+#include <pthread.h>
 #include <sys/socket.h>
+#elif defined(_WIN32)
+#include <windows.h>
 #endif
 
 #define LMC_DEFAULT_CLIENTS_NO 20
 #define LMC_FLUSH_TIME 1 /* minutes */
 #define LMC_LOGFILE_NAME_LEN 128
+#define LMC_SYNC_INTERVAL 1000 /* ms, periodic durability */
+#define LMC_GROUP_COMMIT_WINDOW 2 /* ms, min gap between on-flush syncs */
+#define LMC_SEGMENT_MAX_SIZE (16 << 20) /* bytes, rotate the log file after */
+#define LMC_SEGMENT_MAX_AGE 3600 /* seconds, rotate the log file after */
+#define LMC_RETAIN_MAX_SIZE (1ULL << 30) /* bytes of rotated files kept */
+#define LMC_RETAIN_MAX_AGE (7 * 24 * 3600) /* seconds rotated files are kept */
+#define LMC_COMPACT_INTERVAL 10 /* seconds between compaction passes */
+#define LMC_COMPACT_SMALL_FILE (1 << 20) /* bytes, smaller files get merged */
+#define LMC_COMPACT_MIN_FILES 4 /* merge only runs at least this long */
+#define LMC_COMPACT_RATE (16 << 20) /* bytes/s of compaction I/O */
+#define LMC_COMPACT_SUFFIX ".compact" /* segment being merged */
+#define LMC_MEMORY_BUDGET (1ULL << 30) /* bytes of log lines kept in memory */
+#define LMC_MEMORY_LOW_WATERMARK 90 /* percent of the budget eviction goes down to */
+#define LMC_MEMORY_UNIT 4096 /* bytes, granularity of memory accounting */
+#define LMC_CACHE_MIN_PAGES 16 /* pages of the first log line array */
+#define LMC_PREFAULT_PAGES 256 /* pages faulted in at once, with expected_lines */
+#define LMC_HUGE_PAGE_SIZE (2 << 20) /* bytes, huge pages backing caches */
+#define LMC_WARM_LINES 8192 /* lines of a warm segment, a whole huge page of them */
+#define LMC_HOT_LINES 8192 /* newest lines never compressed */
+#define LMC_HOT_MAX_SHIFT 3 /* caches read often keep up to 8x more hot lines */
+#define LMC_WARM_AGE 600 /* seconds warm lines of unread caches stay in memory */
+#define LMC_TIER_PRESSURE 75 /* percent of the budget above which tiers shrink */
+#define LMC_REPEAT_MARK '\002' /* starts a line holding repeats of the one before */
+#define LMC_REPEAT_FORMAT "last message repeated " UINT64_FMT " times"
+#define LMC_FOLLOW_POLL 100 /* ms a follower waits for lines before checking its socket */
+#define LMC_FOLLOW_HEARTBEAT 10 /* polls without lines before an empty batch is sent */
+#define LMC_CURSOR_SEQ_BITS 40 /* low bits of a cursor, the number of a line; the high ones tag the cache */
+#define LMC_MULTI_MAX 32 /* services of a getlogs_multi, at most */
+#define LMC_MULTI_CHUNK 4096 /* lines of a service a getlogs_multi reads at once, at most */
 
 #ifdef __unix__
 #define LMC_SEND_FLAGS MSG_NOSIGNAL
 typedef int HANDLE;
+typedef pthread_mutex_t lmc_mutex_t;
+typedef pthread_cond_t lmc_cond_t;
+#define LMC_THREAD_LOCAL __thread
+#define lmc_mutex_init(m) pthread_mutex_init((m), NULL)
+#define lmc_mutex_destroy(m) pthread_mutex_destroy(m)
+#define lmc_mutex_lock(m) pthread_mutex_lock(m)
+#define lmc_mutex_unlock(m) pthread_mutex_unlock(m)
+#define lmc_cond_init(c) pthread_cond_init((c), NULL)
+#define lmc_cond_destroy(c) pthread_cond_destroy(c)
+#define lmc_cond_broadcast(c) pthread_cond_broadcast(c)
 #elif defined(_WIN32)
 #define LMC_SEND_FLAGS 0
+typedef CRITICAL_SECTION lmc_mutex_t;
+typedef CONDITION_VARIABLE lmc_cond_t;
+#define LMC_THREAD_LOCAL __declspec(thread)
+#define lmc_mutex_init(m) InitializeCriticalSection(m)
+#define lmc_mutex_destroy(m) DeleteCriticalSection(m)
+#define lmc_mutex_lock(m) EnterCriticalSection(m)
+#define lmc_mutex_unlock(m) LeaveCriticalSection(m)
+#define lmc_cond_init(c) InitializeConditionVariable(c)
+#define lmc_cond_destroy(c)
+#define lmc_cond_broadcast(c) WakeAllConditionVariable(c)
 #endif
 
+/**
+ * How hard a flush tries to get the logs onto stable storage:
+ * LMC_DURABILITY_NONE: write to the page cache only;
+ * LMC_DURABILITY_PERIODIC: a background sync runs every LMC_SYNC_INTERVAL;
+ * LMC_DURABILITY_FLUSH: flush returns only after the data was synced. Syncs
+ * are shared between all services flushing at the same time (group commit).
+ */
+enum lmc_durability {
+	LMC_DURABILITY_NONE,
+	LMC_DURABILITY_PERIODIC,
+	LMC_DURABILITY_FLUSH,
+};
+
+/**
+ * What a full ring cache does with the oldest line before overwriting it:
+ * LMC_RING_DROP: nothing, lines that were not flushed are lost;
+ * LMC_RING_FLUSH: flush the cache first, so the line stays on disk.
+ */
+enum lmc_ring_overwrite {
+	LMC_RING_DROP,
+	LMC_RING_FLUSH,
+};
+
+/**
+ * Pages backing the log line array of a cache:
+ * LMC_HUGE_OFF: regular pages;
+ * LMC_HUGE_THP: transparent huge pages, if the kernel allows them;
+ * LMC_HUGE_HUGETLB: pages of the reserved huge page pool, or transparent
+ * huge pages when the pool is empty.
+ * Huge pages make scanning large caches cheaper, but even a cache holding
+ * one line takes a whole huge page.
+ */
+enum lmc_huge_pages {
+	LMC_HUGE_OFF,
+	LMC_HUGE_THP,
+	LMC_HUGE_HUGETLB,
+};
+
+/**
+ * Options a service passes when connecting: "connect <name> [key=value ...]".
+ * Sizes are in bytes and ages in seconds, 0 meaning no limit.
+ * @field durability: durability level of the flushes ("durability=");
+ * @field segment_size: rotate the log file once it grows this big
+ *                      ("segment_size=");
+ * @field segment_age: rotate the log file once it is this old
+ *                     ("segment_age=");
+ * @field retain_size: delete the oldest rotated files above this total
+ *                     ("retain_size=");
+ * @field retain_age: delete the rotated files older than this
+ *                    ("retain_age=");
+ * @field ring_size: keep only the newest lines that fit in this many bytes,
+ *                   in a ring allocated once ("ring_size=");
+ * @field ring_overwrite: what a full ring does before overwriting a line
+ *                        ("ring_overwrite=drop|flush");
+ * @field expected_lines: number of lines the service expects to keep in
+ *                        memory; the log line array is reserved for that
+ *                        many at once ("expected_lines=");
+ * @field huge_pages: pages backing the log line array
+ *                    ("huge_pages=off|thp|hugetlb");
+ * @field templates: mine templates of the lines and keep the warm lines as
+ *                   templates and parameters ("templates=on|off"), off by
+ *                   default, mining costs every add;
+ * @field dedup: consecutive identical lines added within this many seconds
+ *               of the first one are stored once, followed by a line holding
+ *               their number ("dedup="); 0 keeps every line;
+ * @field index: index the tokens of the lines in the log line array, in at
+ *               most this many bytes, so searches only read the lines holding
+ *               the tokens of their pattern ("index="); 0 indexes nothing.
+ *               Ignored with dedup.
+ * @field bloom: keep a Bloom filter of the grams of every warm segment and
+ *               of every block written to disk, so searches skip those
+ *               holding none of their pattern ("bloom=on|off"). Searches of
+ *               caches with dedup read everything.
+ */
+struct lmc_cache_opts {
+	enum lmc_durability durability;
+	uint64_t segment_size;
+	uint64_t segment_age;
+	uint64_t retain_size;
+	uint64_t retain_age;
+	uint64_t ring_size;
+	enum lmc_ring_overwrite ring_overwrite;
+	uint64_t expected_lines;
+	enum lmc_huge_pages huge_pages;
+	int templates;
+	uint64_t dedup;
+	uint64_t index;
+	int bloom;
+};
+
+/**
+ * Rotated log file of a service. Contains:
+ * @field path: Path of the file;
+ * @field size: Size of the file, in bytes;
+ * @field mtime: Time of the last write to the file;
+ * @field corrupt: Blocks of the file were found that cannot be read back.
+ *                 Compaction leaves the file as it is.
+ */
+struct lmc_logfile {
+	char *path;
+	uint64_t size;
+	time_t mtime;
+	int corrupt;
+};
+
+/**
+ * Log lines of a cache compressed in memory, once they were flushed and
+ * newer lines pushed them out of the hot lines. Contains:
+ * @field lines: Number of lines, LMC_WARM_LINES;
+ * @field raw_len: Size of the lines packed like in a segment block;
+ * @field size: Size of data. Equal to raw_len if compression did not make
+ *              the lines smaller and data holds them just packed;
+ * @field data: The lines, packed and compressed with lmc_lz_compress;
+ * @field since: Time when the lines were compressed;
+ * @field filter: Bloom filter of the grams of the lines, or NULL;
+ * @field filter_len: Size of filter;
+ * @field times: Time values of the lines, encoded with lmc_times_encode,
+ *              or NULL if some time is not in LMC_TIME_FORMAT;
+ * @field times_len: Size of times;
+ * @field first_time: Oldest time of the lines, as a time value;
+ * @field last_time: Newest time of the lines, lower than first_time if
+ *                   times is NULL.
+ */
+struct lmc_warm_segment {
+	uint32_t lines;
+	uint32_t raw_len;
+	uint32_t size;
+	char *data;
+	time_t since;
+	uint8_t *filter;
+	uint32_t filter_len;
+	char *times;
+	uint32_t times_len;
+	int64_t first_time;
+	int64_t last_time;
+};
+
 /**
  * Cache entry for a client service. Contains:
  * @field sevice_name: An identifier for the client linked to this cache;
  * @field ptr: Pointer to the beginning of this cache;
- * @field pages: Number of pages allocated for this cache.
+ * @field pages: Number of pages allocated for this cache;
+ * @field populated: Number of those pages already faulted in;
+ * @field lock: Serializes the connections that share this cache;
+ * @field refs: Number of connections using this cache;
+ * @field unsubscribed: The cache was removed from the list and is freed when
+ *                      the last connection using it goes away;
+ * @field opts: Options received when the cache was created;
+ * @field written_seq: Number of log lines written to the log file;
+ * @field written_ticket: Sync round that was current when written_seq was
+ *                        written. Only a later round makes it durable;
+ * @field queued_ticket: Sync round the log file is queued for, so flushes
+ *                       before that round queue it once;
+ * @field durable_seq: Number of log lines known to be on stable storage;
+ * @field active_size: Size of the log file flushes append to;
+ * @field active_since: Time when the log file flushes append to was created;
+ * @field logfiles: Rotated log files, oldest first;
+ * @field logfile_count: Number of rotated log files;
+ * @field logfile_max: Number of entries allocated in logfiles;
+ * @field logfile_bytes: Total size of the rotated log files;
+ * @field memory: Bytes of log lines held in memory, charged to the budget;
+ * @field last_query: Value of the query clock when logs were last read;
+ * @field queries: Number of times logs were read since the last tier pass;
+ * @field heat: Reads of the last tier passes, halved at every pass;
+ * @field ring_lines: Capacity of the ring, or 0 if the cache grows;
+ * @field warm: Warm segments holding the compressed lines, oldest first;
+ * @field warm_count: Number of warm segments;
+ * @field warm_max: Number of entries allocated in warm;
+ * @field warm_bytes: Total size of the data and filters of the warm segments;
+ * @field templates: Templates mined from the lines added to the cache;
+ * @field repeat_line: Last line stored, with dedup, and the time of its first
+ *                     copy;
+ * @field repeat_since: Time of the first copy of repeat_line;
+ * @field repeat_time: Time of the last repeat of repeat_line;
+ * @field repeats: Repeats of repeat_line not stored yet;
+ * @field repeat_lines: Lines the stored repeats stand for, beyond the lines
+ *                      holding them;
+ * @field collapsed: Number of lines added that were repeats;
+ * @field times: Time keys of the lines in the log line array;
+ * @field index: Tokens of the lines in the log line array;
+ * @field bloom_probed: Filters of warm segments and blocks on disk tested by
+ *                      searches;
+ * @field bloom_skipped: Segments and blocks those filters ruled out;
+ * @field lost_lines: Lines of blocks on disk that could not be read back,
+ *                    passed over by reads;
+ * @field follow: Signaled when lines are added and followers are waiting;
+ * @field followers: Number of connections following the cache;
+ * @field run: Tag of the cursors given out for the lines of the cache, never
+ *             0, so the cursors of an earlier cache of the service, whose
+ *             lines were numbered from 0 too, are told apart.
  */
 struct lmc_cache {
 	char *service_name;
 	void *ptr;
 	size_t pages;
+	size_t populated;
+	lmc_mutex_t lock;
+	unsigned int refs;
+	int unsubscribed;
+	struct lmc_cache_opts opts;
+	uint64_t written_seq;
+	uint64_t written_ticket;
+	uint64_t queued_ticket;
+	uint64_t durable_seq;
+	uint64_t active_size;
+	time_t active_since;
+	struct lmc_logfile *logfiles;
+	size_t logfile_count;
+	size_t logfile_max;
+	uint64_t logfile_bytes;
+	uint64_t memory;
+	uint64_t last_query;
+	uint64_t queries;
+	uint64_t heat;
+	size_t ring_lines;
+	struct lmc_warm_segment *warm;
+	size_t warm_count;
+	size_t warm_max;
+	uint64_t warm_bytes;
+	struct lmc_templates templates;
+	struct lmc_client_logline repeat_line;
+	time_t repeat_since;
+	char repeat_time[LMC_TIME_SIZE];
+	uint64_t repeats;
+	uint64_t repeat_lines;
+	uint64_t collapsed;
+	struct lmc_time_column times;
+	struct lmc_index index;
+	uint64_t bloom_probed;
+	uint64_t bloom_skipped;
+	uint64_t lost_lines;
+	lmc_cond_t follow;
+	unsigned int followers;
+	uint64_t run;
 };
 
 /**
@@ -59,17 +340,47 @@ struct lmc_command {
  * @brief structura care sta in memorie, care tine minte array-ul de loguri
  * Structura tine minte un array de loguri si numarul de loguri.
  * Array-ul va fi alocat si dezalocat cu mmap, respectiv munmap
+ * no_logs_evicted: primele linii, eliberate din memorie cand bugetul de
+ * memorie a fost depasit; se citesc de pe disc.
+ * no_logs_overwritten: intr-un cache de tip ring, primele linii, suprascrise
+ * de cele noi; nu mai sunt trimise clientilor. Linia i se afla in
+ * list_of_logs[i % ring_lines].
+ * no_logs_compressed: liniile de la no_logs_evicted pana aici sunt comprimate
+ * in segmentele calde ale cache-ului. list_of_logs[0] este linia
+ * no_logs_compressed (niciodata mai mica decat no_logs_evicted).
  */
 struct log_in_memory {
 	int no_logs;
 	int no_logs_stored_on_disk;
+	int no_logs_evicted;
+	int no_logs_overwritten;
+	int no_logs_compressed;
 	struct lmc_client_logline *list_of_logs;
 };
 
+typedef int (*lmc_line_fn)(struct lmc_client_logline *, void *);
+typedef int (*lmc_span_fn)(int64_t, int64_t, uint64_t, const int64_t *, void *);
+
 extern char *lmc_logfile_path;
+extern uint64_t lmc_memory_budget;
+extern struct lmc_pool lmc_name_pool;
 
 struct lmc_client *lmc_create_client(SOCKET);
+void lmc_destroy_client(struct lmc_client *);
 int lmc_get_command(struct lmc_client *);
+int lmc_add_logfile(struct lmc_cache *, char *, uint64_t, time_t);
+int lmc_cmp_logfiles(const void *, const void *);
+void lmc_compact_caches(void);
+int lmc_compact_cache(struct lmc_cache *);
+struct lmc_client_logline *lmc_get_logline(struct lmc_cache *, int);
+int lmc_charge_memory(struct lmc_cache *);
+int lmc_find_evicted(struct lmc_cache *, uint64_t *, uint64_t *);
+int lmc_read_evicted(struct lmc_cache *, uint64_t, uint64_t, const struct lmc_bloom_probe *, lmc_span_fn,
+		     lmc_line_fn, void *);
+int lmc_compress_cache(struct lmc_cache *, size_t);
+int lmc_demote_warm(struct lmc_cache *, time_t);
+int lmc_read_warm(struct lmc_cache *, const struct lmc_bloom_probe *, lmc_span_fn, lmc_line_fn, void *);
+void lmc_free_warm(struct lmc_cache *);
 
 /* OS Specific functions */
 void lmc_init_server_os(void);
@@ -77,5 +388,12 @@ int lmc_init_client_cache(struct lmc_cache *);
 int lmc_unsubscribe_os(struct lmc_client *);
 int lmc_add_log_os(struct lmc_client *, struct lmc_client_logline *);
 int lmc_flush_os(struct lmc_client *);
+void lmc_evict_os(struct lmc_cache *);
+int lmc_release_lines_os(struct lmc_cache *, size_t);
+uint64_t lmc_commit_os(struct lmc_cache *);
+int lmc_scan_logfiles_os(struct lmc_cache *);
+void lmc_remove_file_os(char *);
+int lmc_cond_wait_os(lmc_cond_t *, lmc_mutex_t *, unsigned int);
+int lmc_readable_os(SOCKET);
 
 #endif
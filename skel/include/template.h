@@ -0,0 +1,79 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#ifndef __LMC_TEMPLATE
+#define __LMC_TEMPLATE
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Templates of the log lines of a service, mined as the lines are added, in
+ * the spirit of Drain. Lines are split into tokens at spaces; tokens holding
+ * a digit are parameters from the start. A line joins the template with the
+ * same number of tokens and the same first token that shares the most tokens
+ * with it, if it shares at least LMC_TEMPLATE_SIMILARITY percent of them;
+ * the tokens where they differ become parameters of the template. Templates
+ * only ever turn constant tokens into parameters, and each time they do, get
+ * a new version, so lines encoded against an older version still decode.
+ *
+ * Encoded line: LMC_TEMPLATE_MARK, the template ID (2 bytes, little endian),
+ * the version of the template and the parameters, each terminated by a NUL
+ * byte. Log lines are printable, they never start with the mark.
+ */
+#define LMC_TEMPLATE_MAX 1024 /* templates per service */
+#define LMC_TEMPLATE_TOKENS 256 /* tokens of a line, enough for any line */
+#define LMC_TEMPLATE_BUCKETS 256 /* by number of tokens and first token */
+#define LMC_TEMPLATE_SIMILARITY 50 /* percent of tokens a line shares with its template */
+#define LMC_TEMPLATE_NONE 0xffff
+#define LMC_TEMPLATE_MARK '\001'
+#define LMC_TEMPLATE_PARAM "<*>"
+
+/**
+ * Template of log lines. Contains:
+ * @field tokens: Number of tokens;
+ * @field version: Number of times tokens became parameters, plus one;
+ * @field next: Next template in the same bucket, or LMC_TEMPLATE_NONE;
+ * @field count: Number of lines added that matched the template;
+ * @field offsets: Offset of every token in text;
+ * @field param: For every token, the version that made it a parameter, or 0
+ *               if it is still constant;
+ * @field text: Tokens of the first line of the template, each terminated by
+ *              a NUL byte. Constant tokens keep this text.
+ */
+struct lmc_template {
+	uint16_t tokens;
+	uint8_t version;
+	uint16_t next;
+	uint64_t count;
+	uint8_t *offsets;
+	uint8_t *param;
+	char *text;
+};
+
+/**
+ * Templates of a service. Contains:
+ * @field list: Templates, by ID;
+ * @field count: Number of templates;
+ * @field max: Number of entries allocated in list;
+ * @field buckets: First template of every bucket;
+ * @field unmatched: Lines that matched no template when there was no room
+ *                   left for a new one.
+ */
+struct lmc_templates {
+	struct lmc_template *list;
+	uint16_t count;
+	uint16_t max;
+	uint16_t buckets[LMC_TEMPLATE_BUCKETS];
+	uint64_t unmatched;
+};
+
+void lmc_templates_init(struct lmc_templates *);
+void lmc_templates_free(struct lmc_templates *);
+int lmc_template_learn(struct lmc_templates *, const char *);
+size_t lmc_template_encode(struct lmc_templates *, const char *, char *);
+size_t lmc_template_decode(struct lmc_templates *, const char *, size_t, char *);
+size_t lmc_template_format(struct lmc_templates *, uint16_t, char *, size_t);
+
+#endif
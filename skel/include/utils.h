@@ -8,6 +8,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <time.h>
 
 
 #ifdef __unix__
@@ -38,6 +39,14 @@ typedef int ssize_t;
 #define LMC_FTIME_FORMAT "%Y.%m.%d-%H.%M.%S"
 #define LMC_TIME_SIZE 20 /* strlen("YYYY/mm/dd-HH:MM:SS") + 1 */
 #define LMC_LOGLINE_SIZE (LMC_LINE_SIZE - LMC_TIME_SIZE)
+#define LMC_GETLOGS_COLLAPSED "collapsed" /* getlogs sends repeats as one line */
+#define LMC_GETLOGS_REGEX "regex" /* getlogs sends lines matching a regex */
+#define LMC_GETLOGS_SINCE "since" /* getlogs sends the lines after a cursor */
+#define LMC_COUNT_SEARCH "search" /* count and histogram only count lines holding a pattern */
+#define LMC_FOLLOW_BATCH 256 /* lines of a follow batch, at most */
+#define LMC_FOLLOW_HEADER 128 /* bytes of the header of a follow batch */
+#define LMC_FOLLOW_END "end" /* header of the batch ending a follow */
+#define LMC_MULTI_BATCH 256 /* lines of a getlogs_multi batch, at most, after a LMC_FOLLOW_HEADER byte header */
 #define LMC_STATS_FORMAT "Status at %s\nMemory: %ldKB\nLoglines: %lu\n"
 
 #define nitems(arr) (sizeof(arr) / sizeof(*arr))
@@ -61,6 +70,18 @@ typedef int ssize_t;
  * disconnect		// deauthenitcation from server
  * unsubcribe		// flush logs to disk; deallocate data for client
  * getlogs [t1 [t2]]	// send back to client logs between t1 and t2
+ * getlogs collapsed [t1 [t2]]	// the same, repeated lines sent only once
+ * getlogs regex <regex> [t1 [t2]]	// the same, only lines matching regex
+ * getlogs since <cursor> [max]	// send back to client at most max logs added after cursor
+ * templates		// send back to client the templates of its logs
+ * search <pattern> [t1 [t2]]	// send back to client logs holding pattern
+ * count [t1 [t2]]	// send back to client the number of logs between t1 and t2
+ * count search <pattern> [t1 [t2]]	// the same, only logs holding pattern
+ * histogram <seconds> [t1 [t2]]	// the same, per bucket of seconds
+ * histogram <seconds> search <pattern> [t1 [t2]]	// the same, only logs holding pattern
+ * follow [t1]		// send back to client new logs as they are added, from t1
+ * unfollow		// stop sending new logs
+ * getlogs_multi <svc1,svc2,...> [t1 [t2]]	// send back to client logs of those services between t1 and t2, by time
  */
 enum lmc_op_code {
 	LMC_CONNECT, /* new service connects to app */
@@ -71,6 +92,13 @@ enum lmc_op_code {
 	LMC_DISCONNECT,
 	LMC_UNSUBSCRIBE,
 	LMC_GETLOGS, /* get log [from t1 [to t2]] */
+	LMC_TEMPLATES, /* get log templates */
+	LMC_SEARCH, /* search <pattern> [from t1 [to t2]] */
+	LMC_COUNT, /* count [search <pattern>] [from t1 [to t2]] */
+	LMC_HISTOGRAM, /* histogram <seconds> [search <pattern>] [from t1 [to t2]] */
+	LMC_FOLLOW, /* follow [from t1] */
+	LMC_UNFOLLOW, /* end a follow */
+	LMC_GETLOGS_MULTI, /* getlogs_multi <services> [from t1 [to t2]] */
 	LMC_UNKNOWN,
 };
 
@@ -102,12 +130,26 @@ struct lmc_client_logline {
 };
 #pragma pack(pop)
 
+/**
+ * Format of a log line of getlogs_multi. Contains:
+ * @field service: name of the service the line belongs to;
+ * @field line: the line.
+ */
+#pragma pack(push, 1)
+struct lmc_client_service_logline {
+	char service[LMC_CLIENT_MAX_NAME];
+	struct lmc_client_logline line;
+};
+#pragma pack(pop)
+
 const struct lmc_op *lmc_get_op(enum lmc_op_code);
 const struct lmc_op *lmc_get_op_by_str(const char *);
 ssize_t lmc_recv(SOCKET, void *, size_t, int);
 ssize_t lmc_send(SOCKET, const void *, size_t, int);
+int lmc_time_to_str(char *, size_t, const char *, time_t);
 int lmc_crttime_to_str(char *, size_t, const char *);
-int lmc_rotate_logfile(char *);
+int lmc_str_to_time(const char *, time_t *);
+int lmc_rotate_logfile(char *, char *, size_t);
 int lmc_init_logdir(char *);
 
 #endif
@@ -6,8 +6,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <time.h>
@@ -15,6 +17,9 @@
 
 #include "../../include/lmc.h"
 
+/* lines received per system call, at most: two buffers each, under IOV_MAX */
+#define LMC_RECV_LINES 256
+
 extern char *program_invocation_short_name;
 
 /**
@@ -29,6 +34,7 @@ int
 lmc_conn_init_os(struct lmc_conn *conn, char *name)
 {
 	struct sockaddr_in server;
+	int opten = 1;
 
 	if (name == NULL)
 		name = program_invocation_short_name;
@@ -50,6 +56,10 @@ lmc_conn_init_os(struct lmc_conn *conn, char *name)
 			sizeof(server)) < 0)
 		return -1;
 
+	/* lmc_send writes the length and the data separately */
+	setsockopt(conn->socket, IPPROTO_TCP, TCP_NODELAY,
+		(char *)&opten, sizeof(opten));
+
 	return 0;
 }
 
@@ -65,3 +75,61 @@ lmc_conn_free_os(struct lmc_conn *conn)
 {
 	close(conn->socket);
 }
+
+/**
+ * OS-specific code that receives log lines sent one per message by
+ * lmc_send straight into an array: the length of every message goes to a
+ * scratch slot and its data to the next line, LMC_RECV_LINES messages per
+ * system call.
+ *
+ * @param sock: Connection socket;
+ * @param lines: Array receiving the lines;
+ * @param count: Number of lines to receive.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int
+lmc_recv_lines_os(SOCKET sock, struct lmc_client_logline *lines, uint64_t count)
+{
+	struct iovec iov[2 * LMC_RECV_LINES];
+	uint32_t lens[LMC_RECV_LINES];
+	struct msghdr msg;
+	uint64_t done, n, i;
+	ssize_t rc;
+
+	for (done = 0; done < count; done += n) {
+		n = count - done < LMC_RECV_LINES ? count - done : LMC_RECV_LINES;
+		for (i = 0; i < n; i++) {
+			iov[2 * i].iov_base = &lens[i];
+			iov[2 * i].iov_len = sizeof(lens[i]);
+			iov[2 * i + 1].iov_base = &lines[done + i];
+			iov[2 * i + 1].iov_len = sizeof(*lines);
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = 2 * n;
+		while (msg.msg_iovlen != 0) {
+			rc = recvmsg(sock, &msg, MSG_WAITALL);
+			if (rc <= 0)
+				return -1;
+
+			/* a short read leaves the rest of the buffers to the next call */
+			while (msg.msg_iovlen != 0 && (size_t)rc >= msg.msg_iov->iov_len) {
+				rc -= msg.msg_iov->iov_len;
+				msg.msg_iov++;
+				msg.msg_iovlen--;
+			}
+			if (rc != 0) {
+				msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + rc;
+				msg.msg_iov->iov_len -= rc;
+			}
+		}
+
+		for (i = 0; i < n; i++)
+			if (ntohl(lens[i]) != sizeof(*lines))
+				return -1;
+	}
+
+	return 0;
+}
@@ -19,12 +19,14 @@
  * Initialize a connection to the server.
  *
  * @param conn: Connection to the server;
- * @param name: The name (identifier) of the client.
+ * @param name: The name (identifier) of the client;
+ * @param opts: Cache options, as "key=value" pairs separated by spaces, or
+ *              NULL for the defaults.
  *
  * @return: 0 in case of success, or -1 otherwise.
  */
 static int
-lmc_conn_init(struct lmc_conn *conn, char *name)
+lmc_conn_init(struct lmc_conn *conn, char *name, const char *opts)
 {
 	int err;
 	char buffer[LMC_COMMAND_SIZE], response[LMC_LINE_SIZE];
@@ -39,8 +41,12 @@ lmc_conn_init(struct lmc_conn *conn, char *name)
 	memset(response, 0, sizeof(response));
 
 	op = lmc_get_op(LMC_CONNECT);
-	len = snprintf(buffer, sizeof(buffer),
-		"%s %s", op->op_str, conn->name);
+	if (opts != NULL)
+		len = snprintf(buffer, sizeof(buffer),
+			"%s %s %s", op->op_str, conn->name, opts);
+	else
+		len = snprintf(buffer, sizeof(buffer),
+			"%s %s", op->op_str, conn->name);
 
 	if (lmc_send(conn->socket, buffer, len, 0) < 0) {
 		fprintf(stderr, "Error while connecting to lmcd\n");
@@ -66,13 +72,38 @@ lmc_conn_init(struct lmc_conn *conn, char *name)
  */
 struct lmc_conn *
 lmc_connect(char *name)
+{
+	return lmc_connect_opts(name, NULL);
+}
+
+/**
+ * Connect to the server, passing options for the cache of the service. The
+ * options only take effect if the server creates the cache on this connect.
+ * Supported options:
+ * durability=none|periodic|flush	// see enum lmc_durability
+ * ring_size=<bytes>			// keep only the newest lines, in a ring
+ * ring_overwrite=drop|flush		// see enum lmc_ring_overwrite
+ * expected_lines=<lines>		// pre-size the cache for that many lines
+ * huge_pages=off|thp|hugetlb		// see enum lmc_huge_pages
+ * templates=on|off			// mine templates of the log lines, off by default
+ * dedup=<seconds>			// store repeated lines once, see getlogs
+ *
+ * @param name: The name (identifier) of the client;
+ * @param opts: Options, as "key=value" pairs separated by spaces.
+ *
+ * @return: A pointer to a connection descriptor in case of success, or NULL
+ *          otherwise.
+ */
+struct lmc_conn *
+lmc_connect_opts(char *name, const char *opts)
 {
 	struct lmc_conn *conn;
 
 	conn = malloc(sizeof(struct lmc_conn));
 	if (conn != NULL) {
 		conn->name = malloc(LMC_CLIENT_MAX_NAME * sizeof(char));
-		if (lmc_conn_init(conn, name) < 0) {
+		conn->durable_seq = 0;
+		if (lmc_conn_init(conn, name, opts) < 0) {
 			fprintf(stderr, "Could not allocate conn\n");
 			return NULL;
 		}
@@ -133,7 +164,8 @@ lmc_send_log(struct lmc_conn *conn, char *logline)
 }
 
 /**
- * Request flushing the cache on the server to disk.
+ * Request flushing the cache on the server to disk. The number of log lines
+ * that are durable on the server is stored in conn->durable_seq.
  *
  * @param conn: Connection to the server.
  *
@@ -143,6 +175,7 @@ int
 lmc_flush(struct lmc_conn *conn)
 {
 	char buffer[LMC_COMMAND_SIZE], response[LMC_LINE_SIZE];
+	char *op_reply;
 	const struct lmc_op *op;
 	size_t len;
 
@@ -163,22 +196,25 @@ lmc_flush(struct lmc_conn *conn)
 	}
 	fprintf(stdout, "%s\n", response);
 
+	op_reply = strstr(response, ", durable seq ");
+	if (op_reply != NULL)
+		sscanf(op_reply, ", durable seq " UINT64_FMT, &conn->durable_seq);
+
 	return 0;
 }
 
 /**
- * Retrieve the logs for the current server from the server.
+ * Send a getlogs request with the given arguments and receive the logs.
  *
  * @param conn: Connection to the server;
- * @param t1: Beginning time (retrieve only logs newer than this time);
- * @param t2: Ending time (retrieve only logs older than this time);
+ * @param args: Arguments of the request, or NULL;
  * @param logs: Number of logs received from the server.
  *
  * @return: A list of logs received from the server. Is NULL if there are no
  * logs to retrieve or in case of an error.
  */
-struct lmc_client_logline **
-lmc_get_logs(struct lmc_conn *conn, time_t t1, time_t t2, uint64_t *logs)
+static struct lmc_client_logline **
+lmc_request_logs(struct lmc_conn *conn, const char *args, uint64_t *logs)
 {
 	char buffer[LMC_COMMAND_SIZE], response[LMC_LINE_SIZE];
 	struct lmc_client_logline **lines;
@@ -190,7 +226,10 @@ lmc_get_logs(struct lmc_conn *conn, time_t t1, time_t t2, uint64_t *logs)
 	memset(buffer, 0, sizeof(buffer));
 
 	op = lmc_get_op(LMC_GETLOGS);
-	len = snprintf(buffer, sizeof(buffer), "%s", op->op_str);
+	if (args != NULL)
+		len = snprintf(buffer, sizeof(buffer), "%s %s", op->op_str, args);
+	else
+		len = snprintf(buffer, sizeof(buffer), "%s", op->op_str);
 
 	if (lmc_send(conn->socket, buffer, len, 0) < 0) {
 		fprintf(stderr, "Error while getting logs from server\n");
@@ -233,6 +272,299 @@ err:
 	return lines;
 }
 
+/**
+ * Retrieve the logs for the current server from the server. Repeats of a
+ * line collapsed by the server are received as copies of the line.
+ *
+ * @param conn: Connection to the server;
+ * @param t1: Beginning time (retrieve only logs newer than this time);
+ * @param t2: Ending time (retrieve only logs older than this time);
+ * @param logs: Number of logs received from the server.
+ *
+ * @return: A list of logs received from the server. Is NULL if there are no
+ * logs to retrieve or in case of an error.
+ */
+struct lmc_client_logline **
+lmc_get_logs(struct lmc_conn *conn, time_t t1, time_t t2, uint64_t *logs)
+{
+	return lmc_request_logs(conn, NULL, logs);
+}
+
+/**
+ * Retrieve the logs for the current server from the server, with the
+ * repeats of a line collapsed by the server (see the dedup connect option)
+ * received as a single "last message repeated N times" line.
+ *
+ * @param conn: Connection to the server;
+ * @param t1: Beginning time (retrieve only logs newer than this time);
+ * @param t2: Ending time (retrieve only logs older than this time);
+ * @param logs: Number of logs received from the server.
+ *
+ * @return: A list of logs received from the server. Is NULL if there are no
+ * logs to retrieve or in case of an error.
+ */
+struct lmc_client_logline **
+lmc_get_logs_collapsed(struct lmc_conn *conn, time_t t1, time_t t2, uint64_t *logs)
+{
+	return lmc_request_logs(conn, LMC_GETLOGS_COLLAPSED, logs);
+}
+
+/**
+ * Receive the response of the server ending a request.
+ */
+static int
+lmc_recv_response(struct lmc_conn *conn)
+{
+	char response[LMC_LINE_SIZE];
+
+	memset(response, 0, sizeof(response));
+	if (lmc_recv(conn->socket, response, sizeof(response), 0) < 0) {
+		fprintf(stderr, "error while getting response from server\n");
+		return -1;
+	}
+	fprintf(stdout, "%s\n", response);
+
+	return strncmp(response, "FAILED", strlen("FAILED")) == 0 ? -1 : 0;
+}
+
+/**
+ * Retrieve the logs of the current service added after a cursor, so a
+ * client polling for new logs only receives those it did not get yet, at
+ * most max at a time. Repeats of a line collapsed by the server are
+ * received as a single "last message repeated N times" line.
+ *
+ * @param conn: Connection to the server;
+ * @param cursor: Cursor set by the previous call, or 0 to start with the
+ *                oldest logs. Set to the cursor to pass next time;
+ * @param max: Number of logs to receive, at most, or 0 for no limit;
+ * @param logs: Number of logs received from the server;
+ * @param skipped: Set to the number of logs after the cursor that the
+ *                 server no longer has, or NULL.
+ *
+ * @return: The logs, oldest first, in one array that must be freed with
+ * lmc_free_buf. Is NULL if there are no new logs or in case of an error.
+ */
+struct lmc_client_logline *
+lmc_get_logs_since(struct lmc_conn *conn, uint64_t *cursor, uint64_t max, uint64_t *logs, uint64_t *skipped)
+{
+	char args[LMC_LINE_SIZE], buffer[LMC_COMMAND_SIZE], header[128];
+	struct lmc_client_logline *lines = NULL;
+	uint64_t num = 0, next, lost;
+	size_t len;
+
+	*logs = 0;
+	if (skipped != NULL)
+		*skipped = 0;
+
+	memset(buffer, 0, sizeof(buffer));
+	snprintf(args, sizeof(args), "%s " UINT64_FMT " " UINT64_FMT, LMC_GETLOGS_SINCE, *cursor, max);
+	len = snprintf(buffer, sizeof(buffer), "%s %s", lmc_get_op(LMC_GETLOGS)->op_str, args);
+	if (lmc_send(conn->socket, buffer, len, 0) < 0) {
+		fprintf(stderr, "Error while getting logs from server\n");
+		return NULL;
+	}
+
+	/* the number of logs, the next cursor and the logs lost, then the logs */
+	memset(header, 0, sizeof(header));
+	if (lmc_recv(conn->socket, header, sizeof(header), 0) != sizeof(header) ||
+	    sscanf(header, UINT64_FMT " " UINT64_FMT " " UINT64_FMT, &num, &next, &lost) != 3 ||
+	    (max != 0 && num > max)) {
+		fprintf(stderr, "Error while getting logs from server\n");
+		return NULL;
+	}
+	if (num != 0) {
+		lines = malloc((size_t)num * sizeof(*lines));
+		if (lines == NULL || lmc_recv_lines_os(conn->socket, lines, num) != 0) {
+			fprintf(stderr, "Error while getting logs from server\n");
+			free(lines);
+			return NULL;
+		}
+	}
+
+	if (lmc_recv_response(conn) != 0) {
+		free(lines);
+		return NULL;
+	}
+	*cursor = next;
+	*logs = num;
+	if (skipped != NULL)
+		*skipped = lost;
+	return lines;
+}
+
+/**
+ * Retrieve the logs of the current service into one contiguous array, the
+ * lines being received straight into it, many per system call, instead of
+ * one allocation per line as with lmc_get_logs.
+ *
+ * @param conn: Connection to the server;
+ * @param collapsed: Receive the repeats of a line collapsed by the server
+ *                   as a single "last message repeated N times" line,
+ *                   instead of copies of the line;
+ * @param buf: Array receiving the logs, or NULL for the library to
+ *             allocate one holding them all;
+ * @param size: Number of logs buf holds; the logs after them are received
+ *              and dropped;
+ * @param logs: Set to the logs received. Must be released with
+ *              lmc_free_logs.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int
+lmc_get_logs_into(struct lmc_conn *conn, int collapsed, struct lmc_client_logline *buf, uint64_t size,
+		  struct lmc_logs *logs)
+{
+	char buffer[LMC_COMMAND_SIZE], response[LMC_LINE_SIZE];
+	struct lmc_client_logline drop[64];
+	uint64_t num, left, n;
+	size_t len;
+
+	memset(logs, 0, sizeof(*logs));
+	memset(buffer, 0, sizeof(buffer));
+
+	if (collapsed)
+		len = snprintf(buffer, sizeof(buffer), "%s %s", lmc_get_op(LMC_GETLOGS)->op_str, LMC_GETLOGS_COLLAPSED);
+	else
+		len = snprintf(buffer, sizeof(buffer), "%s", lmc_get_op(LMC_GETLOGS)->op_str);
+	if (lmc_send(conn->socket, buffer, len, 0) < 0) {
+		fprintf(stderr, "Error while getting logs from server\n");
+		return -1;
+	}
+
+	memset(response, 0, sizeof(response));
+	if (lmc_recv(conn->socket, response, sizeof(response), 0) < 0 ||
+	    sscanf(response, UINT64_FMT, &logs->total) != 1) {
+		fprintf(stderr, "Error while getting logs from server\n");
+		return -1;
+	}
+
+	if (buf == NULL && logs->total != 0) {
+		buf = malloc((size_t)logs->total * sizeof(*buf));
+		if (buf == NULL) {
+			fprintf(stderr, "Error while getting logs from server\n");
+			return -1;
+		}
+		size = logs->total;
+		logs->owned = 1;
+	}
+	logs->lines = buf;
+
+	num = logs->total < size ? logs->total : size;
+	if (num != 0 && lmc_recv_lines_os(conn->socket, buf, num) != 0)
+		goto err;
+	for (left = logs->total - num; left != 0; left -= n) {
+		n = left < nitems(drop) ? left : nitems(drop);
+		if (lmc_recv_lines_os(conn->socket, drop, n) != 0)
+			goto err;
+	}
+	logs->count = num;
+
+	if (lmc_recv_response(conn) != 0) {
+		lmc_free_logs(logs);
+		return -1;
+	}
+	return 0;
+
+err:
+	fprintf(stderr, "Error while getting logs from server\n");
+	lmc_free_logs(logs);
+	return -1;
+}
+
+/**
+ * Release the logs received by lmc_get_logs_into, freeing their array if
+ * the library allocated it.
+ *
+ * @param logs: Logs to release.
+ */
+void
+lmc_free_logs(struct lmc_logs *logs)
+{
+	if (logs->owned)
+		free(logs->lines);
+	memset(logs, 0, sizeof(*logs));
+}
+
+/**
+ * Retrieve the logs of several services merged by time, oldest first, every
+ * log tagged with the name of its service, so services can be correlated
+ * without sorting their logs on the client. Repeats of a line collapsed by
+ * the server are received as copies of the line. The server sends the logs
+ * in batches as it merges them, so the array grows as they come.
+ *
+ * @param conn: Connection to the server;
+ * @param services: Names of the services, separated by commas;
+ * @param t1: Beginning time (retrieve only logs newer than this time), or 0;
+ * @param t2: Ending time (retrieve only logs older than this time), or 0;
+ * @param logs: Number of logs received from the server.
+ *
+ * @return: The logs, in one array that must be freed with lmc_free_buf. Is
+ * NULL if there are no logs to retrieve or in case of an error.
+ */
+struct lmc_client_service_logline *
+lmc_get_logs_multi(struct lmc_conn *conn, const char *services, time_t t1, time_t t2, uint64_t *logs)
+{
+	size_t size = LMC_FOLLOW_HEADER + LMC_MULTI_BATCH * sizeof(struct lmc_client_service_logline);
+	char buffer[LMC_COMMAND_SIZE], time1[LMC_TIME_SIZE], time2[LMC_TIME_SIZE];
+	struct lmc_client_service_logline *lines = NULL, *grown;
+	uint64_t num = 0, max = 0, n;
+	int done = 0;
+	char *batch;
+	ssize_t rc;
+	size_t len;
+
+	*logs = 0;
+	memset(buffer, 0, sizeof(buffer));
+
+	len = snprintf(buffer, sizeof(buffer), "%s %s", lmc_get_op(LMC_GETLOGS_MULTI)->op_str, services);
+	if (len < sizeof(buffer) && t1 != 0 && lmc_time_to_str(time1, sizeof(time1), LMC_TIME_FORMAT, t1) == 0) {
+		len += snprintf(buffer + len, sizeof(buffer) - len, " %s", time1);
+		if (len < sizeof(buffer) && t2 != 0 && lmc_time_to_str(time2, sizeof(time2), LMC_TIME_FORMAT, t2) == 0)
+			len += snprintf(buffer + len, sizeof(buffer) - len, " %s", time2);
+	}
+	if (len >= sizeof(buffer) || lmc_send(conn->socket, buffer, len, 0) < 0) {
+		fprintf(stderr, "Error while getting logs from server\n");
+		return NULL;
+	}
+
+	/* the lines come in batches, the one with no lines being the last */
+	batch = malloc(size);
+	while (batch != NULL) {
+		rc = lmc_recv(conn->socket, batch, size, 0);
+		if (rc < LMC_FOLLOW_HEADER || (rc - LMC_FOLLOW_HEADER) % sizeof(*lines) != 0)
+			break;
+		batch[LMC_FOLLOW_HEADER - 1] = '\0';
+		if (sscanf(batch, UINT64_FMT, &n) != 1 || n != (rc - LMC_FOLLOW_HEADER) / sizeof(*lines))
+			break;
+		if (n == 0) {
+			done = 1;
+			break;
+		}
+		if (num + n > max) {
+			max = max != 0 ? 2 * max : 4 * LMC_MULTI_BATCH;
+			grown = realloc(lines, (size_t)max * sizeof(*lines));
+			if (grown == NULL)
+				break;
+			lines = grown;
+		}
+		memcpy(&lines[num], batch + LMC_FOLLOW_HEADER, (size_t)n * sizeof(*lines));
+		num += n;
+	}
+	free(batch);
+	if (!done) {
+		fprintf(stderr, "Error while getting logs from server\n");
+		free(lines);
+		return NULL;
+	}
+
+	if (lmc_recv_response(conn) != 0) {
+		free(lines);
+		return NULL;
+	}
+	*logs = num;
+	return lines;
+}
+
 /**
  * Retrieve stats about the logs stored on the server.
  *
@@ -272,6 +604,423 @@ lmc_get_stats(struct lmc_conn *conn)
 	return data;
 }
 
+/**
+ * Retrieve the templates mined from the logs of the current service, most
+ * used first, as "<lines> <template>" with "<*>" in place of parameters.
+ *
+ * @param conn: Connection to the server;
+ * @param count: Number of templates received from the server.
+ *
+ * @return: A list of templates, each to be freed with lmc_free_buf, like the
+ * list. Is NULL if there are no templates or in case of an error.
+ */
+char **
+lmc_get_templates(struct lmc_conn *conn, uint64_t *count)
+{
+	char buffer[LMC_COMMAND_SIZE], response[LMC_LINE_SIZE];
+	char **templates = NULL;
+	const struct lmc_op *op;
+	uint64_t num, i = 0;
+	size_t len;
+
+	memset(buffer, 0, sizeof(buffer));
+	*count = 0;
+
+	op = lmc_get_op(LMC_TEMPLATES);
+	len = snprintf(buffer, sizeof(buffer), "%s", op->op_str);
+	if (lmc_send(conn->socket, buffer, len, 0) < 0) {
+		fprintf(stderr, "Error while getting templates from server\n");
+		return NULL;
+	}
+
+	memset(response, 0, sizeof(response));
+	if (lmc_recv(conn->socket, response, sizeof(response), 0) < 0 ||
+	    sscanf(response, UINT64_FMT, &num) != 1) {
+		fprintf(stderr, "Error while getting templates from server\n");
+		return NULL;
+	}
+
+	if (num != 0)
+		templates = calloc((size_t)num, sizeof(*templates));
+
+	for (i = 0; templates != NULL && i < num; i++) {
+		templates[i] = calloc(LMC_COMMAND_SIZE, sizeof(char));
+		if (templates[i] == NULL ||
+		    lmc_recv(conn->socket, templates[i], LMC_COMMAND_SIZE, 0) < 0) {
+			free(templates[i]);
+			goto err;
+		}
+		templates[i][LMC_COMMAND_SIZE - 1] = '\0';
+	}
+
+	memset(response, 0, sizeof(response));
+	if (lmc_recv(conn->socket, response, sizeof(response), 0) < 0)
+		fprintf(stderr, "error while getting response from server\n");
+	else
+		fprintf(stdout, "%s\n", response);
+
+err:
+	*count = i;
+	return templates;
+}
+
+/**
+ * Retrieve the logs of the current service that a pattern selects. The
+ * server does the search and only sends the matching logs.
+ *
+ * @param conn: Connection to the server;
+ * @param cmd: Command to send, followed by the pattern;
+ * @param pattern: Pattern selecting the logs;
+ * @param t1: Beginning time (only search logs newer than this time), or 0;
+ * @param t2: Ending time (only search logs older than this time), or 0;
+ * @param logs: Number of logs received from the server.
+ *
+ * @return: A list of logs received from the server. Is NULL if no log holds
+ * the pattern or in case of an error.
+ */
+static struct lmc_client_logline **
+lmc_get_matches(struct lmc_conn *conn, const char *cmd, const char *pattern, time_t t1, time_t t2, uint64_t *logs)
+{
+	char buffer[LMC_COMMAND_SIZE], response[LMC_LINE_SIZE];
+	char time1[LMC_TIME_SIZE], time2[LMC_TIME_SIZE];
+	struct lmc_client_logline **lines = NULL, **tmp, line;
+	uint64_t num = 0, max = 0, hits;
+	int nomem = 0;
+	ssize_t rc;
+	size_t len;
+
+	memset(buffer, 0, sizeof(buffer));
+	*logs = 0;
+
+	len = snprintf(buffer, sizeof(buffer), "%s %s", cmd, pattern);
+	if (t1 != 0 && lmc_time_to_str(time1, sizeof(time1), LMC_TIME_FORMAT, t1) == 0) {
+		len += snprintf(buffer + len, sizeof(buffer) - len, " %s", time1);
+		if (t2 != 0 && lmc_time_to_str(time2, sizeof(time2), LMC_TIME_FORMAT, t2) == 0)
+			len += snprintf(buffer + len, sizeof(buffer) - len, " %s", time2);
+	}
+	if (len >= sizeof(buffer) || lmc_send(conn->socket, buffer, len, 0) < 0) {
+		fprintf(stderr, "Error while searching logs on server\n");
+		return NULL;
+	}
+
+	/* the matching logs, then their number */
+	while (1) {
+		rc = lmc_recv(conn->socket, &line, sizeof(line), 0);
+		if (rc != sizeof(line))
+			break;
+
+		// Out of memory, the hits left are still received to stay in step
+		if (nomem)
+			continue;
+		if (num == max) {
+			tmp = realloc(lines, (size_t)(max ? 2 * max : 64) * sizeof(*lines));
+			if (tmp == NULL) {
+				nomem = 1;
+				continue;
+			}
+			lines = tmp;
+			max = max ? 2 * max : 64;
+		}
+		lines[num] = malloc(sizeof(line));
+		if (lines[num] == NULL) {
+			nomem = 1;
+			continue;
+		}
+		memcpy(lines[num++], &line, sizeof(line));
+	}
+	if (nomem || rc <= 0 || rc == sizeof(line) || sscanf((char *)&line, UINT64_FMT, &hits) != 1 || hits != num)
+		fprintf(stderr, "Error while searching logs on server\n");
+
+	memset(response, 0, sizeof(response));
+	if (lmc_recv(conn->socket, response, sizeof(response), 0) < 0)
+		fprintf(stderr, "error while getting response from server\n");
+	else
+		fprintf(stdout, "%s\n", response);
+
+	if (nomem) {
+		while (num > 0)
+			free(lines[--num]);
+		free(lines);
+		return NULL;
+	}
+	*logs = num;
+	return lines;
+}
+
+/**
+ * Retrieve the logs of the current service that hold a pattern. The server
+ * does the search and only sends the matching logs.
+ *
+ * @param conn: Connection to the server;
+ * @param pattern: Text to look for in the logs;
+ * @param t1: Beginning time (only search logs newer than this time), or 0;
+ * @param t2: Ending time (only search logs older than this time), or 0;
+ * @param logs: Number of logs received from the server.
+ *
+ * @return: A list of logs received from the server. Is NULL if no log holds
+ * the pattern or in case of an error.
+ */
+struct lmc_client_logline **
+lmc_search(struct lmc_conn *conn, const char *pattern, time_t t1, time_t t2, uint64_t *logs)
+{
+	return lmc_get_matches(conn, lmc_get_op(LMC_SEARCH)->op_str, pattern, t1, t2, logs);
+}
+
+/**
+ * Retrieve the logs of the current service that match a regular expression,
+ * anywhere in the log. The server compiles the expression and only sends
+ * the matching logs.
+ *
+ * @param conn: Connection to the server;
+ * @param regex: Regular expression, see include/dfa.h for the syntax;
+ * @param t1: Beginning time (only search logs newer than this time), or 0;
+ * @param t2: Ending time (only search logs older than this time), or 0;
+ * @param logs: Number of logs received from the server.
+ *
+ * @return: A list of logs received from the server. Is NULL if no log
+ * matches, if the expression is invalid or in case of an error.
+ */
+struct lmc_client_logline **
+lmc_get_logs_regex(struct lmc_conn *conn, const char *regex, time_t t1, time_t t2, uint64_t *logs)
+{
+	char cmd[LMC_LINE_SIZE];
+
+	snprintf(cmd, sizeof(cmd), "%s %s", lmc_get_op(LMC_GETLOGS)->op_str, LMC_GETLOGS_REGEX);
+	return lmc_get_matches(conn, cmd, regex, t1, t2, logs);
+}
+
+/**
+ * Send a count or histogram request: "<cmd> [search <pattern>] [t1 [t2]]".
+ */
+static int
+lmc_send_count_request(struct lmc_conn *conn, const char *cmd, const char *pattern, time_t t1, time_t t2)
+{
+	char buffer[LMC_COMMAND_SIZE];
+	char time1[LMC_TIME_SIZE], time2[LMC_TIME_SIZE];
+	size_t len;
+
+	memset(buffer, 0, sizeof(buffer));
+	len = snprintf(buffer, sizeof(buffer), "%s", cmd);
+	if (pattern != NULL)
+		len += snprintf(buffer + len, sizeof(buffer) - len, " %s %s", LMC_COUNT_SEARCH, pattern);
+	if (len < sizeof(buffer) && t1 != 0 && lmc_time_to_str(time1, sizeof(time1), LMC_TIME_FORMAT, t1) == 0) {
+		len += snprintf(buffer + len, sizeof(buffer) - len, " %s", time1);
+		if (len < sizeof(buffer) && t2 != 0 && lmc_time_to_str(time2, sizeof(time2), LMC_TIME_FORMAT, t2) == 0)
+			len += snprintf(buffer + len, sizeof(buffer) - len, " %s", time2);
+	}
+	if (len >= sizeof(buffer) || lmc_send(conn->socket, buffer, len, 0) < 0)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * Count the logs of the current service, without receiving them. The
+ * server counts them from its time index.
+ *
+ * @param conn: Connection to the server;
+ * @param pattern: Only count the logs holding this text, or NULL;
+ * @param t1: Beginning time (only count logs newer than this time), or 0;
+ * @param t2: Ending time (only count logs older than this time), or 0;
+ * @param logs: Number of logs.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int
+lmc_count_logs(struct lmc_conn *conn, const char *pattern, time_t t1, time_t t2, uint64_t *logs)
+{
+	char buffer[128];
+
+	*logs = 0;
+	if (lmc_send_count_request(conn, lmc_get_op(LMC_COUNT)->op_str, pattern, t1, t2) != 0) {
+		fprintf(stderr, "Error while counting logs on server\n");
+		return -1;
+	}
+
+	memset(buffer, 0, sizeof(buffer));
+	if (lmc_recv(conn->socket, buffer, sizeof(buffer), 0) != sizeof(buffer) ||
+	    sscanf(buffer, UINT64_FMT, logs) != 1) {
+		fprintf(stderr, "Error while counting logs on server\n");
+		return -1;
+	}
+
+	return lmc_recv_response(conn);
+}
+
+/**
+ * Count the logs of the current service per interval of time, without
+ * receiving them. Intervals start at multiples of their width since the
+ * Epoch; only those holding logs are received.
+ *
+ * @param conn: Connection to the server;
+ * @param width: Seconds of an interval;
+ * @param pattern: Only count the logs holding this text, or NULL;
+ * @param t1: Beginning time (only count logs newer than this time), or 0;
+ * @param t2: Ending time (only count logs older than this time), or 0;
+ * @param buckets: Number of intervals received from the server.
+ *
+ * @return: The intervals holding logs, oldest first. Is NULL if there is
+ * none or in case of an error. Must be freed with lmc_free_buf.
+ */
+struct lmc_count_bucket *
+lmc_get_histogram(struct lmc_conn *conn, uint64_t width, const char *pattern, time_t t1, time_t t2,
+		  uint64_t *buckets)
+{
+	struct lmc_count_bucket *list = NULL;
+	char cmd[LMC_LINE_SIZE], buffer[128];
+	uint64_t num = 0, i;
+
+	*buckets = 0;
+	snprintf(cmd, sizeof(cmd), "%s " UINT64_FMT, lmc_get_op(LMC_HISTOGRAM)->op_str, width);
+	if (lmc_send_count_request(conn, cmd, pattern, t1, t2) != 0) {
+		fprintf(stderr, "Error while counting logs on server\n");
+		return NULL;
+	}
+
+	/* the number of intervals, then every interval */
+	memset(buffer, 0, sizeof(buffer));
+	if (lmc_recv(conn->socket, buffer, sizeof(buffer), 0) != sizeof(buffer) ||
+	    sscanf(buffer, UINT64_FMT, &num) != 1) {
+		fprintf(stderr, "Error while counting logs on server\n");
+		return NULL;
+	}
+	if (num != 0)
+		list = calloc((size_t)num, sizeof(*list));
+
+	for (i = 0; list != NULL && i < num; i++) {
+		if (lmc_recv(conn->socket, buffer, sizeof(buffer), 0) != sizeof(buffer))
+			break;
+		buffer[sizeof(buffer) - 1] = '\0';
+		if (lmc_str_to_time(buffer, &list[i].start) != 0 ||
+		    sscanf(buffer + LMC_TIME_SIZE - 1, UINT64_FMT, &list[i].logs) != 1)
+			break;
+	}
+	if (i != num || list == NULL) {
+		fprintf(stderr, "Error while counting logs on server\n");
+		free(list);
+		return NULL;
+	}
+
+	lmc_recv_response(conn);
+	*buckets = num;
+	return list;
+}
+
+/**
+ * Follow the logs of the current service: the server sends the logs added
+ * from now on, in batches received with lmc_follow_next, until lmc_unfollow
+ * is called. No other request can be sent on the connection meanwhile.
+ *
+ * @param conn: Connection to the server;
+ * @param t1: Also receive the logs the server holds in memory from this time
+ *            on, or 0.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int
+lmc_follow(struct lmc_conn *conn, time_t t1)
+{
+	char buffer[LMC_COMMAND_SIZE], time1[LMC_TIME_SIZE];
+	size_t len;
+
+	memset(buffer, 0, sizeof(buffer));
+	len = snprintf(buffer, sizeof(buffer), "%s", lmc_get_op(LMC_FOLLOW)->op_str);
+	if (t1 != 0 && lmc_time_to_str(time1, sizeof(time1), LMC_TIME_FORMAT, t1) == 0)
+		len += snprintf(buffer + len, sizeof(buffer) - len, " %s", time1);
+	if (lmc_send(conn->socket, buffer, len, 0) < 0) {
+		fprintf(stderr, "Error while following logs on server\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Receive the next batch of followed logs. Blocks until the server sends
+ * one: as soon as logs are added, and about every second, empty, while none
+ * is.
+ *
+ * @param conn: Connection to the server;
+ * @param lines: The logs of the batch, oldest first, or NULL if there is
+ *               none. Must be freed with lmc_free_buf;
+ * @param logs: Number of logs of the batch;
+ * @param skipped: Number of logs added since the batch before that the
+ *                 server dropped, the connection being too slow for them.
+ *
+ * @return: 1 if a batch was received, 0 if the server ended the follow, or
+ *          -1 in case of an error.
+ */
+int
+lmc_follow_next(struct lmc_conn *conn, struct lmc_client_logline **lines, uint64_t *logs, uint64_t *skipped)
+{
+	size_t size = LMC_FOLLOW_HEADER + LMC_FOLLOW_BATCH * sizeof(struct lmc_client_logline);
+	char *batch;
+	ssize_t rc;
+
+	*lines = NULL;
+	*logs = 0;
+	*skipped = 0;
+	batch = malloc(size);
+	if (batch == NULL)
+		return -1;
+
+	rc = lmc_recv(conn->socket, batch, size, 0);
+	if (rc < LMC_FOLLOW_HEADER || (rc - LMC_FOLLOW_HEADER) % sizeof(struct lmc_client_logline) != 0) {
+		fprintf(stderr, "Error while following logs on server\n");
+		free(batch);
+		return -1;
+	}
+	batch[LMC_FOLLOW_HEADER - 1] = '\0';
+	if (strcmp(batch, LMC_FOLLOW_END) == 0) {
+		free(batch);
+		return lmc_recv_response(conn) == 0 ? 0 : -1;
+	}
+	if (sscanf(batch, UINT64_FMT " " UINT64_FMT, logs, skipped) != 2 ||
+	    *logs != (rc - LMC_FOLLOW_HEADER) / sizeof(struct lmc_client_logline)) {
+		fprintf(stderr, "Error while following logs on server\n");
+		free(batch);
+		return -1;
+	}
+
+	/* the lines go to the start of the buffer, which is handed over */
+	if (*logs == 0) {
+		free(batch);
+		return 1;
+	}
+	memmove(batch, batch + LMC_FOLLOW_HEADER, (size_t)*logs * sizeof(struct lmc_client_logline));
+	*lines = (struct lmc_client_logline *)batch;
+	return 1;
+}
+
+/**
+ * Stop following the logs of the current service. The batches the server
+ * sent meanwhile are dropped.
+ *
+ * @param conn: Connection to the server.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int
+lmc_unfollow(struct lmc_conn *conn)
+{
+	struct lmc_client_logline *lines;
+	uint64_t logs, skipped;
+	const char *cmd = lmc_get_op(LMC_UNFOLLOW)->op_str;
+	int rc;
+
+	if (lmc_send(conn->socket, cmd, strlen(cmd), 0) < 0) {
+		fprintf(stderr, "Error while following logs on server\n");
+		return -1;
+	}
+
+	do {
+		rc = lmc_follow_next(conn, &lines, &logs, &skipped);
+		free(lines);
+	} while (rc > 0);
+
+	return rc;
+}
+
 /**
  * Send a disconnect request to the server.
  *
@@ -19,6 +19,9 @@
 #pragma comment (lib, "Ws2_32.lib")
 #pragma comment (lib, "Mswsock.lib")
 
+/* lines received per system call, at most */
+#define LMC_RECV_LINES 256
+
 /**
  * OS-specific code that connects to the server
  *
@@ -93,3 +96,59 @@ lmc_conn_free_os(struct lmc_conn *conn)
 
 	return;
 }
+
+/**
+ * OS-specific code that receives log lines sent one per message by
+ * lmc_send straight into an array: the length of every message goes to a
+ * scratch slot and its data to the next line, LMC_RECV_LINES messages per
+ * system call.
+ *
+ * @param sock: Connection socket;
+ * @param lines: Array receiving the lines;
+ * @param count: Number of lines to receive.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int
+lmc_recv_lines_os(SOCKET sock, struct lmc_client_logline *lines, uint64_t count)
+{
+	WSABUF bufs[2 * LMC_RECV_LINES], *buf;
+	uint32_t lens[LMC_RECV_LINES];
+	DWORD received, flags, nbufs;
+	uint64_t done, n, i;
+
+	for (done = 0; done < count; done += n) {
+		n = count - done < LMC_RECV_LINES ? count - done : LMC_RECV_LINES;
+		for (i = 0; i < n; i++) {
+			bufs[2 * i].buf = (char *)&lens[i];
+			bufs[2 * i].len = sizeof(lens[i]);
+			bufs[2 * i + 1].buf = (char *)&lines[done + i];
+			bufs[2 * i + 1].len = sizeof(*lines);
+		}
+
+		buf = bufs;
+		nbufs = (DWORD)(2 * n);
+		while (nbufs != 0) {
+			flags = MSG_WAITALL;
+			if (WSARecv(sock, buf, nbufs, &received, &flags, NULL, NULL) == SOCKET_ERROR || received == 0)
+				return -1;
+
+			/* a short read leaves the rest of the buffers to the next call */
+			while (nbufs != 0 && received >= buf->len) {
+				received -= buf->len;
+				buf++;
+				nbufs--;
+			}
+			if (received != 0) {
+				buf->buf += received;
+				buf->len -= received;
+			}
+		}
+
+		for (i = 0; i < n; i++)
+			if (ntohl(lens[i]) != sizeof(*lines))
+				return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,251 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/bloom.h"
+
+#define LMC_BLOOM_SET 1024 /* entries of a new gram set */
+
+static int lmc_gram_char(unsigned char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+/**
+ * Gram starting at some byte, the same on every host. Never 0.
+ */
+static uint32_t lmc_gram(const char *s)
+{
+	const unsigned char *p = (const unsigned char *)s;
+
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t lmc_gram_hash(uint32_t gram)
+{
+	uint64_t h = gram * 0x9e3779b97f4a7c15ULL;
+
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
+}
+
+/**
+ * Start an empty set of grams.
+ *
+ * @param g: Set to initialize.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_bloom_init(struct lmc_bloom_grams *g)
+{
+	g->set = calloc(LMC_BLOOM_SET, sizeof(*g->set));
+	g->size = LMC_BLOOM_SET;
+	g->count = 0;
+	return g->set != NULL ? 0 : -1;
+}
+
+/**
+ * Insert a gram in a set.
+ *
+ * @return: 1 if the gram is new, or 0 if it was in the set.
+ */
+static int lmc_bloom_insert(uint32_t *set, size_t size, uint32_t gram)
+{
+	size_t i;
+
+	for (i = lmc_gram_hash(gram) & (size - 1); set[i] != 0; i = (i + 1) & (size - 1))
+		if (set[i] == gram)
+			return 0;
+	set[i] = gram;
+	return 1;
+}
+
+/**
+ * Double the entries of a set of grams, keeping it at most 3/4 full.
+ */
+static int lmc_bloom_grow(struct lmc_bloom_grams *g)
+{
+	uint32_t *set;
+	size_t i;
+
+	set = calloc(2 * g->size, sizeof(*set));
+	if (set == NULL)
+		return -1;
+	for (i = 0; i < g->size; i++)
+		if (g->set[i] != 0)
+			lmc_bloom_insert(set, 2 * g->size, g->set[i]);
+	free(g->set);
+	g->set = set;
+	g->size *= 2;
+	return 0;
+}
+
+/**
+ * Add the grams of a line to a set.
+ *
+ * @param g: Set of grams;
+ * @param line: Text of the line;
+ * @param size: The line ends at a NUL byte or after this many bytes.
+ *
+ * @return: 0 in case of success, or -1 otherwise. The set may then miss
+ *          grams of the line, so no filter must be built from it.
+ */
+int lmc_bloom_add(struct lmc_bloom_grams *g, const char *line, size_t size)
+{
+	const char *end = line + size;
+	size_t run = 0;
+
+	for (; line < end && *line != '\0'; line++) {
+		if (!lmc_gram_char((unsigned char)*line)) {
+			run = 0;
+			continue;
+		}
+		if (++run < LMC_BLOOM_GRAM)
+			continue;
+		if (4 * (g->count + 1) > 3 * g->size && lmc_bloom_grow(g) != 0)
+			return -1;
+		g->count += lmc_bloom_insert(g->set, g->size, lmc_gram(line - (LMC_BLOOM_GRAM - 1)));
+	}
+
+	return 0;
+}
+
+/**
+ * Size of the filter of a set of grams.
+ *
+ * @param g: Set of grams.
+ *
+ * @return: Size of the filter, a multiple of 8 bytes.
+ */
+size_t lmc_bloom_size(const struct lmc_bloom_grams *g)
+{
+	size_t words = (g->count * LMC_BLOOM_BITS + 63) / 64;
+
+	return (words != 0 ? words : 1) * 8;
+}
+
+/**
+ * Positions of the bits of a gram, spread by double hashing.
+ */
+static void lmc_bloom_bits(uint32_t gram, size_t bits, uint32_t *pos)
+{
+	uint64_t h = lmc_gram_hash(gram);
+	uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+	int i;
+
+	for (i = 0; i < LMC_BLOOM_HASHES; i++, h1 += h2)
+		pos[i] = (uint32_t)(((uint64_t)h1 * bits) >> 32);
+}
+
+/**
+ * Build the filter of a set of grams, then empty the set for the next lines.
+ *
+ * @param g: Set of grams;
+ * @param filter: Buffer receiving the filter;
+ * @param len: Size of the filter, as given by lmc_bloom_size.
+ */
+void lmc_bloom_build(struct lmc_bloom_grams *g, uint8_t *filter, size_t len)
+{
+	uint32_t pos[LMC_BLOOM_HASHES];
+	size_t i;
+	int k;
+
+	memset(filter, 0, len);
+	for (i = 0; i < g->size; i++) {
+		if (g->set[i] == 0)
+			continue;
+		lmc_bloom_bits(g->set[i], 8 * len, pos);
+		for (k = 0; k < LMC_BLOOM_HASHES; k++)
+			filter[pos[k] / 8] |= (uint8_t)(1 << (pos[k] % 8));
+	}
+
+	lmc_bloom_reset(g);
+}
+
+/**
+ * Empty a set of grams.
+ *
+ * @param g: Set of grams.
+ */
+void lmc_bloom_reset(struct lmc_bloom_grams *g)
+{
+	memset(g->set, 0, g->size * sizeof(*g->set));
+	g->count = 0;
+}
+
+/**
+ * Free a set of grams.
+ *
+ * @param g: Set of grams.
+ */
+void lmc_bloom_free(struct lmc_bloom_grams *g)
+{
+	free(g->set);
+	memset(g, 0, sizeof(*g));
+}
+
+/**
+ * Collect the grams of a pattern. A pattern with more than LMC_BLOOM_PROBES
+ * distinct grams is only tested for the first ones.
+ *
+ * @param probe: Grams to test;
+ * @param pattern: Pattern of a substring search;
+ * @param len: Length of the pattern.
+ *
+ * @return: 0 in case of success, or -1 if the pattern has no gram, so
+ *          filters cannot rule it out.
+ */
+int lmc_bloom_probe_init(struct lmc_bloom_probe *probe, const char *pattern, size_t len)
+{
+	size_t i, j, run = 0;
+	uint32_t gram;
+
+	probe->count = 0;
+	for (i = 0; i < len && probe->count < LMC_BLOOM_PROBES; i++) {
+		if (!lmc_gram_char((unsigned char)pattern[i])) {
+			run = 0;
+			continue;
+		}
+		if (++run < LMC_BLOOM_GRAM)
+			continue;
+
+		gram = lmc_gram(pattern + i - (LMC_BLOOM_GRAM - 1));
+		for (j = 0; j < probe->count && probe->grams[j] != gram; j++)
+			;
+		if (j == probe->count)
+			probe->grams[probe->count++] = gram;
+	}
+
+	return probe->count != 0 ? 0 : -1;
+}
+
+/**
+ * Test a filter for the grams of a pattern.
+ *
+ * @param probe: Grams of the pattern;
+ * @param filter: Filter of a group of lines;
+ * @param len: Size of the filter.
+ *
+ * @return: 0 if no line of the group holds the pattern, or 1 if some may.
+ */
+int lmc_bloom_test(const struct lmc_bloom_probe *probe, const uint8_t *filter, size_t len)
+{
+	uint32_t pos[LMC_BLOOM_HASHES];
+	size_t i;
+	int k;
+
+	if (len == 0)
+		return 1;
+	for (i = 0; i < probe->count; i++) {
+		lmc_bloom_bits(probe->grams[i], 8 * len, pos);
+		for (k = 0; k < LMC_BLOOM_HASHES; k++)
+			if (!(filter[pos[k] / 8] & (1 << (pos[k] % 8))))
+				return 0;
+	}
+
+	return 1;
+}
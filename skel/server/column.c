@@ -0,0 +1,233 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/column.h"
+
+/**
+ * Key of a time in LMC_TIME_FORMAT ("YYYY/mm/dd-HH:MM:SS"): its digits, read
+ * as one number. Only the first 19 characters are read.
+ *
+ * @param time: Time string.
+ *
+ * @return: The key, or LMC_TIME_KEY_NONE if the time is not in that format.
+ */
+uint64_t lmc_time_key(const char *time)
+{
+	static const char format[] = "dddd/dd/dd-dd:dd:dd";
+	uint64_t key = 0;
+	int i;
+
+	for (i = 0; format[i] != '\0'; i++) {
+		if (format[i] != 'd') {
+			if (time[i] != format[i])
+				return LMC_TIME_KEY_NONE;
+		} else if (time[i] >= '0' && time[i] <= '9') {
+			key = key * 10 + (time[i] - '0');
+		} else {
+			return LMC_TIME_KEY_NONE;
+		}
+	}
+
+	return key;
+}
+
+/**
+ * Time value of a key, in local time like the time strings.
+ *
+ * @param key: Key of a time;
+ * @param t: Receives the time value.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_time_key_value(uint64_t key, int64_t *t)
+{
+	struct tm tm;
+	time_t val;
+
+	if (key == LMC_TIME_KEY_NONE)
+		return -1;
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_sec = (int)(key % 100);
+	tm.tm_min = (int)(key / 100 % 100);
+	tm.tm_hour = (int)(key / 10000 % 100);
+	tm.tm_mday = (int)(key / 1000000 % 100);
+	tm.tm_mon = (int)(key / 100000000 % 100) - 1;
+	tm.tm_year = (int)(key / 10000000000ULL) - 1900;
+	tm.tm_isdst = -1;
+
+	val = mktime(&tm);
+	if (val == (time_t)-1)
+		return -1;
+	*t = (int64_t)val;
+	return 0;
+}
+
+/**
+ * Store the key of a log line. Keys of lines before first are dropped, the
+ * lines left the log line array.
+ *
+ * @param col: Time column;
+ * @param line: Number of the line;
+ * @param first: Number of the oldest line still in the log line array;
+ * @param key: Key of the time of the line.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_column_set(struct lmc_time_column *col, uint64_t line, uint64_t first, uint64_t key)
+{
+	uint64_t *keys, prev;
+	size_t max;
+
+	// Lines are stored in order, the one before is still in the column
+	prev = line > first ? lmc_column_get(col, line - 1) : LMC_TIME_KEY_NONE;
+	if (key == LMC_TIME_KEY_NONE)
+		col->sorted = line + 1;
+	else if (line <= first || key < prev)
+		col->sorted = line;
+
+	if (col->ring != 0) {
+		if (col->keys == NULL) {
+			col->keys = malloc(col->ring * sizeof(*col->keys));
+			if (col->keys == NULL) {
+				col->sorted = line + 1;
+				return -1;
+			}
+			col->max = col->ring;
+		}
+		col->keys[line % col->ring] = key;
+		return 0;
+	}
+
+	if (first > col->base) {
+		if (first < line)
+			memmove(col->keys, col->keys + (first - col->base), (line - first) * sizeof(*col->keys));
+		col->base = first;
+	}
+
+	if (line - col->base >= col->max) {
+		max = col->max ? 2 * col->max : 1024;
+		while (line - col->base >= max)
+			max *= 2;
+		keys = realloc(col->keys, max * sizeof(*keys));
+		if (keys == NULL) {
+			col->sorted = line + 1;
+			return -1;
+		}
+		col->keys = keys;
+		col->max = max;
+	}
+	col->keys[line - col->base] = key;
+	return 0;
+}
+
+/**
+ * Key of a log line held in the log line array.
+ *
+ * @param col: Time column;
+ * @param line: Number of the line.
+ *
+ * @return: The key, or LMC_TIME_KEY_NONE if the column does not have it.
+ */
+uint64_t lmc_column_get(struct lmc_time_column *col, uint64_t line)
+{
+	if (col->keys == NULL)
+		return LMC_TIME_KEY_NONE;
+	if (col->ring != 0)
+		return col->keys[line % col->ring];
+	if (line < col->base || line - col->base >= col->max)
+		return LMC_TIME_KEY_NONE;
+	return col->keys[line - col->base];
+}
+
+/**
+ * Find the first line of a run of lines whose keys do not decrease with a
+ * key of at least some value.
+ *
+ * @param col: Time column;
+ * @param lo: Number of the first line of the run;
+ * @param hi: Number of the line after the run;
+ * @param key: Key looked for.
+ *
+ * @return: Number of the first line with a key >= key, or hi if there is
+ *          none.
+ */
+uint64_t lmc_column_search(struct lmc_time_column *col, uint64_t lo, uint64_t hi, uint64_t key)
+{
+	uint64_t mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (lmc_column_get(col, mid) < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/**
+ * Free the keys of a time column.
+ *
+ * @param col: Time column.
+ */
+void lmc_column_free(struct lmc_time_column *col)
+{
+	free(col->keys);
+	col->keys = NULL;
+	col->max = 0;
+}
+
+/**
+ * Keys of the bounds of an interval filter: lines with start <= time <= end,
+ * times compared as strings.
+ *
+ * @param range: Keys of the interval;
+ * @param start: Oldest time of interest;
+ * @param end: Newest time of interest, or an empty string for no end.
+ */
+void lmc_time_range(struct lmc_time_range *range, const char *start, const char *end)
+{
+	range->start = lmc_time_key(start);
+	range->open = end[0] == '\0';
+	range->end = range->open ? LMC_TIME_KEY_NONE : lmc_time_key(end);
+}
+
+/**
+ * Check the key of a line against an interval. Where the keys are equal,
+ * the bounds may hold more than a time, so only comparing the strings can
+ * tell.
+ *
+ * @param range: Keys of the interval;
+ * @param key: Key of the line.
+ *
+ * @return: 1 if the line is in the interval, 0 if it is not, or -1 if its
+ *          time string has to be compared.
+ */
+int lmc_time_range_test(const struct lmc_time_range *range, uint64_t key)
+{
+	int in = 1;
+
+	if (key == LMC_TIME_KEY_NONE || range->start == LMC_TIME_KEY_NONE ||
+	    (!range->open && range->end == LMC_TIME_KEY_NONE))
+		return -1;
+
+	if (key < range->start)
+		return 0;
+	if (key == range->start)
+		in = -1;
+	if (!range->open) {
+		if (key > range->end)
+			return 0;
+		if (key == range->end)
+			in = -1;
+	}
+
+	return in;
+}
@@ -0,0 +1,419 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#ifdef __unix__
+#include <utime.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <sys/utime.h>
+#define utime _utime
+#define utimbuf _utimbuf
+#endif
+
+#include "../include/server.h"
+#include "../include/segment.h"
+
+/**
+ * A run of adjacent small log files of a service, picked for compaction.
+ * Contains:
+ * @field paths: Paths of the files, oldest first;
+ * @field count: Number of files;
+ * @field mtime: Time of the last write to the newest file.
+ */
+struct lmc_compact_run {
+	char **paths;
+	size_t count;
+	time_t mtime;
+};
+
+/**
+ * Position of a record in the merged output. Records are ordered by time,
+ * and records with the same time keep their original order.
+ */
+struct lmc_compact_entry {
+	const char *time;
+	size_t pos;
+};
+
+/**
+ * I/O throttle of a compaction. Contains:
+ * @field start: Time when the compaction started, in ms;
+ * @field bytes: Bytes read and written so far.
+ */
+struct lmc_throttle {
+	double start;
+	uint64_t bytes;
+};
+
+/**
+ * Monotonic time, in milliseconds.
+ */
+static double lmc_now_ms(void)
+{
+#ifdef __unix__
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+#elif defined(_WIN32)
+	return (double)GetTickCount64();
+#endif
+}
+
+/**
+ * Account for compaction I/O and sleep as long as needed to stay below
+ * LMC_COMPACT_RATE, leaving the disk to the flushes.
+ *
+ * @param t: Throttle state;
+ * @param bytes: Bytes just read or written.
+ */
+static void lmc_throttle(struct lmc_throttle *t, uint64_t bytes)
+{
+	double due, ahead;
+#ifdef __unix__
+	struct timespec ts;
+#endif
+
+	t->bytes += bytes;
+	due = t->start + t->bytes * 1e3 / LMC_COMPACT_RATE;
+	ahead = due - lmc_now_ms();
+	if (ahead <= 0)
+		return;
+
+#ifdef __unix__
+	ts.tv_sec = (time_t)(ahead / 1e3);
+	ts.tv_nsec = (long)((ahead - ts.tv_sec * 1e3) * 1e6);
+	nanosleep(&ts, NULL);
+#elif defined(_WIN32)
+	Sleep((DWORD)ahead);
+#endif
+}
+
+static int lmc_cmp_compact_entries(const void *a, const void *b)
+{
+	const struct lmc_compact_entry *ea = a, *eb = b;
+	int rc;
+
+	rc = strncmp(ea->time, eb->time, LMC_TIME_SIZE);
+	if (rc != 0)
+		return rc;
+	return ea->pos < eb->pos ? -1 : ea->pos > eb->pos;
+}
+
+/**
+ * Pick the oldest run of at least LMC_COMPACT_MIN_FILES adjacent log files
+ * smaller than LMC_COMPACT_SMALL_FILE, totalling at most one segment (or
+ * enough for a full run, for services rotating very small segments). Files
+ * known to be corrupt are left out, merging them would drop their lost
+ * blocks for good. Called with the cache locked.
+ *
+ * @param cache: Cache of the service;
+ * @param run: Picked run. The paths are copies owned by the caller.
+ *
+ * @return: 1 if a run was found, or 0 otherwise.
+ */
+static int lmc_pick_run(struct lmc_cache *cache, struct lmc_compact_run *run)
+{
+	uint64_t limit, total;
+	size_t start, end, i;
+
+	limit = cache->opts.segment_size ? cache->opts.segment_size : LMC_SEGMENT_MAX_SIZE;
+	if (limit < (uint64_t)LMC_COMPACT_SMALL_FILE * LMC_COMPACT_MIN_FILES)
+		limit = (uint64_t)LMC_COMPACT_SMALL_FILE * LMC_COMPACT_MIN_FILES;
+
+	for (start = 0; start < cache->logfile_count; start = end + 1) {
+		total = 0;
+		for (end = start; end < cache->logfile_count; end++) {
+			if (cache->logfiles[end].size >= LMC_COMPACT_SMALL_FILE || cache->logfiles[end].corrupt)
+				break;
+			if (total + cache->logfiles[end].size > limit)
+				break;
+			total += cache->logfiles[end].size;
+		}
+
+		if (end - start < LMC_COMPACT_MIN_FILES)
+			continue;
+
+		run->count = end - start;
+		run->paths = malloc(run->count * sizeof(*run->paths));
+		if (run->paths == NULL)
+			return 0;
+		for (i = 0; i < run->count; i++)
+			run->paths[i] = strdup(cache->logfiles[start + i].path);
+		run->mtime = cache->logfiles[end - 1].mtime;
+		return 1;
+	}
+
+	return 0;
+}
+
+static void lmc_free_run(struct lmc_compact_run *run)
+{
+	size_t i;
+
+	for (i = 0; i < run->count; i++)
+		free(run->paths[i]);
+	free(run->paths);
+}
+
+/**
+ * Mark a log file of a service as corrupt, so it is not picked again.
+ * Called with the cache locked.
+ *
+ * @param cache: Cache of the service;
+ * @param path: Path of the file.
+ */
+static void lmc_mark_corrupt(struct lmc_cache *cache, const char *path)
+{
+	size_t i;
+
+	for (i = 0; i < cache->logfile_count; i++)
+		if (strcmp(cache->logfiles[i].path, path) == 0)
+			cache->logfiles[i].corrupt = 1;
+}
+
+/**
+ * Read all the records of a run into memory. Gives up at the first block
+ * that cannot be read back.
+ *
+ * @param run: Files to read;
+ * @param lines: Records read. Must be freed by the caller;
+ * @param count: Number of records read;
+ * @param corrupt: Receives the position in the run of the file holding the
+ *                 block that could not be read back, or run->count;
+ * @param t: Compaction throttle.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_read_run(struct lmc_compact_run *run, struct lmc_client_logline **lines, size_t *count,
+			size_t *corrupt, struct lmc_throttle *t)
+{
+	struct lmc_segment_reader reader;
+	struct lmc_client_logline *buf, *tmp;
+	size_t max = 0, i;
+	int rc = -1;
+
+	buf = NULL;
+	*count = 0;
+	*corrupt = run->count;
+
+	for (i = 0; i < run->count; i++) {
+		if (lmc_segment_open(&reader, run->paths[i]) != 0)
+			goto err;
+
+		while (1) {
+			if (*count == max) {
+				max = max ? 2 * max : LMC_BLOCK_RECORDS;
+				tmp = realloc(buf, max * sizeof(*buf));
+				if (tmp == NULL) {
+					// Abandon the run, its files stay as they are
+					rc = -1;
+					break;
+				}
+				buf = tmp;
+			}
+
+			rc = lmc_segment_next(&reader, &buf[*count]);
+			if (reader.lost != 0) {
+				*corrupt = i;
+				rc = -1;
+			}
+			if (rc <= 0)
+				break;
+			(*count)++;
+
+			if (*count % LMC_BLOCK_RECORDS == 0)
+				lmc_throttle(t, LMC_BLOCK_RECORDS * sizeof(*buf));
+		}
+		lmc_segment_close(&reader);
+
+		if (rc < 0)
+			goto err;
+	}
+
+	*lines = buf;
+	return 0;
+err:
+	free(buf);
+	return -1;
+}
+
+/**
+ * Write the records of a run, in time order, to a new segment.
+ *
+ * @param path: Path of the new segment;
+ * @param lines: Records of the run;
+ * @param count: Number of records;
+ * @param bloom: Write the filter blocks of the records;
+ * @param t: Compaction throttle.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_write_run(const char *path, struct lmc_client_logline *lines, size_t count, int bloom,
+			 struct lmc_throttle *t)
+{
+	struct lmc_segment_writer writer;
+	struct lmc_compact_entry *order;
+	size_t i;
+
+	order = malloc((count + 1) * sizeof(*order));
+	if (order == NULL)
+		return -1;
+	for (i = 0; i < count; i++) {
+		order[i].time = lines[i].time;
+		order[i].pos = i;
+	}
+	qsort(order, count, sizeof(*order), lmc_cmp_compact_entries);
+
+	if (lmc_segment_create(&writer, path) != 0) {
+		free(order);
+		return -1;
+	}
+	writer.bloom = bloom;
+
+	for (i = 0; i < count; i++) {
+		if (lmc_segment_append(&writer, &lines[order[i].pos]) != 0) {
+			lmc_segment_abort(&writer);
+			free(order);
+			return -1;
+		}
+		if ((i + 1) % LMC_BLOCK_RECORDS == 0)
+			lmc_throttle(t, LMC_BLOCK_RECORDS * sizeof(*lines));
+	}
+	free(order);
+
+	return lmc_segment_finish(&writer);
+}
+
+/**
+ * Replace the compacted run in the file list of the service: the newest file
+ * of the run is replaced by the merged segment and the others are deleted.
+ * Gives up if retention removed files of the run in the meantime.
+ * Called with the cache locked.
+ *
+ * @param cache: Cache of the service;
+ * @param run: Compacted run;
+ * @param merged: Path of the merged segment;
+ * @param size: Size of the merged segment.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_install_run(struct lmc_cache *cache, struct lmc_compact_run *run, const char *merged,
+			   uint64_t size)
+{
+	struct lmc_logfile *files;
+	size_t start, i;
+
+	for (start = 0; start < cache->logfile_count; start++)
+		if (strcmp(cache->logfiles[start].path, run->paths[0]) == 0)
+			break;
+	if (start + run->count > cache->logfile_count)
+		return -1;
+	files = &cache->logfiles[start];
+	for (i = 0; i < run->count; i++)
+		if (strcmp(files[i].path, run->paths[i]) != 0)
+			return -1;
+
+#ifdef _WIN32
+	if (!MoveFileEx(merged, run->paths[run->count - 1], MOVEFILE_REPLACE_EXISTING))
+		return -1;
+#else
+	if (rename(merged, run->paths[run->count - 1]) != 0)
+		return -1;
+#endif
+
+	/* a crash from here on leaves duplicates behind, never loses lines */
+	for (i = 0; i < run->count - 1; i++) {
+		cache->logfile_bytes -= files[i].size;
+		lmc_remove_file_os(files[i].path);
+	}
+	cache->logfile_bytes -= files[run->count - 1].size;
+	cache->logfile_bytes += size;
+	files[run->count - 1].size = size;
+
+	memmove(files, files + run->count - 1, (cache->logfile_count - start - run->count + 1) * sizeof(*files));
+	cache->logfile_count -= run->count - 1;
+
+	return 0;
+}
+
+/**
+ * Merge one run of small rotated log files of a service into a single
+ * time-ordered segment with a block index. Reads and writes are throttled to
+ * LMC_COMPACT_RATE; the cache is only locked to pick and to install the run,
+ * so flushes are not held back by the merge.
+ *
+ * @param cache: Cache of the service.
+ *
+ * @return: 1 if a run was compacted, 0 if there was nothing to compact, or
+ *          -1 in case of an error.
+ */
+int lmc_compact_cache(struct lmc_cache *cache)
+{
+	struct lmc_client_logline *lines = NULL;
+	struct lmc_compact_run run;
+	struct lmc_throttle throttle;
+	struct utimbuf times;
+	char merged[LMC_LOGFILE_NAME_LEN * 2];
+	struct stat st;
+	size_t count, corrupt;
+	int err = -1;
+
+	memset(&run, 0, sizeof(run));
+
+	lmc_mutex_lock(&cache->lock);
+	if (cache->unsubscribed || !lmc_pick_run(cache, &run)) {
+		lmc_mutex_unlock(&cache->lock);
+		return 0;
+	}
+	lmc_mutex_unlock(&cache->lock);
+
+	throttle.start = lmc_now_ms();
+	throttle.bytes = 0;
+
+	snprintf(merged, sizeof(merged), "%s" LMC_COMPACT_SUFFIX, run.paths[run.count - 1]);
+
+	if (lmc_read_run(&run, &lines, &count, &corrupt, &throttle) != 0) {
+		if (corrupt < run.count) {
+			fprintf(stderr, "Not compacting %s, it has corrupted blocks\n", run.paths[corrupt]);
+			lmc_mutex_lock(&cache->lock);
+			lmc_mark_corrupt(cache, run.paths[corrupt]);
+			lmc_mutex_unlock(&cache->lock);
+		}
+		goto out;
+	}
+	if (lmc_write_run(merged, lines, count, cache->opts.bloom, &throttle) != 0)
+		goto out_remove;
+
+	/* keep the time retention goes by */
+	times.actime = run.mtime;
+	times.modtime = run.mtime;
+	utime(merged, &times);
+
+	if (stat(merged, &st) != 0)
+		goto out_remove;
+
+	lmc_mutex_lock(&cache->lock);
+	err = lmc_install_run(cache, &run, merged, st.st_size);
+	lmc_mutex_unlock(&cache->lock);
+	if (err == 0) {
+		fprintf(stderr, "Compacted %zu files of %s into %s\n", run.count, cache->service_name,
+			run.paths[run.count - 1]);
+		err = 1;
+		goto out;
+	}
+
+out_remove:
+	remove(merged);
+out:
+	free(lines);
+	lmc_free_run(&run);
+	return err;
+}
@@ -0,0 +1,282 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#include <string.h>
+
+#include "../include/crc32c.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define LMC_CRC32C_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#define LMC_TARGET_SSE42
+#else
+#include <cpuid.h>
+#include <nmmintrin.h>
+#define LMC_TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+#endif
+
+#define LMC_CRC32C_POLY 0x82f63b78U /* reversed 0x1edc6f41 */
+
+/*
+ * The crc32 instruction has a latency of three cycles but can start every
+ * cycle, so the hardware path checksums three parts of the data at once and
+ * combines them by shifting the checksums over the length of a part.
+ */
+#define LMC_CRC32C_LONG 8192
+#define LMC_CRC32C_SHORT 256
+
+/* slicing-by-8 tables, lmc_crc32c_table[0] is the classic byte table */
+static uint32_t lmc_crc32c_table[8][256];
+/* operators appending LMC_CRC32C_LONG and LMC_CRC32C_SHORT zero bytes */
+static uint32_t lmc_crc32c_long[4][256];
+static uint32_t lmc_crc32c_short[4][256];
+static volatile int lmc_crc32c_ready;
+static int lmc_crc32c_sse42;
+
+/**
+ * Multiply a vector by a matrix over GF(2).
+ */
+static uint32_t lmc_gf2_times(const uint32_t *mat, uint32_t vec)
+{
+	uint32_t sum = 0;
+
+	for (; vec; vec >>= 1, mat++)
+		if (vec & 1)
+			sum ^= *mat;
+	return sum;
+}
+
+static void lmc_gf2_square(uint32_t *square, const uint32_t *mat)
+{
+	int n;
+
+	for (n = 0; n < 32; n++)
+		square[n] = lmc_gf2_times(mat, mat[n]);
+}
+
+/**
+ * Build the tables of the operator appending some zero bytes to the data
+ * covered by a checksum register.
+ *
+ * @param zeros: Tables, one per byte of the register;
+ * @param len: Number of zero bytes, a power of two.
+ */
+static void lmc_crc32c_zeros(uint32_t zeros[4][256], size_t len)
+{
+	uint32_t odd[32], even[32], *op;
+	int n;
+
+	/* operator for one zero bit */
+	odd[0] = LMC_CRC32C_POLY;
+	for (n = 1; n < 32; n++)
+		odd[n] = 1U << (n - 1);
+
+	/* square it up to one zero byte, then once per bit of len */
+	lmc_gf2_square(even, odd);
+	lmc_gf2_square(odd, even);
+	lmc_gf2_square(even, odd);
+	op = even;
+	for (; len > 1; len >>= 1) {
+		lmc_gf2_square(op == even ? odd : even, op);
+		op = op == even ? odd : even;
+	}
+
+	for (n = 0; n < 256; n++) {
+		zeros[0][n] = lmc_gf2_times(op, n);
+		zeros[1][n] = lmc_gf2_times(op, n << 8);
+		zeros[2][n] = lmc_gf2_times(op, n << 16);
+		zeros[3][n] = lmc_gf2_times(op, (uint32_t)n << 24);
+	}
+}
+
+/**
+ * Build the lookup tables and look for the SSE4.2 crc32 instruction. Called
+ * once at startup; later calls do nothing.
+ */
+void lmc_crc32c_init(void)
+{
+	uint32_t crc;
+	int i, j;
+#ifdef LMC_CRC32C_X86
+	unsigned int regs[4] = { 0 };
+#endif
+
+	if (lmc_crc32c_ready)
+		return;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (crc & 1 ? LMC_CRC32C_POLY : 0);
+		lmc_crc32c_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			lmc_crc32c_table[j][i] = (lmc_crc32c_table[j - 1][i] >> 8) ^
+						 lmc_crc32c_table[0][lmc_crc32c_table[j - 1][i] & 0xff];
+	lmc_crc32c_zeros(lmc_crc32c_long, LMC_CRC32C_LONG);
+	lmc_crc32c_zeros(lmc_crc32c_short, LMC_CRC32C_SHORT);
+
+#ifdef LMC_CRC32C_X86
+#ifdef _MSC_VER
+	__cpuid((int *)regs, 1);
+#else
+	__get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+	lmc_crc32c_sse42 = (regs[2] >> 20) & 1;
+#endif
+
+	lmc_crc32c_ready = 1;
+}
+
+/**
+ * Tell whether checksums are computed by the CPU.
+ *
+ * @return: 1 if the SSE4.2 crc32 instruction is used, or 0 otherwise.
+ */
+int lmc_crc32c_hw(void)
+{
+	lmc_crc32c_init();
+	return lmc_crc32c_sse42;
+}
+
+/**
+ * CRC-32C computed with lookup tables, eight bytes at a time.
+ *
+ * @param crc: Checksum of the previous data, or 0;
+ * @param data: Data to checksum;
+ * @param len: Size of the data.
+ *
+ * @return: Checksum of the previous data followed by this data.
+ */
+uint32_t lmc_crc32c_sw(uint32_t crc, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	uint32_t lo, hi;
+
+	lmc_crc32c_init();
+
+	crc = ~crc;
+	while (len >= 8) {
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		/* words are read little endian, like the rest of the format */
+		lo ^= crc;
+		crc = lmc_crc32c_table[7][lo & 0xff] ^ lmc_crc32c_table[6][(lo >> 8) & 0xff] ^
+		      lmc_crc32c_table[5][(lo >> 16) & 0xff] ^ lmc_crc32c_table[4][lo >> 24] ^
+		      lmc_crc32c_table[3][hi & 0xff] ^ lmc_crc32c_table[2][(hi >> 8) & 0xff] ^
+		      lmc_crc32c_table[1][(hi >> 16) & 0xff] ^ lmc_crc32c_table[0][hi >> 24];
+		p += 8;
+		len -= 8;
+	}
+	while (len--)
+		crc = (crc >> 8) ^ lmc_crc32c_table[0][(crc ^ *p++) & 0xff];
+
+	return ~crc;
+}
+
+#ifdef LMC_CRC32C_X86
+/**
+ * Shift a checksum register over some zero bytes.
+ */
+static uint32_t lmc_crc32c_shift(uint32_t zeros[4][256], uint32_t crc)
+{
+	return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^ zeros[2][(crc >> 16) & 0xff] ^
+	       zeros[3][crc >> 24];
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+typedef uint64_t lmc_crc_word_t;
+#define lmc_crc_word(crc, p) _mm_crc32_u64(crc, lmc_crc_load(p))
+static inline uint64_t lmc_crc_load(const uint8_t *p)
+{
+	uint64_t word;
+
+	memcpy(&word, p, sizeof(word));
+	return word;
+}
+#else
+typedef uint32_t lmc_crc_word_t;
+#define lmc_crc_word(crc, p) _mm_crc32_u32(crc, lmc_crc_load(p))
+static inline uint32_t lmc_crc_load(const uint8_t *p)
+{
+	uint32_t word;
+
+	memcpy(&word, p, sizeof(word));
+	return word;
+}
+#endif
+
+/**
+ * Checksum three consecutive parts of len bytes each, in parallel.
+ */
+LMC_TARGET_SSE42 static lmc_crc_word_t lmc_crc32c_triple(lmc_crc_word_t crc0, const uint8_t *p, size_t len,
+							 uint32_t zeros[4][256])
+{
+	lmc_crc_word_t crc1 = 0, crc2 = 0;
+	const uint8_t *end = p + len;
+
+	for (; p < end; p += sizeof(lmc_crc_word_t)) {
+		crc0 = lmc_crc_word(crc0, p);
+		crc1 = lmc_crc_word(crc1, p + len);
+		crc2 = lmc_crc_word(crc2, p + 2 * len);
+	}
+
+	crc0 = lmc_crc32c_shift(zeros, (uint32_t)crc0) ^ crc1;
+	return lmc_crc32c_shift(zeros, (uint32_t)crc0) ^ crc2;
+}
+
+/**
+ * CRC-32C computed with the SSE4.2 crc32 instruction.
+ */
+LMC_TARGET_SSE42 static uint32_t lmc_crc32c_sse(uint32_t crc, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	lmc_crc_word_t crc0 = ~crc;
+
+	while (len >= 3 * LMC_CRC32C_LONG) {
+		crc0 = lmc_crc32c_triple(crc0, p, LMC_CRC32C_LONG, lmc_crc32c_long);
+		p += 3 * LMC_CRC32C_LONG;
+		len -= 3 * LMC_CRC32C_LONG;
+	}
+	while (len >= 3 * LMC_CRC32C_SHORT) {
+		crc0 = lmc_crc32c_triple(crc0, p, LMC_CRC32C_SHORT, lmc_crc32c_short);
+		p += 3 * LMC_CRC32C_SHORT;
+		len -= 3 * LMC_CRC32C_SHORT;
+	}
+	while (len >= sizeof(lmc_crc_word_t)) {
+		crc0 = lmc_crc_word(crc0, p);
+		p += sizeof(lmc_crc_word_t);
+		len -= sizeof(lmc_crc_word_t);
+	}
+
+	crc = (uint32_t)crc0;
+	while (len--)
+		crc = _mm_crc32_u8(crc, *p++);
+
+	return ~crc;
+}
+#endif
+
+/**
+ * CRC-32C of some data, using the CPU instruction when there is one.
+ *
+ * @param crc: Checksum of the previous data, or 0;
+ * @param data: Data to checksum;
+ * @param len: Size of the data.
+ *
+ * @return: Checksum of the previous data followed by this data.
+ */
+uint32_t lmc_crc32c(uint32_t crc, const void *data, size_t len)
+{
+	lmc_crc32c_init();
+
+#ifdef LMC_CRC32C_X86
+	if (lmc_crc32c_sse42)
+		return lmc_crc32c_sse(crc, data, len);
+#endif
+	return lmc_crc32c_sw(crc, data, len);
+}
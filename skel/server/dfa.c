@@ -0,0 +1,830 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/dfa.h"
+
+#define LMC_DFA_WORDS ((LMC_DFA_SYMBOLS + 63) / 64)
+#define LMC_DFA_DEPTH 64 /* nested groups */
+#define LMC_DFA_HASH (2 * LMC_DFA_MAX_STATES)
+
+enum lmc_nfa_type {
+	LMC_NFA_SET, /* reads a symbol of set */
+	LMC_NFA_SPLIT, /* goes on to out and out1 */
+	LMC_NFA_EPS, /* goes on to out */
+	LMC_NFA_MATCH,
+};
+
+enum lmc_re_type {
+	LMC_RE_SET,
+	LMC_RE_EMPTY,
+	LMC_RE_CAT,
+	LMC_RE_ALT,
+	LMC_RE_STAR,
+	LMC_RE_PLUS,
+	LMC_RE_QUEST,
+	LMC_RE_REPEAT,
+};
+
+/**
+ * Node of a parsed pattern. Contains:
+ * @field type: LMC_RE_* type of the node;
+ * @field left: First operand;
+ * @field right: Second operand, for LMC_RE_CAT and LMC_RE_ALT;
+ * @field min: Least number of repeats, for LMC_RE_REPEAT;
+ * @field max: Most repeats, or -1 for no bound;
+ * @field set: Symbols, for LMC_RE_SET.
+ */
+struct lmc_re {
+	int type;
+	int left;
+	int right;
+	int min;
+	int max;
+	uint64_t set[LMC_DFA_WORDS];
+};
+
+struct lmc_re_parser {
+	const char *p;
+	const char *end;
+	struct lmc_re *nodes;
+	int count;
+	int depth;
+	const char *error;
+};
+
+static void lmc_set_add(uint64_t *set, int sym)
+{
+	set[sym / 64] |= 1ULL << (sym % 64);
+}
+
+static int lmc_set_has(const uint64_t *set, int sym)
+{
+	return (set[sym / 64] >> (sym % 64)) & 1;
+}
+
+static void lmc_set_range(uint64_t *set, int lo, int hi)
+{
+	for (; lo <= hi; lo++)
+		lmc_set_add(set, lo);
+}
+
+/**
+ * Complement a set over the bytes a log line holds: neither the NUL byte
+ * ending it nor LMC_DFA_BOL are part of the complement.
+ */
+static void lmc_set_negate(uint64_t *set)
+{
+	int sym;
+
+	for (sym = 1; sym < 256; sym++)
+		set[sym / 64] ^= 1ULL << (sym % 64);
+	set[0] &= ~1ULL;
+	set[LMC_DFA_BOL / 64] &= ~(1ULL << (LMC_DFA_BOL % 64));
+}
+
+static int lmc_re_node(struct lmc_re_parser *ps, int type, int left, int right)
+{
+	struct lmc_re *node;
+
+	if (ps->count == LMC_DFA_NFA_MAX) {
+		ps->error = "pattern too long";
+		return -1;
+	}
+
+	node = &ps->nodes[ps->count];
+	memset(node, 0, sizeof(*node));
+	node->type = type;
+	node->left = left;
+	node->right = right;
+	return ps->count++;
+}
+
+/**
+ * Parse an escape, after the backslash, adding its symbols to set.
+ */
+static int lmc_re_escape(struct lmc_re_parser *ps, uint64_t *set)
+{
+	uint64_t class[LMC_DFA_WORDS];
+	char c;
+	int i;
+
+	if (ps->p == ps->end) {
+		ps->error = "trailing backslash";
+		return -1;
+	}
+
+	c = *ps->p++;
+	memset(class, 0, sizeof(class));
+	switch (c) {
+	case 'd':
+	case 'D':
+		lmc_set_range(class, '0', '9');
+		break;
+	case 'w':
+	case 'W':
+		lmc_set_range(class, '0', '9');
+		lmc_set_range(class, 'A', 'Z');
+		lmc_set_range(class, 'a', 'z');
+		lmc_set_add(class, '_');
+		break;
+	case 's':
+	case 'S':
+		lmc_set_add(class, ' ');
+		lmc_set_add(class, '\t');
+		break;
+	case 't':
+		lmc_set_add(class, '\t');
+		break;
+	default:
+		lmc_set_add(class, (unsigned char)c);
+		break;
+	}
+	if (c == 'D' || c == 'W' || c == 'S')
+		lmc_set_negate(class);
+
+	for (i = 0; i < LMC_DFA_WORDS; i++)
+		set[i] |= class[i];
+	return 0;
+}
+
+/**
+ * POSIX character classes of bracket expressions ("[[:digit:]]"), over the
+ * bytes of the C locale.
+ */
+static const struct {
+	const char *name;
+	int (*is)(int);
+} lmc_re_posix[] = {
+	{ "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank }, { "cntrl", iscntrl },
+	{ "digit", isdigit }, { "graph", isgraph }, { "lower", islower }, { "print", isprint },
+	{ "punct", ispunct }, { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+};
+
+/**
+ * Parse a POSIX class of a bracket expression, at its "[:", adding its
+ * symbols to set. Equivalence classes and collating symbols ("[=", "[.")
+ * are not supported.
+ */
+static int lmc_re_posix_class(struct lmc_re_parser *ps, uint64_t *set)
+{
+	const char *name = ps->p + 2, *close;
+	size_t len, i;
+	int sym;
+
+	if (ps->p[1] != ':') {
+		ps->error = "collating elements not supported";
+		return -1;
+	}
+	for (close = name; close + 1 < ps->end && !(close[0] == ':' && close[1] == ']'); close++)
+		;
+	if (close + 1 >= ps->end) {
+		ps->error = "missing :]";
+		return -1;
+	}
+
+	len = close - name;
+	for (i = 0; i < sizeof(lmc_re_posix) / sizeof(*lmc_re_posix); i++)
+		if (strlen(lmc_re_posix[i].name) == len && strncmp(lmc_re_posix[i].name, name, len) == 0)
+			break;
+	if (i == sizeof(lmc_re_posix) / sizeof(*lmc_re_posix)) {
+		ps->error = "unknown character class";
+		return -1;
+	}
+
+	for (sym = 1; sym < 256; sym++)
+		if (lmc_re_posix[i].is(sym))
+			lmc_set_add(set, sym);
+	ps->p = close + 2;
+	return 0;
+}
+
+/**
+ * Parse a bracket expression, after the opening bracket.
+ */
+static int lmc_re_class(struct lmc_re_parser *ps, uint64_t *set)
+{
+	int negate = 0, first = 1;
+	unsigned char lo, hi;
+
+	if (ps->p < ps->end && *ps->p == '^') {
+		negate = 1;
+		ps->p++;
+	}
+
+	while (ps->p < ps->end && (*ps->p != ']' || first)) {
+		first = 0;
+		if (*ps->p == '\\') {
+			ps->p++;
+			if (lmc_re_escape(ps, set) != 0)
+				return -1;
+			continue;
+		}
+		if (*ps->p == '[' && ps->p + 1 < ps->end && (ps->p[1] == ':' || ps->p[1] == '=' || ps->p[1] == '.')) {
+			if (lmc_re_posix_class(ps, set) != 0)
+				return -1;
+			continue;
+		}
+
+		lo = (unsigned char)*ps->p++;
+		if (ps->p + 1 < ps->end && *ps->p == '-' && ps->p[1] != ']') {
+			hi = (unsigned char)ps->p[1];
+			ps->p += 2;
+			if (hi < lo) {
+				ps->error = "invalid range";
+				return -1;
+			}
+			lmc_set_range(set, lo, hi);
+		} else {
+			lmc_set_add(set, lo);
+		}
+	}
+
+	if (ps->p == ps->end) {
+		ps->error = "missing ]";
+		return -1;
+	}
+	ps->p++;
+	if (negate)
+		lmc_set_negate(set);
+	return 0;
+}
+
+static int lmc_re_alt(struct lmc_re_parser *ps);
+
+static int lmc_re_atom(struct lmc_re_parser *ps)
+{
+	int node;
+	char c;
+
+	c = *ps->p;
+	if (c == '(') {
+		if (++ps->depth > LMC_DFA_DEPTH) {
+			ps->error = "too many nested groups";
+			return -1;
+		}
+		ps->p++;
+		node = lmc_re_alt(ps);
+		if (node < 0)
+			return -1;
+		if (ps->p == ps->end || *ps->p != ')') {
+			ps->error = "missing )";
+			return -1;
+		}
+		ps->p++;
+		ps->depth--;
+		return node;
+	}
+	if (c == '*' || c == '+' || c == '?' || c == '{') {
+		ps->error = "nothing to repeat";
+		return -1;
+	}
+
+	node = lmc_re_node(ps, LMC_RE_SET, -1, -1);
+	if (node < 0)
+		return -1;
+	ps->p++;
+	switch (c) {
+	case '[':
+		return lmc_re_class(ps, ps->nodes[node].set) == 0 ? node : -1;
+	case '\\':
+		return lmc_re_escape(ps, ps->nodes[node].set) == 0 ? node : -1;
+	case '.':
+		lmc_set_range(ps->nodes[node].set, 1, 255);
+		break;
+	case '^':
+		lmc_set_add(ps->nodes[node].set, LMC_DFA_BOL);
+		break;
+	case '$':
+		lmc_set_add(ps->nodes[node].set, 0);
+		break;
+	default:
+		lmc_set_add(ps->nodes[node].set, (unsigned char)c);
+		break;
+	}
+	return node;
+}
+
+/**
+ * Parse a number of a {m,n} bound.
+ */
+static int lmc_re_bound(struct lmc_re_parser *ps)
+{
+	int n = 0;
+
+	if (ps->p == ps->end || *ps->p < '0' || *ps->p > '9')
+		return -1;
+	while (ps->p < ps->end && *ps->p >= '0' && *ps->p <= '9') {
+		n = n * 10 + (*ps->p++ - '0');
+		if (n > LMC_DFA_REPEAT_MAX)
+			return -1;
+	}
+	return n;
+}
+
+static int lmc_re_repeat(struct lmc_re_parser *ps)
+{
+	int node, min, max;
+	char c;
+
+	node = lmc_re_atom(ps);
+	while (node >= 0 && ps->p < ps->end) {
+		c = *ps->p;
+		if (c == '*')
+			node = lmc_re_node(ps, LMC_RE_STAR, node, -1);
+		else if (c == '+')
+			node = lmc_re_node(ps, LMC_RE_PLUS, node, -1);
+		else if (c == '?')
+			node = lmc_re_node(ps, LMC_RE_QUEST, node, -1);
+		else if (c != '{')
+			break;
+		ps->p++;
+		if (c != '{')
+			continue;
+
+		min = max = lmc_re_bound(ps);
+		if (min >= 0 && ps->p < ps->end && *ps->p == ',') {
+			ps->p++;
+			if (ps->p < ps->end && *ps->p == '}')
+				max = -1;
+			else if ((max = lmc_re_bound(ps)) < 0)
+				min = -1;
+		}
+		if (min < 0 || ps->p == ps->end || *ps->p != '}' || (max >= 0 && max < min)) {
+			ps->error = "invalid repeat";
+			return -1;
+		}
+		ps->p++;
+		node = lmc_re_node(ps, LMC_RE_REPEAT, node, -1);
+		if (node >= 0) {
+			ps->nodes[node].min = min;
+			ps->nodes[node].max = max;
+		}
+	}
+
+	return node;
+}
+
+static int lmc_re_cat(struct lmc_re_parser *ps)
+{
+	int node = -1, next;
+
+	while (ps->p < ps->end && *ps->p != '|' && *ps->p != ')') {
+		next = lmc_re_repeat(ps);
+		if (next < 0)
+			return -1;
+		node = node < 0 ? next : lmc_re_node(ps, LMC_RE_CAT, node, next);
+		if (node < 0)
+			return -1;
+	}
+
+	return node < 0 ? lmc_re_node(ps, LMC_RE_EMPTY, -1, -1) : node;
+}
+
+static int lmc_re_alt(struct lmc_re_parser *ps)
+{
+	int node, next;
+
+	node = lmc_re_cat(ps);
+	while (node >= 0 && ps->p < ps->end && *ps->p == '|') {
+		ps->p++;
+		next = lmc_re_cat(ps);
+		if (next < 0)
+			return -1;
+		node = lmc_re_node(ps, LMC_RE_ALT, node, next);
+	}
+
+	return node;
+}
+
+static int lmc_nfa_state(struct lmc_dfa *dfa, int type, int out, int out1)
+{
+	struct lmc_nfa_state *state;
+
+	if (dfa->nfa_count == LMC_DFA_NFA_MAX)
+		return -1;
+
+	state = &dfa->nfa[dfa->nfa_count];
+	memset(state, 0, sizeof(*state));
+	state->type = type;
+	state->out = out;
+	state->out1 = out1;
+	return dfa->nfa_count++;
+}
+
+/**
+ * Build the NFA of a node, Thompson style: a fragment going from its start
+ * state to its end state, an LMC_NFA_EPS state whose out is set by the
+ * caller.
+ *
+ * @return: 0 in case of success, or -1 if there are too many states.
+ */
+static int lmc_nfa_build(struct lmc_dfa *dfa, const struct lmc_re *nodes, int n, int *start, int *end)
+{
+	const struct lmc_re *node = &nodes[n];
+	int s1, e1, s2, e2, i;
+
+	switch (node->type) {
+	case LMC_RE_SET:
+		*end = lmc_nfa_state(dfa, LMC_NFA_EPS, -1, -1);
+		*start = lmc_nfa_state(dfa, LMC_NFA_SET, *end, -1);
+		if (*start < 0 || *end < 0)
+			return -1;
+		memcpy(dfa->nfa[*start].set, node->set, sizeof(node->set));
+		return 0;
+	case LMC_RE_EMPTY:
+		*start = *end = lmc_nfa_state(dfa, LMC_NFA_EPS, -1, -1);
+		return *start < 0 ? -1 : 0;
+	case LMC_RE_CAT:
+		if (lmc_nfa_build(dfa, nodes, node->left, &s1, &e1) != 0 ||
+		    lmc_nfa_build(dfa, nodes, node->right, &s2, &e2) != 0)
+			return -1;
+		dfa->nfa[e1].out = s2;
+		*start = s1;
+		*end = e2;
+		return 0;
+	case LMC_RE_ALT:
+		if (lmc_nfa_build(dfa, nodes, node->left, &s1, &e1) != 0 ||
+		    lmc_nfa_build(dfa, nodes, node->right, &s2, &e2) != 0)
+			return -1;
+		*end = lmc_nfa_state(dfa, LMC_NFA_EPS, -1, -1);
+		*start = lmc_nfa_state(dfa, LMC_NFA_SPLIT, s1, s2);
+		if (*start < 0 || *end < 0)
+			return -1;
+		dfa->nfa[e1].out = *end;
+		dfa->nfa[e2].out = *end;
+		return 0;
+	case LMC_RE_STAR:
+	case LMC_RE_PLUS:
+	case LMC_RE_QUEST:
+		if (lmc_nfa_build(dfa, nodes, node->left, &s1, &e1) != 0)
+			return -1;
+		*end = lmc_nfa_state(dfa, LMC_NFA_EPS, -1, -1);
+		s2 = lmc_nfa_state(dfa, LMC_NFA_SPLIT, s1, *end);
+		if (*end < 0 || s2 < 0)
+			return -1;
+		/* x*: split first, x+: x first, both loop back to the split */
+		dfa->nfa[e1].out = node->type == LMC_RE_QUEST ? *end : s2;
+		*start = node->type == LMC_RE_PLUS ? s1 : s2;
+		return 0;
+	default:
+		/* x{m,n}: m copies of x, then n - m copies of x?, or x* */
+		*start = *end = lmc_nfa_state(dfa, LMC_NFA_EPS, -1, -1);
+		if (*start < 0)
+			return -1;
+		for (i = 0; i < node->min; i++) {
+			if (lmc_nfa_build(dfa, nodes, node->left, &s1, &e1) != 0)
+				return -1;
+			dfa->nfa[*end].out = s1;
+			*end = e1;
+		}
+		for (i = node->min; i < node->max || (node->max < 0 && i == node->min); i++) {
+			if (lmc_nfa_build(dfa, nodes, node->left, &s1, &e1) != 0)
+				return -1;
+			e2 = lmc_nfa_state(dfa, LMC_NFA_EPS, -1, -1);
+			s2 = lmc_nfa_state(dfa, LMC_NFA_SPLIT, s1, e2);
+			if (e2 < 0 || s2 < 0)
+				return -1;
+			dfa->nfa[*end].out = s2;
+			dfa->nfa[e1].out = node->max < 0 ? s2 : e2;
+			*end = e2;
+		}
+		return 0;
+	}
+}
+
+/**
+ * Split the classes only partly in a set of symbols in two.
+ */
+static void lmc_dfa_refine(struct lmc_dfa *dfa, const uint64_t *set, int *size)
+{
+	int inside[LMC_DFA_SYMBOLS], split[LMC_DFA_SYMBOLS];
+	int sym, c;
+
+	memset(inside, 0, dfa->class_count * sizeof(*inside));
+	for (sym = 0; sym < LMC_DFA_SYMBOLS; sym++)
+		if (lmc_set_has(set, sym))
+			inside[dfa->classes[sym]]++;
+
+	for (c = dfa->class_count - 1; c >= 0; c--)
+		split[c] = inside[c] != 0 && inside[c] != size[c] ? dfa->class_count++ : -1;
+	for (sym = 0; sym < LMC_DFA_SYMBOLS; sym++) {
+		c = dfa->classes[sym];
+		if (split[c] >= 0 && lmc_set_has(set, sym)) {
+			dfa->classes[sym] = (uint16_t)split[c];
+			size[c]--;
+			size[split[c]] = inside[c];
+		}
+	}
+}
+
+/**
+ * Split the symbols into classes that no set of the NFA tells apart: the
+ * DFA has a transition per class instead of one per symbol. The NUL byte
+ * gets a class of its own, whose transitions end the line.
+ */
+static void lmc_dfa_classes(struct lmc_dfa *dfa)
+{
+	uint64_t nul[LMC_DFA_WORDS] = { 1 };
+	int size[LMC_DFA_SYMBOLS], i, sym;
+
+	memset(dfa->classes, 0, sizeof(dfa->classes));
+	dfa->class_count = 1;
+	size[0] = LMC_DFA_SYMBOLS;
+
+	lmc_dfa_refine(dfa, nul, size);
+	for (i = 0; i < dfa->nfa_count; i++)
+		if (dfa->nfa[i].type == LMC_NFA_SET)
+			lmc_dfa_refine(dfa, dfa->nfa[i].set, size);
+
+	for (sym = LMC_DFA_SYMBOLS - 1; sym >= 0; sym--)
+		dfa->symbols[dfa->classes[sym]] = (uint16_t)sym;
+}
+
+/**
+ * Add a state and the states it leads to without reading a symbol to a set
+ * of states.
+ */
+static void lmc_nfa_closure(const struct lmc_dfa *dfa, uint64_t *bits, int state)
+{
+	int stack[LMC_DFA_NFA_MAX], top = 0;
+	const struct lmc_nfa_state *s;
+
+	stack[top++] = state;
+	while (top > 0) {
+		state = stack[--top];
+		if (state < 0 || lmc_set_has(bits, state))
+			continue;
+		lmc_set_add(bits, state);
+
+		s = &dfa->nfa[state];
+		if (s->type == LMC_NFA_EPS || s->type == LMC_NFA_SPLIT)
+			stack[top++] = s->out;
+		if (s->type == LMC_NFA_SPLIT)
+			stack[top++] = s->out1;
+	}
+}
+
+static uint64_t *lmc_dfa_set(const struct lmc_dfa *dfa, int state)
+{
+	return dfa->sets + (size_t)state * dfa->words;
+}
+
+static int lmc_dfa_accepts(const struct lmc_dfa *dfa, int state)
+{
+	/* the match state is the last one */
+	return lmc_set_has(lmc_dfa_set(dfa, state), dfa->nfa_count - 1);
+}
+
+/**
+ * Find the DFA state of a set of NFA states, adding it if it is new. Its
+ * transitions are left to be built.
+ *
+ * @return: The index of the state, or -1 if there are LMC_DFA_MAX_STATES
+ *          states already.
+ */
+static int lmc_dfa_add(struct lmc_dfa *dfa, const uint64_t *bits)
+{
+	size_t size = dfa->words * sizeof(*bits);
+	uint64_t h = 14695981039346656037ULL;
+	int i, state;
+
+	for (i = 0; i < dfa->words; i++)
+		h = (h ^ bits[i]) * 1099511628211ULL;
+	h = (h ^ (h >> 32)) % LMC_DFA_HASH;
+
+	while (dfa->hash[h] >= 0) {
+		if (memcmp(lmc_dfa_set(dfa, dfa->hash[h]), bits, size) == 0)
+			return dfa->hash[h];
+		h = (h + 1) % LMC_DFA_HASH;
+	}
+	if (dfa->states == LMC_DFA_MAX_STATES)
+		return -1;
+
+	state = dfa->states++;
+	memcpy(lmc_dfa_set(dfa, state), bits, size);
+	for (i = 0; i < dfa->class_count; i++)
+		dfa->table[state * dfa->class_count + i] = LMC_DFA_LAZY;
+	dfa->hash[h] = (int16_t)state;
+	return state;
+}
+
+/**
+ * Build a transition of the DFA, by reading a symbol of a class in every NFA
+ * state of a DFA state.
+ *
+ * @return: The transition, or LMC_DFA_LAZY if the state it leads to is new
+ *          and there is no room for it.
+ */
+static uint32_t lmc_dfa_step(struct lmc_dfa *dfa, int state, int c)
+{
+	const uint64_t *from = lmc_dfa_set(dfa, state);
+	uint64_t *to = lmc_dfa_set(dfa, LMC_DFA_MAX_STATES);
+	int i, sym = dfa->symbols[c], next = state;
+	uint32_t trans;
+
+	/* accepting states are never left, the line matches */
+	if (!lmc_dfa_accepts(dfa, state)) {
+		memset(to, 0, dfa->words * sizeof(*to));
+		for (i = 0; i < dfa->nfa_count; i++)
+			if (lmc_set_has(from, i) && dfa->nfa[i].type == LMC_NFA_SET &&
+			    lmc_set_has(dfa->nfa[i].set, sym))
+				lmc_nfa_closure(dfa, to, dfa->nfa[i].out);
+		/* a match may start anywhere */
+		lmc_nfa_closure(dfa, to, dfa->nfa_start);
+
+		next = lmc_dfa_add(dfa, to);
+		if (next < 0)
+			return LMC_DFA_LAZY;
+	}
+
+	trans = (uint32_t)(next * dfa->class_count);
+	if (lmc_dfa_accepts(dfa, next))
+		trans |= LMC_DFA_ACCEPT;
+	if (sym == 0)
+		trans |= LMC_DFA_END;
+	dfa->table[state * dfa->class_count + c] = trans;
+	return trans;
+}
+
+/**
+ * Empty the DFA, down to the state before LMC_DFA_BOL and the one after it.
+ */
+static void lmc_dfa_reset(struct lmc_dfa *dfa)
+{
+	uint64_t *bits = lmc_dfa_set(dfa, LMC_DFA_MAX_STATES);
+
+	dfa->states = 0;
+	memset(dfa->hash, 0xff, LMC_DFA_HASH * sizeof(*dfa->hash));
+	memset(bits, 0, dfa->words * sizeof(*bits));
+	lmc_nfa_closure(dfa, bits, dfa->nfa_start);
+	lmc_dfa_add(dfa, bits);
+
+	dfa->start = lmc_dfa_step(dfa, 0, dfa->classes[LMC_DFA_BOL]);
+	dfa->start_accepts = lmc_dfa_accepts(dfa, 0) || (dfa->start & LMC_DFA_ACCEPT);
+	dfa->start &= ~LMC_DFA_ACCEPT;
+}
+
+/**
+ * Build the transitions of the DFA breadth first, as long as there is room
+ * for the states.
+ */
+static int lmc_dfa_build(struct lmc_dfa *dfa)
+{
+	int state, c;
+
+	dfa->words = (dfa->nfa_count + 63) / 64;
+	/* two more sets: the next one, and the current one when flushing */
+	dfa->sets = malloc((size_t)(LMC_DFA_MAX_STATES + 2) * dfa->words * sizeof(*dfa->sets));
+	dfa->hash = malloc(LMC_DFA_HASH * sizeof(*dfa->hash));
+	dfa->table = malloc((size_t)LMC_DFA_MAX_STATES * dfa->class_count * sizeof(*dfa->table));
+	if (dfa->sets == NULL || dfa->hash == NULL || dfa->table == NULL)
+		return -1;
+
+	lmc_dfa_reset(dfa);
+	for (state = 0; state < dfa->states; state++)
+		for (c = 0; c < dfa->class_count; c++)
+			if (dfa->table[state * dfa->class_count + c] == LMC_DFA_LAZY &&
+			    lmc_dfa_step(dfa, state, c) == LMC_DFA_LAZY)
+				return 0;
+
+	dfa->complete = 1;
+	return 0;
+}
+
+/**
+ * Build a transition while matching, emptying the DFA first if it is full.
+ * Takes a time bounded by the number of NFA states.
+ *
+ * @param dfa: Compiled pattern;
+ * @param row: Offset in the table of the row of the state;
+ * @param c: Class of the symbol read.
+ *
+ * @return: The transition.
+ */
+static uint32_t lmc_dfa_fill(struct lmc_dfa *dfa, uint32_t row, int c)
+{
+	uint64_t *cur = lmc_dfa_set(dfa, LMC_DFA_MAX_STATES + 1);
+	uint32_t trans;
+	int state = row / dfa->class_count;
+
+	trans = lmc_dfa_step(dfa, state, c);
+	if (trans != LMC_DFA_LAZY)
+		return trans;
+
+	memcpy(cur, lmc_dfa_set(dfa, state), dfa->words * sizeof(*cur));
+	lmc_dfa_reset(dfa);
+	dfa->flushes++;
+	return lmc_dfa_step(dfa, lmc_dfa_add(dfa, cur), c);
+}
+
+/**
+ * Compile a pattern.
+ *
+ * @param dfa: Compiled pattern, to be freed with lmc_dfa_free;
+ * @param pattern: The pattern;
+ * @param len: Length of the pattern;
+ * @param error: Receives what is wrong with the pattern, if it is invalid.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_dfa_compile(struct lmc_dfa *dfa, const char *pattern, size_t len, const char **error)
+{
+	struct lmc_re_parser ps;
+	int root, start, end, match;
+
+	memset(dfa, 0, sizeof(*dfa));
+	memset(&ps, 0, sizeof(ps));
+	ps.p = pattern;
+	ps.end = pattern + len;
+	ps.error = "out of memory";
+	ps.nodes = malloc(LMC_DFA_NFA_MAX * sizeof(*ps.nodes));
+	dfa->nfa = malloc(LMC_DFA_NFA_MAX * sizeof(*dfa->nfa));
+	if (ps.nodes == NULL || dfa->nfa == NULL)
+		goto err;
+
+	root = lmc_re_alt(&ps);
+	if (root >= 0 && ps.p != ps.end) {
+		ps.error = "unmatched )";
+		root = -1;
+	}
+	if (root < 0)
+		goto err;
+
+	ps.error = "pattern too large";
+	if (lmc_nfa_build(dfa, ps.nodes, root, &start, &end) != 0)
+		goto err;
+	match = lmc_nfa_state(dfa, LMC_NFA_MATCH, -1, -1);
+	if (match < 0)
+		goto err;
+	dfa->nfa[end].out = match;
+	dfa->nfa_start = start;
+
+	ps.error = "out of memory";
+	lmc_dfa_classes(dfa);
+	if (lmc_dfa_build(dfa) != 0)
+		goto err;
+
+	free(ps.nodes);
+	return 0;
+err:
+	*error = ps.error;
+	free(ps.nodes);
+	lmc_dfa_free(dfa);
+	return -1;
+}
+
+/**
+ * Check whether a line matches a pattern.
+ *
+ * @param dfa: Compiled pattern. Transitions missing from the DFA are built
+ *             while matching, so a compiled pattern must not be matched by
+ *             several threads at once;
+ * @param line: Line, NUL terminated within size bytes;
+ * @param size: Size of the buffer holding the line.
+ *
+ * @return: 1 if the line matches, or 0 otherwise.
+ */
+int lmc_dfa_match(struct lmc_dfa *dfa, const char *line, size_t size)
+{
+	const uint16_t *classes = dfa->classes;
+	uint32_t state, next;
+	size_t i;
+
+	if (dfa->start_accepts)
+		return 1;
+
+	state = dfa->start;
+	for (i = 0; i < size; i++) {
+		next = dfa->table[state + classes[(unsigned char)line[i]]];
+		if (next & LMC_DFA_STOP) {
+			if (next == LMC_DFA_LAZY)
+				next = lmc_dfa_fill(dfa, state, classes[(unsigned char)line[i]]);
+			if (next & LMC_DFA_ACCEPT)
+				return 1;
+			if (next & LMC_DFA_END)
+				return 0;
+		}
+		state = next;
+	}
+
+	return 0;
+}
+
+/**
+ * Free a compiled pattern.
+ *
+ * @param dfa: Compiled pattern.
+ */
+void lmc_dfa_free(struct lmc_dfa *dfa)
+{
+	free(dfa->nfa);
+	free(dfa->sets);
+	free(dfa->hash);
+	free(dfa->table);
+	memset(dfa, 0, sizeof(*dfa));
+}
@@ -0,0 +1,205 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "../include/server.h"
+#include "../include/segment.h"
+
+/**
+ * Path of the n-th log file of a service, oldest first: the rotated files,
+ * then the file flushes append to.
+ *
+ * @param cache: Cache of the service;
+ * @param n: Position of the file;
+ * @param path: Buffer receiving the path;
+ * @param len: Size of the buffer.
+ *
+ * @return: 0 in case of success, or -1 if there is no such file.
+ */
+static int lmc_logfile_at(struct lmc_cache *cache, size_t n, char *path, size_t len)
+{
+	if (n < cache->logfile_count) {
+		snprintf(path, len, "%s", cache->logfiles[n].path);
+		return 0;
+	}
+	if (n == cache->logfile_count) {
+		snprintf(path, len, "%s/%s.log", lmc_logfile_path, cache->service_name);
+		return 0;
+	}
+	return -1;
+}
+
+/**
+ * Find the lines of the current run of a service on disk. Flushes of this
+ * run wrote the last no_logs_stored_on_disk records of the log files of the
+ * service; the records before them were left by earlier runs. Retention
+ * may have deleted the oldest lines of this run. Called with the cache
+ * locked.
+ *
+ * @param cache: Cache of the service;
+ * @param start: Position of the first line of this run among all the records
+ *               on disk;
+ * @param lost: Number of lines of this run deleted by retention.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_find_evicted(struct lmc_cache *cache, uint64_t *start, uint64_t *lost)
+{
+	struct log_in_memory *lim = cache->ptr;
+	char path[LMC_LOGFILE_NAME_LEN * 2];
+	uint64_t total = 0, records;
+	size_t n;
+
+	for (n = 0; lmc_logfile_at(cache, n, path, sizeof(path)) == 0; n++)
+		if (lmc_segment_count(path, &records) == 0)
+			total += records;
+
+	if (total >= (uint64_t)lim->no_logs_stored_on_disk) {
+		*start = total - lim->no_logs_stored_on_disk;
+		*lost = 0;
+	} else {
+		*start = 0;
+		*lost = lim->no_logs_stored_on_disk - total;
+	}
+
+	return 0;
+}
+
+/**
+ * Pass an empty line to fn in place of each line of the blocks the reader
+ * could not read back since the last call, as long as lines are wanted.
+ *
+ * @param reader: Segment reader;
+ * @param lost: Lines of those blocks passed so far;
+ * @param count: Number of lines still wanted;
+ * @param fn: Called for every line;
+ * @param arg: Passed to fn.
+ *
+ * @return: 0 in case of success, or -1 if fn did not return 0.
+ */
+static int lmc_pass_lost(struct lmc_segment_reader *reader, uint64_t *lost, uint64_t *count, lmc_line_fn fn,
+			 void *arg)
+{
+	struct lmc_client_logline empty;
+
+	if (*lost == reader->lost_records)
+		return 0;
+
+	memset(&empty, 0, sizeof(empty));
+	for (; *lost < reader->lost_records && *count > 0; (*lost)++, (*count)--)
+		if (fn(&empty, arg) != 0)
+			return -1;
+	return 0;
+}
+
+/**
+ * Read log lines of a service back from disk, in the order they were added.
+ * Files and blocks before the first line wanted are skipped without being
+ * decoded, and so are the blocks whose filter rules out the lines wanted.
+ * Blocks that cannot be read back are passed over: their lines are counted
+ * as lost, and an empty line is passed to fn in place of each of them.
+ * Files holding such blocks are marked as corrupt. Called with the cache
+ * locked.
+ *
+ * @param cache: Cache of the service;
+ * @param start: Position of the first line among all the records on disk;
+ * @param count: Number of lines to read;
+ * @param probe: Only lines holding these grams are wanted, or NULL;
+ * @param span: Called with the oldest and newest time and the number of
+ *              records of every block read whole, or NULL. The block is
+ *              skipped if it returns 1, read if it returns 0, and reading
+ *              stops if it returns -1. If it returns 0, it is called again
+ *              with the times of the records, if the block has them apart;
+ * @param fn: Called for every line read. Reading stops if it does not
+ *            return 0;
+ * @param arg: Passed to span and fn.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_read_evicted(struct lmc_cache *cache, uint64_t start, uint64_t count, const struct lmc_bloom_probe *probe,
+		     lmc_span_fn span, lmc_line_fn fn, void *arg)
+{
+	struct lmc_segment_reader reader;
+	struct lmc_client_logline line;
+	struct lmc_block_index entry;
+	const int64_t *times;
+	char path[LMC_LOGFILE_NAME_LEN * 2];
+	uint64_t records, skipped, lost;
+	size_t n;
+	int rc = 0;
+
+	for (n = 0; count > 0 && lmc_logfile_at(cache, n, path, sizeof(path)) == 0; n++) {
+		if (lmc_segment_count(path, &records) != 0)
+			continue;
+		if (start >= records) {
+			start -= records;
+			continue;
+		}
+
+		if (lmc_segment_open(&reader, path) != 0)
+			return -1;
+		if (lmc_segment_skip(&reader, start) != 0) {
+			lmc_segment_close(&reader);
+			return -1;
+		}
+		start = 0;
+		lost = 0;
+		lmc_segment_filter(&reader, probe);
+
+		// Skipped blocks count too, and may hold the last lines wanted
+		while (count > 0) {
+			rc = lmc_pass_lost(&reader, &lost, &count, fn, arg);
+			if (rc < 0 || count == 0)
+				break;
+
+			if (span != NULL && lmc_segment_peek(&reader, &entry) && entry.records <= count) {
+				rc = span(entry.first_time, entry.last_time, entry.records, NULL, arg);
+				if (rc > 0 && lmc_segment_skip(&reader, entry.records) != 0)
+					rc = -1;
+				// Else the block is loaded, its records read below if need be
+				if (rc == 0 && (rc = lmc_segment_times(&reader, &times)) > 0) {
+					rc = span(entry.first_time, entry.last_time, entry.records, times, arg);
+					if (rc == 0)
+						lmc_segment_rewind_block(&reader);
+				}
+				if (rc < 0)
+					break;
+				if (rc > 0) {
+					count -= entry.records;
+					continue;
+				}
+			}
+
+			skipped = reader.skipped_records;
+			rc = lmc_segment_next(&reader, &line);
+			skipped = reader.skipped_records - skipped;
+			count -= skipped < count ? skipped : count;
+			if (rc >= 0 && lmc_pass_lost(&reader, &lost, &count, fn, arg) != 0)
+				rc = -1;
+			if (rc <= 0 || count == 0)
+				break;
+			count--;
+			if (fn(&line, arg) != 0) {
+				rc = -1;
+				break;
+			}
+		}
+		cache->bloom_probed += reader.probed;
+		cache->bloom_skipped += reader.skipped;
+		cache->lost_lines += lost;
+		if (reader.lost != 0 && n < cache->logfile_count && !cache->logfiles[n].corrupt) {
+			cache->logfiles[n].corrupt = 1;
+			fprintf(stderr, "%s: %u corrupted blocks, " UINT64_FMT " lines lost\n", path, reader.lost,
+				reader.lost_records);
+		}
+		lmc_segment_close(&reader);
+
+		if (rc < 0)
+			return -1;
+	}
+
+	return count == 0 ? 0 : -1;
+}
@@ -0,0 +1,330 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/histogram.h"
+
+/**
+ * Start of the bucket of a time value.
+ */
+static int64_t lmc_bucket_start(const struct lmc_histogram *h, int64_t t)
+{
+	int64_t width = (int64_t)h->width;
+
+	if (width == 0)
+		return 0;
+	return t - ((t % width) + width) % width;
+}
+
+/**
+ * Start counting lines.
+ *
+ * @param h: Histogram to initialize;
+ * @param width: Seconds of a bucket, or 0 for a count;
+ * @param start: Oldest time of interest, or an empty string to count all
+ *               the lines;
+ * @param end: Newest time of interest, or an empty string for no end. Both
+ *             must be in LMC_TIME_FORMAT.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_histogram_init(struct lmc_histogram *h, uint64_t width, const char *start, const char *end)
+{
+	time_t t;
+
+	memset(h, 0, sizeof(*h));
+	h->width = width;
+	h->from = INT64_MIN;
+	h->to = INT64_MAX;
+	// No key cached yet
+	h->lo = 1;
+	h->hi = 0;
+	if (width > LMC_HISTOGRAM_MAX_WIDTH)
+		return -1;
+	if (start[0] == '\0')
+		return 0;
+
+	h->ranged = 1;
+	strncpy(h->start, start, LMC_TIME_SIZE - 1);
+	strncpy(h->end, end, LMC_TIME_SIZE - 1);
+	lmc_time_range(&h->range, h->start, h->end);
+	if (h->range.start == LMC_TIME_KEY_NONE || (!h->range.open && h->range.end == LMC_TIME_KEY_NONE))
+		return -1;
+
+	if (lmc_str_to_time(h->start, &t) != 0)
+		return -1;
+	h->from = (int64_t)t;
+	if (!h->range.open) {
+		if (lmc_str_to_time(h->end, &t) != 0)
+			return -1;
+		h->to = (int64_t)t;
+	}
+
+	return 0;
+}
+
+/**
+ * Count lines in the bucket of a time value.
+ *
+ * @param h: Histogram;
+ * @param t: Time of the lines;
+ * @param n: Number of lines.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_histogram_add(struct lmc_histogram *h, int64_t t, uint64_t n)
+{
+	struct lmc_bucket *buckets;
+	int64_t start = lmc_bucket_start(h, t);
+	size_t lo = 0, hi = h->count, mid, max;
+
+	if (n == 0)
+		return 0;
+
+	// Lines mostly come oldest first
+	if (h->count != 0 && h->buckets[h->count - 1].start <= start)
+		lo = h->count - 1;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (h->buckets[mid].start < start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < h->count && h->buckets[lo].start == start) {
+		h->buckets[lo].count += n;
+		return 0;
+	}
+
+	if (h->count == h->max) {
+		max = h->max ? 2 * h->max : 64;
+		buckets = realloc(h->buckets, max * sizeof(*buckets));
+		if (buckets == NULL)
+			return -1;
+		h->buckets = buckets;
+		h->max = max;
+	}
+	memmove(h->buckets + lo + 1, h->buckets + lo, (h->count - lo) * sizeof(*h->buckets));
+	h->buckets[lo].start = start;
+	h->buckets[lo].count = n;
+	h->count++;
+
+	return 0;
+}
+
+/**
+ * Key of the time a bucket starts at.
+ */
+static uint64_t lmc_bucket_key(int64_t start)
+{
+	char str[LMC_TIME_SIZE];
+
+	if (lmc_time_to_str(str, sizeof(str), LMC_TIME_FORMAT, (time_t)start) != 0)
+		return LMC_TIME_KEY_NONE;
+	return lmc_time_key(str);
+}
+
+/**
+ * Find the bucket of a key, remembering its bounds as keys: the lines after
+ * it mostly fall in the same bucket, and only need comparing their keys.
+ *
+ * @return: 0 in case of success, or -1 if the key is not a valid time.
+ */
+static int lmc_histogram_bucket(struct lmc_histogram *h, uint64_t key)
+{
+	int64_t t;
+
+	if (key >= h->lo && key < h->hi)
+		return 0;
+	if (lmc_time_key_value(key, &t) != 0)
+		return -1;
+
+	h->cur = lmc_bucket_start(h, t);
+	h->lo = lmc_bucket_key(h->cur);
+	h->hi = lmc_bucket_key(h->cur + (int64_t)h->width);
+	// Local time going back an hour, the bounds only hold for this key
+	if (h->lo > key || h->hi <= key || h->hi == LMC_TIME_KEY_NONE) {
+		h->lo = key;
+		h->hi = key + 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Count lines by the key of their time.
+ */
+static int lmc_histogram_add_key(struct lmc_histogram *h, uint64_t key, uint64_t n)
+{
+	if (h->ranged && (key < h->range.start || (!h->range.open && key > h->range.end)))
+		return 0;
+	if (h->width == 0)
+		return lmc_histogram_add(h, 0, n);
+	if (lmc_histogram_bucket(h, key) != 0) {
+		h->unplaced += n;
+		return 0;
+	}
+	return lmc_histogram_add(h, h->cur, n);
+}
+
+/**
+ * Count lines by their time string. Lines out of the interval of interest
+ * are not counted; times are compared as strings, like getlogs does.
+ *
+ * @param h: Histogram;
+ * @param time: Time of the lines;
+ * @param n: Number of lines.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_histogram_add_line(struct lmc_histogram *h, const char *time, uint64_t n)
+{
+	uint64_t key = lmc_time_key(time);
+
+	if (key != LMC_TIME_KEY_NONE)
+		return lmc_histogram_add_key(h, key, n);
+
+	if (h->ranged && (strcmp(time, h->start) < 0 || (!h->range.open && strcmp(time, h->end) > 0)))
+		return 0;
+	if (h->width == 0)
+		return lmc_histogram_add(h, 0, n);
+	h->unplaced += n;
+	return 0;
+}
+
+/**
+ * Count a group of lines from the times of its oldest and newest line only,
+ * if that is enough: the group is out of the interval of interest, or it is
+ * inside and falls in a single bucket.
+ *
+ * @param h: Histogram;
+ * @param first: Time value of the oldest line of the group;
+ * @param last: Time value of the newest line, lower than first if the
+ *              times of the group are not known;
+ * @param lines: Number of lines of the group.
+ *
+ * @return: 1 if the lines were counted, 0 if they have to be counted one by
+ *          one, or -1 in case of an error.
+ */
+int lmc_histogram_add_span(struct lmc_histogram *h, int64_t first, int64_t last, uint64_t lines)
+{
+	// Times that could not be parsed are stored as 0
+	if (last < first || first <= 0)
+		return 0;
+	if (last < h->from || first > h->to)
+		return 1;
+	if (first < h->from || last > h->to)
+		return 0;
+	if (lmc_bucket_start(h, first) != lmc_bucket_start(h, last))
+		return 0;
+
+	return lmc_histogram_add(h, first, lines) == 0 ? 1 : -1;
+}
+
+/**
+ * Count lines from their time values, every run of lines in the same bucket
+ * at once.
+ *
+ * @param h: Histogram;
+ * @param times: Time values of the lines;
+ * @param n: Number of lines.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_histogram_add_times(struct lmc_histogram *h, const int64_t *times, uint64_t n)
+{
+	int64_t start, end;
+	uint64_t i, j;
+
+	for (i = 0; i < n; i = j) {
+		if (times[i] < h->from || times[i] > h->to) {
+			j = i + 1;
+			continue;
+		}
+
+		start = lmc_bucket_start(h, times[i]);
+		end = h->width != 0 ? start + (int64_t)h->width - 1 : INT64_MAX;
+		if (end > h->to)
+			end = h->to;
+		if (start < h->from)
+			start = h->from;
+		for (j = i + 1; j < n && times[j] >= start && times[j] <= end; j++)
+			;
+		if (lmc_histogram_add(h, times[i], j - i) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Count lines of the log line array from the time column, with a binary
+ * search for the first line of every bucket.
+ *
+ * @param h: Histogram;
+ * @param col: Time column;
+ * @param lo: Number of the first line, at least col->sorted;
+ * @param hi: Number of the line after the last one.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_histogram_add_column(struct lmc_histogram *h, struct lmc_time_column *col, uint64_t lo, uint64_t hi)
+{
+	uint64_t key, next;
+
+	if (h->ranged) {
+		lo = lmc_column_search(col, lo, hi, h->range.start);
+		if (!h->range.open)
+			hi = lmc_column_search(col, lo, hi, h->range.end + 1);
+	}
+	if (h->width == 0)
+		return lmc_histogram_add(h, 0, hi - lo);
+
+	for (; lo < hi; lo = next) {
+		key = lmc_column_get(col, lo);
+		if (lmc_histogram_bucket(h, key) != 0) {
+			next = lmc_column_search(col, lo, hi, key + 1);
+			h->unplaced += next - lo;
+			continue;
+		}
+		next = lmc_column_search(col, lo, hi, h->hi);
+		if (lmc_histogram_add(h, h->cur, next - lo) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Number of lines counted, in all the buckets.
+ *
+ * @param h: Histogram.
+ *
+ * @return: The number of lines.
+ */
+uint64_t lmc_histogram_total(const struct lmc_histogram *h)
+{
+	uint64_t total = 0;
+	size_t i;
+
+	for (i = 0; i < h->count; i++)
+		total += h->buckets[i].count;
+
+	return total;
+}
+
+/**
+ * Free the buckets of a histogram.
+ *
+ * @param h: Histogram.
+ */
+void lmc_histogram_free(struct lmc_histogram *h)
+{
+	free(h->buckets);
+	h->buckets = NULL;
+	h->count = 0;
+	h->max = 0;
+}
@@ -0,0 +1,548 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/index.h"
+
+#define LMC_INDEX_SLOTS 1024 /* slots of a new index */
+#define LMC_INDEX_TERMS 128 /* keys of a pattern, enough for any pattern */
+
+static int lmc_token_char(unsigned char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static uint32_t lmc_key_hash(const char *name, size_t len, int kind)
+{
+	uint32_t h = 2166136261U ^ (uint32_t)kind;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ (unsigned char)name[i]) * 16777619U;
+	/* 0 marks free slots */
+	return h != 0 ? h : 1;
+}
+
+/**
+ * Size allocated for a posting list of len bytes kept out of its entry.
+ */
+static size_t lmc_posting_cap(size_t len)
+{
+	size_t cap = 2 * LMC_INDEX_INLINE;
+
+	while (cap < len)
+		cap *= 2;
+	return cap;
+}
+
+static uint8_t *lmc_posting_data(struct lmc_posting *p)
+{
+	return p->len > LMC_INDEX_INLINE ? p->u.data : p->u.bytes;
+}
+
+/**
+ * Initialize an index.
+ *
+ * @param index: Index to initialize;
+ * @param budget: Memory the index may hold, 0 to never index lines.
+ */
+void lmc_index_init(struct lmc_index *index, uint64_t budget)
+{
+	memset(index, 0, sizeof(*index));
+	index->budget = budget;
+}
+
+/**
+ * Drop all the keys of an index. The next line added is the first one.
+ */
+static void lmc_index_empty(struct lmc_index *index)
+{
+	size_t i;
+
+	for (i = 0; i < index->slot_count; i++)
+		if (index->slots[i].hash != 0 && index->slots[i].len > LMC_INDEX_INLINE)
+			free(index->slots[i].u.data);
+	free(index->slots);
+	free(index->names);
+
+	index->slots = NULL;
+	index->slot_count = 0;
+	index->keys = 0;
+	index->names = NULL;
+	index->names_len = 0;
+	index->names_max = 0;
+	index->bytes = 0;
+	index->first = index->next;
+}
+
+/**
+ * Free the memory held by an index.
+ *
+ * @param index: Index.
+ */
+void lmc_index_free(struct lmc_index *index)
+{
+	lmc_index_empty(index);
+	memset(index, 0, sizeof(*index));
+}
+
+static struct lmc_posting *lmc_index_slot(struct lmc_index *index, const char *name, size_t len, int kind,
+					  uint32_t hash)
+{
+	size_t mask = index->slot_count - 1, i = hash & mask;
+	struct lmc_posting *p;
+
+	for (;; i = (i + 1) & mask) {
+		p = &index->slots[i];
+		if (p->hash == 0)
+			return p;
+		if (p->hash == hash && p->kind == kind && p->name_len == len &&
+		    memcmp(index->names + p->name, name, len) == 0)
+			return p;
+	}
+}
+
+/**
+ * Double the slots of an index, keeping it at most 3/4 full.
+ */
+static int lmc_index_grow(struct lmc_index *index)
+{
+	size_t count = index->slot_count ? 2 * index->slot_count : LMC_INDEX_SLOTS, i, j;
+	struct lmc_posting *slots;
+
+	slots = calloc(count, sizeof(*slots));
+	if (slots == NULL)
+		return -1;
+
+	for (i = 0; i < index->slot_count; i++) {
+		if (index->slots[i].hash == 0)
+			continue;
+		for (j = index->slots[i].hash & (count - 1); slots[j].hash != 0; j = (j + 1) & (count - 1))
+			;
+		slots[j] = index->slots[i];
+	}
+
+	free(index->slots);
+	index->bytes += (count - index->slot_count) * sizeof(*slots);
+	index->slots = slots;
+	index->slot_count = count;
+	return 0;
+}
+
+static int lmc_index_name(struct lmc_index *index, const char *name, size_t len)
+{
+	size_t max = index->names_max ? index->names_max : LMC_INDEX_SLOTS * 8;
+	char *names;
+
+	while (index->names_len + len > max)
+		max *= 2;
+	if (max != index->names_max) {
+		names = realloc(index->names, max);
+		if (names == NULL)
+			return -1;
+		index->bytes += max - index->names_max;
+		index->names = names;
+		index->names_max = max;
+	}
+
+	memcpy(index->names + index->names_len, name, len);
+	index->names_len += len;
+	return 0;
+}
+
+/**
+ * Append a line to a posting list, as the varint of its distance to the
+ * line before.
+ */
+static int lmc_posting_append(struct lmc_index *index, struct lmc_posting *p, uint32_t line)
+{
+	uint32_t delta = p->count != 0 ? line - p->last : line;
+	size_t n = 0, len = p->len;
+	uint8_t varint[5], *data;
+
+	do {
+		varint[n++] = (uint8_t)((delta & 0x7f) | (delta > 0x7f ? 0x80 : 0));
+		delta >>= 7;
+	} while (delta != 0);
+
+	if (len + n > LMC_INDEX_INLINE && (len <= LMC_INDEX_INLINE || lmc_posting_cap(len + n) > lmc_posting_cap(len))) {
+		data = malloc(lmc_posting_cap(len + n));
+		if (data == NULL)
+			return -1;
+		memcpy(data, lmc_posting_data(p), len);
+		if (len > LMC_INDEX_INLINE) {
+			free(p->u.data);
+			index->bytes -= lmc_posting_cap(len);
+		}
+		index->bytes += lmc_posting_cap(len + n);
+		p->u.data = data;
+	}
+
+	p->len += n;
+	memcpy(lmc_posting_data(p) + len, varint, n);
+	p->last = line;
+	p->count++;
+	return 0;
+}
+
+static int lmc_index_key(struct lmc_index *index, const char *name, size_t len, int kind, uint32_t line)
+{
+	uint32_t hash = lmc_key_hash(name, len, kind);
+	struct lmc_posting *p;
+
+	if (4 * (index->keys + 1) > 3 * index->slot_count && lmc_index_grow(index) != 0)
+		return -1;
+
+	p = lmc_index_slot(index, name, len, kind, hash);
+	if (p->hash == 0) {
+		p->name = (uint32_t)index->names_len;
+		if (lmc_index_name(index, name, len) != 0)
+			return -1;
+		p->hash = hash;
+		p->name_len = (uint16_t)len;
+		p->kind = (uint16_t)kind;
+		index->keys++;
+	}
+
+	/* a key repeated in a line is listed once */
+	if (p->count != 0 && p->last == line)
+		return 0;
+	return lmc_posting_append(index, p, line);
+}
+
+/**
+ * Index a line added to the cache. Lines must be added in order.
+ *
+ * @param index: Index of the cache;
+ * @param number: Number of the line, lines are numbered like in the cache;
+ * @param line: Text of the line.
+ */
+void lmc_index_add(struct lmc_index *index, uint64_t number, const char *line)
+{
+	uint32_t rel;
+	const char *start;
+	size_t len;
+	int err = 0;
+
+	if (index->budget == 0)
+		return;
+	if (index->next != number || number - index->first > UINT32_MAX) {
+		index->next = number;
+		lmc_index_empty(index);
+	}
+
+	rel = (uint32_t)(number - index->first);
+	while (*line != '\0' && err == 0) {
+		if (!lmc_token_char((unsigned char)*line)) {
+			line++;
+			continue;
+		}
+		for (start = line; lmc_token_char((unsigned char)*line); line++)
+			;
+		len = line - start;
+		if (len >= LMC_INDEX_TOKEN_MIN)
+			err = lmc_index_key(index, start, len, LMC_INDEX_WHOLE, rel);
+		if (len >= LMC_INDEX_AFFIX && err == 0)
+			err = lmc_index_key(index, start, LMC_INDEX_AFFIX, LMC_INDEX_PREFIX, rel);
+		if (len >= LMC_INDEX_AFFIX && err == 0)
+			err = lmc_index_key(index, line - LMC_INDEX_AFFIX, LMC_INDEX_AFFIX, LMC_INDEX_SUFFIX, rel);
+	}
+
+	/* an index missing keys of a line would miss lines */
+	index->next = number + 1;
+	if (err != 0 || index->bytes > index->budget) {
+		lmc_index_empty(index);
+		index->resets++;
+	}
+}
+
+/**
+ * Drop the lines before cut from a posting list, and number the others from
+ * cut. Only the first varint changes, the distances between the lines kept
+ * stay as they are.
+ *
+ * @return: 1 if lines are left, 0 if the list is now empty and was freed,
+ *          or -1 in case of an error.
+ */
+static int lmc_posting_trim(struct lmc_index *index, struct lmc_posting *p, uint32_t cut)
+{
+	const uint8_t *data = lmc_posting_data(p), *end = data + p->len;
+	uint8_t varint[5], inline_bytes[LMC_INDEX_INLINE], *copy;
+	uint32_t line = 0, delta, i;
+	size_t n = 0, len;
+	int shift;
+
+	for (i = 0; i < p->count; i++) {
+		delta = 0;
+		shift = 0;
+		while (data < end && (*data & 0x80)) {
+			delta |= (uint32_t)(*data++ & 0x7f) << shift;
+			shift += 7;
+		}
+		if (data == end)
+			return -1;
+		delta |= (uint32_t)*data++ << shift;
+		line = i == 0 ? delta : line + delta;
+		if (line >= cut)
+			break;
+	}
+
+	if (i == p->count) {
+		if (p->len > LMC_INDEX_INLINE) {
+			free(p->u.data);
+			index->bytes -= lmc_posting_cap(p->len);
+		}
+		return 0;
+	}
+
+	delta = line - cut;
+	do {
+		varint[n++] = (uint8_t)((delta & 0x7f) | (delta > 0x7f ? 0x80 : 0));
+		delta >>= 7;
+	} while (delta != 0);
+
+	len = n + (end - data);
+	copy = len > LMC_INDEX_INLINE ? malloc(lmc_posting_cap(len)) : inline_bytes;
+	if (copy == NULL)
+		return -1;
+	memcpy(copy, varint, n);
+	memcpy(copy + n, data, end - data);
+
+	if (p->len > LMC_INDEX_INLINE) {
+		free(p->u.data);
+		index->bytes -= lmc_posting_cap(p->len);
+	}
+	if (len > LMC_INDEX_INLINE) {
+		p->u.data = copy;
+		index->bytes += lmc_posting_cap(len);
+	} else {
+		memcpy(p->u.bytes, copy, len);
+	}
+	p->len = (uint32_t)len;
+	p->count -= i;
+	p->last -= cut;
+	return 1;
+}
+
+/**
+ * Drop the lines before first from all the posting lists, with the keys no
+ * line left holds, and number the lines from first. The slots and the names
+ * are built again for the keys kept.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_index_rebase(struct lmc_index *index, uint64_t first)
+{
+	uint32_t cut = (uint32_t)(first - index->first);
+	size_t count = LMC_INDEX_SLOTS, names_max = LMC_INDEX_SLOTS * 8, names_len = 0, keys = 0, i, j;
+	struct lmc_posting *slots, *p;
+	char *names;
+	int rc;
+
+	for (i = 0; i < index->slot_count; i++) {
+		p = &index->slots[i];
+		if (p->hash == 0)
+			continue;
+		rc = lmc_posting_trim(index, p, cut);
+		if (rc < 0)
+			return -1;
+		if (rc == 0) {
+			p->hash = 0;
+			continue;
+		}
+		keys++;
+		names_len += p->name_len;
+	}
+
+	while (4 * keys > 3 * count)
+		count *= 2;
+	while (names_len > names_max)
+		names_max *= 2;
+	slots = calloc(count, sizeof(*slots));
+	names = malloc(names_max);
+	if (slots == NULL || names == NULL) {
+		free(slots);
+		free(names);
+		return -1;
+	}
+
+	names_len = 0;
+	for (i = 0; i < index->slot_count; i++) {
+		p = &index->slots[i];
+		if (p->hash == 0)
+			continue;
+		memcpy(names + names_len, index->names + p->name, p->name_len);
+		p->name = (uint32_t)names_len;
+		names_len += p->name_len;
+		for (j = p->hash & (count - 1); slots[j].hash != 0; j = (j + 1) & (count - 1))
+			;
+		slots[j] = *p;
+	}
+
+	index->bytes -= index->slot_count * sizeof(*slots) + index->names_max;
+	index->bytes += count * sizeof(*slots) + names_max;
+	free(index->slots);
+	free(index->names);
+	index->slots = slots;
+	index->slot_count = count;
+	index->keys = keys;
+	index->names = names;
+	index->names_len = names_len;
+	index->names_max = names_max;
+	index->first = first;
+	return 0;
+}
+
+/**
+ * Drop the lines that left the log line array from the index: searches
+ * read them from the other tiers. As trimming goes over the whole index, it
+ * waits for half of the lines indexed to be gone; the index is dropped once
+ * none of them are left.
+ *
+ * @param index: Index of the cache;
+ * @param first: Number of the first line in the log line array.
+ */
+void lmc_index_trim(struct lmc_index *index, uint64_t first)
+{
+	if (index->keys == 0 || first <= index->first)
+		return;
+	if (first >= index->next) {
+		lmc_index_empty(index);
+		return;
+	}
+	if (first - index->first < (index->next - index->first) / 2)
+		return;
+
+	if (lmc_index_rebase(index, first) != 0) {
+		lmc_index_empty(index);
+		index->resets++;
+	}
+}
+
+static int lmc_posting_decode(struct lmc_posting *p, uint32_t *lines)
+{
+	const uint8_t *data = lmc_posting_data(p), *end = data + p->len;
+	uint32_t line = 0, delta;
+	size_t i;
+	int shift;
+
+	for (i = 0; i < p->count; i++) {
+		delta = 0;
+		shift = 0;
+		while (data < end && (*data & 0x80)) {
+			delta |= (uint32_t)(*data++ & 0x7f) << shift;
+			shift += 7;
+		}
+		if (data == end)
+			return -1;
+		delta |= (uint32_t)*data++ << shift;
+		line = i == 0 ? delta : line + delta;
+		lines[i] = line;
+	}
+
+	return 0;
+}
+
+static int lmc_cmp_postings(const void *a, const void *b)
+{
+	const struct lmc_posting *pa = *(struct lmc_posting *const *)a;
+	const struct lmc_posting *pb = *(struct lmc_posting *const *)b;
+
+	return pa->count < pb->count ? -1 : pa->count > pb->count;
+}
+
+/**
+ * Find the candidate lines of a substring search: the indexed lines that may
+ * hold the pattern. Lines before hits->from are not indexed.
+ *
+ * @param index: Index of the cache;
+ * @param pattern: Pattern of the search;
+ * @param len: Length of the pattern;
+ * @param hits: Receives the candidates, to be freed with free(hits->lines).
+ *
+ * @return: 0 in case of success, or -1 if the index cannot narrow the
+ *          search, and all the lines must be searched.
+ */
+int lmc_index_query(struct lmc_index *index, const char *pattern, size_t len, struct lmc_index_hits *hits)
+{
+	struct lmc_posting *keys[LMC_INDEX_TERMS], *p;
+	size_t n = 0, i, j, k, start, end, count;
+	uint32_t *lines, *other = NULL;
+	const char *name;
+	int kind;
+
+	memset(hits, 0, sizeof(*hits));
+	hits->base = index->first;
+	hits->from = index->first;
+	if (index->budget == 0)
+		return -1;
+
+	for (i = 0; i < len && n < LMC_INDEX_TERMS; i = end) {
+		for (start = i; start < len && !lmc_token_char((unsigned char)pattern[start]); start++)
+			;
+		for (end = start; end < len && lmc_token_char((unsigned char)pattern[end]); end++)
+			;
+
+		// A token at an end of the pattern may be part of a longer one
+		name = pattern + start;
+		count = end - start;
+		if (start > 0 && end < len && count >= LMC_INDEX_TOKEN_MIN) {
+			kind = LMC_INDEX_WHOLE;
+		} else if (start == 0 && end < len && count >= LMC_INDEX_AFFIX) {
+			kind = LMC_INDEX_SUFFIX;
+			name = pattern + end - LMC_INDEX_AFFIX;
+			count = LMC_INDEX_AFFIX;
+		} else if (start > 0 && end == len && count >= LMC_INDEX_AFFIX) {
+			kind = LMC_INDEX_PREFIX;
+			count = LMC_INDEX_AFFIX;
+		} else {
+			continue;
+		}
+
+		if (index->slot_count == 0)
+			return 0;
+		p = lmc_index_slot(index, name, count, kind, lmc_key_hash(name, count, kind));
+		if (p->hash == 0)
+			return 0;
+		keys[n++] = p;
+	}
+
+	// Reading most of the lines through the index is slower than in order
+	if (n == 0)
+		return -1;
+	qsort(keys, n, sizeof(*keys), lmc_cmp_postings);
+	if (2 * (uint64_t)keys[0]->count > index->next - index->first)
+		return -1;
+
+	/* intersect, shortest first; much longer lists are left to the search */
+	lines = malloc((keys[0]->count + 1) * sizeof(*lines));
+	if (lines == NULL || lmc_posting_decode(keys[0], lines) != 0)
+		goto err;
+	count = keys[0]->count;
+	for (i = 1; i < n && keys[i]->count <= LMC_INDEX_SKIP * count; i++) {
+		other = malloc((keys[i]->count + 1) * sizeof(*other));
+		if (other == NULL || lmc_posting_decode(keys[i], other) != 0)
+			goto err;
+
+		for (j = k = 0, end = 0; j < count; j++) {
+			while (end < keys[i]->count && other[end] < lines[j])
+				end++;
+			if (end < keys[i]->count && other[end] == lines[j])
+				lines[k++] = lines[j];
+		}
+		count = k;
+		free(other);
+		other = NULL;
+	}
+
+	hits->lines = lines;
+	hits->count = count;
+	return 0;
+err:
+	free(lines);
+	free(other);
+	return -1;
+}
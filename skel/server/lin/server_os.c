@@ -2,22 +2,436 @@
  * Hackathon SO: LogMemCacher
  * (c) 2020-2021, Operating Systems
  */
+#define _GNU_SOURCE
+#include "../../include/pool.h"
 #include "../../include/server.h"
+#include "../../include/segment.h"
 #include <arpa/inet.h>
+#include <dirent.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
-#include <wait.h>
+
+/* not exported by glibc, see ioprio_set(2) */
+#define LMC_IOPRIO_WHO_PROCESS 1
+#define LMC_IOPRIO_IDLE (3 << 13)
 
 char *lmc_logfile_path;
 
+/**
+ * Group commit state, shared by all the flushes on the server. A sync round
+ * makes durable everything written before the round started, so concurrent
+ * flushes wait for one round instead of issuing a sync each. Contains:
+ * @field lock: Protects the fields below;
+ * @field done: Signaled when a round completes;
+ * @field started: Number of sync rounds started;
+ * @field completed: Number of sync rounds completed;
+ * @field in_progress: A round is in progress;
+ * @field pending: Writes not covered by a started round;
+ * @field last_sync: Time when the last round started;
+ * @field fds: Log files written since the last round started, one
+ *             descriptor per file, for the next round to sync;
+ * @field fd_count: Number of descriptors in fds;
+ * @field max_fds: Number of descriptors fds has room for;
+ * @field dir_dirty: A log file was created since the last round started;
+ * @field round_fds: Log files of the round in progress;
+ * @field round_count: Number of descriptors in round_fds;
+ * @field round_next: Next file of the round nobody took to sync yet;
+ * @field round_left: Files of the round not synced yet;
+ * @field round_dir: The round also syncs the log directory;
+ * @field dir_fd: Log directory, synced when files were created or renamed.
+ */
+static struct lmc_sync_state {
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	uint64_t started;
+	uint64_t completed;
+	int in_progress;
+	uint64_t pending;
+	struct timespec last_sync;
+	int *fds;
+	size_t fd_count;
+	size_t max_fds;
+	int dir_dirty;
+	int *round_fds;
+	size_t round_count;
+	size_t round_next;
+	size_t round_left;
+	int round_dir;
+	int dir_fd;
+} lmc_sync = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+	.dir_fd = -1,
+};
+
+/**
+ * Files waiting to be deleted by lmc_delete_thread. Unlinking a large file
+ * can take a while, so it is kept out of the flush path. Contains:
+ * @field lock: Protects the list;
+ * @field wake: Signaled when a file is queued;
+ * @field head: Queued files, as a list linked through lmc_deletion.next.
+ */
+static struct lmc_delete_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	struct lmc_deletion {
+		struct lmc_deletion *next;
+		char *path;
+	} *head;
+} lmc_deletes = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+};
+
+/**
+ * Background thread that deletes the files queued by lmc_remove_file_os.
+ *
+ * @param arg: Unused.
+ *
+ * @return: Never returns.
+ */
+static void *lmc_delete_thread(void *arg)
+{
+	struct lmc_deletion *batch, *next;
+
+	while (1) {
+		pthread_mutex_lock(&lmc_deletes.lock);
+		while (lmc_deletes.head == NULL)
+			pthread_cond_wait(&lmc_deletes.wake, &lmc_deletes.lock);
+		batch = lmc_deletes.head;
+		lmc_deletes.head = NULL;
+		pthread_mutex_unlock(&lmc_deletes.lock);
+
+		for (; batch != NULL; batch = next) {
+			next = batch->next;
+			if (unlink(batch->path) != 0)
+				perror("unlink");
+			free(batch->path);
+			free(batch);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * OS-specific function that deletes a file in the background.
+ *
+ * @param path: Path of the file. The function takes ownership of it.
+ */
+void lmc_remove_file_os(char *path)
+{
+	struct lmc_deletion *deletion;
+
+	deletion = malloc(sizeof(*deletion));
+	if (deletion == NULL) {
+		unlink(path);
+		free(path);
+		return;
+	}
+	deletion->path = path;
+
+	pthread_mutex_lock(&lmc_deletes.lock);
+	deletion->next = lmc_deletes.head;
+	lmc_deletes.head = deletion;
+	pthread_cond_signal(&lmc_deletes.wake);
+	pthread_mutex_unlock(&lmc_deletes.lock);
+}
+
+/**
+ * OS-specific function that waits for a condition, at most a while. The
+ * mutex must be locked, it is locked again when the function returns.
+ *
+ * @param cond: Condition to wait for;
+ * @param mutex: Mutex protecting the condition;
+ * @param ms: Milliseconds to wait, at most.
+ *
+ * @return: 0 if the condition was signaled, or -1 otherwise.
+ */
+int lmc_cond_wait_os(lmc_cond_t *cond, lmc_mutex_t *mutex, unsigned int ms)
+{
+	struct timespec until;
+
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += ms / 1000;
+	until.tv_nsec += (long)(ms % 1000) * 1000000;
+	if (until.tv_nsec >= 1000000000) {
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000;
+	}
+
+	return pthread_cond_timedwait(cond, mutex, &until) == 0 ? 0 : -1;
+}
+
+/**
+ * OS-specific function that checks, without blocking, whether a socket has
+ * data to receive or was closed by the peer.
+ *
+ * @param sock: Socket to check.
+ *
+ * @return: 1 if a receive would not block, or 0 otherwise.
+ */
+int lmc_readable_os(SOCKET sock)
+{
+	struct pollfd pfd = { .fd = sock, .events = POLLIN };
+
+	return poll(&pfd, 1, 0) > 0;
+}
+
+/**
+ * Milliseconds elapsed since a moment in time.
+ *
+ * @param since: Moment in time, on the monotonic clock.
+ *
+ * @return: Elapsed milliseconds.
+ */
+static long lmc_elapsed_ms(const struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/**
+ * Queue the log file a cache was flushed to for the next sync round. Called
+ * with the cache locked and lmc_sync.lock held, after the data was written.
+ * The file is synced through its descriptor, so a rotation renaming it
+ * meanwhile does not matter.
+ *
+ * @param cache: Cache of the service;
+ * @param fd: Descriptor of the file, owned by the round from now on;
+ * @param created: The file was created by this flush.
+ */
+static void lmc_sync_add(struct lmc_cache *cache, int fd, int created)
+{
+	size_t max;
+	int *fds;
+
+	lmc_sync.pending++;
+	lmc_sync.dir_dirty |= created;
+
+	// Flushes of a service before the round share one fdatasync, unless
+	// rotation gave it a new file
+	if (!created && cache->queued_ticket == lmc_sync.started + 1) {
+		close(fd);
+		return;
+	}
+
+	if (lmc_sync.fd_count == lmc_sync.max_fds) {
+		max = lmc_sync.max_fds ? 2 * lmc_sync.max_fds : 64;
+		fds = realloc(lmc_sync.fds, max * sizeof(*fds));
+		if (fds == NULL) {
+			// No room to wait for the round, sync it now
+			if (fdatasync(fd) < 0)
+				perror("fdatasync");
+			close(fd);
+			return;
+		}
+		lmc_sync.fds = fds;
+		lmc_sync.max_fds = max;
+	}
+	lmc_sync.fds[lmc_sync.fd_count++] = fd;
+	cache->queued_ticket = lmc_sync.started + 1;
+}
+
+/**
+ * Complete the round in progress, once all its files are synced. Called
+ * with lmc_sync.lock held; returns with the lock held.
+ */
+static void lmc_sync_finish(void)
+{
+	if (lmc_sync.round_dir) {
+		pthread_mutex_unlock(&lmc_sync.lock);
+		if (fsync(lmc_sync.dir_fd) < 0)
+			perror("fsync log dir");
+		pthread_mutex_lock(&lmc_sync.lock);
+	}
+
+	free(lmc_sync.round_fds);
+	lmc_sync.round_fds = NULL;
+	lmc_sync.round_count = 0;
+	lmc_sync.round_next = 0;
+	lmc_sync.completed = lmc_sync.started;
+	lmc_sync.in_progress = 0;
+	pthread_cond_broadcast(&lmc_sync.done);
+}
+
+/**
+ * Sync files of the round in progress until none is left to take. Every
+ * flush waiting for the round helps, so the filesystem gets the fdatasync
+ * calls at once and can commit them together. Called with lmc_sync.lock
+ * held; returns with the lock held.
+ */
+static void lmc_sync_help(void)
+{
+	int fd;
+
+	while (lmc_sync.round_next < lmc_sync.round_count) {
+		fd = lmc_sync.round_fds[lmc_sync.round_next++];
+		pthread_mutex_unlock(&lmc_sync.lock);
+
+		if (fdatasync(fd) < 0)
+			perror("fdatasync");
+		close(fd);
+
+		pthread_mutex_lock(&lmc_sync.lock);
+		if (--lmc_sync.round_left == 0)
+			lmc_sync_finish();
+	}
+}
+
+/**
+ * Lead one sync round. Called with lmc_sync.lock held and no round in
+ * progress; returns with the lock held, maybe before the round completes.
+ * Waits for LMC_GROUP_COMMIT_WINDOW since the previous round, so the
+ * flushes arriving meanwhile join this one.
+ *
+ * The round syncs the log files queued before it started, one fdatasync
+ * per file however many flushes wrote to it, then the log directory if
+ * files were created, which also covers the renames done by rotation.
+ * Other files on the filesystem are left alone.
+ */
+static void lmc_sync_round(void)
+{
+	struct timespec window;
+	long elapsed;
+
+	lmc_sync.in_progress = 1;
+	elapsed = lmc_elapsed_ms(&lmc_sync.last_sync);
+	pthread_mutex_unlock(&lmc_sync.lock);
+
+	if (elapsed < LMC_GROUP_COMMIT_WINDOW) {
+		window.tv_sec = 0;
+		window.tv_nsec = (LMC_GROUP_COMMIT_WINDOW - elapsed) * 1000000;
+		nanosleep(&window, NULL);
+	}
+
+	pthread_mutex_lock(&lmc_sync.lock);
+	lmc_sync.started++;
+	lmc_sync.pending = 0;
+	lmc_sync.round_fds = lmc_sync.fds;
+	lmc_sync.round_count = lmc_sync.fd_count;
+	lmc_sync.round_left = lmc_sync.fd_count;
+	lmc_sync.round_dir = lmc_sync.dir_dirty;
+	lmc_sync.fds = NULL;
+	lmc_sync.fd_count = 0;
+	lmc_sync.max_fds = 0;
+	lmc_sync.dir_dirty = 0;
+	clock_gettime(CLOCK_MONOTONIC, &lmc_sync.last_sync);
+
+	if (lmc_sync.round_left == 0)
+		lmc_sync_finish();
+	else
+		lmc_sync_help();
+}
+
+/**
+ * Background thread for LMC_DURABILITY_PERIODIC: runs a sync round every
+ * LMC_SYNC_INTERVAL if anything was written since the last one.
+ *
+ * @param arg: Unused.
+ *
+ * @return: Never returns.
+ */
+static void *lmc_sync_thread(void *arg)
+{
+	struct timespec interval;
+
+	interval.tv_sec = LMC_SYNC_INTERVAL / 1000;
+	interval.tv_nsec = (LMC_SYNC_INTERVAL % 1000) * 1000000;
+
+	while (1) {
+		nanosleep(&interval, NULL);
+
+		pthread_mutex_lock(&lmc_sync.lock);
+		if (lmc_sync.pending != 0 && !lmc_sync.in_progress)
+			lmc_sync_round();
+		pthread_mutex_unlock(&lmc_sync.lock);
+	}
+
+	return NULL;
+}
+
+/**
+ * Background thread that compacts the small rotated log files of the
+ * services every LMC_COMPACT_INTERVAL. Its disk and CPU priority are lowered
+ * so it only uses resources the flushes leave unused.
+ *
+ * @param arg: Unused.
+ *
+ * @return: Never returns.
+ */
+static void *lmc_compact_thread(void *arg)
+{
+	if (syscall(SYS_ioprio_set, LMC_IOPRIO_WHO_PROCESS, 0, LMC_IOPRIO_IDLE) < 0)
+		perror("ioprio_set");
+	if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19) < 0)
+		perror("setpriority");
+
+	while (1) {
+		sleep(LMC_COMPACT_INTERVAL);
+		lmc_compact_caches();
+	}
+
+	return NULL;
+}
+
+/**
+ * OS-specific function that makes the logs written by a flush durable,
+ * according to the durability level of the cache.
+ *
+ * @param cache: Cache that was just flushed.
+ *
+ * @return: Number of log lines of the cache known to be on stable storage.
+ */
+uint64_t lmc_commit_os(struct lmc_cache *cache)
+{
+	uint64_t seq, ticket, durable;
+
+	lmc_mutex_lock(&cache->lock);
+	seq = cache->written_seq;
+	ticket = cache->written_ticket;
+	lmc_mutex_unlock(&cache->lock);
+
+	pthread_mutex_lock(&lmc_sync.lock);
+	if (cache->opts.durability == LMC_DURABILITY_FLUSH) {
+		while (lmc_sync.completed <= ticket) {
+			if (!lmc_sync.in_progress)
+				lmc_sync_round();
+			else if (lmc_sync.round_next < lmc_sync.round_count)
+				lmc_sync_help();
+			else
+				pthread_cond_wait(&lmc_sync.done, &lmc_sync.lock);
+		}
+	}
+	durable = lmc_sync.completed > ticket;
+	pthread_mutex_unlock(&lmc_sync.lock);
+
+	lmc_mutex_lock(&cache->lock);
+	if (durable && seq > cache->durable_seq)
+		cache->durable_seq = seq;
+	seq = cache->durable_seq;
+	lmc_mutex_unlock(&cache->lock);
+
+	return seq;
+}
+
 /**
  * Client connection loop function. Creates the appropriate client connection
  * socket and receives commands from the client in a loop.
@@ -29,14 +443,20 @@ char *lmc_logfile_path;
  * The lmc_get_command function executes blocking operations. The server
  * is unable to handle multiple connections simultaneously.
  *
- * Server deals with this problem by creating a process for every client
+ * Server deals with this problem by creating a thread for every client, so
+ * that all the connections of a service share the same cache.
  */
-static int lmc_client_function(SOCKET client_sock)
+static void *lmc_client_function(void *arg)
 {
 	int rc;
 	struct lmc_client *client;
+	SOCKET client_sock = (SOCKET)(intptr_t)arg;
 
 	client = lmc_create_client(client_sock);
+	if (client == NULL) {
+		close(client_sock);
+		return NULL;
+	}
 
 	// Endlessly get & resolve commands
 	while (1) {
@@ -47,9 +467,10 @@ static int lmc_client_function(SOCKET client_sock)
 
 	// Free resources
 	close(client_sock);
-	free(client);
+	lmc_destroy_client(client);
+	lmc_pool_drain();
 
-	return 0;
+	return NULL;
 }
 
 /**
@@ -60,7 +481,9 @@ void lmc_init_server_os(void)
 {
 	int sock, client_size, client_sock;
 	struct sockaddr_in server, client;
-	int opten;
+	pthread_attr_t attr;
+	pthread_t tid;
+	int opten, rc;
 
 	memset(&server, 0, sizeof(struct sockaddr_in));
 
@@ -80,11 +503,27 @@ void lmc_init_server_os(void)
 		exit(1);
 	}
 
-	if (listen(sock, LMC_DEFAULT_CLIENTS_NO) < 0) {
+	if (listen(sock, SOMAXCONN) < 0) {
 		perror("Error while listening");
 		exit(1);
 	}
 
+	lmc_sync.dir_fd = open(lmc_logfile_path, O_RDONLY | O_DIRECTORY);
+	DIE(lmc_sync.dir_fd < 0, "open log dir");
+	clock_gettime(CLOCK_MONOTONIC, &lmc_sync.last_sync);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	rc = pthread_create(&tid, &attr, lmc_sync_thread, NULL);
+	DIE(rc != 0, "pthread_create sync");
+
+	rc = pthread_create(&tid, &attr, lmc_delete_thread, NULL);
+	DIE(rc != 0, "pthread_create delete");
+
+	rc = pthread_create(&tid, &attr, lmc_compact_thread, NULL);
+	DIE(rc != 0, "pthread_create compact");
+
 	while (1) {
 		memset(&client, 0, sizeof(struct sockaddr_in));
 		client_size = sizeof(struct sockaddr_in);
@@ -92,28 +531,18 @@ void lmc_init_server_os(void)
 
 		if (client_sock < 0) {
 			perror("Error while accepting clients");
+			continue;
 		}
 
-		pid_t client_pid = fork();
+		// lmc_send writes the length and the data separately
+		setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, (char *)&opten, sizeof(opten));
 
-		switch (client_pid) {
-		case -1:
-			// Fork error
-			DIE(client_pid, "fork client_pid");
-			break;
-		case 0:
-			// Client process
-			lmc_client_function(client_sock);
-			goto end_of_function;
-			break;
-		default:
-			// Parent process should close the pipe
+		rc = pthread_create(&tid, &attr, lmc_client_function, (void *)(intptr_t)client_sock);
+		if (rc != 0) {
+			fprintf(stderr, "Could not create client thread\n");
 			close(client_sock);
-			break;
 		}
 	}
-end_of_function:
-	return;
 }
 
 /**
@@ -137,6 +566,9 @@ int lmc_init_client_cache(struct lmc_cache *cache)
 	// Pointer to log struct
 	((struct log_in_memory *)cache->ptr)->no_logs = 0;
 	((struct log_in_memory *)cache->ptr)->no_logs_stored_on_disk = 0;
+	((struct log_in_memory *)cache->ptr)->no_logs_evicted = 0;
+	((struct log_in_memory *)cache->ptr)->no_logs_overwritten = 0;
+	((struct log_in_memory *)cache->ptr)->no_logs_compressed = 0;
 	((struct log_in_memory *)cache->ptr)->list_of_logs = NULL;
 
 	// Pages
@@ -145,6 +577,92 @@ int lmc_init_client_cache(struct lmc_cache *cache)
 	return 0;
 }
 
+/**
+ * Pages of the first log line array of a cache, enough for the lines the
+ * service expects.
+ *
+ * @param cache: Cache of the service;
+ * @param page_size: Size of a page.
+ *
+ * @return: Number of pages, or 0 if the service gave no hint.
+ */
+static size_t lmc_expected_pages(struct lmc_cache *cache, int page_size)
+{
+	return (cache->opts.expected_lines * sizeof(struct lmc_client_logline) + page_size - 1) / page_size;
+}
+
+/**
+ * Map a log line array. With huge pages, the array is aligned to a huge
+ * page, so the kernel can back all of it with them. Falls back to
+ * transparent huge pages when the huge page pool is empty, and to regular
+ * pages when those are disabled.
+ *
+ * @param cache: Cache of the service;
+ * @param size: Size of the array, a multiple of LMC_HUGE_PAGE_SIZE when huge
+ *              pages are used.
+ *
+ * @return: Address of the array, or MAP_FAILED.
+ */
+static void *lmc_map_lines_os(struct lmc_cache *cache, size_t size)
+{
+	int flags = MAP_ANON | MAP_PRIVATE;
+	char *addr, *start;
+	size_t lead;
+
+	if (cache->opts.huge_pages == LMC_HUGE_HUGETLB) {
+		addr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+		if (addr != MAP_FAILED)
+			return addr;
+	}
+
+	flags |= MAP_NORESERVE;
+	if (cache->opts.huge_pages == LMC_HUGE_OFF)
+		return mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+	// Map one huge page more and trim it to an aligned start
+	addr = mmap(NULL, size + LMC_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (addr == MAP_FAILED)
+		return addr;
+	start = (char *)(((uintptr_t)addr + LMC_HUGE_PAGE_SIZE - 1) & ~((uintptr_t)LMC_HUGE_PAGE_SIZE - 1));
+	lead = start - addr;
+	if (lead != 0)
+		munmap(addr, lead);
+	munmap(start + size, LMC_HUGE_PAGE_SIZE - lead);
+
+	// Not an error if transparent huge pages are disabled
+	madvise(start, size, MADV_HUGEPAGE);
+	return start;
+}
+
+/**
+ * Grow a log line array. The pages are moved, not copied; with huge pages
+ * they are moved into a new aligned array, and copied only if the kernel
+ * cannot move them (huge page pool mappings on older kernels).
+ *
+ * @param cache: Cache of the service;
+ * @param size: New size of the array.
+ *
+ * @return: Address of the array, or MAP_FAILED.
+ */
+static void *lmc_grow_lines_os(struct lmc_cache *cache, size_t size)
+{
+	struct log_in_memory *lim = cache->ptr;
+	size_t old_size = cache->pages * getpagesize();
+	void *addr;
+
+	if (cache->opts.huge_pages == LMC_HUGE_OFF)
+		return mremap(lim->list_of_logs, old_size, size, MREMAP_MAYMOVE);
+
+	addr = lmc_map_lines_os(cache, size);
+	if (addr == MAP_FAILED)
+		return addr;
+	if (mremap(lim->list_of_logs, old_size, old_size, MREMAP_MAYMOVE | MREMAP_FIXED, addr) == MAP_FAILED) {
+		memcpy(addr, lim->list_of_logs, old_size);
+		munmap(lim->list_of_logs, old_size);
+	}
+	return addr;
+}
+
 /**
  * OS-specific function that handles adding a log line to the cache.
  *
@@ -160,37 +678,110 @@ int lmc_add_log_os(struct lmc_client *client, struct lmc_client_logline *log)
 {
 	int page_size = getpagesize();
 
-	struct log_in_memory *lim = client->cache->ptr;
-
-	// If no pages allocated, allocate the first
-	if (lim->no_logs == 0) {
-		lim->list_of_logs = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, -1, 0);
-		client->cache->pages = 1;
-	} else {
-		// If space is full, need to allocate one more page
-		if ((lim->no_logs + 1) * sizeof(struct lmc_client_logline) >= client->cache->pages * page_size) {
-			// Map address
-			void *new_addr = mmap(NULL, (client->cache->pages + 1) * page_size, PROT_READ | PROT_WRITE,
-					      MAP_ANON | MAP_SHARED, -1, 0);
-
-			// Copy logs to new address
-			memcpy(new_addr, lim->list_of_logs, lim->no_logs * sizeof(struct lmc_client_logline));
-
-			// Unmap previoous address
-			munmap(lim->list_of_logs, client->cache->pages * page_size);
-
-			// Point list of logs to new address
-			lim->list_of_logs = new_addr;
+	struct lmc_cache *cache = client->cache;
+	struct log_in_memory *lim = cache->ptr;
+	size_t count = lim->no_logs - lim->no_logs_compressed, pages;
+	void *addr;
+
+	// A ring is allocated once, with room for all its lines
+	if (cache->ring_lines != 0)
+		count = cache->ring_lines - 1;
+
+	// If space is full, grow by half, so adding lines stays linear
+	if ((count + 1) * sizeof(struct lmc_client_logline) > cache->pages * page_size) {
+		pages = cache->pages + cache->pages / 2;
+		if (pages < LMC_CACHE_MIN_PAGES)
+			pages = LMC_CACHE_MIN_PAGES;
+		// The first array holds all the lines the service said to expect
+		if (cache->pages == 0 && pages < lmc_expected_pages(cache, page_size))
+			pages = lmc_expected_pages(cache, page_size);
+		if (cache->ring_lines != 0)
+			pages = (cache->ring_lines * sizeof(struct lmc_client_logline) + page_size - 1) / page_size;
+		if (cache->opts.huge_pages != LMC_HUGE_OFF)
+			pages = (pages * page_size + LMC_HUGE_PAGE_SIZE - 1) / LMC_HUGE_PAGE_SIZE * LMC_HUGE_PAGE_SIZE /
+				page_size;
+
+		// Pages are moved, not copied; untouched pages take no memory
+		if (cache->pages == 0) {
+			addr = lmc_map_lines_os(cache, pages * page_size);
+			cache->populated = 0;
+		} else {
+			addr = lmc_grow_lines_os(cache, pages * page_size);
+		}
+		if (addr == MAP_FAILED) {
+			perror("cache grow error");
+			return -1;
 		}
+
+		lim->list_of_logs = addr;
+		cache->pages = pages;
+	}
+
+	// Fault the pages of a pre-sized cache in ahead of the lines, a batch at
+	// a time, instead of one page per fault. Older kernels just fault them.
+	if (cache->opts.expected_lines != 0 && cache->populated < cache->pages &&
+	    (count + 1) * sizeof(struct lmc_client_logline) > cache->populated * page_size) {
+		pages = cache->pages - cache->populated;
+		if (pages > LMC_PREFAULT_PAGES)
+			pages = LMC_PREFAULT_PAGES;
+#ifdef MADV_POPULATE_WRITE
+		madvise((char *)lim->list_of_logs + cache->populated * page_size, pages * page_size,
+			MADV_POPULATE_WRITE);
+#endif
+		cache->populated += pages;
 	}
 
 	// Enough space left for logging
-	memcpy(&(lim->list_of_logs[lim->no_logs]), log, sizeof(struct lmc_client_logline));
+	memcpy(lmc_get_logline(cache, lim->no_logs), log, sizeof(struct lmc_client_logline));
 	lim->no_logs++;
 
 	return 0;
 }
 
+/**
+ * OS-specific function that releases the memory of the log lines of a cache.
+ * All the lines must have been flushed.
+ *
+ * @param cache: Cache of the service.
+ */
+void lmc_evict_os(struct lmc_cache *cache)
+{
+	struct log_in_memory *lim = cache->ptr;
+
+	if (cache->pages != 0)
+		munmap(lim->list_of_logs, cache->pages * getpagesize());
+	lim->list_of_logs = NULL;
+	lim->no_logs_evicted = lim->no_logs;
+	lim->no_logs_compressed = lim->no_logs;
+	cache->pages = 0;
+	cache->populated = 0;
+}
+
+/**
+ * OS-specific function that releases the memory of the oldest lines of the
+ * log line array of a cache, once they were compressed. The lines fill
+ * whole huge pages, so the rest of the array stays aligned to them.
+ *
+ * @param cache: Cache of the service;
+ * @param count: Number of lines, a multiple of LMC_WARM_LINES.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_release_lines_os(struct lmc_cache *cache, size_t count)
+{
+	struct log_in_memory *lim = cache->ptr;
+	size_t pages = count * sizeof(struct lmc_client_logline) / getpagesize();
+
+	if (munmap(lim->list_of_logs, pages * getpagesize()) != 0)
+		return -1;
+	lim->list_of_logs += count;
+	lim->no_logs_compressed += count;
+	cache->pages -= pages;
+	cache->populated = cache->populated > pages ? cache->populated - pages : 0;
+
+	return 0;
+}
+
 /**
  * OS-specific function that handles flushing the cache to disk,
  *
@@ -203,28 +794,116 @@ int lmc_add_log_os(struct lmc_client *client, struct lmc_client_logline *log)
 int lmc_flush_os(struct lmc_client *client)
 {
 	struct log_in_memory *lim = client->cache->ptr;
+	struct lmc_segment_writer writer;
+	int i, fd = -1, created;
+
+	if (lim->no_logs_stored_on_disk == lim->no_logs)
+		return 0;
 
 	// Get logfile name
 	char buffer[512];
-	sprintf(buffer, "%s/%s.log", "logs_logmemcache", client->cache->service_name);
+	sprintf(buffer, "%s/%s.log", lmc_logfile_path, client->cache->service_name);
 
 	// Init log dir & file
-	lmc_init_logdir("logs_logmemcache");
-	lmc_rotate_logfile(buffer);
+	lmc_init_logdir(lmc_logfile_path);
 
-	// Open file to write in
-	int fd = open(buffer, O_WRONLY | O_CREAT, 0644);
-	DIE(fd < 0, "flush open error");
+	// Append compressed blocks, rotation is handled by lmc_rotate_cache
+	if (lmc_segment_open_active(&writer, buffer) != 0) {
+		perror("flush open error");
+		return -1;
+	}
+	writer.bloom = client->cache->opts.bloom;
+
+	created = client->cache->active_size == 0;
+	if (created)
+		client->cache->active_since = time(NULL);
+
+	// Lines a ring overwrote before they were flushed are lost
+	i = lim->no_logs_stored_on_disk;
+	if (i < lim->no_logs_overwritten)
+		i = lim->no_logs_overwritten;
+	for (; i < lim->no_logs; i++)
+		if (lmc_segment_append(&writer, lmc_get_logline(client->cache, i)) != 0)
+			break;
 
-	// Write to logfile
-	for (int i = lim->no_logs_stored_on_disk; i < lim->no_logs; i++) {
-		write(fd, &(lim->list_of_logs[i]), sizeof(lim->list_of_logs[i]));
+	// Durability is left to the group commit, which syncs the file by this
+	// descriptor; without one, the file is synced here
+	if (client->cache->opts.durability != LMC_DURABILITY_NONE)
+		fd = dup(fileno(writer.file));
+	if (lmc_segment_close_active(&writer, client->cache->opts.durability != LMC_DURABILITY_NONE && fd < 0) != 0 ||
+	    i != lim->no_logs) {
+		perror("flush write error");
+		if (fd >= 0)
+			close(fd);
+		client->cache->active_size = writer.offset;
+		return -1;
 	}
+	client->cache->active_size = writer.offset;
 
 	// Update disk storage stats
 	lim->no_logs_stored_on_disk = lim->no_logs;
-	close(fd);
 
+	// Remember which sync round can make these lines durable
+	pthread_mutex_lock(&lmc_sync.lock);
+	if (fd >= 0)
+		lmc_sync_add(client->cache, fd, created);
+	client->cache->written_ticket = lmc_sync.started;
+	pthread_mutex_unlock(&lmc_sync.lock);
+	client->cache->written_seq = lim->no_logs;
+
+	return 0;
+}
+
+/**
+ * OS-specific function that finds the log files a service left on disk, so
+ * rotation and retention continue where they stopped.
+ *
+ * @param cache: Cache of the service.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_scan_logfiles_os(struct lmc_cache *cache)
+{
+	char path[PATH_MAX], prefix[LMC_LOGFILE_NAME_LEN];
+	struct dirent *entry;
+	struct stat st;
+	size_t prefix_len, name_len;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), "%s/%s.log", lmc_logfile_path, cache->service_name);
+	if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+		cache->active_size = st.st_size;
+		cache->active_since = st.st_mtime;
+	}
+
+	dir = opendir(lmc_logfile_path);
+	if (dir == NULL)
+		return -1;
+
+	prefix_len = snprintf(prefix, sizeof(prefix), "%s.log.", cache->service_name);
+	while ((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name, prefix, prefix_len) != 0)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", lmc_logfile_path, entry->d_name);
+
+		// Left behind by a compaction that did not finish
+		name_len = strlen(entry->d_name);
+		if (name_len > strlen(LMC_COMPACT_SUFFIX) &&
+		    strcmp(entry->d_name + name_len - strlen(LMC_COMPACT_SUFFIX), LMC_COMPACT_SUFFIX) == 0) {
+			unlink(path);
+			continue;
+		}
+
+		if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		lmc_add_logfile(cache, strdup(path), st.st_size, st.st_mtime);
+	}
+	closedir(dir);
+
+	if (cache->logfile_count > 1)
+		qsort(cache->logfiles, cache->logfile_count, sizeof(*cache->logfiles), lmc_cmp_logfiles);
 	return 0;
 }
 
@@ -247,13 +926,13 @@ int lmc_unsubscribe_os(struct lmc_client *client)
 
 	// Free cache
 	struct log_in_memory *lim = client->cache->ptr;
-	munmap(lim->list_of_logs, client->cache->pages * page_size);
+	if (client->cache->pages != 0)
+		munmap(lim->list_of_logs, client->cache->pages * page_size);
 
 	// Free log structure
 	munmap(lim, sizeof(struct log_in_memory));
 
 	// Free client memory
-	free(client->cache->service_name);
-	free(client->cache);
+	lmc_pool_free(&lmc_name_pool, client->cache->service_name);
 	return 0;
 }
@@ -0,0 +1,211 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#include <string.h>
+
+#include "../include/lz.h"
+
+#define LMC_LZ_HASH_BITS 13
+#define LMC_LZ_HASH_SIZE (1 << LMC_LZ_HASH_BITS)
+
+static uint32_t lmc_lz_read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t lmc_lz_hash(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - LMC_LZ_HASH_BITS);
+}
+
+/**
+ * Write a length that did not fit in its token nibble.
+ */
+static uint8_t *lmc_lz_put_length(uint8_t *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+/**
+ * Worst case size of the compressed form of some data.
+ *
+ * @param len: Size of the data.
+ *
+ * @return: Size of the buffer the compressor needs.
+ */
+size_t lmc_lz_bound(size_t len)
+{
+	return len + len / 255 + 16;
+}
+
+/**
+ * Emit one sequence: literals followed by an optional match.
+ */
+static uint8_t *lmc_lz_put_sequence(uint8_t *op, const uint8_t *lit, size_t lit_len, size_t offset,
+				    size_t match_len)
+{
+	uint8_t *token = op++;
+	size_t ml = match_len ? match_len - LMC_LZ_MIN_MATCH : 0;
+
+	*token = (uint8_t)((lit_len < 15 ? lit_len : 15) << 4);
+	if (lit_len >= 15)
+		op = lmc_lz_put_length(op, lit_len - 15);
+	memcpy(op, lit, lit_len);
+	op += lit_len;
+
+	if (match_len == 0)
+		return op;
+
+	*op++ = (uint8_t)(offset & 0xff);
+	*op++ = (uint8_t)(offset >> 8);
+	*token |= (uint8_t)(ml < 15 ? ml : 15);
+	if (ml >= 15)
+		op = lmc_lz_put_length(op, ml - 15);
+
+	return op;
+}
+
+/**
+ * Compress a block of data.
+ *
+ * @param src: Data to compress;
+ * @param len: Size of the data;
+ * @param dst: Output buffer;
+ * @param cap: Size of the output buffer. Must be at least lmc_lz_bound(len).
+ *
+ * @return: Size of the compressed data, or 0 if it did not fit.
+ */
+size_t lmc_lz_compress(const void *src, size_t len, void *dst, size_t cap)
+{
+	uint32_t table[LMC_LZ_HASH_SIZE];
+	const uint8_t *base = src, *ip = base, *anchor = base;
+	const uint8_t *end = base + len, *match_limit;
+	uint8_t *op = dst;
+	size_t match_len, misses = 0;
+	uint32_t h, v;
+	const uint8_t *ref;
+
+	if (cap < lmc_lz_bound(len))
+		return 0;
+
+	memset(table, 0, sizeof(table));
+
+	match_limit = len > LMC_LZ_MIN_MATCH ? end - LMC_LZ_MIN_MATCH : base;
+	while (ip < match_limit) {
+		v = lmc_lz_read32(ip);
+		h = lmc_lz_hash(v);
+		ref = base + table[h];
+		table[h] = (uint32_t)(ip - base);
+
+		if (ref >= ip || ip - ref > LMC_LZ_MAX_OFFSET || lmc_lz_read32(ref) != v) {
+			/* skip faster through data that does not compress */
+			ip += 1 + (misses++ >> 5);
+			continue;
+		}
+		misses = 0;
+
+		match_len = LMC_LZ_MIN_MATCH;
+		while (ip + match_len < end && ref[match_len] == ip[match_len])
+			match_len++;
+
+		op = lmc_lz_put_sequence(op, anchor, ip - anchor, ip - ref, match_len);
+		ip += match_len;
+		anchor = ip;
+
+		/* the middle of the match is a good place for the next lookup */
+		if (ip - 2 >= base && ip < match_limit)
+			table[lmc_lz_hash(lmc_lz_read32(ip - 2))] = (uint32_t)(ip - 2 - base);
+	}
+
+	op = lmc_lz_put_sequence(op, anchor, end - anchor, 0, 0);
+
+	return op - (uint8_t *)dst;
+}
+
+/**
+ * Read a length extension. Fails if it runs past the end of the input.
+ */
+static int lmc_lz_get_length(const uint8_t **ip, const uint8_t *end, size_t *len)
+{
+	uint8_t b;
+
+	do {
+		if (*ip >= end)
+			return -1;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+
+	return 0;
+}
+
+/**
+ * Decompress a block of data. The input is fully validated, a corrupted
+ * block never makes the decoder read or write out of bounds.
+ *
+ * @param src: Compressed data;
+ * @param len: Size of the compressed data;
+ * @param dst: Output buffer;
+ * @param raw_len: Exact size of the decompressed data.
+ *
+ * @return: 0 in case of success, or -1 if the data is corrupted.
+ */
+int lmc_lz_decompress(const void *src, size_t len, void *dst, size_t raw_len)
+{
+	const uint8_t *ip = src, *end = ip + len, *ref;
+	uint8_t *op = dst, *oend = op + raw_len;
+	size_t lit_len, match_len, offset;
+	uint8_t token;
+
+	while (ip < end) {
+		token = *ip++;
+
+		lit_len = token >> 4;
+		if (lit_len == 15 && lmc_lz_get_length(&ip, end, &lit_len) != 0)
+			return -1;
+		if (lit_len > (size_t)(end - ip) || lit_len > (size_t)(oend - op))
+			return -1;
+		memcpy(op, ip, lit_len);
+		ip += lit_len;
+		op += lit_len;
+
+		/* the last sequence has no match */
+		if (ip == end)
+			break;
+
+		if (end - ip < 2)
+			return -1;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - (uint8_t *)dst))
+			return -1;
+
+		match_len = token & 15;
+		if (match_len == 15 && lmc_lz_get_length(&ip, end, &match_len) != 0)
+			return -1;
+		match_len += LMC_LZ_MIN_MATCH;
+		if (match_len > (size_t)(oend - op))
+			return -1;
+
+		ref = op - offset;
+		if (offset >= match_len) {
+			memcpy(op, ref, match_len);
+			op += match_len;
+		} else {
+			/* overlapping match, repeats the last offset bytes */
+			while (match_len--)
+				*op++ = *ref++;
+		}
+	}
+
+	return op == oend ? 0 : -1;
+}
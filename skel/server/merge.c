@@ -0,0 +1,250 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/merge.h"
+
+/**
+ * Time key of a line and its position in the run, to sort the run by time.
+ */
+struct lmc_merge_pos {
+	uint64_t key;
+	size_t pos;
+};
+
+/**
+ * Add a line to a run.
+ *
+ * @param run: Run;
+ * @param line: Line to copy to the run;
+ * @param copies: Number of times the line is merged.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_merge_run_add(struct lmc_merge_run *run, const struct lmc_client_logline *line, uint64_t copies)
+{
+	struct lmc_client_logline *lines;
+	uint64_t *keys, *counts;
+	size_t max;
+
+	if (run->count == run->max) {
+		max = run->max ? 2 * run->max : 256;
+		lines = realloc(run->lines, max * sizeof(*lines));
+		if (lines == NULL)
+			return -1;
+		run->lines = lines;
+		keys = realloc(run->keys, max * sizeof(*keys));
+		if (keys == NULL)
+			return -1;
+		run->keys = keys;
+		counts = realloc(run->copies, max * sizeof(*counts));
+		if (counts == NULL)
+			return -1;
+		run->copies = counts;
+		run->max = max;
+	}
+
+	memcpy(&run->lines[run->count], line, sizeof(*line));
+	run->copies[run->count] = copies;
+	run->keys[run->count++] = lmc_time_key(line->time);
+	return 0;
+}
+
+static int lmc_cmp_merge_pos(const void *a, const void *b)
+{
+	const struct lmc_merge_pos *x = a, *y = b;
+
+	if (x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+	return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+/**
+ * Order the lines of a run by time, if their keys decrease somewhere.
+ *
+ * @param run: Run.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_merge_run_sort(struct lmc_merge_run *run)
+{
+	struct lmc_merge_pos *pos;
+	size_t i;
+
+	for (i = 1; i < run->count; i++)
+		if (run->keys[i] < run->keys[i - 1])
+			break;
+	if (i >= run->count)
+		return 0;
+
+	pos = malloc(run->count * sizeof(*pos));
+	run->order = malloc(run->count * sizeof(*run->order));
+	if (pos == NULL || run->order == NULL) {
+		free(pos);
+		return -1;
+	}
+	for (i = 0; i < run->count; i++) {
+		pos[i].key = run->keys[i];
+		pos[i].pos = i;
+	}
+	qsort(pos, run->count, sizeof(*pos), lmc_cmp_merge_pos);
+	for (i = 0; i < run->count; i++)
+		run->order[i] = pos[i].pos;
+
+	free(pos);
+	return 0;
+}
+
+void lmc_merge_run_free(struct lmc_merge_run *run)
+{
+	free(run->lines);
+	free(run->keys);
+	free(run->copies);
+	free(run->order);
+	memset(run, 0, sizeof(*run));
+}
+
+/**
+ * Fill a run whose lines were all taken with the next lines of its service,
+ * keeping the memory it holds.
+ */
+static int lmc_merge_fill_run(struct lmc_merge *m, size_t i)
+{
+	struct lmc_merge_run *run = &m->runs[i];
+
+	free(run->order);
+	run->order = NULL;
+	run->count = 0;
+	run->next = 0;
+	if (m->fill(run, i, m->arg) != 0)
+		return -1;
+	return lmc_merge_run_sort(run);
+}
+
+/**
+ * Position in a run of its next line.
+ */
+static size_t lmc_merge_pos(const struct lmc_merge_run *run)
+{
+	return run->order != NULL ? run->order[run->next] : run->next;
+}
+
+/**
+ * Whether the next line of run a comes before the next line of run b.
+ */
+static int lmc_merge_before(const struct lmc_merge *m, size_t a, size_t b)
+{
+	uint64_t ka = m->runs[a].keys[lmc_merge_pos(&m->runs[a])];
+	uint64_t kb = m->runs[b].keys[lmc_merge_pos(&m->runs[b])];
+
+	return ka < kb || (ka == kb && a < b);
+}
+
+static void lmc_merge_sift_down(struct lmc_merge *m, size_t i)
+{
+	size_t child, tmp;
+
+	while ((child = 2 * i + 1) < m->count) {
+		if (child + 1 < m->count && lmc_merge_before(m, m->heap[child + 1], m->heap[child]))
+			child++;
+		if (!lmc_merge_before(m, m->heap[child], m->heap[i]))
+			break;
+		tmp = m->heap[i];
+		m->heap[i] = m->heap[child];
+		m->heap[child] = tmp;
+		i = child;
+	}
+}
+
+/**
+ * Start merging runs. The runs must stay alive until the merge is freed.
+ *
+ * @param m: Merge to initialize;
+ * @param runs: Runs to merge, sorted if fill is NULL, or else empty;
+ * @param count: Number of runs;
+ * @param fill: Called to fill every run, first here and again whenever the
+ *              merge has taken all its lines, or NULL if the runs hold all
+ *              their lines;
+ * @param arg: Passed to fill.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_merge_init(struct lmc_merge *m, struct lmc_merge_run *runs, size_t count, lmc_merge_fill_fn fill,
+		   void *arg)
+{
+	size_t i;
+
+	memset(m, 0, sizeof(*m));
+	m->runs = runs;
+	m->fill = fill;
+	m->arg = arg;
+	if (count == 0)
+		return 0;
+	m->heap = malloc(count * sizeof(*m->heap));
+	if (m->heap == NULL)
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		if (fill != NULL && lmc_merge_fill_run(m, i) != 0)
+			return -1;
+		if (runs[i].next < runs[i].count)
+			m->heap[m->count++] = i;
+	}
+	for (i = m->count / 2; i-- > 0;)
+		lmc_merge_sift_down(m, i);
+
+	return 0;
+}
+
+/**
+ * Take the oldest line left of the runs. A line with copies is taken that
+ * many times.
+ *
+ * @param m: Merge;
+ * @param line: Set to the line, valid until the next call;
+ * @param run: Set to the position of the run of the line.
+ *
+ * @return: 1 if a line was taken, 0 if all the lines were, or -1 if a run
+ *          could not be filled.
+ */
+int lmc_merge_next(struct lmc_merge *m, const struct lmc_client_logline **line, size_t *run)
+{
+	struct lmc_merge_run *r;
+	size_t pos;
+
+	// A run taken whole by the call before is left on top, to be filled
+	while (m->count != 0 && m->runs[m->heap[0]].next == m->runs[m->heap[0]].count) {
+		if (lmc_merge_fill_run(m, m->heap[0]) != 0)
+			return -1;
+		if (m->runs[m->heap[0]].count == 0)
+			m->heap[0] = m->heap[--m->count];
+		lmc_merge_sift_down(m, 0);
+	}
+	if (m->count == 0)
+		return 0;
+
+	*run = m->heap[0];
+	r = &m->runs[*run];
+	pos = lmc_merge_pos(r);
+	*line = &r->lines[pos];
+	if (r->copies[pos] > 1) {
+		r->copies[pos]--;
+		return 1;
+	}
+	if (++r->next < r->count || m->fill == NULL) {
+		if (r->next == r->count)
+			m->heap[0] = m->heap[--m->count];
+		lmc_merge_sift_down(m, 0);
+	}
+
+	return 1;
+}
+
+void lmc_merge_free(struct lmc_merge *m)
+{
+	free(m->heap);
+	memset(m, 0, sizeof(*m));
+}
@@ -0,0 +1,183 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../include/pool.h"
+
+/**
+ * Free objects of a pool held by a worker thread. Contains:
+ * @field head: Objects, linked through their first word;
+ * @field count: Number of objects;
+ * @field allocs: Objects handed out since the last report to the pool.
+ */
+struct lmc_pool_list {
+	void *head;
+	size_t count;
+	uint64_t allocs;
+};
+
+static struct lmc_pool *lmc_pools[LMC_POOL_MAX];
+static int lmc_pool_count;
+static LMC_THREAD_LOCAL struct lmc_pool_list lmc_pool_lists[LMC_POOL_MAX];
+
+/**
+ * Set up a pool. Called at startup, before the workers start.
+ *
+ * @param pool: Pool to set up;
+ * @param size: Size of its objects.
+ */
+void lmc_pool_init(struct lmc_pool *pool, size_t size)
+{
+	DIE(lmc_pool_count == LMC_POOL_MAX, "too many pools");
+
+	pool->size = (size + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+	pool->id = lmc_pool_count;
+	lmc_mutex_init(&pool->lock);
+	pool->free = NULL;
+	pool->slabs = 0;
+	pool->allocs = 0;
+
+	lmc_pools[lmc_pool_count++] = pool;
+}
+
+/**
+ * Move a batch of objects from a pool to the free list of the worker,
+ * carving a new slab if the pool has none left.
+ */
+static void lmc_pool_refill(struct lmc_pool *pool, struct lmc_pool_list *list)
+{
+	char *slab, *obj;
+	size_t i;
+
+	lmc_mutex_lock(&pool->lock);
+	pool->allocs += list->allocs;
+	list->allocs = 0;
+
+	if (pool->free == NULL) {
+		slab = malloc(LMC_SLAB_SIZE);
+		if (slab != NULL) {
+			pool->slabs++;
+			for (i = 0; i + pool->size <= LMC_SLAB_SIZE; i += pool->size) {
+				*(void **)(slab + i) = pool->free;
+				pool->free = slab + i;
+			}
+		}
+	}
+
+	for (i = 0; i < LMC_POOL_BATCH && pool->free != NULL; i++) {
+		obj = pool->free;
+		pool->free = *(void **)obj;
+		*(void **)obj = list->head;
+		list->head = obj;
+		list->count++;
+	}
+	lmc_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Give objects from the free list of the worker back to a pool.
+ */
+static void lmc_pool_release(struct lmc_pool *pool, struct lmc_pool_list *list, size_t count)
+{
+	void *obj;
+
+	lmc_mutex_lock(&pool->lock);
+	pool->allocs += list->allocs;
+	list->allocs = 0;
+
+	for (; count > 0 && list->head != NULL; count--) {
+		obj = list->head;
+		list->head = *(void **)obj;
+		list->count--;
+		*(void **)obj = pool->free;
+		pool->free = obj;
+	}
+	lmc_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Allocate an object from a pool. Does not call malloc, unless the pool
+ * needs a new slab.
+ *
+ * @param pool: Pool of the object.
+ *
+ * @return: The object, with undefined contents, or NULL if there is no
+ *          memory left.
+ */
+void *lmc_pool_alloc(struct lmc_pool *pool)
+{
+	struct lmc_pool_list *list = &lmc_pool_lists[pool->id];
+	void *obj;
+
+	if (list->head == NULL)
+		lmc_pool_refill(pool, list);
+
+	obj = list->head;
+	if (obj == NULL)
+		return NULL;
+	list->head = *(void **)obj;
+	list->count--;
+	list->allocs++;
+
+	return obj;
+}
+
+/**
+ * Free an object allocated from a pool, possibly by another worker.
+ *
+ * @param pool: Pool of the object;
+ * @param obj: The object, or NULL.
+ */
+void lmc_pool_free(struct lmc_pool *pool, void *obj)
+{
+	struct lmc_pool_list *list = &lmc_pool_lists[pool->id];
+
+	if (obj == NULL)
+		return;
+
+	*(void **)obj = list->head;
+	list->head = obj;
+	list->count++;
+
+	if (list->count >= 2 * LMC_POOL_BATCH)
+		lmc_pool_release(pool, list, LMC_POOL_BATCH);
+}
+
+/**
+ * Give all the objects held by the calling worker back to their pools.
+ * Called when a worker thread exits.
+ */
+void lmc_pool_drain(void)
+{
+	int i;
+
+	for (i = 0; i < lmc_pool_count; i++)
+		lmc_pool_release(lmc_pools[i], &lmc_pool_lists[i], lmc_pool_lists[i].count);
+}
+
+/**
+ * Allocation counters of all the pools. Workers report the objects they
+ * hand out when they exchange objects with a pool, so the counters can lag
+ * behind by up to a batch per worker.
+ *
+ * @param allocs: Objects handed out;
+ * @param slabs: Slabs allocated by the pools.
+ */
+void lmc_pool_stats(uint64_t *allocs, uint64_t *slabs)
+{
+	struct lmc_pool *pool;
+	int i;
+
+	*allocs = 0;
+	*slabs = 0;
+	for (i = 0; i < lmc_pool_count; i++) {
+		pool = lmc_pools[i];
+		lmc_mutex_lock(&pool->lock);
+		*allocs += pool->allocs + lmc_pool_lists[i].allocs;
+		*slabs += pool->slabs;
+		lmc_mutex_unlock(&pool->lock);
+	}
+}
@@ -0,0 +1,332 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#include <string.h>
+
+#include "../include/search.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define LMC_SEARCH_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#define LMC_TARGET_AVX2
+#define LMC_NOINLINE __declspec(noinline)
+#else
+#include <immintrin.h>
+#define LMC_TARGET_AVX2 __attribute__((target("avx2")))
+#define LMC_NOINLINE __attribute__((noinline))
+#endif
+#endif
+
+enum lmc_search_kernels {
+	LMC_SEARCH_SW,
+	LMC_SEARCH_SSE2, /* always there on x86-64 */
+	LMC_SEARCH_AVX2,
+};
+
+static volatile int lmc_search_ready;
+static int lmc_search_best;
+
+/**
+ * Pick the widest kernel the CPU runs.
+ */
+static void lmc_search_detect(void)
+{
+#if defined(LMC_SEARCH_X86) && defined(_MSC_VER)
+	int regs[4] = { 0 };
+#endif
+
+	if (lmc_search_ready)
+		return;
+
+	lmc_search_best = LMC_SEARCH_SW;
+#ifdef LMC_SEARCH_X86
+	lmc_search_best = LMC_SEARCH_SSE2;
+#ifdef _MSC_VER
+	__cpuid(regs, 1);
+	/* the OS saves the AVX registers */
+	if (((regs[2] >> 27) & 1) && (_xgetbv(0) & 6) == 6) {
+		__cpuidex(regs, 7, 0);
+		if ((regs[1] >> 5) & 1)
+			lmc_search_best = LMC_SEARCH_AVX2;
+	}
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		lmc_search_best = LMC_SEARCH_AVX2;
+#endif
+#endif
+
+	lmc_search_ready = 1;
+}
+
+/**
+ * Name of the kernel searches use.
+ *
+ * @return: "avx2", "sse2" or "memchr".
+ */
+const char *lmc_search_kernel(void)
+{
+	lmc_search_detect();
+
+	switch (lmc_search_best) {
+	case LMC_SEARCH_AVX2:
+		return "avx2";
+	case LMC_SEARCH_SSE2:
+		return "sse2";
+	default:
+		return "memchr";
+	}
+}
+
+/**
+ * Prepare a search.
+ *
+ * @param s: Search to initialize;
+ * @param pattern: Pattern to look for;
+ * @param len: Length of the pattern.
+ *
+ * @return: 0 in case of success, or -1 if the pattern is empty or longer
+ *          than a log line.
+ */
+int lmc_search_init(struct lmc_search *s, const char *pattern, size_t len)
+{
+	lmc_search_detect();
+
+	if (len == 0 || len >= sizeof(s->pattern))
+		return -1;
+
+	memcpy(s->pattern, pattern, len);
+	s->pattern[len] = '\0';
+	s->len = len;
+	return 0;
+}
+
+/**
+ * Find a pattern in a text, looking for its first byte with memchr.
+ *
+ * @param s: Search;
+ * @param text: Text to search;
+ * @param len: Length of the text.
+ *
+ * @return: The first occurrence of the pattern in the text, or NULL.
+ */
+const char *lmc_search_find_sw(const struct lmc_search *s, const char *text, size_t len)
+{
+	const char *p = text, *end = text + len;
+
+	while ((size_t)(end - p) >= s->len) {
+		p = memchr(p, s->pattern[0], end - p - s->len + 1);
+		if (p == NULL)
+			return NULL;
+		if (memcmp(p + 1, s->pattern + 1, s->len - 1) == 0)
+			return p;
+		p++;
+	}
+
+	return NULL;
+}
+
+#ifdef LMC_SEARCH_X86
+static int lmc_ctz(unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long bit;
+
+	_BitScanForward(&bit, mask);
+	return (int)bit;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+/**
+ * Check the candidates of a block: the positions where both the first and
+ * the last byte of the pattern match. Kept out of the vector loops, which
+ * only rarely find candidates, so they keep their registers.
+ *
+ * @param s: Search;
+ * @param block: Start of the block;
+ * @param mask: Candidates, bit i for block[i].
+ *
+ * @return: The first occurrence of the pattern in the block, or NULL.
+ */
+LMC_NOINLINE
+static const char *lmc_search_candidates(const struct lmc_search *s, const char *block, unsigned int mask)
+{
+	int bit;
+
+	while (mask != 0) {
+		bit = lmc_ctz(mask);
+		if (memcmp(block + bit + 1, s->pattern + 1, s->len - 2) == 0)
+			return block + bit;
+		mask &= mask - 1;
+	}
+
+	return NULL;
+}
+
+static const char *lmc_search_sse2(const struct lmc_search *s, const char *text, size_t len)
+{
+	const __m128i first = _mm_set1_epi8(s->pattern[0]);
+	const __m128i last = _mm_set1_epi8(s->pattern[s->len - 1]);
+	__m128i a, b;
+	const char *found;
+	unsigned int mask;
+	size_t i;
+
+	for (i = 0; i + s->len - 1 + 16 <= len; i += 16) {
+		a = _mm_loadu_si128((const __m128i *)(text + i));
+		b = _mm_loadu_si128((const __m128i *)(text + i + s->len - 1));
+		mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+		if (mask != 0) {
+			found = lmc_search_candidates(s, text + i, mask);
+			if (found != NULL)
+				return found;
+		}
+	}
+
+	return lmc_search_find_sw(s, text + i, len - i);
+}
+
+/**
+ * Search a NUL terminated text in a buffer of size bytes. The buffer is read
+ * past the NUL byte, so the length of the text is found along the way.
+ */
+static const char *lmc_search_str_sse2(const struct lmc_search *s, const char *text, size_t size)
+{
+	const __m128i first = _mm_set1_epi8(s->pattern[0]);
+	const __m128i last = _mm_set1_epi8(s->pattern[s->len - 1]);
+	const __m128i zero = _mm_setzero_si128();
+	unsigned int mask, nul;
+	const char *found;
+	__m128i a, b;
+	size_t i;
+
+	for (i = 0; i + s->len - 1 + 16 <= size; i += 16) {
+		a = _mm_loadu_si128((const __m128i *)(text + i));
+		b = _mm_loadu_si128((const __m128i *)(text + i + s->len - 1));
+		nul = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(a, zero));
+		mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+		/* candidates past the end of the text do not count */
+		if (nul != 0)
+			mask &= (nul & -nul) - 1;
+		if (mask != 0) {
+			found = lmc_search_candidates(s, text + i, mask);
+			if (found != NULL)
+				return found;
+		}
+		if (nul != 0)
+			return NULL;
+	}
+
+	return lmc_search_find_sw(s, text + i, strnlen(text + i, size - i));
+}
+
+LMC_TARGET_AVX2
+static const char *lmc_search_avx2(const struct lmc_search *s, const char *text, size_t len)
+{
+	const __m256i first = _mm256_set1_epi8(s->pattern[0]);
+	const __m256i last = _mm256_set1_epi8(s->pattern[s->len - 1]);
+	__m256i a, b;
+	const char *found;
+	unsigned int mask;
+	size_t i;
+
+	for (i = 0; i + s->len - 1 + 32 <= len; i += 32) {
+		a = _mm256_loadu_si256((const __m256i *)(text + i));
+		b = _mm256_loadu_si256((const __m256i *)(text + i + s->len - 1));
+		mask = (unsigned int)_mm256_movemask_epi8(
+			_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+		if (mask != 0) {
+			found = lmc_search_candidates(s, text + i, mask);
+			if (found != NULL)
+				return found;
+		}
+	}
+
+	/* the rest of a log line is often shorter than 32 bytes */
+	return lmc_search_sse2(s, text + i, len - i);
+}
+
+LMC_TARGET_AVX2
+static const char *lmc_search_str_avx2(const struct lmc_search *s, const char *text, size_t size)
+{
+	const __m256i first = _mm256_set1_epi8(s->pattern[0]);
+	const __m256i last = _mm256_set1_epi8(s->pattern[s->len - 1]);
+	const __m256i zero = _mm256_setzero_si256();
+	unsigned int mask, nul;
+	const char *found;
+	__m256i a, b;
+	size_t i;
+
+	for (i = 0; i + s->len - 1 + 32 <= size; i += 32) {
+		a = _mm256_loadu_si256((const __m256i *)(text + i));
+		b = _mm256_loadu_si256((const __m256i *)(text + i + s->len - 1));
+		nul = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, zero));
+		mask = (unsigned int)_mm256_movemask_epi8(
+			_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+		/* candidates past the end of the text do not count */
+		if (nul != 0)
+			mask &= (nul & -nul) - 1;
+		if (mask != 0) {
+			found = lmc_search_candidates(s, text + i, mask);
+			if (found != NULL)
+				return found;
+		}
+		if (nul != 0)
+			return NULL;
+	}
+
+	return lmc_search_str_sse2(s, text + i, size - i);
+}
+#endif
+
+/**
+ * Find a pattern in a text, with the widest kernel the CPU runs.
+ *
+ * @param s: Search, initialized with lmc_search_init;
+ * @param text: Text to search;
+ * @param len: Length of the text.
+ *
+ * @return: The first occurrence of the pattern in the text, or NULL.
+ */
+const char *lmc_search_find(const struct lmc_search *s, const char *text, size_t len)
+{
+	if (s->len == 1)
+		return memchr(text, s->pattern[0], len);
+
+#ifdef LMC_SEARCH_X86
+	if (lmc_search_best == LMC_SEARCH_AVX2)
+		return lmc_search_avx2(s, text, len);
+	if (lmc_search_best == LMC_SEARCH_SSE2)
+		return lmc_search_sse2(s, text, len);
+#endif
+	return lmc_search_find_sw(s, text, len);
+}
+
+/**
+ * Check whether a log line holds a pattern. The whole line buffer may be
+ * read, the length of the line is found while searching it.
+ *
+ * @param s: Search, initialized with lmc_search_init;
+ * @param line: Log line, in a buffer of LMC_LOGLINE_SIZE bytes, NUL
+ *              terminated within it.
+ *
+ * @return: 1 if it does, or 0 otherwise.
+ */
+int lmc_search_line(const struct lmc_search *s, const char *line)
+{
+	if (s->len == 1)
+		return memchr(line, s->pattern[0], strnlen(line, LMC_LOGLINE_SIZE)) != NULL;
+
+#ifdef LMC_SEARCH_X86
+	if (lmc_search_best == LMC_SEARCH_AVX2)
+		return lmc_search_str_avx2(s, line, LMC_LOGLINE_SIZE) != NULL;
+	if (lmc_search_best == LMC_SEARCH_SSE2)
+		return lmc_search_str_sse2(s, line, LMC_LOGLINE_SIZE) != NULL;
+#endif
+	return lmc_search_find_sw(s, line, strnlen(line, LMC_LOGLINE_SIZE)) != NULL;
+}
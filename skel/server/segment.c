@@ -0,0 +1,1323 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __unix__
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <io.h>
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#endif
+
+#include "../include/crc32c.h"
+#include "../include/lz.h"
+#include "../include/segment.h"
+
+/**
+ * Timestamp of a record, as a time value. Consecutive records usually share
+ * their timestamp, so the last conversion is remembered, along with whether
+ * formatting the time value gives back the same timestamp.
+ *
+ * @param w: Segment writer;
+ * @param time: Timestamp, in LMC_TIME_FORMAT format.
+ *
+ * @return: The time of the log line, or 0 if it cannot be parsed.
+ */
+static int64_t lmc_record_time(struct lmc_segment_writer *w, const char *time)
+{
+	char str[LMC_TIME_SIZE];
+	time_t t;
+
+	if (strncmp(w->last_str, time, LMC_TIME_SIZE) == 0)
+		return w->last_val;
+
+	w->last_exact = 0;
+	if (lmc_str_to_time(time, &t) != 0)
+		t = 0;
+	else if (lmc_time_to_str(str, sizeof(str), LMC_TIME_FORMAT, t) == 0)
+		w->last_exact = strncmp(str, time, LMC_TIME_SIZE) == 0;
+	strncpy(w->last_str, time, LMC_TIME_SIZE);
+	w->last_val = (int64_t)t;
+	return w->last_val;
+}
+
+/**
+ * Encode the time values of the records of a block: the first one as is,
+ * then one zigzag varint per record, of the difference between its delta to
+ * the record before and the previous delta.
+ *
+ * @param times: Time values;
+ * @param count: Number of time values;
+ * @param buf: Buffer receiving the encoding, of at least 8 + 10 * count bytes.
+ *
+ * @return: Number of bytes written.
+ */
+size_t lmc_times_encode(const int64_t *times, uint32_t count, char *buf)
+{
+	uint64_t delta, prev_delta = 0, v;
+	unsigned char *out = (unsigned char *)buf;
+	uint32_t i;
+
+	if (count == 0)
+		return 0;
+
+	memcpy(out, &times[0], sizeof(times[0]));
+	out += sizeof(times[0]);
+	for (i = 1; i < count; i++) {
+		delta = (uint64_t)times[i] - (uint64_t)times[i - 1];
+		v = delta - prev_delta;
+		prev_delta = delta;
+
+		/* zigzag: small negative values get small codes too */
+		v = (v << 1) ^ (uint64_t)((int64_t)v >> 63);
+		while (v >= 0x80) {
+			*out++ = (unsigned char)(v | 0x80);
+			v >>= 7;
+		}
+		*out++ = (unsigned char)v;
+	}
+
+	return (char *)out - buf;
+}
+
+/**
+ * Decode the time values written by lmc_times_encode. While the varints
+ * take one byte each, which is the common case, they are checked and
+ * decoded eight at a time; eight zero bytes, lines logged at a steady rate,
+ * are decoded without a dependency between the values.
+ *
+ * @param data: Encoded time values;
+ * @param len: Number of bytes available in data;
+ * @param count: Number of time values to decode;
+ * @param times: Buffer receiving the time values.
+ *
+ * @return: Number of bytes read, or -1 if data is not a valid encoding.
+ */
+long lmc_times_decode(const char *data, size_t len, uint32_t count, int64_t *times)
+{
+	const unsigned char *in = (const unsigned char *)data, *end = in + len;
+	uint64_t word, v, delta = 0, t;
+	uint32_t i, k;
+	int shift;
+
+	if (count == 0)
+		return 0;
+	if (len < sizeof(times[0]))
+		return -1;
+
+	memcpy(&times[0], in, sizeof(times[0]));
+	in += sizeof(times[0]);
+	t = (uint64_t)times[0];
+
+	for (i = 1; i < count;) {
+		if (count - i >= 8 && end - in >= 8) {
+			memcpy(&word, in, sizeof(word));
+			if (word == 0) {
+				/* same delta: the values do not depend on each other */
+				for (k = 0; k < 8; k++)
+					times[i + k] = (int64_t)(t + (k + 1) * delta);
+				t += 8 * delta;
+				in += 8;
+				i += 8;
+				continue;
+			}
+			if ((word & 0x8080808080808080ULL) == 0) {
+				for (k = 0; k < 8; k++) {
+					delta += (uint64_t)((int64_t)(in[k] >> 1) ^ -(int64_t)(in[k] & 1));
+					t += delta;
+					times[i + k] = (int64_t)t;
+				}
+				in += 8;
+				i += 8;
+				continue;
+			}
+		}
+
+		v = 0;
+		for (shift = 0;; shift += 7) {
+			if (in == end || shift > 63)
+				return -1;
+			v |= (uint64_t)(*in & 0x7f) << shift;
+			if ((*in++ & 0x80) == 0)
+				break;
+		}
+		delta += (uint64_t)((int64_t)(v >> 1) ^ -(int64_t)(v & 1));
+		t += delta;
+		times[i++] = (int64_t)t;
+	}
+
+	return (const char *)in - data;
+}
+
+/**
+ * Rebuild the block of a writer with the timestamps stored as deltas, in
+ * w->timed.
+ *
+ * @param w: Segment writer, whose block timestamps are all exact.
+ *
+ * @return: Size of the block rebuilt.
+ */
+static uint32_t lmc_segment_time_block(struct lmc_segment_writer *w)
+{
+	size_t len, line_len, pos = 0;
+	uint32_t i;
+
+	len = lmc_times_encode(w->times, w->block_records, w->timed);
+	for (i = 0; i < w->block_records; i++) {
+		/* the timestamp, then the line */
+		pos += strlen(w->block + pos) + 1;
+		line_len = strlen(w->block + pos) + 1;
+		memcpy(w->timed + len, w->block + pos, line_len);
+		len += line_len;
+		pos += line_len;
+	}
+
+	return (uint32_t)len;
+}
+
+/**
+ * Checksum of a block, stored in its header.
+ *
+ * @param header: Header of the block;
+ * @param data: Data following the header.
+ *
+ * @return: CRC-32C of the header, with the crc field set to 0, and the data.
+ */
+static uint32_t lmc_block_crc(const struct lmc_block_header *header, const void *data)
+{
+	struct lmc_block_header copy = *header;
+
+	copy.crc = 0;
+	return lmc_crc32c(lmc_crc32c(0, &copy, sizeof(copy)), data, header->stored_len);
+}
+
+/**
+ * Write a block and add it to the block index of the writer.
+ *
+ * @param w: Segment writer;
+ * @param header: Header of the block, complete;
+ * @param data: Data following the header.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_segment_put_block(struct lmc_segment_writer *w, const struct lmc_block_header *header,
+				 const void *data)
+{
+	struct lmc_block_index *entry, *index;
+	uint32_t max;
+
+	if (w->blocks == w->max_blocks) {
+		max = w->max_blocks ? 2 * w->max_blocks : 64;
+		index = realloc(w->index, max * sizeof(*index));
+		if (index == NULL)
+			return -1;
+		w->index = index;
+		w->max_blocks = max;
+	}
+
+	if (fwrite(header, sizeof(*header), 1, w->file) != 1)
+		return -1;
+	if (header->stored_len != 0 && fwrite(data, header->stored_len, 1, w->file) != 1)
+		return -1;
+
+	entry = &w->index[w->blocks++];
+	entry->offset = w->offset;
+	entry->records = header->records;
+	entry->stored_len = header->stored_len;
+	entry->first_time = header->first_time;
+	entry->last_time = header->last_time;
+
+	w->offset += sizeof(*header) + header->stored_len;
+	return 0;
+}
+
+/**
+ * Write the filter block of the records buffered in the writer, which goes
+ * right before their block. Their grams are dropped either way.
+ *
+ * @param w: Segment writer.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_segment_write_filter(struct lmc_segment_writer *w)
+{
+	struct lmc_block_header header;
+	size_t len = lmc_bloom_size(&w->grams);
+
+	if (!w->bloom || len > LMC_BLOOM_MAX) {
+		lmc_bloom_reset(&w->grams);
+		return 0;
+	}
+	lmc_bloom_build(&w->grams, (uint8_t *)w->stored, len);
+
+	memset(&header, 0, sizeof(header));
+	header.magic = LMC_BLOCK_MAGIC;
+	header.codec = LMC_CODEC_BLOOM;
+	header.flags = LMC_BLOCK_CRC;
+	header.raw_len = (uint32_t)len;
+	header.stored_len = (uint32_t)len;
+	header.first_time = w->first_time;
+	header.last_time = w->last_time;
+	header.crc = lmc_block_crc(&header, w->stored);
+
+	return lmc_segment_put_block(w, &header, w->stored);
+}
+
+/**
+ * Write the records buffered in the writer as one block, compressed unless
+ * compression does not make it smaller, after their filter block.
+ *
+ * @param w: Segment writer.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_segment_write_block(struct lmc_segment_writer *w)
+{
+	struct lmc_block_header header;
+	const char *data, *raw = w->block;
+	size_t stored_len;
+
+	if (w->block_records == 0)
+		return 0;
+	if (lmc_segment_write_filter(w) != 0)
+		return -1;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = LMC_BLOCK_MAGIC;
+	header.records = w->block_records;
+	header.raw_len = w->block_len;
+	header.first_time = w->first_time;
+	header.last_time = w->last_time;
+	header.flags = LMC_BLOCK_CRC;
+	if (w->times_exact) {
+		header.raw_len = lmc_segment_time_block(w);
+		header.flags |= LMC_BLOCK_TIMES;
+		raw = w->timed;
+	}
+
+	stored_len = lmc_lz_compress(raw, header.raw_len, w->stored, lmc_lz_bound(LMC_BLOCK_SIZE));
+	if (stored_len != 0 && stored_len < header.raw_len) {
+		header.codec = LMC_CODEC_LZ;
+		header.stored_len = (uint32_t)stored_len;
+		data = w->stored;
+	} else {
+		header.codec = LMC_CODEC_PACKED;
+		header.stored_len = header.raw_len;
+		data = raw;
+	}
+	header.crc = lmc_block_crc(&header, data);
+
+	if (lmc_segment_put_block(w, &header, data) != 0)
+		return -1;
+	w->block_records = 0;
+	w->block_len = 0;
+
+	return 0;
+}
+
+/**
+ * Allocate the buffers of a segment writer.
+ */
+static int lmc_segment_init_writer(struct lmc_segment_writer *w)
+{
+	memset(w, 0, sizeof(*w));
+
+	w->block = malloc(LMC_BLOCK_SIZE);
+	w->timed = malloc(LMC_BLOCK_SIZE);
+	w->times = malloc(LMC_BLOCK_TIMES_MAX * sizeof(*w->times));
+	w->stored = malloc(lmc_lz_bound(LMC_BLOCK_SIZE));
+	if (w->block == NULL || w->timed == NULL || w->times == NULL || w->stored == NULL ||
+	    lmc_bloom_init(&w->grams) != 0) {
+		free(w->block);
+		free(w->timed);
+		free(w->times);
+		free(w->stored);
+		return -1;
+	}
+	w->bloom = 1;
+
+	return 0;
+}
+
+static void lmc_segment_free_writer(struct lmc_segment_writer *w)
+{
+	free(w->block);
+	free(w->timed);
+	free(w->times);
+	free(w->stored);
+	free(w->index);
+	lmc_bloom_free(&w->grams);
+	memset(w, 0, sizeof(*w));
+}
+
+/**
+ * Write the segment header at the start of an empty file.
+ */
+static int lmc_segment_write_header(struct lmc_segment_writer *w)
+{
+	struct lmc_segment_header header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, LMC_SEGMENT_MAGIC, sizeof(header.magic));
+	header.version = LMC_SEGMENT_VERSION;
+	if (fwrite(&header, sizeof(header), 1, w->file) != 1)
+		return -1;
+	w->offset = sizeof(header);
+
+	return 0;
+}
+
+/**
+ * Start writing a new segment file.
+ *
+ * @param w: Segment writer to initialize;
+ * @param path: Path of the file. An existing file is truncated.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_segment_create(struct lmc_segment_writer *w, const char *path)
+{
+	if (lmc_segment_init_writer(w) != 0)
+		return -1;
+
+	w->file = fopen(path, "wb");
+	if (w->file == NULL) {
+		lmc_segment_free_writer(w);
+		return -1;
+	}
+
+	if (lmc_segment_write_header(w) != 0) {
+		lmc_segment_abort(w);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Append a record to the segment being written.
+ *
+ * @param w: Segment writer;
+ * @param line: Log line to append.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_segment_append(struct lmc_segment_writer *w, const struct lmc_client_logline *line)
+{
+	size_t time_len, line_len;
+	int64_t t;
+
+	time_len = strnlen(line->time, LMC_TIME_SIZE - 1);
+	line_len = strnlen(line->logline, LMC_LOGLINE_SIZE - 1);
+	if (w->block_len + time_len + line_len + 2 > LMC_BLOCK_SIZE && lmc_segment_write_block(w) != 0)
+		return -1;
+
+	t = lmc_record_time(w, line->time);
+	if (w->block_records == 0 || t < w->first_time)
+		w->first_time = t;
+	if (w->block_records == 0 || t > w->last_time)
+		w->last_time = t;
+
+	if (w->block_records == 0)
+		w->times_exact = 1;
+	if (w->last_exact && w->block_records < LMC_BLOCK_TIMES_MAX)
+		w->times[w->block_records] = t;
+	else
+		w->times_exact = 0;
+
+	memcpy(w->block + w->block_len, line->time, time_len);
+	w->block_len += time_len;
+	w->block[w->block_len++] = '\0';
+	memcpy(w->block + w->block_len, line->logline, line_len);
+	w->block_len += line_len;
+	w->block[w->block_len++] = '\0';
+
+	// Without all its grams, the filter would rule out lines of the block
+	if (w->bloom && lmc_bloom_add(&w->grams, line->logline, line_len) != 0) {
+		lmc_bloom_reset(&w->grams);
+		w->bloom = 0;
+	}
+
+	w->block_records++;
+	w->records++;
+
+	return 0;
+}
+
+/**
+ * Write the block index and the footer of a segment, which seals it. The
+ * file position must be at the end of the last block.
+ */
+static int lmc_segment_write_footer(FILE *file, struct lmc_block_index *index, uint32_t blocks,
+				    uint64_t index_offset, uint64_t records)
+{
+	struct lmc_segment_footer footer;
+
+	memset(&footer, 0, sizeof(footer));
+	footer.index_offset = index_offset;
+	footer.records = records;
+	footer.blocks = blocks;
+	footer.version = LMC_SEGMENT_VERSION;
+	memcpy(footer.magic, LMC_SEGMENT_MAGIC, sizeof(footer.magic));
+
+	if (blocks != 0 && fwrite(index, sizeof(*index), blocks, file) != blocks)
+		return -1;
+	if (fwrite(&footer, sizeof(footer), 1, file) != 1)
+		return -1;
+	return 0;
+}
+
+/**
+ * Make sure the data written to a file reached stable storage.
+ */
+static int lmc_segment_sync(FILE *file)
+{
+	if (fflush(file) != 0)
+		return -1;
+#ifdef __unix__
+	if (fsync(fileno(file)) != 0)
+		return -1;
+#elif defined(_WIN32)
+	if (_commit(_fileno(file)) != 0)
+		return -1;
+#endif
+	return 0;
+}
+
+/**
+ * Seal the segment being written: write the last block, the block index and
+ * the footer, then make sure the file reached stable storage.
+ *
+ * @param w: Segment writer. Its resources are released.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_segment_finish(struct lmc_segment_writer *w)
+{
+	int err = -1;
+
+	if (lmc_segment_write_block(w) != 0)
+		goto out;
+	if (lmc_segment_write_footer(w->file, w->index, w->blocks, w->offset, w->records) != 0)
+		goto out;
+	if (lmc_segment_sync(w->file) != 0)
+		goto out;
+	err = 0;
+out:
+	if (fclose(w->file) != 0)
+		err = -1;
+	lmc_segment_free_writer(w);
+	return err;
+}
+
+/**
+ * Stop writing a segment and release the writer. The caller removes the
+ * partially written file.
+ *
+ * @param w: Segment writer.
+ */
+void lmc_segment_abort(struct lmc_segment_writer *w)
+{
+	fclose(w->file);
+	lmc_segment_free_writer(w);
+}
+
+/**
+ * Open the active log file of a service to append blocks to it. The segment
+ * header is written if the file is new.
+ *
+ * @param w: Segment writer to initialize;
+ * @param path: Path of the file.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_segment_open_active(struct lmc_segment_writer *w, const char *path)
+{
+	if (lmc_segment_init_writer(w) != 0)
+		return -1;
+
+	w->file = fopen(path, "ab");
+	if (w->file == NULL) {
+		lmc_segment_free_writer(w);
+		return -1;
+	}
+
+	if (fseeko(w->file, 0, SEEK_END) != 0)
+		goto err;
+	w->offset = ftello(w->file);
+	if (w->offset == 0 && lmc_segment_write_header(w) != 0)
+		goto err;
+
+	return 0;
+err:
+	lmc_segment_abort(w);
+	return -1;
+}
+
+/**
+ * Write the records appended to the active log file as a block and close it,
+ * without sealing it: later flushes append more blocks.
+ *
+ * @param w: Segment writer. Its resources are released, w->offset is kept
+ *           and holds the new size of the file;
+ * @param sync: Also make sure the file reached stable storage.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_segment_close_active(struct lmc_segment_writer *w, int sync)
+{
+	uint64_t offset;
+	int err = -1;
+
+	if (lmc_segment_write_block(w) != 0)
+		goto out;
+	if (fflush(w->file) != 0)
+		goto out;
+	if (sync && lmc_segment_sync(w->file) != 0)
+		goto out;
+	err = 0;
+out:
+	if (fclose(w->file) != 0)
+		err = -1;
+	offset = w->offset;
+	lmc_segment_free_writer(w);
+	w->offset = offset;
+	return err;
+}
+
+/**
+ * Check that a block header describes a block this version can decode.
+ */
+static int lmc_block_valid(const struct lmc_block_header *header)
+{
+	if (header->magic != LMC_BLOCK_MAGIC)
+		return 0;
+	if ((header->flags & LMC_BLOCK_TIMES) &&
+	    (header->codec == LMC_CODEC_RAW || header->records > LMC_BLOCK_TIMES_MAX))
+		return 0;
+
+	switch (header->codec) {
+	case LMC_CODEC_RAW:
+		return header->records <= LMC_BLOCK_RECORDS &&
+		       header->stored_len == header->records * sizeof(struct lmc_client_logline);
+	case LMC_CODEC_PACKED:
+		return header->raw_len <= LMC_BLOCK_SIZE && header->stored_len == header->raw_len;
+	case LMC_CODEC_LZ:
+		return header->raw_len <= LMC_BLOCK_SIZE && header->stored_len <= lmc_lz_bound(LMC_BLOCK_SIZE);
+	case LMC_CODEC_BLOOM:
+		return header->records == 0 && header->raw_len <= LMC_BLOOM_MAX && header->stored_len == header->raw_len;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Rebuild the block index of a segment that has no footer, by walking the
+ * block headers. Stops at the first block that is not complete or whose
+ * checksum does not match.
+ *
+ * @param r: Segment reader.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_segment_scan(struct lmc_segment_reader *r)
+{
+	struct lmc_block_header header;
+	struct lmc_block_index *index;
+	uint64_t offset, size;
+	uint32_t max = 0;
+
+	if (fseeko(r->file, 0, SEEK_END) != 0)
+		return -1;
+	size = ftello(r->file);
+
+	offset = sizeof(struct lmc_segment_header);
+	if (fseeko(r->file, offset, SEEK_SET) != 0)
+		return -1;
+	while (offset + sizeof(header) <= size) {
+		if (fread(&header, sizeof(header), 1, r->file) != 1)
+			break;
+		if (!lmc_block_valid(&header))
+			break;
+		if (offset + sizeof(header) + header.stored_len > size)
+			break;
+		if (header.flags & LMC_BLOCK_CRC) {
+			if (header.stored_len != 0 && fread(r->stored, header.stored_len, 1, r->file) != 1)
+				break;
+			if (lmc_block_crc(&header, r->stored) != header.crc)
+				break;
+		} else if (fseeko(r->file, header.stored_len, SEEK_CUR) != 0) {
+			return -1;
+		}
+
+		if (r->blocks == max) {
+			max = max ? 2 * max : 64;
+			index = realloc(r->index, max * sizeof(*index));
+			if (index == NULL)
+				return -1;
+			r->index = index;
+		}
+
+		r->index[r->blocks].offset = offset;
+		r->index[r->blocks].records = header.records;
+		r->index[r->blocks].stored_len = header.stored_len;
+		r->index[r->blocks].first_time = header.first_time;
+		r->index[r->blocks].last_time = header.last_time;
+		r->blocks++;
+
+		offset += sizeof(header) + header.stored_len;
+	}
+
+	return 0;
+}
+
+/**
+ * Open a segment file for reading. Both sealed segments, segments still being
+ * appended to and plain record arrays are supported.
+ *
+ * @param r: Segment reader to initialize;
+ * @param path: Path of the file.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_segment_open(struct lmc_segment_reader *r, const char *path)
+{
+	struct lmc_segment_header header;
+	struct lmc_segment_footer footer;
+
+	memset(r, 0, sizeof(*r));
+	r->from = INT64_MIN;
+	r->to = INT64_MAX;
+
+	r->file = fopen(path, "rb");
+	if (r->file == NULL)
+		return -1;
+
+	r->block = malloc(LMC_BLOCK_RECORDS * sizeof(*r->block));
+	r->data = malloc(LMC_BLOCK_SIZE);
+	r->stored = malloc(lmc_lz_bound(LMC_BLOCK_SIZE));
+	r->times = malloc(LMC_BLOCK_TIMES_MAX * sizeof(*r->times));
+	if (r->block == NULL || r->data == NULL || r->stored == NULL || r->times == NULL)
+		goto err;
+
+	if (fread(&header, sizeof(header), 1, r->file) != 1 ||
+	    memcmp(header.magic, LMC_SEGMENT_MAGIC, sizeof(header.magic)) != 0) {
+		r->legacy = 1;
+		r->codec = LMC_CODEC_RAW;
+		rewind(r->file);
+		return 0;
+	}
+	if (header.version > LMC_SEGMENT_VERSION)
+		goto err;
+
+	if (fseeko(r->file, -(long)sizeof(footer), SEEK_END) == 0 &&
+	    fread(&footer, sizeof(footer), 1, r->file) == 1 &&
+	    memcmp(footer.magic, LMC_SEGMENT_MAGIC, sizeof(footer.magic)) == 0) {
+		r->sealed = 1;
+		r->blocks = footer.blocks;
+		r->index = malloc(footer.blocks * sizeof(*r->index) + 1);
+		if (r->index == NULL)
+			goto err;
+		if (fseeko(r->file, footer.index_offset, SEEK_SET) != 0)
+			goto err;
+		if (footer.blocks != 0 &&
+		    fread(r->index, sizeof(*r->index), footer.blocks, r->file) != footer.blocks)
+			goto err;
+		return 0;
+	}
+
+	if (lmc_segment_scan(r) != 0)
+		goto err;
+	return 0;
+
+err:
+	lmc_segment_close(r);
+	return -1;
+}
+
+/**
+ * Restrict the reader to the blocks that may hold records of a time range.
+ * Only the block index is looked at, so the other blocks are never read nor
+ * decompressed. In blocks with LMC_BLOCK_TIMES, records out of the range are
+ * skipped too, by their decoded time values; records of the other blocks
+ * must still be filtered by the caller.
+ *
+ * @param r: Segment reader;
+ * @param from: Oldest time of interest;
+ * @param to: Newest time of interest.
+ */
+void lmc_segment_range(struct lmc_segment_reader *r, time_t from, time_t to)
+{
+	r->from = (int64_t)from;
+	r->to = (int64_t)to;
+}
+
+/**
+ * Skip the blocks whose filter rules out the grams of a pattern. Blocks
+ * without a filter are read. Records skipped are counted in
+ * r->skipped_records.
+ *
+ * @param r: Segment reader;
+ * @param probe: Grams of the pattern, or NULL to read all the blocks. Must
+ *               stay valid while the reader is used.
+ */
+void lmc_segment_filter(struct lmc_segment_reader *r, const struct lmc_bloom_probe *probe)
+{
+	r->probe = probe;
+}
+
+/**
+ * Read a filter block and test it for the grams the reader looks for.
+ *
+ * @param r: Segment reader;
+ * @param entry: Index entry of the filter block.
+ *
+ * @return: 0 if the block after it holds none of the lines wanted, or 1 if
+ *          it must be read, also when the filter cannot be read.
+ */
+static int lmc_segment_test_filter(struct lmc_segment_reader *r, const struct lmc_block_index *entry)
+{
+	struct lmc_block_header header;
+
+	r->probed++;
+	if (fseeko(r->file, entry->offset, SEEK_SET) != 0)
+		return 1;
+	if (fread(&header, sizeof(header), 1, r->file) != 1)
+		return 1;
+	if (!lmc_block_valid(&header) || header.codec != LMC_CODEC_BLOOM)
+		return 1;
+	if (header.stored_len == 0 || fread(r->stored, header.stored_len, 1, r->file) != 1)
+		return 1;
+	if ((header.flags & LMC_BLOCK_CRC) && lmc_block_crc(&header, r->stored) != header.crc)
+		return 1;
+
+	return lmc_bloom_test(r->probe, (const uint8_t *)r->stored, header.stored_len);
+}
+
+/**
+ * Read, verify and decode a block of records, the file being positioned at
+ * its header.
+ *
+ * @param r: Segment reader;
+ * @param entry: Index entry of the block.
+ *
+ * @return: 0 in case of success, or -1 if the block cannot be read back.
+ */
+static int lmc_segment_decode_block(struct lmc_segment_reader *r, const struct lmc_block_index *entry)
+{
+	struct lmc_block_header header;
+	void *stored;
+	long len;
+
+	if (fread(&header, sizeof(header), 1, r->file) != 1)
+		return -1;
+	if (!lmc_block_valid(&header) || header.records != entry->records)
+		return -1;
+
+	switch (header.codec) {
+	case LMC_CODEC_RAW:
+		stored = r->block;
+		break;
+	case LMC_CODEC_PACKED:
+		stored = r->data;
+		break;
+	default:
+		stored = r->stored;
+		break;
+	}
+	if (header.stored_len != 0 && fread(stored, header.stored_len, 1, r->file) != 1)
+		return -1;
+	if ((header.flags & LMC_BLOCK_CRC) && lmc_block_crc(&header, stored) != header.crc)
+		return -1;
+	if (header.codec == LMC_CODEC_LZ &&
+	    lmc_lz_decompress(r->stored, header.stored_len, r->data, header.raw_len) != 0)
+		return -1;
+
+	if (header.flags & LMC_BLOCK_TIMES) {
+		len = lmc_times_decode(r->data, header.raw_len, header.records, r->times);
+		if (len < 0)
+			return -1;
+		r->data_pos = (uint32_t)len;
+	}
+	r->data_start = r->data_pos;
+
+	r->codec = header.codec;
+	r->flags = header.flags;
+	r->data_len = header.raw_len;
+	r->block_records = header.records;
+	return 0;
+}
+
+/**
+ * Read, verify and decode the next block of interest of the segment. Blocks
+ * that cannot be read back are passed over, and counted in r->lost and
+ * r->lost_records.
+ *
+ * @param r: Segment reader.
+ *
+ * @return: 1 if a block was read, 0 at the end of the segment, or -1 in case
+ *          of an error.
+ */
+static int lmc_segment_load_block(struct lmc_segment_reader *r)
+{
+	struct lmc_block_index *entry;
+	size_t count;
+
+	r->block_pos = 0;
+	r->data_pos = 0;
+	r->block_records = 0;
+
+	if (r->legacy) {
+		count = fread(r->block, sizeof(*r->block), LMC_BLOCK_RECORDS, r->file);
+		r->block_records = (uint32_t)count;
+		return count != 0;
+	}
+
+	while (r->next_block < r->blocks) {
+		entry = &r->index[r->next_block++];
+		if (entry->last_time < r->from || entry->first_time > r->to)
+			continue;
+
+		// A filter block, of the block after it
+		if (entry->records == 0) {
+			if (r->probe == NULL || r->next_block == r->blocks || r->index[r->next_block].records == 0 ||
+			    lmc_segment_test_filter(r, entry))
+				continue;
+			r->skipped++;
+			r->skipped_records += r->index[r->next_block++].records;
+			continue;
+		}
+
+		if (fseeko(r->file, entry->offset, SEEK_SET) != 0)
+			return -1;
+		if (lmc_segment_decode_block(r, entry) == 0)
+			return 1;
+
+		// Only this block is lost, the index tells where the next one starts
+		r->block_pos = 0;
+		r->data_pos = 0;
+		r->block_records = 0;
+		r->lost++;
+		r->lost_records += entry->records;
+	}
+
+	return 0;
+}
+
+/**
+ * Decode the next NUL terminated string of the current block.
+ *
+ * @param r: Segment reader;
+ * @param buf: Buffer receiving the string, or NULL to skip it;
+ * @param size: Size of buf.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_segment_string(struct lmc_segment_reader *r, char *buf, size_t size)
+{
+	const char *str = r->data + r->data_pos;
+	size_t left = r->data_len - r->data_pos, len;
+
+	len = strnlen(str, left);
+	if (len == left || len >= size)
+		return -1;
+	if (buf != NULL)
+		memcpy(buf, str, len);
+	r->data_pos += len + 1;
+
+	return 0;
+}
+
+/**
+ * Decode the next packed record of the current block.
+ */
+static int lmc_segment_unpack(struct lmc_segment_reader *r, struct lmc_client_logline *line)
+{
+	memset(line, 0, sizeof(*line));
+	if (lmc_segment_string(r, line->time, LMC_TIME_SIZE) != 0)
+		return -1;
+	if (lmc_segment_string(r, line->logline, LMC_LOGLINE_SIZE) != 0)
+		return -1;
+
+	return 1;
+}
+
+/**
+ * Decode the next record of a block with LMC_BLOCK_TIMES. The timestamp is
+ * formatted from its time value, once for all the records sharing it.
+ */
+static int lmc_segment_unpack_timed(struct lmc_segment_reader *r, int64_t t, struct lmc_client_logline *line)
+{
+	if (t != r->time_val || r->time_str[0] == '\0') {
+		if (lmc_time_to_str(r->time_str, sizeof(r->time_str), LMC_TIME_FORMAT, (time_t)t) != 0)
+			return -1;
+		r->time_val = t;
+	}
+
+	memset(line, 0, sizeof(*line));
+	memcpy(line->time, r->time_str, sizeof(line->time));
+	if (lmc_segment_string(r, line->logline, LMC_LOGLINE_SIZE) != 0)
+		return -1;
+
+	return 1;
+}
+
+/**
+ * Read the next record of the segment.
+ *
+ * @param r: Segment reader;
+ * @param line: Buffer receiving the log line;
+ * @param filter: Skip the records out of the time range of the reader.
+ *
+ * @return: 1 if a record was read, 0 at the end of the segment, or -1 in case
+ *          of an error.
+ */
+static int lmc_segment_read(struct lmc_segment_reader *r, struct lmc_client_logline *line, int filter)
+{
+	int64_t t;
+	int rc;
+
+	while (1) {
+		while (r->block_pos == r->block_records) {
+			rc = lmc_segment_load_block(r);
+			if (rc <= 0)
+				return rc;
+		}
+
+		r->block_pos++;
+		if (r->codec == LMC_CODEC_RAW) {
+			memcpy(line, &r->block[r->block_pos - 1], sizeof(*line));
+			return 1;
+		}
+		if (!(r->flags & LMC_BLOCK_TIMES))
+			return lmc_segment_unpack(r, line);
+
+		t = r->times[r->block_pos - 1];
+		if (!filter || (t >= r->from && t <= r->to))
+			return lmc_segment_unpack_timed(r, t, line);
+		if (lmc_segment_string(r, NULL, LMC_LOGLINE_SIZE) != 0)
+			return -1;
+	}
+}
+
+/**
+ * Read the next record of the segment.
+ *
+ * @param r: Segment reader;
+ * @param line: Buffer receiving the log line.
+ *
+ * @return: 1 if a record was read, 0 at the end of the segment, or -1 in case
+ *          of an error.
+ */
+int lmc_segment_next(struct lmc_segment_reader *r, struct lmc_client_logline *line)
+{
+	return lmc_segment_read(r, line, 1);
+}
+
+/**
+ * Skip records without decoding them. Whole blocks are skipped using the
+ * block index; only the block holding the first record wanted is decoded.
+ * Ignores the time range of the reader.
+ *
+ * @param r: Segment reader, before any record was read;
+ * @param count: Number of records to skip.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_segment_skip(struct lmc_segment_reader *r, uint64_t count)
+{
+	struct lmc_client_logline line;
+	uint64_t lost;
+	int rc;
+
+	if (r->legacy) {
+		if (fseeko(r->file, count * sizeof(line), SEEK_SET) != 0)
+			return -1;
+		return 0;
+	}
+
+	while (r->next_block < r->blocks && r->index[r->next_block].records <= count)
+		count -= r->index[r->next_block++].records;
+	if (count == 0)
+		return 0;
+
+	// The block holding the first record wanted. If it is lost, so are its
+	// records after the ones skipped, and reading goes on with the next block
+	lost = r->lost_records;
+	rc = lmc_segment_load_block(r);
+	if (rc <= 0)
+		return rc;
+	if (r->lost_records != lost) {
+		r->lost_records -= count;
+		return 0;
+	}
+
+	for (; count > 0; count--) {
+		rc = lmc_segment_read(r, &line, 0);
+		if (rc <= 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+/**
+ * Look at the index entry of the next block of records, once the records of
+ * the current block were all read. Its records can then be skipped with
+ * lmc_segment_skip without decoding them.
+ *
+ * @param r: Segment reader;
+ * @param entry: Receives the index entry.
+ *
+ * @return: 1 if the entry was found, or 0 if the reader is inside a block,
+ *          at the end of the segment, or the file has no block index.
+ */
+int lmc_segment_peek(struct lmc_segment_reader *r, struct lmc_block_index *entry)
+{
+	uint32_t b = r->next_block;
+
+	if (r->legacy || r->block_pos != r->block_records)
+		return 0;
+
+	// Filter blocks go with the block after them
+	while (b < r->blocks && r->index[b].records == 0)
+		b++;
+	if (b == r->blocks)
+		return 0;
+
+	*entry = r->index[b];
+	return 1;
+}
+
+/**
+ * Read the next block and pass over its records, if their timestamps are
+ * stored as time values, which can be used instead of the records.
+ *
+ * @param r: Segment reader, with the records of the current block all read;
+ * @param times: Receives the time values of the records of the block, as
+ *               many as it has records, in the order of the records.
+ *
+ * @return: 1 if the block was passed over, which lmc_segment_rewind_block
+ *          undoes, 0 if its timestamps are only in its records, which are
+ *          read next, or if it could not be read back and the records after
+ *          it are read next, or -1 in case of an error.
+ */
+int lmc_segment_times(struct lmc_segment_reader *r, const int64_t **times)
+{
+	uint64_t lost = r->lost_records;
+	int rc;
+
+	if (r->legacy || r->block_pos != r->block_records)
+		return -1;
+	rc = lmc_segment_load_block(r);
+	if (rc < 0)
+		return -1;
+	if (rc == 0 || r->lost_records != lost)
+		return 0;
+	if (r->codec == LMC_CODEC_RAW || !(r->flags & LMC_BLOCK_TIMES))
+		return 0;
+
+	*times = r->times;
+	r->block_pos = r->block_records;
+	return 1;
+}
+
+/**
+ * Read the records of the block passed over by lmc_segment_times after all,
+ * from the first one.
+ *
+ * @param r: Segment reader.
+ */
+void lmc_segment_rewind_block(struct lmc_segment_reader *r)
+{
+	r->block_pos = 0;
+	r->data_pos = r->data_start;
+}
+
+/**
+ * Count the records of a segment file. Only the block index is read, or the
+ * file size is used for plain record arrays.
+ *
+ * @param path: Path of the file;
+ * @param records: Number of records in the file.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_segment_count(const char *path, uint64_t *records)
+{
+	struct lmc_segment_reader r;
+	uint32_t i;
+
+	if (lmc_segment_open(&r, path) != 0)
+		return -1;
+
+	*records = 0;
+	if (r.legacy) {
+		if (fseeko(r.file, 0, SEEK_END) == 0)
+			*records = ftello(r.file) / sizeof(struct lmc_client_logline);
+	} else {
+		for (i = 0; i < r.blocks; i++)
+			*records += r.index[i].records;
+	}
+
+	lmc_segment_close(&r);
+	return 0;
+}
+
+/**
+ * Close a segment reader and release its resources.
+ *
+ * @param r: Segment reader.
+ */
+void lmc_segment_close(struct lmc_segment_reader *r)
+{
+	if (r->file != NULL)
+		fclose(r->file);
+	free(r->block);
+	free(r->data);
+	free(r->stored);
+	free(r->times);
+	free(r->index);
+	memset(r, 0, sizeof(*r));
+}
+
+/**
+ * Offset right after the last valid block of a segment being read. A filter
+ * block left without its block is not valid: the filter of the next block
+ * written would come after it, and its block would be taken for the block
+ * of this filter.
+ */
+static uint64_t lmc_segment_valid_end(struct lmc_segment_reader *r)
+{
+	struct lmc_block_index *last;
+
+	while (r->blocks != 0 && r->index[r->blocks - 1].records == 0)
+		r->blocks--;
+	if (r->blocks == 0)
+		return sizeof(struct lmc_segment_header);
+	last = &r->index[r->blocks - 1];
+	return last->offset + sizeof(struct lmc_block_header) + last->stored_len;
+}
+
+/**
+ * Cut a file opened for writing at some offset.
+ */
+static int lmc_segment_truncate(FILE *file, uint64_t end)
+{
+#ifdef __unix__
+	return ftruncate(fileno(file), end);
+#elif defined(_WIN32)
+	return _chsize_s(_fileno(file), end) == 0 ? 0 : -1;
+#endif
+}
+
+/**
+ * Seal a log file that flushes were appending to, before it is rotated: a
+ * torn block left at its end by a crash is dropped, then the block index and
+ * the footer are written. Sealed segments and plain record arrays are left
+ * untouched.
+ *
+ * @param path: Path of the file.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_segment_seal(const char *path)
+{
+	struct lmc_segment_reader r;
+	uint64_t end, records = 0;
+	FILE *file;
+	uint32_t i;
+	int err = -1;
+
+	if (lmc_segment_open(&r, path) != 0)
+		return -1;
+	if (r.legacy || r.sealed) {
+		lmc_segment_close(&r);
+		return 0;
+	}
+
+	end = lmc_segment_valid_end(&r);
+	for (i = 0; i < r.blocks; i++)
+		records += r.index[i].records;
+
+	file = fopen(path, "r+b");
+	if (file == NULL)
+		goto out;
+	if (lmc_segment_truncate(file, end) != 0)
+		goto out_close;
+	if (fseeko(file, end, SEEK_SET) != 0)
+		goto out_close;
+	if (lmc_segment_write_footer(file, r.index, r.blocks, end, records) != 0)
+		goto out_close;
+	err = lmc_segment_sync(file);
+out_close:
+	if (fclose(file) != 0)
+		err = -1;
+out:
+	lmc_segment_close(&r);
+	return err;
+}
+
+/**
+ * Check the active log file of a service at startup. A crash during a flush
+ * can leave a torn block at the end of the file; it is cut off, so the next
+ * flushes append after the last valid block. Invalid data followed by more
+ * than one block worth of bytes is not a torn write, and the file is left as
+ * it is.
+ *
+ * @param path: Path of the file;
+ * @param size: Size of the file once repaired.
+ *
+ * @return: 0 if the file is valid or was repaired, 1 if it is corrupted
+ *          before its end, or -1 in case of an error.
+ */
+int lmc_segment_recover(const char *path, uint64_t *size)
+{
+	struct lmc_segment_reader r;
+	uint64_t end, file_size;
+	FILE *file;
+	int err = -1;
+
+	if (lmc_segment_open(&r, path) != 0)
+		return -1;
+	if (r.legacy || r.sealed) {
+		lmc_segment_close(&r);
+		return 0;
+	}
+
+	end = lmc_segment_valid_end(&r);
+	if (fseeko(r.file, 0, SEEK_END) != 0)
+		goto out;
+	file_size = ftello(r.file);
+	*size = file_size;
+	if (file_size == end) {
+		err = 0;
+		goto out;
+	}
+	if (file_size - end > sizeof(struct lmc_block_header) + lmc_lz_bound(LMC_BLOCK_SIZE)) {
+		err = 1;
+		goto out;
+	}
+
+	file = fopen(path, "r+b");
+	if (file == NULL)
+		goto out;
+	err = lmc_segment_truncate(file, end);
+	if (err == 0)
+		err = lmc_segment_sync(file);
+	if (fclose(file) != 0)
+		err = -1;
+	if (err == 0) {
+		fprintf(stderr, "Dropped %llu bytes of torn block at the end of %s\n",
+			(unsigned long long)(file_size - end), path);
+		*size = end;
+	}
+out:
+	lmc_segment_close(&r);
+	return err;
+}
@@ -4,12 +4,20 @@
  */
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include "../include/crc32c.h"
+#include "../include/dfa.h"
+#include "../include/histogram.h"
+#include "../include/merge.h"
+#include "../include/pool.h"
+#include "../include/search.h"
 #include "../include/server.h"
+#include "../include/segment.h"
 
 #ifdef __unix__
 #include <sys/socket.h>
@@ -20,6 +28,42 @@
 static struct lmc_cache **lmc_caches;
 static size_t lmc_cache_count;
 static size_t lmc_max_caches;
+static lmc_mutex_t lmc_caches_lock;
+
+uint64_t lmc_memory_budget = LMC_MEMORY_BUDGET;
+static uint64_t lmc_memory_used;
+static uint64_t lmc_query_clock;
+static uint64_t lmc_run_clock;
+static lmc_mutex_t lmc_memory_lock;
+static lmc_mutex_t lmc_evict_lock;
+
+/**
+ * Log lines moved between the storage tiers by the tier passes, protected
+ * by lmc_memory_lock. Contains:
+ * @field to_warm: Lines compressed in memory;
+ * @field to_cold: Warm lines released from memory, left only on disk;
+ * @field warm_rate: Lines compressed per second, since the pass before;
+ * @field cold_rate: Lines released per second, since the pass before;
+ * @field last_pass: Time when the last pass ended;
+ * @field last_warm: Value of to_warm at that time;
+ * @field last_cold: Value of to_cold at that time.
+ */
+static struct lmc_tier_stats {
+	uint64_t to_warm;
+	uint64_t to_cold;
+	uint64_t warm_rate;
+	uint64_t cold_rate;
+	time_t last_pass;
+	uint64_t last_warm;
+	uint64_t last_cold;
+} lmc_tiers;
+
+/* Fixed-size objects allocated while serving commands */
+static struct lmc_pool lmc_client_pool;
+static struct lmc_pool lmc_cache_pool;
+static struct lmc_pool lmc_command_pool;
+static struct lmc_pool lmc_line_pool;
+struct lmc_pool lmc_name_pool;
 
 /* Server API */
 
@@ -30,6 +74,134 @@ static void lmc_init_client_list(void)
 {
 	lmc_max_caches = LMC_DEFAULT_CLIENTS_NO;
 	lmc_caches = malloc(lmc_max_caches * sizeof(*lmc_caches));
+	lmc_mutex_init(&lmc_caches_lock);
+	lmc_mutex_init(&lmc_memory_lock);
+	lmc_mutex_init(&lmc_evict_lock);
+	lmc_tiers.last_pass = time(NULL);
+}
+
+/**
+ * Set up the pools of the objects the workers allocate, so serving commands
+ * does not call malloc once the pools are warm.
+ */
+static void lmc_init_pools(void)
+{
+	lmc_pool_init(&lmc_client_pool, sizeof(struct lmc_client));
+	lmc_pool_init(&lmc_cache_pool, sizeof(struct lmc_cache));
+	lmc_pool_init(&lmc_name_pool, LMC_LOGFILE_NAME_LEN);
+	lmc_pool_init(&lmc_command_pool, LMC_COMMAND_SIZE);
+	lmc_pool_init(&lmc_line_pool, sizeof(struct lmc_client_logline));
+}
+
+/**
+ * Position of the oldest log line of a cache that is still in memory.
+ *
+ * @param lim: Log lines of the cache.
+ *
+ * @return: Number of lines added before it.
+ */
+static int lmc_first_in_memory(struct log_in_memory *lim)
+{
+	return lim->no_logs_overwritten > lim->no_logs_evicted ? lim->no_logs_overwritten : lim->no_logs_evicted;
+}
+
+/**
+ * Position of the oldest log line of a cache held in its log line array,
+ * neither compressed nor overwritten.
+ *
+ * @param lim: Log lines of the cache.
+ *
+ * @return: Number of lines added before it.
+ */
+static int lmc_first_in_array(struct log_in_memory *lim)
+{
+	return lim->no_logs_overwritten > lim->no_logs_compressed ? lim->no_logs_overwritten : lim->no_logs_compressed;
+}
+
+/**
+ * Slot holding a log line of a cache. The line must be in the log line
+ * array.
+ *
+ * @param cache: Cache of the service;
+ * @param index: Number of lines added before the line.
+ *
+ * @return: A pointer to the line.
+ */
+struct lmc_client_logline *lmc_get_logline(struct lmc_cache *cache, int index)
+{
+	struct log_in_memory *lim = cache->ptr;
+
+	if (cache->ring_lines != 0)
+		return &lim->list_of_logs[index % cache->ring_lines];
+	return &lim->list_of_logs[index - lim->no_logs_compressed];
+}
+
+/**
+ * Charge the memory held by the log lines of a cache to the server-wide
+ * budget, in LMC_MEMORY_UNIT steps: the log line array, the warm segments
+ * and the index of the lines of the array, trimmed of the lines that left
+ * it first. Called with the cache locked, after lines were added, released
+ * or compressed.
+ *
+ * @param cache: Cache of the service.
+ *
+ * @return: 1 if the memory used by all the caches is over the budget, or 0
+ *          otherwise.
+ */
+int lmc_charge_memory(struct lmc_cache *cache)
+{
+	struct log_in_memory *lim = cache->ptr;
+	uint64_t used;
+	int over;
+
+	lmc_index_trim(&cache->index, lmc_first_in_array(lim));
+
+	used = (uint64_t)(lim->no_logs - lmc_first_in_array(lim)) * (sizeof(struct lmc_client_logline) + sizeof(uint64_t));
+	used += cache->warm_bytes;
+	used += cache->index.bytes;
+	used = (used + LMC_MEMORY_UNIT - 1) / LMC_MEMORY_UNIT * LMC_MEMORY_UNIT;
+	if (used == cache->memory)
+		return 0;
+
+	lmc_mutex_lock(&lmc_memory_lock);
+	// Eviction reads cache->memory with only the memory lock held
+	lmc_memory_used += used - cache->memory;
+	cache->memory = used;
+	over = lmc_memory_budget != 0 && lmc_memory_used > lmc_memory_budget;
+	lmc_mutex_unlock(&lmc_memory_lock);
+
+	return over;
+}
+
+/**
+ * Mark the logs of a cache as just read, so eviction picks other caches
+ * first.
+ *
+ * @param cache: Cache of the service.
+ */
+static void lmc_touch_cache(struct lmc_cache *cache)
+{
+	lmc_mutex_lock(&lmc_memory_lock);
+	cache->last_query = ++lmc_query_clock;
+	cache->queries++;
+	lmc_mutex_unlock(&lmc_memory_lock);
+}
+
+/**
+ * Check whether the caches use more than LMC_TIER_PRESSURE percent of the
+ * memory budget.
+ *
+ * @return: 1 if they do, or 0 otherwise.
+ */
+static int lmc_memory_pressure(void)
+{
+	int pressure;
+
+	lmc_mutex_lock(&lmc_memory_lock);
+	pressure = lmc_memory_budget != 0 && lmc_memory_used > lmc_memory_budget / 100 * LMC_TIER_PRESSURE;
+	lmc_mutex_unlock(&lmc_memory_lock);
+
+	return pressure;
 }
 
 /**
@@ -39,6 +211,10 @@ static void lmc_init_client_list(void)
 static void lmc_init_server(void)
 {
 	lmc_init_client_list();
+	lmc_init_pools();
+	// Cursors of a cache are told apart from those of the run before
+	lmc_run_clock = (uint64_t)time(NULL);
+	lmc_crc32c_init();
 	lmc_init_server_os();
 }
 
@@ -55,303 +231,2187 @@ struct lmc_client *lmc_create_client(SOCKET client_sock)
 {
 	struct lmc_client *client;
 
-	client = malloc(sizeof(*client));
+	client = lmc_pool_alloc(&lmc_client_pool);
+	if (client == NULL)
+		return NULL;
 	client->client_sock = client_sock;
 	client->cache = NULL;
 
 	return client;
 }
 
+/**
+ * Drop the reference a connection holds on its cache. An unsubscribed cache
+ * is released together with its last connection.
+ *
+ * @param client: Client connection.
+ */
+static void lmc_put_cache(struct lmc_client *client)
+{
+	struct lmc_cache *cache = client->cache;
+	int release;
+
+	if (cache == NULL)
+		return;
+
+	lmc_mutex_lock(&lmc_caches_lock);
+	cache->refs--;
+	release = cache->refs == 0 && cache->unsubscribed;
+	lmc_mutex_unlock(&lmc_caches_lock);
+
+	if (release) {
+		lmc_mutex_lock(&lmc_memory_lock);
+		lmc_memory_used -= cache->memory;
+		lmc_mutex_unlock(&lmc_memory_lock);
+
+		lmc_unsubscribe_os(client);
+		lmc_free_warm(cache);
+		lmc_templates_free(&cache->templates);
+		lmc_column_free(&cache->times);
+		lmc_index_free(&cache->index);
+		while (cache->logfile_count > 0)
+			free(cache->logfiles[--cache->logfile_count].path);
+		free(cache->logfiles);
+		lmc_cond_destroy(&cache->follow);
+		lmc_mutex_destroy(&cache->lock);
+		lmc_pool_free(&lmc_cache_pool, cache);
+	}
+	client->cache = NULL;
+}
+
+/**
+ * Free a client connection structure created by lmc_create_client.
+ *
+ * @param client: Client connection.
+ */
+void lmc_destroy_client(struct lmc_client *client)
+{
+	lmc_put_cache(client);
+	lmc_pool_free(&lmc_client_pool, client);
+}
+
+/**
+ * Parse a non-negative decimal option value.
+ *
+ * @param value: Option value;
+ * @param result: Parsed number.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_parse_number(const char *value, uint64_t *result)
+{
+	char *end;
+
+	if (!isdigit((unsigned char)value[0]))
+		return -1;
+
+	*result = strtoull(value, &end, 10);
+	return *end == '\0' ? 0 : -1;
+}
+
+/**
+ * Split the connect argument "<name> [key=value ...]" into the service name
+ * and the cache options. Unknown keys are rejected.
+ *
+ * @param data: Command data. The name is terminated in place;
+ * @param opts: Parsed options.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_parse_cache_opts(char *data, struct lmc_cache_opts *opts)
+{
+	char *token, *value, *saveptr;
+
+	memset(opts, 0, sizeof(*opts));
+	opts->durability = LMC_DURABILITY_NONE;
+	opts->segment_size = LMC_SEGMENT_MAX_SIZE;
+	opts->segment_age = LMC_SEGMENT_MAX_AGE;
+	opts->retain_size = LMC_RETAIN_MAX_SIZE;
+	opts->retain_age = LMC_RETAIN_MAX_AGE;
+	opts->ring_overwrite = LMC_RING_DROP;
+	opts->huge_pages = LMC_HUGE_OFF;
+	opts->templates = 0;
+	opts->bloom = 1;
+
+	token = strchr(data, ' ');
+	if (token == NULL)
+		return 0;
+	*token++ = '\0';
+
+	for (token = strtok_r(token, " ", &saveptr); token != NULL;
+	     token = strtok_r(NULL, " ", &saveptr)) {
+		value = strchr(token, '=');
+		if (value == NULL)
+			return -1;
+		*value++ = '\0';
+
+		if (strcmp(token, "durability") == 0) {
+			if (strcmp(value, "none") == 0)
+				opts->durability = LMC_DURABILITY_NONE;
+			else if (strcmp(value, "periodic") == 0)
+				opts->durability = LMC_DURABILITY_PERIODIC;
+			else if (strcmp(value, "flush") == 0)
+				opts->durability = LMC_DURABILITY_FLUSH;
+			else
+				return -1;
+		} else if (strcmp(token, "segment_size") == 0) {
+			if (lmc_parse_number(value, &opts->segment_size) != 0)
+				return -1;
+		} else if (strcmp(token, "segment_age") == 0) {
+			if (lmc_parse_number(value, &opts->segment_age) != 0)
+				return -1;
+		} else if (strcmp(token, "retain_size") == 0) {
+			if (lmc_parse_number(value, &opts->retain_size) != 0)
+				return -1;
+		} else if (strcmp(token, "retain_age") == 0) {
+			if (lmc_parse_number(value, &opts->retain_age) != 0)
+				return -1;
+		} else if (strcmp(token, "ring_size") == 0) {
+			if (lmc_parse_number(value, &opts->ring_size) != 0)
+				return -1;
+			// at least one line, and positions of lines fit in an int
+			if (opts->ring_size != 0 && (opts->ring_size < sizeof(struct lmc_client_logline) ||
+						     opts->ring_size / sizeof(struct lmc_client_logline) > INT_MAX))
+				return -1;
+		} else if (strcmp(token, "expected_lines") == 0) {
+			if (lmc_parse_number(value, &opts->expected_lines) != 0 || opts->expected_lines > INT_MAX)
+				return -1;
+		} else if (strcmp(token, "huge_pages") == 0) {
+			if (strcmp(value, "off") == 0)
+				opts->huge_pages = LMC_HUGE_OFF;
+			else if (strcmp(value, "thp") == 0)
+				opts->huge_pages = LMC_HUGE_THP;
+			else if (strcmp(value, "hugetlb") == 0)
+				opts->huge_pages = LMC_HUGE_HUGETLB;
+			else
+				return -1;
+		} else if (strcmp(token, "dedup") == 0) {
+			if (lmc_parse_number(value, &opts->dedup) != 0)
+				return -1;
+		} else if (strcmp(token, "index") == 0) {
+			if (lmc_parse_number(value, &opts->index) != 0)
+				return -1;
+		} else if (strcmp(token, "templates") == 0) {
+			if (strcmp(value, "on") == 0)
+				opts->templates = 1;
+			else if (strcmp(value, "off") == 0)
+				opts->templates = 0;
+			else
+				return -1;
+		} else if (strcmp(token, "bloom") == 0) {
+			if (strcmp(value, "on") == 0)
+				opts->bloom = 1;
+			else if (strcmp(value, "off") == 0)
+				opts->bloom = 0;
+			else
+				return -1;
+		} else if (strcmp(token, "ring_overwrite") == 0) {
+			if (strcmp(value, "drop") == 0)
+				opts->ring_overwrite = LMC_RING_DROP;
+			else if (strcmp(value, "flush") == 0)
+				opts->ring_overwrite = LMC_RING_FLUSH;
+			else
+				return -1;
+		} else {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Check the active log file of a service when its cache is created. A torn
+ * block left by a crash is cut off. A file written by an older version as a
+ * plain array of records, or corrupted before its end, is rotated away so
+ * flushes can append blocks to a new segment.
+ *
+ * @param cache: Cache of the service, just created.
+ */
+static void lmc_recover_logfile(struct lmc_cache *cache)
+{
+	char path[LMC_LOGFILE_NAME_LEN * 2], rotated[LMC_LOGFILE_NAME_LEN * 2];
+	struct lmc_segment_reader reader;
+	uint64_t size;
+	int rc;
+
+	if (cache->active_size == 0)
+		return;
+
+	snprintf(path, sizeof(path), "%s/%s.log", lmc_logfile_path, cache->service_name);
+	if (lmc_segment_open(&reader, path) != 0)
+		return;
+	rc = reader.legacy;
+	lmc_segment_close(&reader);
+
+	if (rc == 0) {
+		rc = lmc_segment_recover(path, &size);
+		if (rc == 0)
+			cache->active_size = size;
+		if (rc != 1)
+			return;
+		fprintf(stderr, "%s is corrupted, starting a new log file\n", path);
+	}
+
+	if (lmc_rotate_logfile(path, rotated, sizeof(rotated)) != 0)
+		return;
+	if (rotated[0] != '\0')
+		lmc_add_logfile(cache, strdup(rotated), cache->active_size, cache->active_since);
+	cache->active_size = 0;
+}
+
 /**
  * Handle client connect.
  *
  * Locate a cache entry for the client and allot it to the client connection
  * (populate the cache field of the client connection structure).
  * If the client already has an existing connection (and respective cache) use
- * the same cache. Otherwise, locate a free cache.
+ * the same cache. Otherwise, create a new cache, growing the cache list if all
+ * entries are occupied. Options only apply when the cache is created. The log
+ * files of a new service are looked up with only its cache locked, so other
+ * services connect meanwhile.
  *
  * @param client: Client connection;
- * @param name: The name (identifier) of the client.
+ * @param data: The name (identifier) of the client, followed by options.
  *
  * @return: 0 in case of success, or -1 otherwise.
- *
- * TODO: Must be able to handle the case when all caches are occupied.
  */
-static int lmc_add_client(struct lmc_client *client, char *name)
+static int lmc_add_client(struct lmc_client *client, char *data)
 {
+	struct lmc_cache_opts opts;
+	struct lmc_cache *cache, **caches;
+	char *name = data;
 	int err = 0;
 	size_t i;
 
+	if (data == NULL || lmc_parse_cache_opts(data, &opts) != 0)
+		return -1;
+	if (strlen(name) >= LMC_LOGFILE_NAME_LEN)
+		return -1;
+
+	lmc_mutex_lock(&lmc_caches_lock);
+
 	for (i = 0; i < lmc_cache_count; i++) {
 		if (lmc_caches[i] == NULL)
 			continue;
 		if (lmc_caches[i]->service_name == NULL)
 			continue;
 		if (strcmp(lmc_caches[i]->service_name, name) == 0) {
-			client->cache = lmc_caches[i];
+			cache = lmc_caches[i];
 			goto found;
 		}
 	}
 
-	if (lmc_cache_count == lmc_max_caches) {
-		return -1;
+	if (lmc_cache_count == lmc_max_caches) {
+		caches = realloc(lmc_caches, 2 * lmc_max_caches * sizeof(*lmc_caches));
+		if (caches == NULL) {
+			err = -1;
+			goto out;
+		}
+		lmc_caches = caches;
+		lmc_max_caches *= 2;
+	}
+
+	cache = lmc_pool_alloc(&lmc_cache_pool);
+	if (cache == NULL) {
+		err = -1;
+		goto out;
+	}
+	memset(cache, 0, sizeof(*cache));
+	cache->service_name = lmc_pool_alloc(&lmc_name_pool);
+	if (cache->service_name == NULL) {
+		lmc_pool_free(&lmc_cache_pool, cache);
+		err = -1;
+		goto out;
+	}
+	strcpy(cache->service_name, name);
+	cache->opts = opts;
+	cache->run = ++lmc_run_clock % ((1ULL << (64 - LMC_CURSOR_SEQ_BITS)) - 1) + 1;
+	cache->ring_lines = opts.ring_size / sizeof(struct lmc_client_logline);
+	lmc_templates_init(&cache->templates);
+	cache->times.ring = cache->ring_lines;
+	// Repeats stand for lines the index would not know about
+	lmc_index_init(&cache->index, opts.dedup == 0 ? opts.index : 0);
+	lmc_mutex_init(&cache->lock);
+	lmc_cond_init(&cache->follow);
+
+	err = lmc_init_client_cache(cache);
+	if (err != 0) {
+		lmc_cond_destroy(&cache->follow);
+		lmc_mutex_destroy(&cache->lock);
+		lmc_pool_free(&lmc_name_pool, cache->service_name);
+		lmc_pool_free(&lmc_cache_pool, cache);
+		goto out;
+	}
+	lmc_touch_cache(cache);
+
+	// Nobody else has the cache yet, its lock is free
+	lmc_mutex_lock(&cache->lock);
+	lmc_caches[lmc_cache_count] = cache;
+	lmc_cache_count++;
+	cache->refs++;
+	lmc_mutex_unlock(&lmc_caches_lock);
+
+	// Log files left by previous runs
+	lmc_scan_logfiles_os(cache);
+	lmc_recover_logfile(cache);
+	lmc_mutex_unlock(&cache->lock);
+
+	lmc_put_cache(client);
+	client->cache = cache;
+	return 0;
+
+found:
+	if (client->cache != cache) {
+		cache->refs++;
+		lmc_mutex_unlock(&lmc_caches_lock);
+		lmc_put_cache(client);
+		client->cache = cache;
+		return 0;
+	}
+out:
+	lmc_mutex_unlock(&lmc_caches_lock);
+	return err;
+}
+
+/**
+ * Handle client connect
+ *
+ *
+ * @param client Client structure
+ * @param name Client name
+ * @return 1 if error, 0 if good
+ */
+static int lmc_connect_client(struct lmc_client *client, char *name)
+{
+	return lmc_add_client(client, name);
+}
+
+/**
+ * Handle client disconnect.
+ *
+ * @param client: Client connection.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ *
+ * Implement proper handling logic.
+ */
+static int lmc_disconnect_client(struct lmc_client *client)
+{
+	// The reference of the client keeps its cache alive, no lookup needed
+	printf("%s\n", client->cache->service_name);
+
+	return 0;
+}
+
+/**
+ * Handle unsubscription requests.
+ *
+ * @param client: Client connection.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ *
+ * Implement proper handling logic.
+ */
+static int lmc_unsubscribe_client(struct lmc_client *client)
+{
+	int err = -1;
+	size_t i, j;
+
+	printf("%s\n", client->cache->service_name);
+
+	lmc_mutex_lock(&lmc_caches_lock);
+	for (i = 0; i < lmc_cache_count; i++) {
+		if (lmc_caches[i] == client->cache) {
+			// remove this from the array
+			for (j = i + 1; j < lmc_cache_count; j++) {
+				lmc_caches[j - 1] = lmc_caches[j];
+			}
+			lmc_cache_count--;
+
+			// freed along with the last connection using it
+			client->cache->unsubscribed = 1;
+			err = 0;
+			break;
+		}
+	}
+	lmc_mutex_unlock(&lmc_caches_lock);
+
+	// Followers of the service stop
+	if (err == 0) {
+		lmc_mutex_lock(&client->cache->lock);
+		lmc_cond_broadcast(&client->cache->follow);
+		lmc_mutex_unlock(&client->cache->lock);
+	}
+
+	return err;
+}
+
+/**
+ * Record a rotated log file of the service. Files must be added oldest first.
+ *
+ * @param cache: Cache of the service;
+ * @param path: Path of the file. The cache takes ownership of it;
+ * @param size: Size of the file;
+ * @param mtime: Time of the last write to the file.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_add_logfile(struct lmc_cache *cache, char *path, uint64_t size, time_t mtime)
+{
+	struct lmc_logfile *logfiles;
+	size_t max;
+
+	if (cache->logfile_count == cache->logfile_max) {
+		max = cache->logfile_max ? 2 * cache->logfile_max : 16;
+		logfiles = realloc(cache->logfiles, max * sizeof(*logfiles));
+		if (logfiles == NULL)
+			return -1;
+		cache->logfiles = logfiles;
+		cache->logfile_max = max;
+	}
+
+	cache->logfiles[cache->logfile_count].path = path;
+	cache->logfiles[cache->logfile_count].size = size;
+	cache->logfiles[cache->logfile_count].mtime = mtime;
+	cache->logfiles[cache->logfile_count].corrupt = 0;
+	cache->logfile_count++;
+	cache->logfile_bytes += size;
+
+	return 0;
+}
+
+/**
+ * Compare two rotated log files by name, for qsort. The time suffix makes the
+ * names sort in the order the files were rotated; runs of digits are compared
+ * by value so that "-10" comes after "-9" for files rotated in the same
+ * second.
+ */
+int lmc_cmp_logfiles(const void *a, const void *b)
+{
+	const char *pa = ((const struct lmc_logfile *)a)->path;
+	const char *pb = ((const struct lmc_logfile *)b)->path;
+	size_t la, lb;
+
+	while (*pa != '\0' && *pb != '\0') {
+		if (isdigit((unsigned char)*pa) && isdigit((unsigned char)*pb)) {
+			for (la = 0; isdigit((unsigned char)pa[la]); la++)
+				;
+			for (lb = 0; isdigit((unsigned char)pb[lb]); lb++)
+				;
+			if (la != lb)
+				return la < lb ? -1 : 1;
+			if (strncmp(pa, pb, la) != 0)
+				return strncmp(pa, pb, la);
+			pa += la;
+			pb += lb;
+			continue;
+		}
+		if (*pa != *pb)
+			return (unsigned char)*pa - (unsigned char)*pb;
+		pa++;
+		pb++;
+	}
+
+	return (unsigned char)*pa - (unsigned char)*pb;
+}
+
+/**
+ * Drop the oldest rotated log files of the service until the retention limits
+ * are met. The files are deleted in the background, so the flush does not
+ * wait for the filesystem to release them.
+ *
+ * @param cache: Cache of the service.
+ */
+static void lmc_enforce_retention(struct lmc_cache *cache)
+{
+	const struct lmc_cache_opts *opts = &cache->opts;
+	time_t now = time(NULL);
+	size_t victims = 0;
+	struct lmc_logfile *oldest;
+
+	while (victims < cache->logfile_count) {
+		oldest = &cache->logfiles[victims];
+		if ((opts->retain_size == 0 || cache->logfile_bytes <= opts->retain_size) &&
+		    (opts->retain_age == 0 || (uint64_t)(now - oldest->mtime) < opts->retain_age))
+			break;
+
+		cache->logfile_bytes -= oldest->size;
+		lmc_remove_file_os(oldest->path);
+		victims++;
+	}
+
+	if (victims == 0)
+		return;
+
+	cache->logfile_count -= victims;
+	memmove(cache->logfiles, cache->logfiles + victims, cache->logfile_count * sizeof(*cache->logfiles));
+}
+
+/**
+ * Move the log lines of a cache down the storage tiers: hot lines in the log
+ * line array, warm lines compressed in memory and cold lines only on disk.
+ * The more often the logs of the cache are read, the more lines stay hot.
+ * Warm lines of a cache nobody reads go to disk after LMC_WARM_AGE. Under
+ * memory pressure, all but LMC_HOT_LINES lines are compressed and warm lines
+ * go to disk, oldest first, until the pressure is gone.
+ *
+ * @param cache: Cache of the service.
+ */
+static void lmc_tier_cache(struct lmc_cache *cache)
+{
+	uint64_t heat, warm = 0, cold = 0;
+	size_t hot_lines;
+	time_t before;
+
+	lmc_mutex_lock(&lmc_memory_lock);
+	cache->heat = cache->heat / 2 + cache->queries;
+	cache->queries = 0;
+	heat = cache->heat;
+	lmc_mutex_unlock(&lmc_memory_lock);
+
+	hot_lines = LMC_HOT_LINES << (heat < LMC_HOT_MAX_SHIFT ? heat : LMC_HOT_MAX_SHIFT);
+	if (lmc_memory_pressure())
+		hot_lines = LMC_HOT_LINES;
+	while (lmc_compress_cache(cache, hot_lines) > 0)
+		warm += LMC_WARM_LINES;
+
+	while (1) {
+		if (lmc_memory_pressure())
+			before = time(NULL);
+		else if (heat == 0)
+			before = time(NULL) - LMC_WARM_AGE;
+		else
+			break;
+		if (!lmc_demote_warm(cache, before))
+			break;
+		cold += LMC_WARM_LINES;
+	}
+
+	lmc_mutex_lock(&lmc_memory_lock);
+	lmc_tiers.to_warm += warm;
+	lmc_tiers.to_cold += cold;
+	lmc_mutex_unlock(&lmc_memory_lock);
+}
+
+/**
+ * Update the migration rates between the storage tiers, at the end of a
+ * tier pass.
+ */
+static void lmc_update_tier_rates(void)
+{
+	time_t now = time(NULL);
+
+	lmc_mutex_lock(&lmc_memory_lock);
+	if (now > lmc_tiers.last_pass) {
+		lmc_tiers.warm_rate = (lmc_tiers.to_warm - lmc_tiers.last_warm) / (now - lmc_tiers.last_pass);
+		lmc_tiers.cold_rate = (lmc_tiers.to_cold - lmc_tiers.last_cold) / (now - lmc_tiers.last_pass);
+	}
+	lmc_tiers.last_pass = now;
+	lmc_tiers.last_warm = lmc_tiers.to_warm;
+	lmc_tiers.last_cold = lmc_tiers.to_cold;
+	lmc_mutex_unlock(&lmc_memory_lock);
+}
+
+/**
+ * Run a compaction pass over the rotated log files of every service, and a
+ * tier pass over the log lines they hold in memory. Called periodically from
+ * a background thread by the OS-specific code.
+ */
+void lmc_compact_caches(void)
+{
+	struct lmc_client holder;
+	struct lmc_cache *cache;
+	size_t i;
+
+	for (i = 0;; i++) {
+		lmc_mutex_lock(&lmc_caches_lock);
+		if (i >= lmc_cache_count) {
+			lmc_mutex_unlock(&lmc_caches_lock);
+			break;
+		}
+		cache = lmc_caches[i];
+		cache->refs++;
+		lmc_mutex_unlock(&lmc_caches_lock);
+
+		while (lmc_compact_cache(cache) > 0)
+			;
+		lmc_tier_cache(cache);
+
+		memset(&holder, 0, sizeof(holder));
+		holder.cache = cache;
+		lmc_put_cache(&holder);
+	}
+
+	lmc_update_tier_rates();
+}
+
+/**
+ * Start a new log file for the service if the current one reached the size or
+ * the age limit. Flushes append to "<service>.log"; rotated files are named
+ * "<service>.log.<time>" and are subject to the retention limits.
+ *
+ * @param cache: Cache of the service.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_rotate_cache(struct lmc_cache *cache)
+{
+	const struct lmc_cache_opts *opts = &cache->opts;
+	char path[LMC_LOGFILE_NAME_LEN * 2], rotated[LMC_LOGFILE_NAME_LEN * 2];
+	time_t now = time(NULL);
+
+	if (cache->active_size == 0)
+		return 0;
+	if ((opts->segment_size == 0 || cache->active_size < opts->segment_size) &&
+	    (opts->segment_age == 0 || (uint64_t)(now - cache->active_since) < opts->segment_age))
+		return 0;
+
+	snprintf(path, sizeof(path), "%s/%s.log", lmc_logfile_path, cache->service_name);
+
+	/* a file that cannot be sealed stays readable, its index is rebuilt */
+	if (lmc_segment_seal(path) != 0)
+		fprintf(stderr, "Could not seal %s\n", path);
+	if (lmc_rotate_logfile(path, rotated, sizeof(rotated)) != 0)
+		return -1;
+
+	if (rotated[0] != '\0')
+		lmc_add_logfile(cache, strdup(rotated), cache->active_size, now);
+	cache->active_size = 0;
+	cache->active_since = now;
+
+	lmc_enforce_retention(cache);
+	return 0;
+}
+
+/**
+ * Number of repeats a line stands for.
+ *
+ * @return: The number held by a line starting with LMC_REPEAT_MARK, or 0
+ *          for any other line.
+ */
+static uint64_t lmc_repeats_of(const struct lmc_client_logline *line)
+{
+	return line->logline[0] == LMC_REPEAT_MARK ? strtoull(line->logline + 1, NULL, 10) : 0;
+}
+
+/**
+ * Store a log line in the client's cache. A full ring cache overwrites its
+ * oldest line, after flushing the cache if the line is not on disk yet and
+ * the service asked for it. Called with the cache locked.
+ *
+ * @param client: Client connection;
+ * @param log: Log line to store.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_store_log(struct lmc_client *client, struct lmc_client_logline *log)
+{
+	struct lmc_cache *cache = client->cache;
+	struct log_in_memory *lim = cache->ptr;
+	uint64_t repeats;
+	int err = 0;
+
+	if (cache->ring_lines != 0 && (size_t)(lim->no_logs - lim->no_logs_overwritten) == cache->ring_lines) {
+		// One flush writes the whole ring, the next lines overwrite flushed ones
+		if (cache->opts.ring_overwrite == LMC_RING_FLUSH &&
+		    lim->no_logs_stored_on_disk <= lim->no_logs_overwritten) {
+			err = lmc_rotate_cache(cache);
+			if (err == 0)
+				err = lmc_flush_os(client);
+		}
+		if (err == 0) {
+			repeats = lmc_repeats_of(lmc_get_logline(cache, lim->no_logs_overwritten));
+			if (repeats != 0)
+				cache->repeat_lines -= repeats - 1;
+			lim->no_logs_overwritten++;
+		}
+	}
+	if (err == 0)
+		err = lmc_add_log_os(client, log);
+	// Without its key, the line is only filtered on its time string
+	if (err == 0) {
+		lmc_column_set(&cache->times, lim->no_logs - 1, lmc_first_in_array(lim), lmc_time_key(log->time));
+		lmc_index_trim(&cache->index, lmc_first_in_array(lim));
+		lmc_index_add(&cache->index, lim->no_logs - 1, log->logline);
+		if (cache->followers != 0)
+			lmc_cond_broadcast(&cache->follow);
+	}
+	return err;
+}
+
+/**
+ * Store the repeats of the last line stored, if there are any, as a line of
+ * their own: LMC_REPEAT_MARK followed by their number, with the time of the
+ * last repeat. Called with the cache locked.
+ *
+ * @param client: Client connection.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_close_repeats(struct lmc_client *client)
+{
+	struct lmc_cache *cache = client->cache;
+	struct lmc_client_logline line;
+	int err;
+
+	if (cache->repeats == 0)
+		return 0;
+
+	memset(&line, 0, sizeof(line));
+	memcpy(line.time, cache->repeat_time, LMC_TIME_SIZE);
+	snprintf(line.logline, sizeof(line.logline), "%c" UINT64_FMT, LMC_REPEAT_MARK, cache->repeats);
+	err = lmc_store_log(client, &line);
+	if (err == 0)
+		cache->repeat_lines += cache->repeats - 1;
+	cache->repeats = 0;
+	return err;
+}
+
+/**
+ * Check if a log line repeats the last line stored within the dedup window
+ * of the cache. Called with the cache locked.
+ */
+static int lmc_is_repeat(struct lmc_cache *cache, struct lmc_client_logline *log)
+{
+	time_t t;
+
+	if (cache->opts.dedup == 0 || cache->repeat_since == 0 ||
+	    strcmp(cache->repeat_line.logline, log->logline) != 0 || lmc_str_to_time(log->time, &t) != 0)
+		return 0;
+
+	return t >= cache->repeat_since && (uint64_t)(t - cache->repeat_since) <= cache->opts.dedup;
+}
+
+/**
+ * Flush client logs to disk. Depending on the durability level of the cache,
+ * also wait for the logs to reach stable storage. The cache is not locked
+ * while waiting, so other connections of the service can keep adding logs.
+ *
+ * @param client: Client connection;
+ * @param durable_seq: Number of log lines of the service that are durable.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_flush(struct lmc_client *client, uint64_t *durable_seq)
+{
+	int err;
+
+	lmc_mutex_lock(&client->cache->lock);
+	err = lmc_close_repeats(client);
+	if (err == 0)
+		err = lmc_rotate_cache(client->cache);
+	if (err == 0)
+		err = lmc_flush_os(client);
+	lmc_mutex_unlock(&client->cache->lock);
+	if (err != 0)
+		return err;
+
+	*durable_seq = lmc_commit_os(client->cache);
+	return 0;
+}
+
+/**
+ * Add a log line to the client's cache. With dedup, a line repeating the
+ * last one is only counted; the repeats are stored once another line comes,
+ * the window passes, or the cache is flushed or read.
+ *
+ * @param client: Client connection;
+ * @param log: Log line to add to the cache;
+ * @param over_budget: Set if the caches now use more memory than the budget.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ *
+ * TODO DONE: Implement proper handling logic.
+ */
+
+static int lmc_add_log(struct lmc_client *client, struct lmc_client_logline *log, int *over_budget)
+{
+	struct lmc_cache *cache = client->cache;
+	int err;
+
+	lmc_mutex_lock(&cache->lock);
+	if (lmc_is_repeat(cache, log)) {
+		memcpy(cache->repeat_time, log->time, LMC_TIME_SIZE);
+		cache->repeats++;
+		cache->collapsed++;
+		*over_budget = 0;
+		lmc_mutex_unlock(&cache->lock);
+		return 0;
+	}
+
+	err = lmc_close_repeats(client);
+	if (err == 0 && cache->opts.templates)
+		lmc_template_learn(&cache->templates, log->logline);
+	if (err == 0)
+		err = lmc_store_log(client, log);
+	if (err == 0 && cache->opts.dedup != 0) {
+		memcpy(&cache->repeat_line, log, sizeof(*log));
+		if (lmc_str_to_time(log->time, &cache->repeat_since) != 0)
+			cache->repeat_since = 0;
+	}
+	*over_budget = lmc_charge_memory(cache);
+	lmc_mutex_unlock(&cache->lock);
+	return err;
+}
+
+/**
+ * Release the memory held by the log lines of a cache. Lines that were not
+ * flushed yet are written to disk first; queries read the released lines
+ * back from the log files. Ring caches keep their memory, it is bounded by
+ * their size.
+ *
+ * @param cache: Cache of the service.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_evict_cache(struct lmc_cache *cache)
+{
+	struct log_in_memory *lim = cache->ptr;
+	struct lmc_client holder;
+	uint64_t lines;
+	int err = -1;
+
+	memset(&holder, 0, sizeof(holder));
+	holder.cache = cache;
+
+	lmc_mutex_lock(&cache->lock);
+	if (cache->unsubscribed || cache->memory == 0 || cache->ring_lines != 0)
+		goto out;
+	if (lmc_rotate_cache(cache) != 0 || lmc_flush_os(&holder) != 0)
+		goto out;
+
+	lines = lim->no_logs - lim->no_logs_evicted;
+	lmc_evict_os(cache);
+	lmc_free_warm(cache);
+	lmc_charge_memory(cache);
+
+	lmc_mutex_lock(&lmc_memory_lock);
+	lmc_tiers.to_cold += lines;
+	lmc_mutex_unlock(&lmc_memory_lock);
+	err = 0;
+out:
+	lmc_mutex_unlock(&cache->lock);
+	return err;
+}
+
+/**
+ * Bring the memory used by the caches back under the budget, down to
+ * LMC_MEMORY_LOW_WATERMARK percent of it, by evicting the caches whose logs
+ * were read the longest time ago. Called without any cache locked; callers
+ * going over the budget at the same time wait for the eviction in progress.
+ */
+static void lmc_enforce_memory_budget(void)
+{
+	struct lmc_cache *victim, *cache;
+	struct lmc_client holder;
+	uint64_t target;
+	size_t i;
+	int done;
+
+	target = lmc_memory_budget / 100 * LMC_MEMORY_LOW_WATERMARK;
+
+	lmc_mutex_lock(&lmc_evict_lock);
+	while (1) {
+		victim = NULL;
+
+		lmc_mutex_lock(&lmc_caches_lock);
+		lmc_mutex_lock(&lmc_memory_lock);
+		done = lmc_memory_used <= target;
+		for (i = 0; !done && i < lmc_cache_count; i++) {
+			cache = lmc_caches[i];
+			if (cache->memory == 0 || cache->ring_lines != 0)
+				continue;
+			if (victim == NULL || cache->last_query < victim->last_query)
+				victim = cache;
+		}
+		lmc_mutex_unlock(&lmc_memory_lock);
+		if (victim != NULL)
+			victim->refs++;
+		lmc_mutex_unlock(&lmc_caches_lock);
+
+		if (victim == NULL)
+			break;
+
+		done = lmc_evict_cache(victim) != 0;
+		if (!done)
+			fprintf(stderr, "Evicted the logs of %s from memory\n", victim->service_name);
+
+		memset(&holder, 0, sizeof(holder));
+		holder.cache = victim;
+		lmc_put_cache(&holder);
+
+		if (done)
+			break;
+	}
+	lmc_mutex_unlock(&lmc_evict_lock);
+}
+
+/**
+ * Send stats about the stored logs to the client. Must not send the actual
+ * logs, but a string formatted in LMC_STATS_FORMAT. Should contain the current
+ * time on the server, allocated memory in KBs and the number of log lines
+ * stored.
+ *
+ * @param client: Client connection.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ *
+ * TODO DONE: Implement proper handling logic.
+ */
+static int lmc_send_stats(struct lmc_client *client)
+{
+	// Get server time
+	char time_buf[LMC_TIME_SIZE];
+
+	// Get memory held by the log lines, in KBs
+	unsigned long used_memory = client->cache->memory / 1024;
+
+	// Get number of log lines
+	struct log_in_memory *lim = client->cache->ptr;
+
+	unsigned long log_lines_cnt = lim->no_logs - lim->no_logs_overwritten;
+
+	char stats[LMC_STATUS_MAX_SIZE];
+
+	int buf_len = 0;
+
+	// Objects the pools of the whole server handed out, and their slabs
+	uint64_t allocs, slabs;
+
+	unsigned long hot_lines = lim->no_logs - lmc_first_in_array(lim);
+	unsigned long warm_lines = lim->no_logs_compressed - lim->no_logs_evicted;
+	struct lmc_tier_stats tiers;
+
+	lmc_crttime_to_str(time_buf, LMC_TIME_SIZE, LMC_TIME_FORMAT);
+
+	// Build stats
+
+	memset(stats, 0, LMC_STATUS_MAX_SIZE);
+	sprintf(stats, LMC_STATS_FORMAT, time_buf, used_memory, log_lines_cnt);
+	lmc_pool_stats(&allocs, &slabs);
+	buf_len = strlen(stats);
+	snprintf(stats + buf_len, sizeof(stats) - buf_len, "Allocations: " UINT64_FMT " from pools, " UINT64_FMT
+		 " slabs\n", allocs, slabs);
+
+	// Lines and memory in every tier; warm lines also with their raw size
+	buf_len = strlen(stats);
+	snprintf(stats + buf_len, sizeof(stats) - buf_len,
+		 "Tiers: hot %lu lines %luKB, warm %lu lines %luKB of %luKB, cold %lu lines %luKB on disk\n",
+		 hot_lines, hot_lines * sizeof(struct lmc_client_logline) / 1024, warm_lines,
+		 (unsigned long)(client->cache->warm_bytes / 1024), warm_lines * sizeof(struct lmc_client_logline) / 1024,
+		 (unsigned long)lim->no_logs_evicted,
+		 (unsigned long)((client->cache->logfile_bytes + client->cache->active_size) / 1024));
+
+	// Migrations of the whole server
+	lmc_mutex_lock(&lmc_memory_lock);
+	tiers = lmc_tiers;
+	lmc_mutex_unlock(&lmc_memory_lock);
+	buf_len = strlen(stats);
+	snprintf(stats + buf_len, sizeof(stats) - buf_len,
+		 "Migrations: " UINT64_FMT " lines to warm at " UINT64_FMT "/s, " UINT64_FMT " lines to cold at "
+		 UINT64_FMT "/s\n", tiers.to_warm, tiers.warm_rate, tiers.to_cold, tiers.cold_rate);
+
+	// Lines not stored because they repeated the one before
+	buf_len = strlen(stats);
+	snprintf(stats + buf_len, sizeof(stats) - buf_len, "Repeats: " UINT64_FMT " lines collapsed\n",
+		 client->cache->collapsed);
+
+	// Tokens indexed, and the memory they hold against the budget
+	buf_len = strlen(stats);
+	snprintf(stats + buf_len, sizeof(stats) - buf_len,
+		 "Index: %lu keys of %lu lines, %luKB of %luKB, " UINT64_FMT " resets\n",
+		 (unsigned long)client->cache->index.keys,
+		 (unsigned long)(client->cache->index.next - client->cache->index.first),
+		 (unsigned long)(client->cache->index.bytes / 1024), (unsigned long)(client->cache->index.budget / 1024),
+		 client->cache->index.resets);
+
+	// Warm segments and blocks on disk searches did not read
+	buf_len = strlen(stats);
+	snprintf(stats + buf_len, sizeof(stats) - buf_len,
+		 "Bloom: " UINT64_FMT " of " UINT64_FMT " segments and blocks skipped\n", client->cache->bloom_skipped,
+		 client->cache->bloom_probed);
+
+	// Lines of corrupted blocks on disk reads passed over
+	buf_len = strlen(stats);
+	snprintf(stats + buf_len, sizeof(stats) - buf_len, "Lost: " UINT64_FMT " lines of corrupted blocks\n",
+		 client->cache->lost_lines);
+
+	// Send stats
+	buf_len = strlen(stats);
+	lmc_send(client->client_sock, stats, buf_len, LMC_SEND_FLAGS);
+
+	return 0;
+}
+
+/**
+ * Log lines being sent to a client. Contains:
+ * @field client: Client connection;
+ * @field sent: Number of lines sent so far;
+ * @field count: Number of lines the client was told about, no more are sent;
+ * @field start: Oldest time of interest, or NULL to send all the lines;
+ * @field end: Newest time of interest;
+ * @field start_time: Value of start, when reading from a cursor: blocks on
+ *                    disk and warm segments whose lines are all older are
+ *                    passed over;
+ * @field end_time: Value of end, or INT64_MAX if there is none, the same for
+ *                  the lines all newer;
+ * @field search: Only lines holding this pattern are sent, or NULL;
+ * @field regex: Only lines matching this regular expression are sent, or
+ *               NULL;
+ * @field hits: Indexed lines of the log line array that may hold the search
+ *              pattern, the only ones read from there, or NULL;
+ * @field probe: Grams of the search pattern, warm segments and blocks on
+ *               disk whose filter rules them out are not read, or NULL;
+ * @field hist: Lines are counted in it instead of being sent, or NULL;
+ * @field run: Lines are copied to it instead of being sent, or NULL;
+ * @field pad: Lines that cannot be read back are sent as empty lines, instead
+ *             of being left out;
+ * @field collapsed: Send repeats as a single line instead of copies;
+ * @field seq: Number of the next line read, when reading from a cursor;
+ * @field from: Number of the first line sent, when reading from a cursor;
+ * @field to: Number of the line after the last one read, when reading from
+ *            a cursor;
+ * @field prev: Text of the last line read, the one repeats are copies of.
+ */
+struct lmc_send_state {
+	struct lmc_client *client;
+	uint64_t sent;
+	uint64_t count;
+	char *start;
+	char *end;
+	int64_t start_time;
+	int64_t end_time;
+	const struct lmc_search *search;
+	struct lmc_dfa *regex;
+	const struct lmc_index_hits *hits;
+	const struct lmc_bloom_probe *probe;
+	struct lmc_histogram *hist;
+	struct lmc_merge_run *run;
+	int pad;
+	int collapsed;
+	uint64_t seq;
+	uint64_t from;
+	uint64_t to;
+	char prev[LMC_LOGLINE_SIZE];
+};
+
+static int is_in_interval(char *time, char *start, char *end)
+{
+	if (end[0] == '\0') {
+		// nu exista end
+		return strcmp(time, start) >= 0;
+	}
+	return strcmp(time, start) >= 0 && strcmp(time, end) <= 0;
+}
+
+/**
+ * Check whether the text of a line passes the pattern the client asked for.
+ */
+static int lmc_line_wanted(struct lmc_send_state *state, const char *logline)
+{
+	if (state->search != NULL && !lmc_search_line(state->search, logline))
+		return 0;
+	if (state->regex != NULL && !lmc_dfa_match(state->regex, logline, LMC_LOGLINE_SIZE))
+		return 0;
+	return 1;
+}
+
+static int lmc_send_one(struct lmc_client_logline *line, struct lmc_send_state *state)
+{
+	if (state->start != NULL && !is_in_interval(line->time, state->start, state->end))
+		return 0;
+	if (!lmc_line_wanted(state, line->logline))
+		return 0;
+	if (state->hist != NULL)
+		return lmc_histogram_add_line(state->hist, line->time, 1);
+	if (state->sent == state->count)
+		return 0;
+
+	state->sent++;
+	if (state->run != NULL)
+		return lmc_merge_run_add(state->run, line, 1);
+	if (lmc_send(state->client->client_sock, line, sizeof(*line), LMC_SEND_FLAGS) < 0)
+		return -1;
+	return 0;
+}
+
+/**
+ * Send the line holding the repeats of the line before it: as a line saying
+ * how many there were if the client asked for collapsed lines, or else as
+ * that many copies of the line before it. Both have the time of the last
+ * repeat. Repeats of a line that was not read back are empty lines.
+ */
+static int lmc_send_repeats(struct lmc_client_logline *line, struct lmc_send_state *state)
+{
+	struct lmc_client_logline copy;
+	uint64_t repeats = lmc_repeats_of(line);
+
+	memset(&copy, 0, sizeof(copy));
+	memcpy(copy.time, line->time, LMC_TIME_SIZE);
+	if (state->collapsed) {
+		snprintf(copy.logline, sizeof(copy.logline), LMC_REPEAT_FORMAT, repeats);
+		return lmc_send_one(&copy, state);
+	}
+
+	memcpy(copy.logline, state->prev, LMC_LOGLINE_SIZE);
+	if (!lmc_line_wanted(state, copy.logline))
+		return 0;
+	if (state->hist != NULL)
+		return lmc_histogram_add_line(state->hist, copy.time, repeats);
+	// A run keeps the copies as one line, the merge takes it that many times
+	if (state->run != NULL) {
+		if (state->start != NULL && !is_in_interval(copy.time, state->start, state->end))
+			return 0;
+		state->sent++;
+		return lmc_merge_run_add(state->run, &copy, repeats);
+	}
+	for (; repeats > 0 && state->sent < state->count; repeats--)
+		if (lmc_send_one(&copy, state) != 0)
+			return -1;
+	return 0;
+}
+
+static int lmc_send_line(struct lmc_client_logline *line, void *arg)
+{
+	struct lmc_send_state *state = arg;
+
+	// An empty line stands for one that could not be read back
+	if (line->time[0] == '\0' && !state->pad)
+		return 0;
+	if (line->logline[0] == LMC_REPEAT_MARK)
+		return lmc_send_repeats(line, state);
+	if (state->client->cache->opts.dedup != 0)
+		memcpy(state->prev, line->logline, LMC_LOGLINE_SIZE);
+	return lmc_send_one(line, state);
+}
+
+/**
+ * Count a block on disk or a warm segment without reading its lines, from
+ * the times of its oldest and newest line if they are enough, or else from
+ * the times of all its lines.
+ */
+static int lmc_count_span(int64_t first, int64_t last, uint64_t lines, const int64_t *times, void *arg)
+{
+	struct lmc_send_state *state = arg;
+
+	if (times != NULL)
+		return lmc_histogram_add_times(state->hist, times, lines) == 0 ? 1 : -1;
+	return lmc_histogram_add_span(state->hist, first, last, lines);
+}
+
+/**
+ * Count the lines of the log line array, from the time column: lines whose
+ * keys do not decrease with a binary search per bucket, the ones before one
+ * by one. Called with the cache locked.
+ */
+static int lmc_count_hot(struct lmc_send_state *state, uint64_t hot)
+{
+	struct lmc_cache *cache = state->client->cache;
+	struct log_in_memory *lim = cache->ptr;
+	uint64_t i, sorted = cache->times.sorted > hot ? cache->times.sorted : hot;
+
+	for (i = hot; i < sorted && i < (uint64_t)lim->no_logs; i++)
+		if (lmc_send_line(lmc_get_logline(cache, (int)i), state) != 0)
+			return -1;
+
+	if (sorted >= (uint64_t)lim->no_logs)
+		return 0;
+	return lmc_histogram_add_column(state->hist, &cache->times, sorted, lim->no_logs);
+}
+
+/**
+ * Send the log lines of the client's service, oldest first. Lines evicted
+ * from memory are read back from disk, compressed lines are decompressed.
+ * Called with the cache locked.
+ *
+ * @param state: Lines being sent. Must point to the client;
+ * @param start: Position on disk of the first evicted line still there;
+ * @param lost: Number of evicted lines deleted by retention;
+ * @param count: Number of lines the client was told about. If state->pad
+ *               is set, lines that cannot be read back are replaced by
+ *               empty lines, so the client gets exactly that many. Where
+ *               repeats are expanded, the lines in memory may stand for
+ *               more lines than they are, so the empty lines come last.
+ *
+ * Lines being counted without a pattern are counted from the time index
+ * where it is enough, unless repeats stand for more lines than they are.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_send_all_lines(struct lmc_send_state *state, uint64_t start, uint64_t lost, uint64_t count)
+{
+	struct lmc_cache *cache = state->client->cache;
+	struct log_in_memory *lim = cache->ptr;
+	struct lmc_client_logline empty;
+	struct lmc_time_range range;
+	lmc_span_fn span = NULL;
+	int i, first, hot, last, err = 0;
+	size_t k;
+
+	if (state->hist != NULL && state->search == NULL && state->regex == NULL && cache->opts.dedup == 0)
+		span = lmc_count_span;
+
+	state->count = count;
+	memset(&empty, 0, sizeof(empty));
+	if ((uint64_t)lim->no_logs_evicted > lost)
+		err = lmc_read_evicted(cache, start, lim->no_logs_evicted - lost, state->probe, span, lmc_send_line,
+				       state);
+
+	first = lmc_first_in_memory(lim);
+	if (state->pad && (state->collapsed || cache->repeat_lines == 0))
+		while (state->sent < count - (lim->no_logs - first))
+			lmc_send_line(&empty, state);
+
+	if (cache->warm_count != 0 && lmc_read_warm(cache, state->probe, span, lmc_send_line, state) != 0)
+		return -1;
+
+	// Oldest first, also when a ring has wrapped around. Interval filters
+	// scan the time column and skip lines outside without touching them;
+	// repeats need the line before them, so caches with dedup read all.
+	if (state->start != NULL)
+		lmc_time_range(&range, state->start, state->end);
+	hot = lmc_first_in_array(lim);
+	if (span != NULL)
+		return lmc_count_hot(state, hot) != 0 ? -1 : err;
+	last = lim->no_logs;
+	if (state->hits != NULL && state->hits->from < (uint64_t)last)
+		last = state->hits->from > (uint64_t)hot ? (int)state->hits->from : hot;
+	for (i = hot; i < last; i++) {
+		if (state->start != NULL && cache->opts.dedup == 0 &&
+		    lmc_time_range_test(&range, lmc_column_get(&cache->times, i)) == 0)
+			continue;
+		if (lmc_send_line(lmc_get_logline(cache, i), state) != 0)
+			return -1;
+	}
+
+	// Past the lines not indexed, only the candidates of the index
+	for (k = 0; state->hits != NULL && k < state->hits->count; k++) {
+		i = (int)(state->hits->base + state->hits->lines[k]);
+		if (i < hot || i >= lim->no_logs)
+			continue;
+		if (lmc_send_line(lmc_get_logline(cache, i), state) != 0)
+			return -1;
+	}
+
+	while (state->pad && state->sent < count)
+		lmc_send_line(&empty, state);
+
+	return err;
+}
+
+/**
+ * Find the evicted lines of the client's service that are still on disk.
+ * Repeats not stored yet are stored first, so they are read too. Called
+ * with the cache locked.
+ */
+static int lmc_find_lines(struct lmc_client *client, uint64_t *start, uint64_t *lost)
+{
+	struct log_in_memory *lim = client->cache->ptr;
+
+	*start = 0;
+	*lost = 0;
+	if (lmc_close_repeats(client) != 0)
+		return -1;
+
+	if (lim->no_logs_evicted == 0)
+		return 0;
+	if (lmc_find_evicted(client->cache, start, lost) != 0)
+		return -1;
+	if (*lost > (uint64_t)lim->no_logs_evicted)
+		*lost = lim->no_logs_evicted;
+	return 0;
+}
+
+/**
+ * Find the evicted lines of the client's service that are still on disk,
+ * like lmc_find_lines, and mark the cache as just queried. Called with the
+ * cache locked.
+ */
+static int lmc_locate_lines(struct lmc_client *client, uint64_t *start, uint64_t *lost)
+{
+	lmc_touch_cache(client->cache);
+	return lmc_find_lines(client, start, lost);
+}
+
+/**
+ * Send the stored log lines to the client.
+ * The server must first send the number of lines, and then the log lines,
+ * one by one.
+ *
+ * @param client: Client connection;
+ * @param collapsed: Send repeats as a single line instead of copies.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ *
+ * TODO DONE: Implement proper handling logic.
+ */
+static int lmc_send_loglines(struct lmc_client *client, int collapsed)
+{
+	struct log_in_memory *lim = client->cache->ptr;
+	struct lmc_send_state state;
+	unsigned long number_of_lines;
+	uint64_t start, lost;
+	char buffer[128];
+
+	if (lmc_locate_lines(client, &start, &lost) != 0)
+		return -1;
+	number_of_lines = lim->no_logs - lim->no_logs_overwritten - lost;
+	if (!collapsed)
+		number_of_lines += client->cache->repeat_lines;
+
+	sprintf(buffer, "%ld", number_of_lines);
+	lmc_send(client->client_sock, buffer, sizeof(buffer), LMC_SEND_FLAGS);
+
+	memset(&state, 0, sizeof(state));
+	state.client = client;
+	state.pad = 1;
+	state.collapsed = collapsed;
+	return lmc_send_all_lines(&state, start, lost, number_of_lines);
+}
+
+static int lmc_send_loglines_interval(struct lmc_client *client, char *args, int collapsed)
+{
+
+	char time1[21];
+	char time2[21];
+
+	struct log_in_memory *lim = client->cache->ptr;
+	struct lmc_send_state state;
+	unsigned long number_of_lines;
+	uint64_t start, lost;
+	char buffer[128];
+
+	memset(time1, 0, sizeof(time1));
+	memset(time2, 0, sizeof(time2));
+
+	memcpy(time1, args, sizeof(time1) - 1);
+	memcpy(time2, args, sizeof(time2) - 1);
+
+	if (lmc_locate_lines(client, &start, &lost) != 0)
+		return -1;
+	number_of_lines = lim->no_logs - lim->no_logs_overwritten;
+	if (!collapsed)
+		number_of_lines += client->cache->repeat_lines;
+
+	sprintf(buffer, "%ld", number_of_lines);
+	lmc_send(client->client_sock, buffer, sizeof(buffer), LMC_SEND_FLAGS);
+
+	memset(&state, 0, sizeof(state));
+	state.client = client;
+	state.collapsed = collapsed;
+	state.start = time1;
+	state.end = time2;
+	return lmc_send_all_lines(&state, start, lost, number_of_lines);
+}
+
+/**
+ * Pass over the warm segments before the cursor, and those after the last
+ * line to send, without decompressing them. With an interval, so are the
+ * blocks and segments whose lines are all outside it, unless repeats need
+ * the lines before them. Times that could not be parsed are stored as 0.
+ */
+static int lmc_cursor_span(int64_t first, int64_t last, uint64_t lines, const int64_t *times, void *arg)
+{
+	struct lmc_send_state *state = arg;
+
+	if (state->sent == state->count || state->seq >= state->to)
+		return 1;
+	if (state->seq + lines <= state->from ||
+	    (state->start != NULL && state->client->cache->opts.dedup == 0 && first > 0 && last >= first &&
+	     (last < state->start_time || first > state->end_time))) {
+		state->seq += lines;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Send a line read from disk or from a warm segment, if it is after the
+ * cursor, before the last line to read and the client still wants lines.
+ */
+static int lmc_cursor_line(struct lmc_client_logline *line, void *arg)
+{
+	struct lmc_send_state *state = arg;
+
+	if (state->sent == state->count || state->seq >= state->to || state->seq++ < state->from)
+		return 0;
+	return lmc_send_line(line, state);
+}
+
+/**
+ * Send the log lines of the client's service added after a cursor, oldest
+ * first, at most a number of them, so pollers only get the lines they did
+ * not see yet. A cursor is the number of the next line to send, tagged with
+ * the run of the cache; a cursor of another run, or 0, starts with the
+ * oldest line. Reading starts at the cursor: files and blocks on disk and
+ * warm segments before it are not decoded. Repeats are sent as a single
+ * line, so every stored line is sent once. The server first sends
+ * "<lines> <cursor> <skipped>" in a 128 byte buffer: the number of lines
+ * that follow, the cursor to pass next time and the number of lines after
+ * the cursor that are gone, deleted by retention or overwritten. Lines that
+ * cannot be read back are sent as empty lines.
+ *
+ * @param client: Client connection;
+ * @param args: "<cursor> [max]", max being 0 or missing for no limit.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_send_since(struct lmc_client *client, const char *args)
+{
+	struct lmc_cache *cache = client->cache;
+	struct log_in_memory *lim = cache->ptr;
+	struct lmc_client_logline empty;
+	struct lmc_send_state state;
+	uint64_t cursor = 0, max = 0, first, lost, from, disk, memory, next, skipped = 0;
+	int valid, i, in_memory, err = -1;
+	char buffer[128], *rest = NULL;
+
+	valid = args != NULL && isdigit((unsigned char)args[0]);
+	if (valid)
+		cursor = strtoull(args, &rest, 10);
+	if (valid && *rest == ' ') {
+		valid = isdigit((unsigned char)rest[1]);
+		max = strtoull(rest + 1, &rest, 10);
+	}
+	valid = valid && *rest == '\0';
+	if (max == 0)
+		max = UINT64_MAX;
+
+	memset(&state, 0, sizeof(state));
+	memset(&empty, 0, sizeof(empty));
+	memset(buffer, 0, sizeof(buffer));
+	state.client = client;
+	state.pad = 1;
+	state.collapsed = 1;
+	state.to = UINT64_MAX;
+
+	lmc_mutex_lock(&cache->lock);
+	if (!valid || lmc_locate_lines(client, &first, &lost) != 0) {
+		lmc_mutex_unlock(&cache->lock);
+		sprintf(buffer, "0 " UINT64_FMT " 0", cursor);
+		lmc_send(client->client_sock, buffer, sizeof(buffer), LMC_SEND_FLAGS);
+		return -1;
+	}
+
+	// Lines are on disk up to no_logs_evicted, then in memory from in_memory
+	from = cursor >> LMC_CURSOR_SEQ_BITS == cache->run ? cursor & ((1ULL << LMC_CURSOR_SEQ_BITS) - 1) : 0;
+	if (from > (uint64_t)lim->no_logs)
+		from = lim->no_logs;
+	if (from < lost) {
+		skipped = lost - from;
+		from = lost;
+	}
+	in_memory = lmc_first_in_memory(lim);
+	if (from >= (uint64_t)lim->no_logs_evicted && from < (uint64_t)in_memory) {
+		skipped += in_memory - from;
+		from = in_memory;
+	}
+	disk = from < (uint64_t)lim->no_logs_evicted ? lim->no_logs_evicted - from : 0;
+	memory = lim->no_logs - (from > (uint64_t)in_memory ? from : (uint64_t)in_memory);
+	state.count = disk + memory < max ? disk + memory : max;
+	next = state.count <= disk ? from + state.count : lim->no_logs - memory + state.count - disk;
+
+	sprintf(buffer, UINT64_FMT " " UINT64_FMT " " UINT64_FMT, state.count,
+		cache->run << LMC_CURSOR_SEQ_BITS | next, skipped);
+	err = lmc_send(client->client_sock, buffer, sizeof(buffer), LMC_SEND_FLAGS) < 0 ? -1 : 0;
+
+	state.from = from;
+	state.seq = from;
+	if (err == 0 && disk != 0)
+		err = lmc_read_evicted(cache, first + (from - lost), disk < state.count ? disk : state.count, NULL,
+				       NULL, lmc_cursor_line, &state);
+	state.seq = lim->no_logs_evicted;
+	if (state.sent < state.count && cache->warm_count != 0 &&
+	    lmc_read_warm(cache, NULL, lmc_cursor_span, lmc_cursor_line, &state) != 0)
+		err = -1;
+	i = lmc_first_in_array(lim);
+	if ((uint64_t)i < from)
+		i = (int)from;
+	for (; i < lim->no_logs && state.sent < state.count; i++)
+		if (lmc_send_line(lmc_get_logline(cache, i), &state) != 0)
+			break;
+	while (state.sent < state.count)
+		if (lmc_send_line(&empty, &state) != 0)
+			break;
+	lmc_mutex_unlock(&cache->lock);
+
+	return err;
+}
+
+/**
+ * Parse the arguments of a search: the pattern, then optionally the oldest
+ * and the newest time of interest. The pattern may hold spaces; the last
+ * words are only taken as times if they are in LMC_TIME_FORMAT.
+ *
+ * @param args: Arguments of the command;
+ * @param start: Buffer of LMC_TIME_SIZE bytes receiving the oldest time, or
+ *               an empty string if there is none;
+ * @param end: Buffer of LMC_TIME_SIZE bytes receiving the newest time, or
+ *             an empty string if there is none.
+ *
+ * @return: The length of the pattern, at the start of args.
+ */
+static size_t lmc_parse_search(const char *args, char *start, char *end)
+{
+	const char *times[2] = { NULL, NULL };
+	size_t len = strlen(args), word;
+	int n = 0;
+
+	start[0] = end[0] = '\0';
+	while (n < 2 && len > LMC_TIME_SIZE - 1 && args[len - LMC_TIME_SIZE] == ' ' &&
+	       lmc_time_key(args + len - (LMC_TIME_SIZE - 1)) != LMC_TIME_KEY_NONE) {
+		word = len - (LMC_TIME_SIZE - 1);
+		times[n++] = args + word;
+		len = word - 1;
+	}
+
+	if (n == 2) {
+		memcpy(start, times[1], LMC_TIME_SIZE - 1);
+		memcpy(end, times[0], LMC_TIME_SIZE - 1);
+	} else if (n == 1) {
+		memcpy(start, times[0], LMC_TIME_SIZE - 1);
+	}
+	if (n != 0) {
+		start[LMC_TIME_SIZE - 1] = '\0';
+		end[LMC_TIME_SIZE - 1] = '\0';
 	}
 
-	client->cache = malloc(sizeof(*client->cache));
-	client->cache->service_name = strdup(name);
-	lmc_caches[lmc_cache_count] = client->cache;
-	lmc_cache_count++;
+	return len;
+}
 
-	err = lmc_init_client_cache(client->cache);
-found:
-	return err;
+/**
+ * Narrow a search down with the token index of the cache and the filters of
+ * its warm segments and blocks on disk. Called with the cache locked.
+ *
+ * @param state: Lines being searched, with the pattern;
+ * @param hits: Receives the candidates of the index;
+ * @param probe: Receives the grams of the pattern.
+ */
+static void lmc_narrow_search(struct lmc_send_state *state, struct lmc_index_hits *hits,
+			      struct lmc_bloom_probe *probe)
+{
+	struct lmc_cache *cache = state->client->cache;
+	const struct lmc_search *search = state->search;
+
+	if (lmc_index_query(&cache->index, search->pattern, search->len, hits) == 0)
+		state->hits = hits;
+	// Repeats are copies of lines in blocks that may be skipped
+	if (cache->opts.bloom && cache->opts.dedup == 0 && lmc_bloom_probe_init(probe, search->pattern, search->len) == 0)
+		state->probe = probe;
 }
+
 /**
- * Handle client connect
+ * Send the log lines of the client's service that hold a pattern, or match
+ * a regular expression, oldest first, searching all of them: on disk,
+ * compressed and in memory. The hits are sent as they are found, one by
+ * one, then the number of hits, in a 128 byte buffer, which ends the list.
+ * A regular expression is compiled before the cache is locked.
  *
+ * @param client: Client connection;
+ * @param args: "<pattern> [t1 [t2]]";
+ * @param regex: The pattern is a regular expression, not a substring.
  *
- * @param client Client structure
- * @param name Client name
- * @return 1 if error, 0 if good
+ * @return: 0 in case of success, or -1 otherwise.
  */
-static int lmc_connect_client(struct lmc_client *client, char *name)
+static int lmc_send_search(struct lmc_client *client, char *args, int regex)
 {
+	char start[LMC_TIME_SIZE], end[LMC_TIME_SIZE], buffer[128];
+	struct lmc_send_state state;
+	struct lmc_index_hits hits;
+	struct lmc_bloom_probe probe;
+	struct lmc_search search;
+	struct lmc_dfa dfa;
+	const char *error;
+	uint64_t first, lost;
 	int err = -1;
-	size_t i;
+	size_t len;
+
+	memset(&state, 0, sizeof(state));
+	state.client = client;
+	if (args != NULL) {
+		len = lmc_parse_search(args, start, end);
+		if (regex && lmc_dfa_compile(&dfa, args, len, &error) == 0)
+			state.regex = &dfa;
+		else if (!regex && lmc_search_init(&search, args, len) == 0)
+			state.search = &search;
+		else if (regex)
+			fprintf(stderr, "regex %.*s: %s\n", (int)len, args, error);
+	}
 
-	for (i = 0; i < lmc_cache_count; i++) {
-		if (lmc_caches[i] == NULL)
-			continue;
-		if (lmc_caches[i]->service_name == NULL)
-			continue;
-		if (strcmp(lmc_caches[i]->service_name, name) == 0) {
-			client->cache = lmc_caches[i];
-			goto found;
+	lmc_mutex_lock(&client->cache->lock);
+	if ((state.search != NULL || state.regex != NULL) && lmc_locate_lines(client, &first, &lost) == 0) {
+		if (start[0] != '\0') {
+			state.start = start;
+			state.end = end;
 		}
+		if (state.search != NULL)
+			lmc_narrow_search(&state, &hits, &probe);
+		err = lmc_send_all_lines(&state, first, lost, UINT64_MAX);
+		if (state.hits != NULL)
+			free(hits.lines);
 	}
+	lmc_mutex_unlock(&client->cache->lock);
+	if (state.regex != NULL)
+		lmc_dfa_free(&dfa);
 
-	if (lmc_cache_count == lmc_max_caches) {
+	memset(buffer, 0, sizeof(buffer));
+	sprintf(buffer, UINT64_FMT, state.sent);
+	if (lmc_send(client->client_sock, buffer, sizeof(buffer), LMC_SEND_FLAGS) < 0)
 		return -1;
-	}
-
-	client->cache = malloc(sizeof(*client->cache));
-	client->cache->service_name = strdup(name);
-	lmc_caches[lmc_cache_count] = client->cache;
-	lmc_cache_count++;
-
-	err = lmc_init_client_cache(client->cache);
-found:
 	return err;
 }
 
 /**
- * Handle client disconnect.
- *
- * @param client: Client connection.
+ * Parse "[t1 [t2]]", the oldest and the newest time of interest.
  *
- * @return: 0 in case of success, or -1 otherwise.
+ * @param args: Arguments of the command;
+ * @param start: Buffer of LMC_TIME_SIZE bytes receiving the oldest time, or
+ *               an empty string if there is none;
+ * @param end: Buffer of LMC_TIME_SIZE bytes receiving the newest time, or
+ *             an empty string if there is none.
  *
- * Implement proper handling logic.
+ * @return: 0 in case of success, or -1 if args holds more than times in
+ *          LMC_TIME_FORMAT.
  */
-static int lmc_disconnect_client(struct lmc_client *client)
+static int lmc_parse_times(const char *args, char *start, char *end)
 {
-	int err = -1;
-	size_t i;
+	char buf[LMC_COMMAND_SIZE + 1];
 
-	printf("%s\n", client->cache->service_name);
+	start[0] = end[0] = '\0';
+	if (args[0] == '\0')
+		return 0;
 
-	for (i = 0; i < lmc_cache_count; i++) {
-		if (lmc_caches[i] == NULL)
-			continue;
-		if (lmc_caches[i]->service_name == NULL)
-			continue;
-		if (strcmp(lmc_caches[i]->service_name, client->cache->service_name) == 0) {
-			// TODO Terminate session
-			err = 0;
-			goto found;
-		}
-	}
-found:
-	return err;
+	// Times are only taken after a space, like after a pattern
+	snprintf(buf, sizeof(buf), " %s", args);
+	return lmc_parse_search(buf, start, end) == 0 ? 0 : -1;
 }
 
 /**
- * Handle unsubscription requests.
+ * Send the number of log lines of the client's service, in all or per
+ * bucket of time, without sending the lines: all of them or those holding a
+ * pattern, optionally only those in an interval. Without a pattern, lines
+ * are counted from the time index: the time column for the log line array,
+ * with a binary search per bucket, and the oldest and newest time of warm
+ * segments and blocks on disk, which are only read if their lines do not
+ * fall in a single bucket. A count is sent in a 128 byte buffer. A histogram
+ * is sent as the number of buckets holding lines, in a 128 byte buffer, then
+ * every one of them, oldest first, as "<start> <lines>" in a 128 byte
+ * buffer, the start in LMC_TIME_FORMAT. Buckets start at multiples of their
+ * width since the Epoch.
  *
- * @param client: Client connection.
+ * @param client: Client connection;
+ * @param args: "[t1 [t2]]" or "search <pattern> [t1 [t2]]", after the
+ *              width of the buckets in seconds for a histogram, or NULL;
+ * @param histogram: Count the lines per bucket of time.
  *
  * @return: 0 in case of success, or -1 otherwise.
- *
- * Implement proper handling logic.
  */
-static int lmc_unsubscribe_client(struct lmc_client *client)
+static int lmc_send_count(struct lmc_client *client, const char *args, int histogram)
 {
-	int err = -1;
-	size_t i;
+	char start[LMC_TIME_SIZE], end[LMC_TIME_SIZE], buffer[128];
+	struct lmc_send_state state;
+	struct lmc_histogram hist;
+	struct lmc_index_hits hits;
+	struct lmc_bloom_probe probe;
+	struct lmc_search search;
+	uint64_t width = 0, first, lost, buckets;
+	char *rest;
+	int valid = 1, err = -1;
+	size_t len, i;
+
+	memset(&state, 0, sizeof(state));
+	memset(&hist, 0, sizeof(hist));
+	state.client = client;
+	if (args == NULL)
+		args = "";
+
+	if (histogram) {
+		valid = isdigit((unsigned char)args[0]);
+		width = strtoull(args, &rest, 10);
+		valid = valid && width != 0 && (*rest == ' ' || *rest == '\0');
+		args = *rest == ' ' ? rest + 1 : rest;
+	}
 
-	printf("%s\n", client->cache->service_name);
+	// "search <pattern> [t1 [t2]]" only counts lines holding pattern
+	len = strlen(LMC_COUNT_SEARCH);
+	if (strncmp(args, LMC_COUNT_SEARCH, len) == 0 && args[len] == ' ') {
+		args += len + 1;
+		len = lmc_parse_search(args, start, end);
+		valid = valid && lmc_search_init(&search, args, len) == 0;
+		if (valid)
+			state.search = &search;
+	} else {
+		valid = valid && lmc_parse_times(args, start, end) == 0;
+	}
+	valid = valid && lmc_histogram_init(&hist, width, start, end) == 0;
+
+	lmc_mutex_lock(&client->cache->lock);
+	if (valid && lmc_locate_lines(client, &first, &lost) == 0) {
+		state.hist = &hist;
+		if (state.search != NULL)
+			lmc_narrow_search(&state, &hits, &probe);
+		err = lmc_send_all_lines(&state, first, lost, UINT64_MAX);
+		if (state.hits != NULL)
+			free(hits.lines);
+	}
+	lmc_mutex_unlock(&client->cache->lock);
 
-	for (i = 0; i < lmc_cache_count; i++) {
-		if (lmc_caches[i] == NULL)
-			continue;
-		if (lmc_caches[i]->service_name == NULL)
-			continue;
-		if (strcmp(lmc_caches[i]->service_name, client->cache->service_name) == 0) {
-			// remove this from the array
-			int j;
-			for (j = i + 1; j < lmc_cache_count; j++) {
-				lmc_caches[j - 1] = lmc_caches[j];
-			}
-			lmc_cache_count--;
+	memset(buffer, 0, sizeof(buffer));
+	if (!histogram) {
+		sprintf(buffer, UINT64_FMT, err == 0 ? lmc_histogram_total(&hist) : 0);
+		if (lmc_send(client->client_sock, buffer, sizeof(buffer), LMC_SEND_FLAGS) < 0)
+			err = -1;
+		lmc_histogram_free(&hist);
+		return err;
+	}
 
-			lmc_unsubscribe_os(client);
-			err = 0;
-			goto found;
+	buckets = err == 0 ? hist.count : 0;
+	sprintf(buffer, UINT64_FMT, buckets);
+	if (lmc_send(client->client_sock, buffer, sizeof(buffer), LMC_SEND_FLAGS) < 0) {
+		lmc_histogram_free(&hist);
+		return -1;
+	}
+	for (i = 0; i < buckets; i++) {
+		memset(buffer, 0, sizeof(buffer));
+		if (lmc_time_to_str(buffer, sizeof(buffer), LMC_TIME_FORMAT, (time_t)hist.buckets[i].start) != 0)
+			buffer[0] = '\0';
+		len = strlen(buffer);
+		snprintf(buffer + len, sizeof(buffer) - len, " " UINT64_FMT, hist.buckets[i].count);
+		if (lmc_send(client->client_sock, buffer, sizeof(buffer), LMC_SEND_FLAGS) < 0) {
+			err = -1;
+			break;
 		}
 	}
-found:
+
+	lmc_histogram_free(&hist);
 	return err;
 }
 
 /**
- * Add a log line to the client's cache.
- *
- * @param client: Client connection;
- * @param log: Log line to add to the cache.
- *
- * @return: 0 in case of success, or -1 otherwise.
- *
- * TODO DONE: Implement proper handling logic.
+ * Services of a getlogs_multi being merged. Contains:
+ * @field states: Lines being read of every service, a chunk at a time, from
+ *                the line numbered from;
+ * @field last: Number of lines of every service when the merge started; the
+ *              lines added after them are not sent.
  */
+struct lmc_multi {
+	struct lmc_send_state states[LMC_MULTI_MAX];
+	uint64_t last[LMC_MULTI_MAX];
+};
 
-static int lmc_add_log(struct lmc_client *client, struct lmc_client_logline *log)
+/**
+ * Read the next chunk of lines of a service of a getlogs_multi into its
+ * run: at most LMC_MULTI_CHUNK lines from the position reached, wherever
+ * they are, the way lmc_send_since reads from a cursor. Lines gone since
+ * the chunk before, deleted by retention or overwritten, are passed over.
+ * The cache was marked as queried when the command came. Called with the
+ * cache locked.
+ */
+static int lmc_read_multi(struct lmc_send_state *state, uint64_t last)
 {
-	lmc_add_log_os(client, log);
-	return 0;
+	struct lmc_cache *cache = state->client->cache;
+	struct log_in_memory *lim = cache->ptr;
+	uint64_t first, lost, from, disk;
+	int i, in_memory, err;
+
+	if (lmc_find_lines(state->client, &first, &lost) != 0)
+		return -1;
+	from = state->from > lost ? state->from : lost;
+	in_memory = lmc_first_in_memory(lim);
+	if (from >= (uint64_t)lim->no_logs_evicted && from < (uint64_t)in_memory)
+		from = in_memory;
+	state->from = from;
+	state->to = from;
+	if (from >= last)
+		return 0;
+	state->to = last - from > LMC_MULTI_CHUNK ? from + LMC_MULTI_CHUNK : last;
+
+	err = 0;
+	state->seq = from;
+	disk = from < (uint64_t)lim->no_logs_evicted ? lim->no_logs_evicted - from : 0;
+	if (disk > state->to - from)
+		disk = state->to - from;
+	if (disk != 0)
+		err = lmc_read_evicted(cache, first + (from - lost), disk, NULL, lmc_cursor_span, lmc_cursor_line,
+				       state);
+	state->seq = lim->no_logs_evicted;
+	if (err == 0 && state->to > state->seq && cache->warm_count != 0)
+		err = lmc_read_warm(cache, NULL, lmc_cursor_span, lmc_cursor_line, state);
+	i = lmc_first_in_array(lim);
+	if ((uint64_t)i < from)
+		i = (int)from;
+	for (; err == 0 && (uint64_t)i < state->to; i++)
+		err = lmc_send_line(lmc_get_logline(cache, i), state);
+	return err;
 }
 
 /**
- * Flush client logs to disk.
- *
- * @param client: Client connection.
- *
- * @return: 0 in case of success, or -1 otherwise.
- *
- * TODO DONE: Implement proper handling logic.
+ * Fill the run of a service of a getlogs_multi, a chunk at a time until
+ * some lines of the chunk are wanted or the service has no more. The cache
+ * is locked only while a chunk is read.
  */
-static int lmc_flush(struct lmc_client *client)
+static int lmc_fill_multi(struct lmc_merge_run *run, size_t n, void *arg)
 {
-	lmc_flush_os(client);
-	return 0;
+	struct lmc_multi *multi = arg;
+	struct lmc_send_state *state = &multi->states[n];
+	struct lmc_cache *cache = state->client->cache;
+	int err = 0;
+
+	state->run = run;
+	while (err == 0 && run->count == 0 && state->from < multi->last[n]) {
+		lmc_mutex_lock(&cache->lock);
+		err = lmc_read_multi(state, multi->last[n]);
+		lmc_mutex_unlock(&cache->lock);
+		state->from = state->to;
+	}
+	return err;
 }
 
 /**
- * Send stats about the stored logs to the client. Must not send the actual
- * logs, but a string formatted in LMC_STATS_FORMAT. Should contain the current
- * time on the server, allocated memory in KBs and the number of log lines
- * stored.
+ * Send a getlogs_multi batch: a LMC_FOLLOW_HEADER byte header, "<lines>",
+ * followed by the lines, in a single message. The batch with no lines ends
+ * the command.
+ */
+static int lmc_send_multi_batch(struct lmc_client *client, char *batch, size_t count)
+{
+	memset(batch, 0, LMC_FOLLOW_HEADER);
+	snprintf(batch, LMC_FOLLOW_HEADER, "%lu", (unsigned long)count);
+
+	return lmc_send(client->client_sock, batch,
+			LMC_FOLLOW_HEADER + count * sizeof(struct lmc_client_service_logline), LMC_SEND_FLAGS) < 0 ?
+		       -1 : 0;
+}
+
+/**
+ * Send the log lines of several services merged by time, oldest first,
+ * optionally only those in an interval, every line tagged with its service.
+ * The lines every service had when the command came are read into a run at
+ * most LMC_MULTI_CHUNK at a time, the way getlogs reads them, repeats as
+ * copies; a run is read again from where it stopped once the merge (see
+ * merge.h) has taken all its lines. Each cache is locked only while a chunk
+ * is read, the lines are sent with no cache locked, and the memory of the
+ * runs is charged to the budget while they are merged, evicting caches if
+ * it goes over. Every cache is marked as queried once. The lines are sent
+ * in batches of at most LMC_MULTI_BATCH struct lmc_client_service_logline;
+ * the batch with no lines ends the command.
  *
- * @param client: Client connection.
+ * @param client: Client connection;
+ * @param args: "<service>[,<service>...] [t1 [t2]]", at most LMC_MULTI_MAX
+ *              services.
  *
  * @return: 0 in case of success, or -1 otherwise.
- *
- * TODO DONE: Implement proper handling logic.
  */
-static int lmc_send_stats(struct lmc_client *client)
+static int lmc_send_multi(struct lmc_client *client, const char *args)
 {
-	// Get server time
-	char time_buf[LMC_TIME_SIZE];
-
-	// Get allocated memory
-	int page_size = 0; // getpagesize();
-	unsigned long used_memory = client->cache->pages * page_size;
-
-	// Get number of log lines
-	struct log_in_memory *lim = client->cache->ptr;
-
-	unsigned long log_lines_cnt = lim->no_logs;
-
-	char stats[LMC_STATUS_MAX_SIZE];
-
-	int buf_len = 0;
-
-	lmc_crttime_to_str(time_buf, LMC_TIME_SIZE, LMC_TIME_FORMAT);
+	char start[LMC_TIME_SIZE], end[LMC_TIME_SIZE], name[LMC_LOGFILE_NAME_LEN], header[LMC_FOLLOW_HEADER];
+	char tags[LMC_MULTI_MAX][LMC_CLIENT_MAX_NAME];
+	struct lmc_client peers[LMC_MULTI_MAX];
+	struct lmc_merge_run runs[LMC_MULTI_MAX];
+	struct lmc_client_service_logline *out;
+	const struct lmc_client_logline *line;
+	struct lmc_send_state *state;
+	struct lmc_multi multi;
+	struct lmc_merge merge;
+	int64_t start_time, end_time = INT64_MAX;
+	uint64_t charged;
+	const char *p, *times;
+	size_t n = 0, i, j, len, count = 0;
+	int valid, rc, err, over_budget;
+	char *batch;
+
+	memset(runs, 0, sizeof(runs));
+	memset(&merge, 0, sizeof(merge));
+	if (args == NULL)
+		args = "";
+	times = strchr(args, ' ');
+	valid = args[0] != '\0' && lmc_parse_times(times != NULL ? times + 1 : "", start, end) == 0;
+	if (times == NULL)
+		times = args + strlen(args);
+
+	// Pin the caches of the services, so none is freed while it is read
+	lmc_mutex_lock(&lmc_caches_lock);
+	for (p = args; valid && p < times; p += len + 1) {
+		len = strcspn(p, ", ");
+		valid = len != 0 && len < sizeof(name) && n < LMC_MULTI_MAX;
+		if (!valid)
+			break;
+		memcpy(name, p, len);
+		name[len] = '\0';
+
+		for (i = 0; i < lmc_cache_count; i++)
+			if (lmc_caches[i] != NULL && lmc_caches[i]->service_name != NULL &&
+			    strcmp(lmc_caches[i]->service_name, name) == 0)
+				break;
+		valid = i < lmc_cache_count;
+
+		// A service named twice is read once
+		for (j = 0; valid && j < n; j++)
+			if (peers[j].cache == lmc_caches[i])
+				break;
+		if (valid && j == n) {
+			peers[n].client_sock = client->client_sock;
+			peers[n].cache = lmc_caches[i];
+			lmc_caches[i]->refs++;
+			memset(tags[n], 0, sizeof(tags[n]));
+			memcpy(tags[n], name, len < sizeof(tags[n]) ? len : sizeof(tags[n]) - 1);
+			n++;
+		}
+	}
+	lmc_mutex_unlock(&lmc_caches_lock);
+
+	if (valid && start[0] != '\0' && lmc_time_key_value(lmc_time_key(start), &start_time) != 0)
+		start_time = INT64_MIN;
+	if (valid && end[0] != '\0' && lmc_time_key_value(lmc_time_key(end), &end_time) != 0)
+		end_time = INT64_MAX;
+
+	memset(&multi, 0, sizeof(multi));
+	for (i = 0; valid && i < n; i++) {
+		state = &multi.states[i];
+		state->client = &peers[i];
+		state->count = UINT64_MAX;
+		if (start[0] != '\0') {
+			state->start = start;
+			state->end = end;
+			state->start_time = start_time;
+			state->end_time = end_time;
+		}
+		lmc_mutex_lock(&peers[i].cache->lock);
+		lmc_touch_cache(peers[i].cache);
+		if (lmc_close_repeats(&peers[i]) != 0)
+			valid = 0;
+		multi.last[i] = ((struct log_in_memory *)peers[i].cache->ptr)->no_logs;
+		lmc_mutex_unlock(&peers[i].cache->lock);
+	}
 
-	// Build stats
+	charged = (uint64_t)n * LMC_MULTI_CHUNK *
+		  (sizeof(struct lmc_client_logline) + 2 * sizeof(uint64_t) + sizeof(size_t));
+	lmc_mutex_lock(&lmc_memory_lock);
+	lmc_memory_used += charged;
+	over_budget = lmc_memory_budget != 0 && lmc_memory_used > lmc_memory_budget;
+	lmc_mutex_unlock(&lmc_memory_lock);
+
+	// Make room for the runs, the lines evicted are read back from disk
+	if (over_budget)
+		lmc_enforce_memory_budget();
+
+	batch = malloc(LMC_FOLLOW_HEADER + LMC_MULTI_BATCH * sizeof(*out));
+	valid = valid && batch != NULL && lmc_merge_init(&merge, runs, n, lmc_fill_multi, &multi) == 0;
+	out = valid ? (struct lmc_client_service_logline *)(batch + LMC_FOLLOW_HEADER) : NULL;
+
+	err = valid ? 0 : -1;
+	while (err == 0 && (rc = lmc_merge_next(&merge, &line, &i)) != 0) {
+		if (rc < 0) {
+			err = -1;
+			break;
+		}
+		memcpy(out[count].service, tags[i], sizeof(out[count].service));
+		memcpy(&out[count].line, line, sizeof(out[count].line));
+		if (++count == LMC_MULTI_BATCH) {
+			err = lmc_send_multi_batch(client, batch, count);
+			count = 0;
+		}
+	}
+	if (err == 0 && count != 0)
+		err = lmc_send_multi_batch(client, batch, count);
+	if (lmc_send_multi_batch(client, header, 0) != 0)
+		err = -1;
 
-	memset(stats, 0, LMC_STATUS_MAX_SIZE);
-	sprintf(stats, LMC_STATS_FORMAT, time_buf, used_memory, log_lines_cnt);
+	lmc_merge_free(&merge);
+	for (i = 0; i < n; i++) {
+		lmc_merge_run_free(&runs[i]);
+		lmc_put_cache(&peers[i]);
+	}
+	lmc_mutex_lock(&lmc_memory_lock);
+	lmc_memory_used -= charged;
+	lmc_mutex_unlock(&lmc_memory_lock);
+	free(batch);
+	return err;
+}
 
-	// Send stats
-	buf_len = strlen(stats);
-	lmc_send(client->client_sock, stats, buf_len, LMC_SEND_FLAGS);
+/**
+ * Copy lines of the log line array to a follow batch. A line holding the
+ * repeats of the line before it is copied as a line saying how many there
+ * were. Called with the cache locked.
+ */
+static void lmc_copy_follow(struct lmc_cache *cache, int first, int count, struct lmc_client_logline *lines)
+{
+	struct lmc_client_logline *line;
+	int i;
 
-	return 0;
+	for (i = 0; i < count; i++) {
+		line = lmc_get_logline(cache, first + i);
+		memcpy(&lines[i], line, sizeof(*line));
+		if (line->logline[0] != LMC_REPEAT_MARK)
+			continue;
+		memset(lines[i].logline, 0, sizeof(lines[i].logline));
+		snprintf(lines[i].logline, sizeof(lines[i].logline), LMC_REPEAT_FORMAT, lmc_repeats_of(line));
+	}
 }
 
 /**
- * Send the stored log lines to the client.
- * The server must first send the number of lines, and then the log lines,
- * one by one.
+ * Send a follow batch: a LMC_FOLLOW_HEADER byte header, "<lines> <skipped>"
+ * or LMC_FOLLOW_END, followed by the lines, in a single message.
  *
- * @param client: Client connection.
+ * @param client: Client connection;
+ * @param batch: Header, followed by the lines;
+ * @param count: Number of lines, or -1 for the batch ending the follow;
+ * @param skipped: Lines added since the batch before and not sent.
  *
  * @return: 0 in case of success, or -1 otherwise.
- *
- * TODO DONE: Implement proper handling logic.
  */
-static int lmc_send_loglines(struct lmc_client *client)
+static int lmc_send_follow(struct lmc_client *client, char *batch, int count, uint64_t skipped)
 {
-	struct log_in_memory *lim = client->cache->ptr;
-	unsigned long number_of_lines = lim->no_logs;
-	char buffer[128];
-	int i;
-
-	sprintf(buffer, "%ld", number_of_lines);
-	lmc_send(client->client_sock, buffer, sizeof(buffer), LMC_SEND_FLAGS);
-
-	for (i = 0; i < number_of_lines; i++) {
-		lmc_send(client->client_sock, &(lim->list_of_logs[i]), sizeof(struct lmc_client_logline),
-			 LMC_SEND_FLAGS);
-	}
+	memset(batch, 0, LMC_FOLLOW_HEADER);
+	if (count < 0)
+		snprintf(batch, LMC_FOLLOW_HEADER, "%s", LMC_FOLLOW_END);
+	else
+		snprintf(batch, LMC_FOLLOW_HEADER, "%d " UINT64_FMT, count, skipped);
+	if (count < 0)
+		count = 0;
 
-	return 0;
+	return lmc_send(client->client_sock, batch, LMC_FOLLOW_HEADER + count * sizeof(struct lmc_client_logline),
+			LMC_SEND_FLAGS) < 0 ? -1 : 0;
 }
 
-static int is_in_interval(char *time, char *start, char *end)
+/**
+ * Follow the log lines of the client's service: send the lines added to the
+ * cache as they come, oldest first, until the client sends a command, which
+ * ends the follow without being run, or the service unsubscribes. Adding a
+ * line only wakes the followers; they copy the new lines, up to
+ * LMC_FOLLOW_BATCH at a time, and send them with the cache unlocked, so a
+ * slow follower never holds back the services adding lines. Lines a
+ * follower was too slow for, compressed or overwritten before it got to
+ * them, are skipped and counted in the next batch. Without new lines, an
+ * empty batch is sent every LMC_FOLLOW_HEARTBEAT polls. The last batch has
+ * the LMC_FOLLOW_END header. Repeats not stored yet are sent once they are
+ * stored, as a line saying how many there were.
+ *
+ * @param client: Client connection;
+ * @param args: "[t1]": also send the lines of the log line array from the
+ *              first one at or after t1, or NULL to only send new lines.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_follow_cache(struct lmc_client *client, const char *args)
 {
-	if (end[0] == '\0') {
-		// nu exista end
-		return strcmp(time, start) >= 0;
+	char start[LMC_TIME_SIZE], end[LMC_TIME_SIZE], command[LMC_COMMAND_SIZE];
+	struct lmc_cache *cache = client->cache;
+	struct log_in_memory *lim = cache->ptr;
+	struct lmc_client_logline *lines;
+	uint64_t key, from, skipped = 0;
+	int next, first, count, idle = 0, err = 0;
+	char *batch;
+
+	if (lmc_parse_times(args != NULL ? args : "", start, end) != 0 || end[0] != '\0')
+		return -1;
+	batch = malloc(LMC_FOLLOW_HEADER + LMC_FOLLOW_BATCH * sizeof(*lines));
+	if (batch == NULL)
+		return -1;
+	lines = (struct lmc_client_logline *)(batch + LMC_FOLLOW_HEADER);
+
+	lmc_mutex_lock(&cache->lock);
+	cache->followers++;
+	lmc_touch_cache(cache);
+	next = lim->no_logs;
+	if (start[0] != '\0') {
+		from = lmc_time_key(start);
+		for (next = lmc_first_in_array(lim); next < lim->no_logs; next++) {
+			key = lmc_column_get(&cache->times, next);
+			if (key != LMC_TIME_KEY_NONE ? key >= from : strcmp(lmc_get_logline(cache, next)->time, start) >= 0)
+				break;
+		}
 	}
-	return strcmp(time, start) >= 0 && strcmp(time, end) <= 0;
-}
+	lmc_mutex_unlock(&cache->lock);
+
+	while (1) {
+		lmc_mutex_lock(&cache->lock);
+		if (next == lim->no_logs && !cache->unsubscribed &&
+		    lmc_cond_wait_os(&cache->follow, &cache->lock, LMC_FOLLOW_POLL) != 0)
+			idle++;
+		if (cache->unsubscribed) {
+			lmc_mutex_unlock(&cache->lock);
+			break;
+		}
+		first = lmc_first_in_array(lim);
+		if (next < first) {
+			skipped += first - next;
+			next = first;
+		}
+		count = lim->no_logs - next;
+		if (count > LMC_FOLLOW_BATCH)
+			count = LMC_FOLLOW_BATCH;
+		lmc_copy_follow(cache, next, count, lines);
+		next += count;
+		lmc_mutex_unlock(&cache->lock);
+
+		// A closed connection ends the follow too
+		if (lmc_readable_os(client->client_sock)) {
+			if (lmc_recv(client->client_sock, command, sizeof(command), 0) <= 0)
+				err = -1;
+			break;
+		}
+		if (count == 0 && skipped == 0 && idle < LMC_FOLLOW_HEARTBEAT)
+			continue;
 
-static int lmc_send_loglines_interval(struct lmc_client *client, char *args)
-{
+		if (lmc_send_follow(client, batch, count, skipped) != 0) {
+			err = -1;
+			break;
+		}
+		skipped = 0;
+		idle = 0;
+	}
 
-	char time1[21];
-	char time2[21];
+	lmc_mutex_lock(&cache->lock);
+	cache->followers--;
+	lmc_mutex_unlock(&cache->lock);
 
-	struct log_in_memory *lim = client->cache->ptr;
-	unsigned long number_of_lines = lim->no_logs;
-	char buffer[128];
-	int i;
+	if (err == 0)
+		err = lmc_send_follow(client, batch, -1, 0);
+	free(batch);
+	return err;
+}
 
-	memset(time1, 0, sizeof(time1));
-	memset(time2, 0, sizeof(time2));
+static int lmc_cmp_templates(const void *a, const void *b)
+{
+	const struct lmc_template *ta = *(const struct lmc_template **)a;
+	const struct lmc_template *tb = *(const struct lmc_template **)b;
 
-	memcpy(time1, args, sizeof(time1) - 1);
-	memcpy(time2, args, sizeof(time2) - 1);
+	return ta->count < tb->count ? 1 : ta->count > tb->count ? -1 : 0;
+}
 
-	sprintf(buffer, "%ld", number_of_lines);
-	lmc_send(client->client_sock, buffer, sizeof(buffer), LMC_SEND_FLAGS);
+/**
+ * Send the templates mined from the log lines of the client's service, most
+ * used first. The server first sends the number of templates, then every
+ * template as "<lines> <template>", with LMC_TEMPLATE_PARAM in place of the
+ * parameters. Called with the cache locked.
+ *
+ * @param client: Client connection.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+static int lmc_send_templates(struct lmc_client *client)
+{
+	struct lmc_templates *templates = &client->cache->templates;
+	struct lmc_template *sorted[LMC_TEMPLATE_MAX];
+	char buffer[LMC_COMMAND_SIZE];
+	size_t len;
+	uint16_t i;
+
+	for (i = 0; i < templates->count; i++)
+		sorted[i] = &templates->list[i];
+	qsort(sorted, templates->count, sizeof(*sorted), lmc_cmp_templates);
+
+	sprintf(buffer, "%u", templates->count);
+	if (lmc_send(client->client_sock, buffer, 128, LMC_SEND_FLAGS) < 0)
+		return -1;
 
-	for (i = 0; i < number_of_lines; i++) {
-		if (is_in_interval(lim->list_of_logs[i].time, time1, time2)) {
-			lmc_send(client->client_sock, &(lim->list_of_logs[i]), sizeof(struct lmc_client_logline),
-				 LMC_SEND_FLAGS);
-		}
+	for (i = 0; i < templates->count; i++) {
+		len = sprintf(buffer, UINT64_FMT " ", sorted[i]->count);
+		len += lmc_template_format(templates, (uint16_t)(sorted[i] - templates->list), buffer + len,
+					   sizeof(buffer) - len);
+		if (lmc_send(client->client_sock, buffer, len + 1, LMC_SEND_FLAGS) < 0)
+			return -1;
 	}
 
 	return 0;
@@ -361,21 +2421,38 @@ static int lmc_send_loglines_interval(struct lmc_client *client, char *args)
  * Parse a command from the client. The command must be in the following format:
  * "cmd data", with a single space between the command and the associated data.
  *
- * @param cmd: Parsed command structure;
- * @param string: Command string;
+ * @param cmd: Parsed command structure. The data is allocated from the
+ *             command pool;
+ * @param string: Command string, in a buffer of LMC_COMMAND_SIZE bytes,
+ *                zeroed past the command;
  * @param datalen: The amount of data send with the command.
+ *
+ * @return: 0 in case of success, or -1 if the command pool is out of memory.
  */
-static void lmc_parse_command(struct lmc_command *cmd, char *string, ssize_t *datalen)
+static int lmc_parse_command(struct lmc_command *cmd, char *string, ssize_t *datalen)
 {
 	char *command, *line;
+	size_t len;
 
-	command = strdup(string);
+	command = lmc_pool_alloc(&lmc_command_pool);
+	if (command == NULL)
+		return -1;
+	memcpy(command, string, LMC_COMMAND_SIZE);
+	command[LMC_COMMAND_SIZE - 1] = '\0';
 	line = strchr(command, ' ');
 
 	cmd->data = NULL;
 	if (line != NULL) {
 		line[0] = '\0';
-		cmd->data = strdup(line + 1);
+		// Whole buffer, readers of fixed-size fields only see zeroes past the data
+		len = LMC_COMMAND_SIZE - (line + 1 - command);
+		cmd->data = lmc_pool_alloc(&lmc_command_pool);
+		if (cmd->data == NULL) {
+			lmc_pool_free(&lmc_command_pool, command);
+			return -1;
+		}
+		memcpy(cmd->data, line + 1, len);
+		memset(cmd->data + len, 0, LMC_COMMAND_SIZE - len);
 		*datalen -= strlen(command) + 1;
 	}
 
@@ -383,7 +2460,8 @@ static void lmc_parse_command(struct lmc_command *cmd, char *string, ssize_t *da
 
 	printf("command = %s, line = %s\n", cmd->op->op_str, cmd->data ? cmd->data : "null");
 
-	free(command);
+	lmc_pool_free(&lmc_command_pool, command);
+	return 0;
 }
 
 /**
@@ -410,12 +2488,16 @@ static int lmc_validate_arg(const char *line, size_t len)
  * @brief Creates a new logline
  *
  * @param cmd to extract log data from
- * @return struct lmc_client_logline* newly crated logline
+ * @return struct lmc_client_logline* newly crated logline, or NULL if the
+ *         line pool is out of memory
  */
 struct lmc_client_logline *lmc_create_logline(struct lmc_command cmd)
 {
 	// Alloc struct
-	struct lmc_client_logline *log = malloc(sizeof(struct lmc_client_logline));
+	struct lmc_client_logline *log = lmc_pool_alloc(&lmc_line_pool);
+
+	if (log == NULL)
+		return NULL;
 
 	// Copy data to fields
 	memcpy(log->time, cmd.data, LMC_TIME_SIZE);
@@ -442,9 +2524,13 @@ int lmc_get_command(struct lmc_client *client)
 	int err;
 	ssize_t recv_size;
 	char buffer[LMC_COMMAND_SIZE], response[LMC_LINE_SIZE];
-	char *reply_msg;
+	char *reply_msg, reply_buf[LMC_LINE_SIZE / 2];
 	struct lmc_command cmd;
 	struct lmc_client_logline *log;
+	uint64_t durable_seq;
+	int over_budget, collapsed;
+	char *args;
+	size_t len;
 
 	int flag = 0;
 
@@ -458,13 +2544,16 @@ int lmc_get_command(struct lmc_client *client)
 	if (recv_size <= 0)
 		return -1;
 
-	lmc_parse_command(&cmd, buffer, &recv_size);
+	if (lmc_parse_command(&cmd, buffer, &recv_size) != 0) {
+		reply_msg = "out of memory";
+		goto end;
+	}
 	if (recv_size > LMC_LINE_SIZE) {
 		reply_msg = "message too long";
 		goto end;
 	}
 
-	if (cmd.op->requires_auth && client->cache->service_name == NULL) {
+	if (cmd.op->requires_auth && client->cache == NULL) {
 		reply_msg = "authentication required";
 		goto end;
 	}
@@ -477,6 +2566,8 @@ int lmc_get_command(struct lmc_client *client)
 		}
 	}
 
+	reply_msg = cmd.op->op_reply;
+
 	switch (cmd.op->code) {
 	case LMC_CONNECT:
 		err = lmc_connect_client(client, cmd.data);
@@ -485,20 +2576,35 @@ int lmc_get_command(struct lmc_client *client)
 		err = lmc_add_client(client, cmd.data);
 		break;
 	case LMC_STAT:
+		lmc_mutex_lock(&client->cache->lock);
 		err = lmc_send_stats(client);
+		lmc_mutex_unlock(&client->cache->lock);
 		break;
 	case LMC_ADD:
 		/* Parse the client data and create a log line structure */
 		log = lmc_create_logline(cmd);
+		if (log == NULL) {
+			err = -1;
+			break;
+		}
 
 		// Call command handler
-		err = lmc_add_log(client, log);
+		err = lmc_add_log(client, log, &over_budget);
 
 		// Free aux resources
-		free(log);
+		lmc_pool_free(&lmc_line_pool, log);
+
+		// Make room in memory, outside of the cache lock
+		if (over_budget)
+			lmc_enforce_memory_budget();
 		break;
 	case LMC_FLUSH:
-		err = lmc_flush(client);
+		err = lmc_flush(client, &durable_seq);
+		if (err == 0) {
+			snprintf(reply_buf, sizeof(reply_buf), "%s, durable seq " UINT64_FMT,
+				 cmd.op->op_reply, durable_seq);
+			reply_msg = reply_buf;
+		}
 		break;
 	case LMC_DISCONNECT:
 		err = lmc_disconnect_client(client);
@@ -509,11 +2615,59 @@ int lmc_get_command(struct lmc_client *client)
 		err = lmc_unsubscribe_client(client);
 		break;
 	case LMC_GETLOGS:
-		if (cmd.data != NULL) {
-			err = lmc_send_loglines_interval(client, cmd.data);
+		// "getlogs since <cursor> [max]" sends the lines after cursor
+		len = strlen(LMC_GETLOGS_SINCE);
+		if (cmd.data != NULL && strncmp(cmd.data, LMC_GETLOGS_SINCE, len) == 0 &&
+		    (cmd.data[len] == ' ' || cmd.data[len] == '\0')) {
+			err = lmc_send_since(client, cmd.data[len] == ' ' ? cmd.data + len + 1 : NULL);
+			break;
+		}
+
+		// "getlogs regex <regex> [t1 [t2]]" sends the lines matching it
+		len = strlen(LMC_GETLOGS_REGEX);
+		if (cmd.data != NULL && strncmp(cmd.data, LMC_GETLOGS_REGEX, len) == 0 && cmd.data[len] == ' ') {
+			err = lmc_send_search(client, cmd.data + len + 1, 1);
+			break;
+		}
+
+		// "getlogs collapsed [t1 [t2]]" sends repeats as one line
+		len = strlen(LMC_GETLOGS_COLLAPSED);
+		collapsed = cmd.data != NULL && strncmp(cmd.data, LMC_GETLOGS_COLLAPSED, len) == 0 &&
+			    (cmd.data[len] == ' ' || cmd.data[len] == '\0');
+		args = cmd.data;
+		if (collapsed)
+			args = cmd.data[len] == ' ' ? cmd.data + len + 1 : NULL;
+		lmc_mutex_lock(&client->cache->lock);
+		if (args != NULL) {
+			err = lmc_send_loglines_interval(client, args, collapsed);
 		} else {
-			err = lmc_send_loglines(client);
+			err = lmc_send_loglines(client, collapsed);
 		}
+		lmc_mutex_unlock(&client->cache->lock);
+		break;
+	case LMC_TEMPLATES:
+		lmc_mutex_lock(&client->cache->lock);
+		err = lmc_send_templates(client);
+		lmc_mutex_unlock(&client->cache->lock);
+		break;
+	case LMC_SEARCH:
+		err = lmc_send_search(client, cmd.data, 0);
+		break;
+	case LMC_COUNT:
+		err = lmc_send_count(client, cmd.data, 0);
+		break;
+	case LMC_HISTOGRAM:
+		err = lmc_send_count(client, cmd.data, 1);
+		break;
+	case LMC_FOLLOW:
+		err = lmc_follow_cache(client, cmd.data);
+		break;
+	case LMC_UNFOLLOW:
+		// Only ends a follow, which handles it
+		err = -1;
+		break;
+	case LMC_GETLOGS_MULTI:
+		err = lmc_send_multi(client, cmd.data);
 		break;
 	default:
 		/* unknown command */
@@ -521,8 +2675,6 @@ int lmc_get_command(struct lmc_client *client)
 		break;
 	}
 
-	reply_msg = cmd.op->op_reply;
-
 end:
 	if (err == 0)
 		sprintf(response, "%s", reply_msg);
@@ -530,7 +2682,7 @@ end:
 		sprintf(response, "FAILED: %s", reply_msg);
 
 	if (cmd.data != NULL)
-		free(cmd.data);
+		lmc_pool_free(&lmc_command_pool, cmd.data);
 	if (flag == 0) {
 		return lmc_send(client->client_sock, response, LMC_LINE_SIZE, LMC_SEND_FLAGS);
 	}
@@ -548,6 +2700,12 @@ int main(int argc, char *argv[])
 	else
 		lmc_logfile_path = strdup(argv[1]);
 
+	// Bytes of log lines kept in memory, 0 for no limit
+	if (argc > 2 && lmc_parse_number(argv[2], &lmc_memory_budget) != 0) {
+		fprintf(stderr, "Usage: %s [logdir [memory_budget]]\n", argv[0]);
+		exit(-1);
+	}
+
 	if (lmc_init_logdir(lmc_logfile_path) < 0)
 		exit(-1);
 
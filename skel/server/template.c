@@ -0,0 +1,337 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/template.h"
+#include "../include/utils.h"
+
+/**
+ * Tokens of a line. Contains:
+ * @field count: Number of tokens;
+ * @field start: Start of every token in the line;
+ * @field len: Length of every token.
+ */
+struct lmc_tokens {
+	int count;
+	const char *start[LMC_TEMPLATE_TOKENS];
+	uint8_t len[LMC_TEMPLATE_TOKENS];
+};
+
+/**
+ * Split a log line into tokens at spaces. Tokens may be empty, so joining
+ * them with single spaces gives the line back.
+ */
+static void lmc_tokenize(const char *line, struct lmc_tokens *t)
+{
+	const char *end = line + strnlen(line, LMC_LOGLINE_SIZE - 1), *sp;
+
+	t->count = 0;
+	while (t->count < LMC_TEMPLATE_TOKENS) {
+		sp = memchr(line, ' ', end - line);
+		t->start[t->count] = line;
+		t->len[t->count] = (uint8_t)((sp ? sp : end) - line);
+		t->count++;
+		if (sp == NULL)
+			break;
+		line = sp + 1;
+	}
+}
+
+static int lmc_has_digit(const char *token, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if (token[i] >= '0' && token[i] <= '9')
+			return 1;
+	return 0;
+}
+
+/**
+ * Bucket of the templates a line can match: same number of tokens and same
+ * first token, unless the first token is a parameter.
+ */
+static unsigned int lmc_template_bucket(const struct lmc_tokens *t)
+{
+	uint32_t h = 2166136261U ^ (uint32_t)t->count;
+	uint8_t i;
+
+	if (!lmc_has_digit(t->start[0], t->len[0]))
+		for (i = 0; i < t->len[0]; i++)
+			h = (h ^ (uint8_t)t->start[0][i]) * 16777619U;
+
+	return h % LMC_TEMPLATE_BUCKETS;
+}
+
+static int lmc_token_is(const struct lmc_template *tpl, int i, const struct lmc_tokens *t)
+{
+	const char *text = tpl->text + tpl->offsets[i];
+
+	return strlen(text) == t->len[i] && memcmp(text, t->start[i], t->len[i]) == 0;
+}
+
+/**
+ * Set up an empty set of templates.
+ *
+ * @param templates: Templates of the service.
+ */
+void lmc_templates_init(struct lmc_templates *templates)
+{
+	memset(templates, 0, sizeof(*templates));
+	memset(templates->buckets, 0xff, sizeof(templates->buckets));
+}
+
+/**
+ * Free the templates of a service.
+ *
+ * @param templates: Templates of the service.
+ */
+void lmc_templates_free(struct lmc_templates *templates)
+{
+	while (templates->count > 0)
+		free(templates->list[--templates->count].offsets);
+	free(templates->list);
+	lmc_templates_init(templates);
+}
+
+/**
+ * Create a template from the tokens of a line.
+ *
+ * @return: ID of the template, or -1 if there is no room for it.
+ */
+static int lmc_template_create(struct lmc_templates *templates, const struct lmc_tokens *t, unsigned int bucket)
+{
+	struct lmc_template *tpl, *list;
+	size_t text_len = 0;
+	uint16_t max;
+	int i;
+
+	if (templates->count == LMC_TEMPLATE_MAX)
+		return -1;
+	if (templates->count == templates->max) {
+		max = templates->max ? 2 * templates->max : 16;
+		list = realloc(templates->list, max * sizeof(*list));
+		if (list == NULL)
+			return -1;
+		templates->list = list;
+		templates->max = max;
+	}
+
+	for (i = 0; i < t->count; i++)
+		text_len += t->len[i] + 1;
+
+	tpl = &templates->list[templates->count];
+	tpl->offsets = malloc(2 * t->count + text_len);
+	if (tpl->offsets == NULL)
+		return -1;
+	tpl->param = tpl->offsets + t->count;
+	tpl->text = (char *)tpl->param + t->count;
+	tpl->tokens = (uint16_t)t->count;
+	tpl->version = 1;
+	tpl->count = 0;
+
+	for (i = 0, text_len = 0; i < t->count; i++) {
+		tpl->offsets[i] = (uint8_t)text_len;
+		tpl->param[i] = lmc_has_digit(t->start[i], t->len[i]) ? 1 : 0;
+		memcpy(tpl->text + text_len, t->start[i], t->len[i]);
+		text_len += t->len[i];
+		tpl->text[text_len++] = '\0';
+	}
+
+	tpl->next = templates->buckets[bucket];
+	templates->buckets[bucket] = templates->count;
+	return templates->count++;
+}
+
+/**
+ * Find the template of a log line, adding the line to it. The template is
+ * generalized if the line differs from it in some constant tokens, and a new
+ * one is created if no template is similar enough.
+ *
+ * @param templates: Templates of the service;
+ * @param line: Log line.
+ *
+ * @return: ID of the template, or -1 if there is none.
+ */
+int lmc_template_learn(struct lmc_templates *templates, const char *line)
+{
+	struct lmc_template *tpl, *best = NULL;
+	struct lmc_tokens t;
+	unsigned int bucket;
+	int i, sim, best_sim = -1, changed, id;
+	uint16_t n;
+
+	lmc_tokenize(line, &t);
+	bucket = lmc_template_bucket(&t);
+
+	for (n = templates->buckets[bucket]; n != LMC_TEMPLATE_NONE; n = tpl->next) {
+		tpl = &templates->list[n];
+		// Buckets are shared, the first token has to be the same
+		if (tpl->tokens != t.count || (tpl->param[0] == 0 && !lmc_token_is(tpl, 0, &t)))
+			continue;
+
+		// Parameters count as shared if the token looks like one too
+		for (i = 0, sim = 0; i < t.count; i++)
+			if (tpl->param[i] ? lmc_has_digit(t.start[i], t.len[i]) : lmc_token_is(tpl, i, &t))
+				sim++;
+		if (sim > best_sim) {
+			best = tpl;
+			best_sim = sim;
+		}
+	}
+
+	if (best == NULL || best_sim * 100 < t.count * LMC_TEMPLATE_SIMILARITY) {
+		id = lmc_template_create(templates, &t, bucket);
+		if (id < 0) {
+			templates->unmatched++;
+			return -1;
+		}
+		best = &templates->list[id];
+	}
+
+	for (i = 0, changed = 0; i < t.count && best->version < UINT8_MAX; i++) {
+		if (best->param[i] == 0 && !lmc_token_is(best, i, &t)) {
+			best->param[i] = best->version + 1;
+			changed = 1;
+		}
+	}
+	best->version += changed;
+	best->count++;
+
+	return (int)(best - templates->list);
+}
+
+/**
+ * Encode a log line as a template and its parameters. The line is matched
+ * against the templates, but does not change them.
+ *
+ * @param templates: Templates of the service;
+ * @param line: Log line;
+ * @param buf: Buffer of LMC_LOGLINE_SIZE bytes receiving the encoded line.
+ *
+ * @return: Size of the encoded line, or 0 if no template matches it or the
+ *          encoded line would not be shorter than the line.
+ */
+size_t lmc_template_encode(struct lmc_templates *templates, const char *line, char *buf)
+{
+	struct lmc_template *tpl;
+	struct lmc_tokens t;
+	size_t len = 4, line_len = strnlen(line, LMC_LOGLINE_SIZE - 1);
+	int i;
+	uint16_t n;
+
+	if (templates->count == 0)
+		return 0;
+
+	lmc_tokenize(line, &t);
+	for (n = templates->buckets[lmc_template_bucket(&t)]; n != LMC_TEMPLATE_NONE; n = tpl->next) {
+		tpl = &templates->list[n];
+		if (tpl->tokens != t.count)
+			continue;
+		for (i = 0; i < t.count; i++)
+			if (tpl->param[i] == 0 && !lmc_token_is(tpl, i, &t))
+				break;
+		if (i == t.count)
+			break;
+	}
+	if (n == LMC_TEMPLATE_NONE)
+		return 0;
+
+	buf[0] = LMC_TEMPLATE_MARK;
+	buf[1] = (char)(n & 0xff);
+	buf[2] = (char)(n >> 8);
+	buf[3] = (char)tpl->version;
+	for (i = 0; i < t.count; i++) {
+		if (tpl->param[i] == 0)
+			continue;
+		if (len + t.len[i] + 1 > line_len)
+			return 0;
+		memcpy(buf + len, t.start[i], t.len[i]);
+		len += t.len[i];
+		buf[len++] = '\0';
+	}
+
+	return len < line_len + 1 ? len : 0;
+}
+
+/**
+ * Decode a log line encoded by lmc_template_encode. The encoded data is
+ * validated, corrupted data is never read or written out of bounds.
+ *
+ * @param templates: Templates of the service;
+ * @param data: Encoded line;
+ * @param left: Number of bytes available at data;
+ * @param line: Buffer of LMC_LOGLINE_SIZE bytes receiving the line.
+ *
+ * @return: Size of the encoded line, or 0 if it is corrupted.
+ */
+size_t lmc_template_decode(struct lmc_templates *templates, const char *data, size_t left, char *line)
+{
+	struct lmc_template *tpl;
+	const char *token;
+	size_t pos = 4, len = 0, token_len;
+	uint16_t id;
+	uint8_t version;
+	int i;
+
+	if (left < 4 || data[0] != LMC_TEMPLATE_MARK)
+		return 0;
+	id = (uint8_t)data[1] | (uint8_t)data[2] << 8;
+	version = (uint8_t)data[3];
+	if (id >= templates->count)
+		return 0;
+	tpl = &templates->list[id];
+	if (version == 0 || version > tpl->version)
+		return 0;
+
+	for (i = 0; i < tpl->tokens; i++) {
+		if (tpl->param[i] != 0 && tpl->param[i] <= version) {
+			token = data + pos;
+			token_len = strnlen(token, left - pos);
+			if (token_len == left - pos)
+				return 0;
+			pos += token_len + 1;
+		} else {
+			token = tpl->text + tpl->offsets[i];
+			token_len = strlen(token);
+		}
+
+		if (len + (i != 0) + token_len >= LMC_LOGLINE_SIZE)
+			return 0;
+		if (i != 0)
+			line[len++] = ' ';
+		memcpy(line + len, token, token_len);
+		len += token_len;
+	}
+	line[len] = '\0';
+
+	return pos;
+}
+
+/**
+ * Text of a template, with LMC_TEMPLATE_PARAM in place of its parameters.
+ *
+ * @param templates: Templates of the service;
+ * @param id: ID of the template;
+ * @param buf: Buffer receiving the text;
+ * @param size: Size of the buffer.
+ *
+ * @return: Length of the text, truncated to fit in the buffer.
+ */
+size_t lmc_template_format(struct lmc_templates *templates, uint16_t id, char *buf, size_t size)
+{
+	struct lmc_template *tpl = &templates->list[id];
+	size_t len = 0;
+	int i;
+
+	buf[0] = '\0';
+	for (i = 0; i < tpl->tokens && len < size; i++)
+		len += snprintf(buf + len, size - len, "%s%s", i != 0 ? " " : "",
+				tpl->param[i] ? LMC_TEMPLATE_PARAM : tpl->text + tpl->offsets[i]);
+
+	return len < size ? len : size - 1;
+}
@@ -0,0 +1,407 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/lz.h"
+#include "../include/segment.h"
+#include "../include/server.h"
+
+/**
+ * Pack log lines like the records of a segment block: the timestamp and the
+ * log line, each terminated by a NUL byte. Lines matching a template of the
+ * service are packed as the template and their parameters instead, which
+ * leaves the compression only the parameters to deal with. Called with the
+ * cache locked.
+ *
+ * @param cache: Cache of the service;
+ * @param first: Number of lines added before the first line to pack;
+ * @param count: Number of lines to pack;
+ * @param buf: Buffer of count * LMC_LINE_SIZE bytes;
+ * @param grams: Receives the grams of the lines, or NULL. Set to NULL if
+ *               some could not be added.
+ *
+ * @return: Size of the packed lines.
+ */
+static uint32_t lmc_warm_pack(struct lmc_cache *cache, int first, uint32_t count, char *buf,
+			      struct lmc_bloom_grams **grams)
+{
+	struct lmc_client_logline *line;
+	char encoded[LMC_LOGLINE_SIZE];
+	size_t time_len, line_len, encoded_len;
+	uint32_t len = 0, i;
+
+	for (i = 0; i < count; i++) {
+		line = lmc_get_logline(cache, first + i);
+		time_len = strnlen(line->time, LMC_TIME_SIZE - 1);
+		line_len = strnlen(line->logline, LMC_LOGLINE_SIZE - 1);
+		if (*grams != NULL && lmc_bloom_add(*grams, line->logline, line_len) != 0)
+			*grams = NULL;
+
+		memcpy(buf + len, line->time, time_len);
+		len += time_len;
+		buf[len++] = '\0';
+
+		encoded_len = cache->opts.templates ? lmc_template_encode(&cache->templates, line->logline, encoded) : 0;
+		if (encoded_len != 0) {
+			memcpy(buf + len, encoded, encoded_len);
+			len += encoded_len;
+			continue;
+		}
+		memcpy(buf + len, line->logline, line_len);
+		len += line_len;
+		buf[len++] = '\0';
+	}
+
+	return len;
+}
+
+/**
+ * Encode the times of the lines of a warm segment, so they can be counted
+ * without decompressing the lines, and keep the oldest and the newest.
+ *
+ * @param keys: Keys of the times of the lines, from the time column;
+ * @param count: Number of lines;
+ * @param segment: Segment receiving the times. It gets none if some time
+ *                 is not in LMC_TIME_FORMAT or in case of an error.
+ */
+static void lmc_warm_times(const uint64_t *keys, uint32_t count, struct lmc_warm_segment *segment)
+{
+	int64_t *times, t = 0;
+	char *buf, *encoded;
+	uint32_t i;
+	size_t len;
+
+	segment->times = NULL;
+	segment->times_len = 0;
+	segment->first_time = 1;
+	segment->last_time = 0;
+
+	times = malloc(count * sizeof(*times));
+	buf = malloc(sizeof(*times) + 10 * (size_t)count);
+	if (times == NULL || buf == NULL)
+		goto out;
+	for (i = 0; i < count; i++) {
+		// Lines mostly have the time of the line before
+		if ((i == 0 || keys[i] != keys[i - 1]) && lmc_time_key_value(keys[i], &t) != 0)
+			goto out;
+		times[i] = t;
+		if (i == 0 || t < segment->first_time)
+			segment->first_time = t;
+		if (i == 0 || t > segment->last_time)
+			segment->last_time = t;
+	}
+
+	len = lmc_times_encode(times, count, buf);
+	encoded = realloc(buf, len);
+	segment->times = encoded != NULL ? encoded : buf;
+	segment->times_len = (uint32_t)len;
+	buf = NULL;
+out:
+	if (segment->times == NULL) {
+		segment->first_time = 1;
+		segment->last_time = 0;
+	}
+	free(buf);
+	free(times);
+}
+
+/**
+ * Decode the next packed line.
+ *
+ * @return: Size of the packed line, or 0 if it is corrupted.
+ */
+static size_t lmc_warm_unpack(struct lmc_cache *cache, const char *data, size_t left,
+			      struct lmc_client_logline *line)
+{
+	const char *text;
+	size_t time_len, line_len;
+
+	time_len = strnlen(data, left);
+	if (time_len == left || time_len >= LMC_TIME_SIZE)
+		return 0;
+	text = data + time_len + 1;
+	left -= time_len + 1;
+
+	memset(line, 0, sizeof(*line));
+	memcpy(line->time, data, time_len);
+	if (left != 0 && text[0] == LMC_TEMPLATE_MARK) {
+		line_len = lmc_template_decode(&cache->templates, text, left, line->logline);
+		return line_len ? time_len + 1 + line_len : 0;
+	}
+
+	line_len = strnlen(text, left);
+	if (line_len == left || line_len >= LMC_LOGLINE_SIZE)
+		return 0;
+
+	memcpy(line->logline, text, line_len);
+
+	return time_len + line_len + 2;
+}
+
+/**
+ * Compress the oldest LMC_WARM_LINES lines of a cache held in its log line
+ * array into a warm segment and release their memory. Only lines already on
+ * disk are compressed, and the newest lines are left as they are, since
+ * most queries read them. Ring caches are never compressed. The cache is
+ * only locked to pack the lines and to install the segment, so adds are not
+ * held back by the compression.
+ *
+ * @param cache: Cache of the service;
+ * @param hot_lines: Number of newest lines to leave in the array.
+ *
+ * @return: 1 if a segment was compressed, 0 if there was nothing to
+ *          compress, or -1 in case of an error.
+ */
+int lmc_compress_cache(struct lmc_cache *cache, size_t hot_lines)
+{
+	struct log_in_memory *lim = cache->ptr;
+	struct lmc_warm_segment *segment, *warm, times;
+	struct lmc_bloom_grams set = { NULL, 0, 0 }, *grams = NULL;
+	char *packed, *stored = NULL, *data;
+	uint8_t *filter = NULL;
+	uint64_t *keys;
+	size_t size, max, filter_len = 0;
+	uint32_t raw_len, i;
+	int first, err = -1;
+
+	lmc_mutex_lock(&cache->lock);
+	first = lim->no_logs_compressed;
+	if (cache->unsubscribed || cache->ring_lines != 0 || first + LMC_WARM_LINES > lim->no_logs_stored_on_disk ||
+	    first + LMC_WARM_LINES + hot_lines > (size_t)lim->no_logs) {
+		lmc_mutex_unlock(&cache->lock);
+		return 0;
+	}
+	packed = malloc(LMC_WARM_LINES * sizeof(struct lmc_client_logline));
+	keys = malloc(LMC_WARM_LINES * sizeof(*keys));
+	if (packed == NULL || keys == NULL) {
+		lmc_mutex_unlock(&cache->lock);
+		free(packed);
+		free(keys);
+		return -1;
+	}
+	if (cache->opts.bloom && lmc_bloom_init(&set) == 0)
+		grams = &set;
+	raw_len = lmc_warm_pack(cache, first, LMC_WARM_LINES, packed, &grams);
+	for (i = 0; i < LMC_WARM_LINES; i++)
+		keys[i] = lmc_column_get(&cache->times, first + i);
+	lmc_mutex_unlock(&cache->lock);
+
+	lmc_warm_times(keys, LMC_WARM_LINES, &times);
+	free(keys);
+
+	// A segment without a filter is searched like before
+	if (grams != NULL) {
+		filter_len = lmc_bloom_size(grams);
+		filter = malloc(filter_len);
+		if (filter != NULL)
+			lmc_bloom_build(grams, filter, filter_len);
+		else
+			filter_len = 0;
+	}
+	lmc_bloom_free(&set);
+
+	stored = malloc(lmc_lz_bound(raw_len));
+	if (stored == NULL)
+		goto out;
+	size = lmc_lz_compress(packed, raw_len, stored, lmc_lz_bound(raw_len));
+	if (size != 0 && size < raw_len) {
+		data = realloc(stored, size);
+		if (data == NULL)
+			goto out;
+		stored = NULL;
+	} else {
+		size = raw_len;
+		data = realloc(packed, size);
+		if (data == NULL)
+			goto out;
+		packed = NULL;
+	}
+
+	lmc_mutex_lock(&cache->lock);
+	// Evicted or unsubscribed in the meantime, the lines are gone
+	if (cache->unsubscribed || lim->no_logs_compressed != first) {
+		err = 0;
+		goto out_unlock;
+	}
+
+	if (cache->warm_count == cache->warm_max) {
+		max = cache->warm_max ? 2 * cache->warm_max : 16;
+		warm = realloc(cache->warm, max * sizeof(*warm));
+		if (warm == NULL)
+			goto out_unlock;
+		cache->warm = warm;
+		cache->warm_max = max;
+	}
+	if (lmc_release_lines_os(cache, LMC_WARM_LINES) != 0)
+		goto out_unlock;
+
+	segment = &cache->warm[cache->warm_count++];
+	segment->lines = LMC_WARM_LINES;
+	segment->raw_len = raw_len;
+	segment->size = (uint32_t)size;
+	segment->data = data;
+	segment->since = time(NULL);
+	segment->filter = filter;
+	segment->filter_len = (uint32_t)filter_len;
+	segment->times = times.times;
+	segment->times_len = times.times_len;
+	segment->first_time = times.first_time;
+	segment->last_time = times.last_time;
+	data = NULL;
+	filter = NULL;
+	times.times = NULL;
+	cache->warm_bytes += size + filter_len + segment->times_len;
+	lmc_charge_memory(cache);
+	err = 1;
+
+out_unlock:
+	lmc_mutex_unlock(&cache->lock);
+	free(data);
+out:
+	free(times.times);
+	free(filter);
+	free(stored);
+	free(packed);
+	return err;
+}
+
+/**
+ * Release the oldest warm segment of a cache, if it was compressed early
+ * enough. Its lines are all on disk, queries read them back from there.
+ *
+ * @param cache: Cache of the service;
+ * @param before: Only a segment compressed at this time or earlier is
+ *                released.
+ *
+ * @return: 1 if a segment was released, or 0 otherwise.
+ */
+int lmc_demote_warm(struct lmc_cache *cache, time_t before)
+{
+	struct log_in_memory *lim = cache->ptr;
+	struct lmc_warm_segment *segment;
+	int demoted = 0;
+
+	lmc_mutex_lock(&cache->lock);
+	segment = cache->warm;
+	if (cache->unsubscribed || cache->warm_count == 0 || segment->since > before)
+		goto out;
+
+	lim->no_logs_evicted += segment->lines;
+	cache->warm_bytes -= segment->size + segment->filter_len + segment->times_len;
+	free(segment->data);
+	free(segment->filter);
+	free(segment->times);
+	cache->warm_count--;
+	memmove(cache->warm, cache->warm + 1, cache->warm_count * sizeof(*cache->warm));
+	lmc_charge_memory(cache);
+	demoted = 1;
+out:
+	lmc_mutex_unlock(&cache->lock);
+	return demoted;
+}
+
+/**
+ * Read the lines of the warm segments of a cache, oldest first, each
+ * segment decompressed on its own. Segments whose filter rules out the
+ * lines wanted are skipped. Called with the cache locked.
+ *
+ * @param cache: Cache of the service;
+ * @param probe: Only lines holding these grams are wanted, or NULL;
+ * @param span: Called with the oldest and newest time and the number of
+ *              lines of every segment, or NULL. The segment is skipped if
+ *              it returns 1, read if it returns 0, and reading stops if it
+ *              returns -1. If it returns 0, it is called again with the
+ *              times of the lines, if the segment has them;
+ * @param fn: Called for every line. Reading stops if it does not return 0;
+ * @param arg: Passed to span and fn.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_read_warm(struct lmc_cache *cache, const struct lmc_bloom_probe *probe, lmc_span_fn span, lmc_line_fn fn,
+		  void *arg)
+{
+	struct lmc_warm_segment *segment;
+	struct lmc_client_logline line;
+	int64_t *times = NULL;
+	char *buf = NULL;
+	const char *data;
+	size_t pos, len, n;
+	uint32_t i;
+	int err = 0;
+
+	for (n = 0; err == 0 && n < cache->warm_count; n++) {
+		segment = &cache->warm[n];
+		if (span != NULL) {
+			err = span(segment->first_time, segment->last_time, segment->lines, NULL, arg);
+			if (err == 0 && segment->times != NULL) {
+				if (times == NULL)
+					times = malloc(LMC_WARM_LINES * sizeof(*times));
+				if (times == NULL ||
+				    lmc_times_decode(segment->times, segment->times_len, segment->lines, times) < 0)
+					err = -1;
+				else
+					err = span(segment->first_time, segment->last_time, segment->lines, times, arg);
+			}
+			if (err != 0) {
+				err = err > 0 ? 0 : -1;
+				continue;
+			}
+		}
+		if (probe != NULL && segment->filter != NULL) {
+			cache->bloom_probed++;
+			if (!lmc_bloom_test(probe, segment->filter, segment->filter_len)) {
+				cache->bloom_skipped++;
+				continue;
+			}
+		}
+
+		data = segment->data;
+		if (segment->size != segment->raw_len) {
+			if (buf == NULL)
+				buf = malloc(LMC_WARM_LINES * sizeof(struct lmc_client_logline));
+			if (buf == NULL ||
+			    lmc_lz_decompress(segment->data, segment->size, buf, segment->raw_len) != 0) {
+				err = -1;
+				break;
+			}
+			data = buf;
+		}
+
+		for (i = 0, pos = 0; i < segment->lines; i++, pos += len) {
+			len = lmc_warm_unpack(cache, data + pos, segment->raw_len - pos, &line);
+			if (len == 0 || fn(&line, arg) != 0) {
+				err = -1;
+				break;
+			}
+		}
+	}
+
+	free(times);
+	free(buf);
+	return err;
+}
+
+/**
+ * Free the warm segments of a cache. Called with the cache locked, when its
+ * lines are evicted or the cache is released.
+ *
+ * @param cache: Cache of the service.
+ */
+void lmc_free_warm(struct lmc_cache *cache)
+{
+	while (cache->warm_count > 0) {
+		cache->warm_count--;
+		free(cache->warm[cache->warm_count].data);
+		free(cache->warm[cache->warm_count].filter);
+		free(cache->warm[cache->warm_count].times);
+	}
+	free(cache->warm);
+	cache->warm = NULL;
+	cache->warm_max = 0;
+	cache->warm_bytes = 0;
+}
@@ -8,7 +8,9 @@
 
 #pragma comment(lib, "Ws2_32.lib")
 
+#include "../../include/pool.h"
 #include "../../include/server.h"
+#include "../../include/segment.h"
 
 #include <windows.h>
 #include <winsock2.h>
@@ -33,6 +35,10 @@ static DWORD WINAPI lmc_client_function(SOCKET client_sock)
 	struct lmc_client *client;
 
 	client = lmc_create_client(client_sock);
+	if (client == NULL) {
+		closesocket(client_sock);
+		return 0;
+	}
 
 	while (1) {
 		rc = lmc_get_command(client);
@@ -41,7 +47,7 @@ static DWORD WINAPI lmc_client_function(SOCKET client_sock)
 	}
 
 	closesocket(client_sock);
-	free(client);
+	lmc_destroy_client(client);
 
 	return 0;
 }
@@ -100,6 +106,9 @@ void lmc_init_server_os(void)
 		}
 
 		lmc_client_function(client_sock);
+
+		// no background threads here, compact between connections
+		lmc_compact_caches();
 	}
 }
 
@@ -119,6 +128,9 @@ int lmc_init_client_cache(struct lmc_cache *cache) {
 	cache->ptr = addr;
 	((struct log_in_memory *)cache->ptr)->no_logs = 0;
 	((struct log_in_memory *)cache->ptr)->no_logs_stored_on_disk = 0;
+	((struct log_in_memory *)cache->ptr)->no_logs_evicted = 0;
+	((struct log_in_memory *)cache->ptr)->no_logs_overwritten = 0;
+	((struct log_in_memory *)cache->ptr)->no_logs_compressed = 0;
 	((struct log_in_memory *)cache->ptr)->list_of_logs = NULL;
 	cache->pages = 0;
 	return 0; }
@@ -138,34 +150,100 @@ int lmc_add_log_os(struct lmc_client *client, struct lmc_client_logline *log) {
 
 	int page_size = 4096;
 
-	struct log_in_memory *lim = client->cache->ptr;
-	void *newAddr, *addr_res;
+	struct lmc_cache *cache = client->cache;
+	struct log_in_memory *lim = cache->ptr;
+	size_t count = lim->no_logs - lim->no_logs_compressed, pages, expected, large;
+	void *newAddr;
+
+	// un ring se aloca o singura data, cu loc pentru toate liniile
+	if (cache->ring_lines != 0)
+		count = cache->ring_lines - 1;
 	
-	if (lim->no_logs == 0) {
-		addr_res = VirtualAlloc(NULL, page_size, MEM_RESERVE, PAGE_READWRITE);
-		lim->list_of_logs = VirtualAlloc(addr_res, page_size, MEM_COMMIT, PAGE_READWRITE);
-		client->cache->pages = 1;
-	} else {
-		if ((lim->no_logs + 1) * sizeof(struct lmc_client_logline) < client->cache->pages * page_size) {
-			// imi incape in memorie pentru inca un log
-
-		} else {
-			// trebuie sa mai aloc o pagina
-			addr_res = VirtualAlloc(NULL, (client->cache->pages + 1) * page_size, MEM_RESERVE, PAGE_READWRITE);
-			newAddr = VirtualAlloc(addr_res, (client->cache->pages + 1) * page_size, MEM_COMMIT, PAGE_READWRITE);
-			memcpy(newAddr, lim->list_of_logs, lim->no_logs * sizeof(struct lmc_client_logline));
-			VirtualFree(lim->list_of_logs, client->cache->pages * page_size, MEM_DECOMMIT);
-			lim->list_of_logs = newAddr;
+	if ((count + 1) * sizeof(struct lmc_client_logline) > cache->pages * page_size) {
+		// trebuie sa mai aloc memorie, creste cu jumatate
+		pages = cache->pages + cache->pages / 2;
+		if (pages < LMC_CACHE_MIN_PAGES)
+			pages = LMC_CACHE_MIN_PAGES;
+		// primul array are loc pentru toate liniile anuntate de serviciu
+		expected = (cache->opts.expected_lines * sizeof(struct lmc_client_logline) + page_size - 1) / page_size;
+		if (cache->pages == 0 && pages < expected)
+			pages = expected;
+		if (cache->ring_lines != 0)
+			pages = (cache->ring_lines * sizeof(struct lmc_client_logline) + page_size - 1) / page_size;
+		// pagini mari daca serviciul le cere si procesul are dreptul la ele
+		newAddr = NULL;
+		large = GetLargePageMinimum();
+		if (cache->opts.huge_pages != LMC_HUGE_OFF && large != 0) {
+			large = (pages * page_size + large - 1) / large * large / page_size;
+			newAddr = VirtualAlloc(NULL, large * page_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+					       PAGE_READWRITE);
+			if (newAddr != NULL)
+				pages = large;
+		}
+		if (newAddr == NULL)
+			newAddr = VirtualAlloc(NULL, pages * page_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (newAddr == NULL)
+			return -1;
+		if (cache->pages != 0) {
+			memcpy(newAddr, lim->list_of_logs, count * sizeof(struct lmc_client_logline));
+			VirtualFree(lim->list_of_logs, 0, MEM_RELEASE);
 		}
+		lim->list_of_logs = newAddr;
+		cache->pages = pages;
 	}
 
-	memcpy(&(lim->list_of_logs[lim->no_logs]), log, sizeof(struct lmc_client_logline));
+	memcpy(lmc_get_logline(cache, lim->no_logs), log, sizeof(struct lmc_client_logline));
 	lim->no_logs++;
 
 	return 0;
 
 }
 
+/**
+ * OS-specific function that releases the memory of the log lines of a cache.
+ * All the lines must have been flushed.
+ *
+ * @param cache: Cache of the service.
+ */
+void lmc_evict_os(struct lmc_cache *cache) {
+	struct log_in_memory *lim = cache->ptr;
+
+	if (cache->pages != 0)
+		VirtualFree(lim->list_of_logs, 0, MEM_RELEASE);
+	lim->list_of_logs = NULL;
+	lim->no_logs_evicted = lim->no_logs;
+	lim->no_logs_compressed = lim->no_logs;
+	cache->pages = 0;
+}
+
+/**
+ * OS-specific function that releases the memory of the oldest lines of the
+ * log line array of a cache, once they were compressed.
+ *
+ * @param cache: Cache of the service;
+ * @param count: Number of lines, a multiple of LMC_WARM_LINES.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_release_lines_os(struct lmc_cache *cache, size_t count) {
+	struct log_in_memory *lim = cache->ptr;
+	size_t left = lim->no_logs - lim->no_logs_compressed - count;
+	size_t pages = cache->pages - count * sizeof(struct lmc_client_logline) / 4096;
+	void *newAddr;
+
+	// VirtualFree elibereaza doar regiuni intregi, liniile ramase se muta
+	newAddr = VirtualAlloc(NULL, pages * 4096, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (newAddr == NULL)
+		return -1;
+	memcpy(newAddr, lim->list_of_logs + count, left * sizeof(struct lmc_client_logline));
+	VirtualFree(lim->list_of_logs, 0, MEM_RELEASE);
+	lim->list_of_logs = newAddr;
+	lim->no_logs_compressed += count;
+	cache->pages = pages;
+
+	return 0;
+}
+
 /**
  * OS-specific function that handles flushing the cache to disk,
  *
@@ -177,32 +255,166 @@ int lmc_add_log_os(struct lmc_client *client, struct lmc_client_logline *log) {
  */
 int lmc_flush_os(struct lmc_client *client) { 
 	struct log_in_memory *lim = client->cache->ptr;
+	struct lmc_segment_writer writer;
 	char buffer[512];
-	HANDLE fd;
-	int i;
-	int bytesWritten = 0;
-	
-	sprintf(buffer, "%s/%s.log", "logs_logmemcache", client->cache->service_name);
-	lmc_init_logdir("logs_logmemcache");
-	lmc_rotate_logfile(buffer);
-	// int fd = open(buffer, O_WRONLY | O_CREAT);
-	fd = CreateFile(buffer, GENERIC_WRITE, FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	int i, sync;
 	
-	if (fd < 0) {
-		printf("eroare! %d\n", fd);
+	if (lim->no_logs_stored_on_disk == lim->no_logs)
+		return 0;
+
+	sprintf(buffer, "%s/%s.log", lmc_logfile_path, client->cache->service_name);
+	lmc_init_logdir(lmc_logfile_path);
+	// rotation is handled by lmc_rotate_cache, append blocks to the current file
+	if (lmc_segment_open_active(&writer, buffer) != 0) {
+		printf("eroare! %d\n", GetLastError());
+		return -1;
 	}
-	for (i = lim->no_logs_stored_on_disk; i < lim->no_logs; i++) {
-		WriteFile(fd, &(lim->list_of_logs[i]), sizeof(lim->list_of_logs[i]), &bytesWritten, NULL);
-		//write(fd, &(lim->list_of_logs[i]), sizeof(lim->list_of_logs[i]));
+	writer.bloom = client->cache->opts.bloom;
+	if (client->cache->active_size == 0)
+		client->cache->active_since = time(NULL);
+	// liniile suprascrise de ring inainte de flush s-au pierdut
+	i = lim->no_logs_stored_on_disk;
+	if (i < lim->no_logs_overwritten)
+		i = lim->no_logs_overwritten;
+	for (; i < lim->no_logs; i++)
+		if (lmc_segment_append(&writer, lmc_get_logline(client->cache, i)) != 0)
+			break;
+
+	// connections are served one at a time, so there is nothing to group
+	sync = client->cache->opts.durability != LMC_DURABILITY_NONE;
+	if (lmc_segment_close_active(&writer, sync) != 0 || i != lim->no_logs) {
+		client->cache->active_size = writer.offset;
+		return -1;
 	}
+	client->cache->active_size = writer.offset;
 
 	lim->no_logs_stored_on_disk = lim->no_logs;
-	// close(fd);
-	CloseHandle(fd);
+	client->cache->written_seq = lim->no_logs;
+	if (sync)
+		client->cache->durable_seq = client->cache->written_seq;
+
 	return 0; 
 
 }
 
+/**
+ * OS-specific function that makes the logs written by a flush durable.
+ * lmc_flush_os already synced the file if the cache asked for it.
+ *
+ * @param cache: Cache that was just flushed.
+ *
+ * @return: Number of log lines of the cache known to be on stable storage.
+ */
+uint64_t lmc_commit_os(struct lmc_cache *cache)
+{
+	return cache->durable_seq;
+}
+
+/**
+ * Convert a FILETIME to a time_t.
+ */
+static time_t lmc_filetime_to_time(const FILETIME *ft)
+{
+	ULARGE_INTEGER ul;
+
+	ul.LowPart = ft->dwLowDateTime;
+	ul.HighPart = ft->dwHighDateTime;
+	return (time_t)((ul.QuadPart - 116444736000000000ULL) / 10000000ULL);
+}
+
+/**
+ * OS-specific function that finds the log files a service left on disk, so
+ * rotation and retention continue where they stopped.
+ *
+ * @param cache: Cache of the service.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_scan_logfiles_os(struct lmc_cache *cache)
+{
+	char pattern[MAX_PATH], path[MAX_PATH];
+	WIN32_FIND_DATA data;
+	HANDLE find;
+	uint64_t size;
+
+	snprintf(pattern, MAX_PATH, "%s/%s.log", lmc_logfile_path, cache->service_name);
+	find = FindFirstFile(pattern, &data);
+	if (find != INVALID_HANDLE_VALUE) {
+		cache->active_size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+		cache->active_since = lmc_filetime_to_time(&data.ftLastWriteTime);
+		FindClose(find);
+	}
+
+	snprintf(pattern, MAX_PATH, "%s/%s.log.*", lmc_logfile_path, cache->service_name);
+	find = FindFirstFile(pattern, &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return 0;
+
+	do {
+		if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+		snprintf(path, MAX_PATH, "%s/%s", lmc_logfile_path, data.cFileName);
+		// Left behind by a compaction that did not finish
+		if (strstr(data.cFileName, LMC_COMPACT_SUFFIX) != NULL) {
+			DeleteFile(path);
+			continue;
+		}
+		size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+		lmc_add_logfile(cache, strdup(path), size, lmc_filetime_to_time(&data.ftLastWriteTime));
+	} while (FindNextFile(find, &data));
+	FindClose(find);
+
+	if (cache->logfile_count > 1)
+		qsort(cache->logfiles, cache->logfile_count, sizeof(*cache->logfiles), lmc_cmp_logfiles);
+	return 0;
+}
+
+/**
+ * OS-specific function that deletes a file. Connections are served one at a
+ * time, so there is no flush to keep it away from.
+ *
+ * @param path: Path of the file. The function takes ownership of it.
+ */
+void lmc_remove_file_os(char *path)
+{
+	DeleteFile(path);
+	free(path);
+}
+
+/**
+ * OS-specific function that waits for a condition, at most a while. The
+ * critical section must be entered, it is entered again when the function
+ * returns.
+ *
+ * @param cond: Condition to wait for;
+ * @param mutex: Critical section protecting the condition;
+ * @param ms: Milliseconds to wait, at most.
+ *
+ * @return: 0 if the condition was signaled, or -1 otherwise.
+ */
+int lmc_cond_wait_os(lmc_cond_t *cond, lmc_mutex_t *mutex, unsigned int ms)
+{
+	return SleepConditionVariableCS(cond, mutex, ms) ? 0 : -1;
+}
+
+/**
+ * OS-specific function that checks, without blocking, whether a socket has
+ * data to receive or was closed by the peer.
+ *
+ * @param sock: Socket to check.
+ *
+ * @return: 1 if a receive would not block, or 0 otherwise.
+ */
+int lmc_readable_os(SOCKET sock)
+{
+	struct timeval tv = { 0, 0 };
+	fd_set set;
+
+	FD_ZERO(&set);
+	FD_SET(sock, &set);
+	return select(0, &set, NULL, NULL, &tv) > 0;
+}
+
 /**
  * OS-specific function that handles client unsubscribe requests.
  *
@@ -215,22 +427,20 @@ int lmc_flush_os(struct lmc_client *client) {
  */
 int lmc_unsubscribe_os(struct lmc_client *client) { 
 
-	int page_size = 4096;
-	
 	struct log_in_memory *lim;
 	// flush them maybe?
 	lmc_flush_os(client);
 
 	// free the fields
-	free(client->cache->service_name);
+	lmc_pool_free(&lmc_name_pool, client->cache->service_name);
 
 	// free cache with munmap
 	lim = client->cache->ptr;
-	VirtualFree(lim->list_of_logs, client->cache->pages * page_size, MEM_DECOMMIT);
+	if (client->cache->pages != 0)
+		VirtualFree(lim->list_of_logs, 0, MEM_RELEASE);
 
 	VirtualFree(lim, sizeof(struct log_in_memory), MEM_DECOMMIT);
 
-	free(client->cache);
 	return 0;
 
  }
@@ -0,0 +1,152 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+/**
+ * Monotonic time, in seconds.
+ */
+double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Read counters from a line of stat, with sscanf.
+ *
+ * @param conn: Connection to the service;
+ * @param name: Start of the line, such as "Tiers:";
+ * @param format: Format of the rest of the line, the lines after it may be
+ *                read too.
+ *
+ * @return: The number of counters read, or -1 if stat has no such line.
+ */
+int bench_get_stat(struct lmc_conn *conn, const char *name, const char *format, ...)
+{
+	char *stats, *line;
+	va_list ap;
+	int rc = -1;
+
+	stats = lmc_get_stats(conn);
+	if (stats == NULL)
+		return -1;
+	line = strstr(stats, name);
+	if (line != NULL) {
+		va_start(ap, format);
+		rc = vsscanf(line + strlen(name), format, ap);
+		va_end(ap);
+	}
+	lmc_free_buf(stats);
+	return rc;
+}
+
+/**
+ * Print a line of stat, indented, to stderr.
+ *
+ * @param conn: Connection to the service;
+ * @param name: Start of the line, such as "Tiers:".
+ */
+void bench_print_stat(struct lmc_conn *conn, const char *name)
+{
+	char *stats, *line;
+
+	stats = lmc_get_stats(conn);
+	if (stats == NULL)
+		return;
+	line = strstr(stats, name);
+	if (line != NULL)
+		fprintf(stderr, "  %.*s\n", (int)strcspn(line, "\n"), line);
+	lmc_free_buf(stats);
+}
+
+/**
+ * Read the memory and the tiers of a service from stat.
+ *
+ * @param conn: Connection to the service;
+ * @param t: Receives the tiers, zeroed if stat does not have them.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int bench_get_tiers(struct lmc_conn *conn, struct bench_tiers *t)
+{
+	char *stats, *line;
+	int rc = -1;
+
+	memset(t, 0, sizeof(*t));
+	stats = lmc_get_stats(conn);
+	if (stats == NULL)
+		return -1;
+	line = strstr(stats, "Memory:");
+	if (line != NULL)
+		sscanf(line, "Memory: %luKB", &t->memory);
+	line = strstr(stats, "Tiers:");
+	if (line != NULL &&
+	    sscanf(line, "Tiers: hot %lu lines %luKB, warm %lu lines %luKB of %luKB, cold %lu lines %luKB", &t->hot,
+		   &t->hot_kb, &t->warm, &t->warm_kb, &t->warm_raw_kb, &t->cold, &t->cold_kb) == 7)
+		rc = 0;
+	lmc_free_buf(stats);
+	if (rc != 0)
+		fprintf(stderr, "no tiers in stat\n");
+	return rc;
+}
+
+/**
+ * Wait for the tier pass to move lines of a service into a tier: until the
+ * lines in it stop changing, or for at most a number of seconds.
+ *
+ * @param conn: Connection to the service;
+ * @param tier: "warm" or "cold";
+ * @param seconds: Time to wait, at most.
+ */
+void bench_wait_tier(struct lmc_conn *conn, const char *tier, int seconds)
+{
+	struct bench_tiers t;
+	unsigned long seen = 0, cur;
+	double t0 = bench_now();
+
+	while (bench_now() - t0 < seconds) {
+		bench_get_tiers(conn, &t);
+		cur = strcmp(tier, "cold") == 0 ? t.cold : t.warm;
+		if (cur != 0 && cur == seen)
+			break;
+		seen = cur;
+		sleep(1);
+	}
+}
+
+/**
+ * Read the allocations of a server started with alloc_count.so preloaded,
+ * from the file named by BENCH_ALLOCS_ENV.
+ *
+ * @param calls: Receives the calls to the malloc family so far.
+ *
+ * @return: 0 in case of success, or -1 if the counters cannot be read.
+ */
+int bench_get_allocs(uint64_t *calls)
+{
+	const char *path = getenv(BENCH_ALLOCS_ENV);
+	struct bench_allocs counts;
+	FILE *file;
+	int rc = -1;
+
+	*calls = 0;
+	if (path == NULL || (file = fopen(path, "rb")) == NULL)
+		return -1;
+	if (fread(&counts, sizeof(counts), 1, file) == 1) {
+		*calls = counts.calls;
+		rc = 0;
+	}
+	fclose(file);
+	return rc;
+}
@@ -0,0 +1,44 @@
+/**
+ * Hackathon SO: LogMemCacher
+ * (c) 2020-2021, Operating Systems
+ */
+#ifndef __LMC_BENCH
+#define __LMC_BENCH
+
+#include "../include/lmc.h"
+
+/*
+ * Helpers shared by the benchmarks: a monotonic clock, the counters of a
+ * service read from the lines of stat, and the allocations of a server
+ * started with alloc_count.so preloaded.
+ */
+
+#define BENCH_ALLOCS_ENV "LMC_BENCH_ALLOCS" /* file of the allocation counters */
+
+/**
+ * Allocation counters shared by alloc_count.so with the benchmarks.
+ * Contains:
+ * @field calls: Calls to malloc, calloc and realloc.
+ */
+struct bench_allocs {
+	uint64_t calls;
+};
+
+/**
+ * Tiers of a service, as reported by stat, in lines and KB.
+ */
+struct bench_tiers {
+	unsigned long memory;
+	unsigned long hot, hot_kb;
+	unsigned long warm, warm_kb, warm_raw_kb;
+	unsigned long cold, cold_kb;
+};
+
+double bench_now(void);
+int bench_get_stat(struct lmc_conn *, const char *, const char *, ...);
+void bench_print_stat(struct lmc_conn *, const char *);
+int bench_get_tiers(struct lmc_conn *, struct bench_tiers *);
+void bench_wait_tier(struct lmc_conn *, const char *, int);
+int bench_get_allocs(uint64_t *);
+
+#endif
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/lmc.h"
+#include "bench.h"
+
+/*
+ * Allocations on the server while services add lines and connections come
+ * and go: objects taken from the pools, from the "Allocations:" line of
+ * stat, and every call to malloc, calloc and realloc, counted by
+ * alloc_count.so preloaded into the server. Without it, only the pool
+ * objects are reported.
+ * Usage: LMC_BENCH_ALLOCS=<file> LD_PRELOAD=./alloc_count.so lmcd ...
+ *        LMC_BENCH_ALLOCS=<file> bench_alloc [lines [connections]]
+ */
+static long lines = 100000;
+static long connections = 1000;
+
+static int counted;
+
+static void allocations(struct lmc_conn *conn, uint64_t *allocs, uint64_t *mallocs)
+{
+	*allocs = 0;
+	if (bench_get_stat(conn, "Allocations:", UINT64_FMT " from pools", allocs) != 1)
+		fprintf(stderr, "no allocation counters in stat\n");
+	counted = bench_get_allocs(mallocs) == 0;
+}
+
+static void report(const char *what, long count, double secs, uint64_t *before, uint64_t *after)
+{
+	fprintf(stderr, "%-18s %8ld in %5.2fs: " UINT64_FMT " pool allocations (%.0f/s)", what, count, secs,
+		after[0] - before[0], (after[0] - before[0]) / secs);
+	if (counted)
+		fprintf(stderr, ", " UINT64_FMT " malloc calls, %.4f per command", after[1] - before[1],
+			(double)(after[1] - before[1]) / count);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t before[2], after[2];
+	struct lmc_conn *conn, *probe;
+	char name[LMC_CLIENT_MAX_NAME];
+	double t0;
+	long i;
+
+	if (argc > 1)
+		lines = atol(argv[1]);
+	if (argc > 2)
+		connections = atol(argv[2]);
+
+	/* the library echoes every reply */
+	freopen("/dev/null", "w", stdout);
+
+	probe = lmc_connect("balloc_probe");
+	conn = lmc_connect("balloc");
+	if (probe == NULL || conn == NULL)
+		return EXIT_FAILURE;
+
+	/* warm the pools up */
+	for (i = 0; i < 1000; i++)
+		lmc_send_log(conn, "warming up the pools");
+
+	allocations(conn, before, before + 1);
+	t0 = bench_now();
+	for (i = 0; i < lines; i++)
+		lmc_send_log(conn, "a log line on the hot path");
+	allocations(conn, after, after + 1);
+	report("add", lines, bench_now() - t0, before, after);
+
+	/* the adding connection reported its counters along with the stat */
+	before[0] = after[0];
+	before[1] = after[1];
+	t0 = bench_now();
+	for (i = 0; i < connections; i++) {
+		snprintf(name, sizeof(name), "balloc%ld", i % 8);
+		lmc_free(conn);
+		conn = lmc_connect(name);
+		if (conn == NULL)
+			return EXIT_FAILURE;
+		lmc_send_log(conn, "a log line after a reconnect");
+		lmc_disconnect(conn);
+	}
+	/* the counters of a connection are reported when it goes away */
+	lmc_free(conn);
+	allocations(probe, after, after + 1);
+	report("connect+add+disc", connections, bench_now() - t0, before, after);
+
+	lmc_disconnect(probe);
+	lmc_free(probe);
+	return 0;
+}
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/lmc.h"
+#include "../include/search.h"
+#include "../include/segment.h"
+#include "bench.h"
+
+/*
+ * Rare keyword searches over a week of history. First in this process: a
+ * week of lines is written as one segment per day, with and without filter
+ * blocks, then every search reads the days back, skipping the blocks whose
+ * filter rules its pattern out, against reading all the blocks of the files
+ * without filters. Reports the size of the filters, how many blocks were
+ * skipped and how long the searches took. Then the same searches done by a
+ * service with filters and by one without, once the tier pass compressed
+ * their lines (warm) and, with a budget, once they went to disk (cold). The
+ * server has to run with the same budget:
+ *     lmcd <logdir> <budget_mb * 1048576>
+ * Usage: bench_bloom [lines_per_day [server_lines [budget_mb]]]
+ */
+#define DAYS 7
+
+static long lines_per_day = 200000;
+static long server_lines = 200000;
+static long budget_mb;
+static int rounds = 3;
+static int wait_seconds = 30;
+
+static const char *dir = "bench_bloom_segments";
+static const char *levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+static const char *paths[] = { "/api/v1/users", "/api/v1/orders", "/api/v1/cart", "/health", "/static/app.js" };
+static char patterns[][64] = {
+	"",                        /* trace id of one line, set by main */
+	"request_id=r0004242",     /* one line */
+	"payment gateway timeout", /* one line in 100000 */
+	"user=99999 ",             /* no line */
+	"status=503",              /* a tenth of the lines */
+};
+
+static unsigned long long trace_of(long i)
+{
+	unsigned long long x = (unsigned long long)i * 0x9e3779b97f4a7c15ULL + 12345;
+
+	x = (x ^ (x >> 31)) * 0xbf58476d1ce4e5b9ULL;
+	return x ^ (x >> 29);
+}
+
+static void make_line(long i, char *buf, size_t len)
+{
+	unsigned long r = (unsigned long)trace_of(i) >> 7;
+
+	snprintf(buf, len, "%s [worker-%ld] GET path=%s user=%lu status=%d latency=%lums request_id=r%07ld trace=%016llx",
+		 levels[r % nitems(levels)], i % 8, paths[(r >> 4) % nitems(paths)], 1000 + (r >> 8) % 5000,
+		 (r >> 24) % 10 ? 200 : 503, (r >> 32) % 300, i, trace_of(i));
+	if (i % 100000 == 77)
+		snprintf(buf, len, "ERROR [worker-%ld] payment gateway timeout request_id=r%07ld trace=%016llx", i % 8,
+			 i, trace_of(i));
+}
+
+static long file_size(const char *path)
+{
+	struct stat st;
+
+	return stat(path, &st) == 0 ? (long)st.st_size : 0;
+}
+
+static void write_week(int bloom, long *size)
+{
+	struct lmc_segment_writer w;
+	struct lmc_client_logline line;
+	char path[256];
+	long d, i, n = 0;
+
+	*size = 0;
+	for (d = 0; d < DAYS; d++) {
+		snprintf(path, sizeof(path), "%s/%s%ld.log", dir, bloom ? "bloom" : "plain", d);
+		if (lmc_segment_create(&w, path) != 0)
+			exit(EXIT_FAILURE);
+		w.bloom = bloom;
+		for (i = 0; i < lines_per_day; i++, n++) {
+			memset(&line, 0, sizeof(line));
+			lmc_time_to_str(line.time, sizeof(line.time), LMC_TIME_FORMAT,
+					1600000000 + d * 86400 + i * 86400 / lines_per_day);
+			make_line(n, line.logline, sizeof(line.logline));
+			if (lmc_segment_append(&w, &line) != 0)
+				exit(EXIT_FAILURE);
+		}
+		if (lmc_segment_finish(&w) != 0)
+			exit(EXIT_FAILURE);
+		*size += file_size(path);
+	}
+}
+
+/**
+ * Search the week, with the filters of the files if probe is set.
+ */
+static long search_week(const struct lmc_search *s, const struct lmc_bloom_probe *probe, unsigned long *blocks,
+			unsigned long *skipped)
+{
+	struct lmc_segment_reader r;
+	struct lmc_client_logline line;
+	char path[256];
+	long d, hits = 0;
+	uint32_t b;
+
+	*blocks = *skipped = 0;
+	for (d = 0; d < DAYS; d++) {
+		snprintf(path, sizeof(path), "%s/%s%ld.log", dir, probe ? "bloom" : "plain", d);
+		if (lmc_segment_open(&r, path) != 0)
+			exit(EXIT_FAILURE);
+		for (b = 0; b < r.blocks; b++)
+			*blocks += r.index[b].records != 0;
+		lmc_segment_filter(&r, probe);
+		while (lmc_segment_next(&r, &line) > 0)
+			hits += lmc_search_line(s, line.logline);
+		*skipped += r.skipped;
+		lmc_segment_close(&r);
+	}
+
+	return hits;
+}
+
+static void bench_local(void)
+{
+	struct lmc_bloom_probe probe;
+	struct lmc_search s;
+	unsigned long blocks, skipped;
+	long size[2], hits[2];
+	double t0, t, plain, bloom;
+	size_t p;
+	int r;
+
+	mkdir(dir, 0755);
+	t0 = bench_now();
+	write_week(0, &size[0]);
+	t = bench_now() - t0;
+	t0 = bench_now();
+	write_week(1, &size[1]);
+	printf("%ld lines over %d days: %.1f MB without filters in %.2fs, %.1f MB with filters in %.2fs (+%.1f%%)\n",
+	       lines_per_day * DAYS, DAYS, size[0] / 1e6, t, size[1] / 1e6, bench_now() - t0,
+	       100.0 * (size[1] - size[0]) / size[0]);
+
+	for (p = 0; p < nitems(patterns); p++) {
+		lmc_search_init(&s, patterns[p], strlen(patterns[p]));
+		if (lmc_bloom_probe_init(&probe, patterns[p], strlen(patterns[p])) != 0)
+			continue;
+		plain = bloom = 1e9;
+		for (r = 0; r < rounds; r++) {
+			t0 = bench_now();
+			hits[0] = search_week(&s, NULL, &blocks, &skipped);
+			t = bench_now() - t0;
+			if (t < plain)
+				plain = t;
+			t0 = bench_now();
+			hits[1] = search_week(&s, &probe, &blocks, &skipped);
+			t = bench_now() - t0;
+			if (t < bloom)
+				bloom = t;
+		}
+		printf("%-28s %5lu of %5lu blocks skipped (%5.1f%%), %8.1f ms -> %8.1f ms (%6.1fx), %ld hits%s\n",
+		       patterns[p], skipped, blocks, 100.0 * skipped / blocks, plain * 1e3, bloom * 1e3, plain / bloom,
+		       hits[0], hits[0] == hits[1] ? "" : ", MISMATCH");
+	}
+}
+
+static void search_server(struct lmc_conn **conn, const char *what)
+{
+	struct lmc_client_logline **logs;
+	uint64_t count[2], i;
+	double t0, t[2];
+	size_t p;
+	int c;
+
+	for (p = 0; p < nitems(patterns); p++) {
+		for (c = 0; c < 2; c++) {
+			t0 = bench_now();
+			logs = lmc_search(conn[c], patterns[p], 0, 0, &count[c]);
+			t[c] = bench_now() - t0;
+			for (i = 0; i < count[c]; i++)
+				free(logs[i]);
+			free(logs);
+		}
+		fprintf(stderr, "%-5s %-28s search %8.2f ms, with filters %8.2f ms, " UINT64_FMT " hits%s\n", what,
+			patterns[p], t[0] * 1e3, t[1] * 1e3, count[1], count[0] == count[1] ? "" : ", DIFFERENT hits");
+	}
+	bench_print_stat(conn[1], "Tiers:");
+	bench_print_stat(conn[1], "Bloom:");
+}
+
+static void bench_server(void)
+{
+	char name[3][LMC_CLIENT_MAX_NAME], log[LMC_LOGLINE_SIZE];
+	static const char *opts[] = { "bloom=off", "bloom=on" };
+	struct lmc_conn *conn[3];
+	long n, fill;
+	int c;
+
+	for (c = 0; c < 2; c++) {
+		snprintf(name[c], sizeof(name[c]), "bbloom%d%d", c, (int)getpid() % 10000);
+		conn[c] = lmc_connect_opts(name[c], opts[c]);
+		if (conn[c] == NULL)
+			exit(EXIT_FAILURE);
+		for (n = 0; n < server_lines; n++) {
+			make_line(n, log, sizeof(log));
+			if (lmc_send_log(conn[c], log) < 0)
+				exit(EXIT_FAILURE);
+		}
+		if (lmc_flush(conn[c]) < 0)
+			exit(EXIT_FAILURE);
+	}
+
+	/* the tier pass runs with the compaction pass */
+	bench_wait_tier(conn[0], "warm", wait_seconds);
+	bench_wait_tier(conn[1], "warm", wait_seconds);
+	search_server(conn, "warm");
+
+	if (budget_mb != 0) {
+		/* fill memory past the pressure threshold, not past the budget */
+		snprintf(name[2], sizeof(name[2]), "bbfill%d", (int)getpid() % 10000);
+		conn[2] = lmc_connect(name[2]);
+		if (conn[2] == NULL)
+			exit(EXIT_FAILURE);
+		fill = (budget_mb << 20) / 100 * 85 / LMC_LINE_SIZE;
+		for (n = 0; n < fill; n++) {
+			make_line(n * 7 + 3, log, sizeof(log));
+			if (lmc_send_log(conn[2], log) < 0)
+				exit(EXIT_FAILURE);
+		}
+		lmc_flush(conn[2]);
+		bench_wait_tier(conn[0], "cold", wait_seconds);
+		bench_wait_tier(conn[1], "cold", wait_seconds);
+		search_server(conn, "cold");
+		lmc_unsubscribe(conn[2]);
+		lmc_free(conn[2]);
+	}
+
+	for (c = 0; c < 2; c++) {
+		lmc_unsubscribe(conn[c]);
+		lmc_free(conn[c]);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1)
+		lines_per_day = atol(argv[1]);
+	if (argc > 2)
+		server_lines = atol(argv[2]);
+	if (argc > 3)
+		budget_mb = atol(argv[3]);
+
+	snprintf(patterns[0], sizeof(patterns[0]), "trace=%016llx", trace_of(123456));
+	bench_local();
+	fflush(stdout);
+
+	/* the library echoes every reply */
+	freopen("/dev/null", "w", stdout);
+	bench_server();
+	return 0;
+}
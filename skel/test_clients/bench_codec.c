@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/lz.h"
+#include "../include/segment.h"
+#include "bench.h"
+
+/*
+ * Size and decode speed of the block-compressed segment format, on a log
+ * corpus: either a text file with one log line per line, or generated
+ * service logs. Also measures a time-range query that only needs a tenth
+ * of the segment.
+ * Usage: bench_codec [corpus_file [lines]]
+ */
+static long max_lines = 1000000;
+
+static const char *levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+static const char *paths[] = { "/api/v1/users", "/api/v1/orders", "/api/v1/cart", "/health", "/static/app.js" };
+static const char *events[] = { "request served", "cache miss", "db query slow", "retrying upstream" };
+
+static void set_time(struct lmc_client_logline *line, time_t t)
+{
+	struct tm tm;
+
+	localtime_r(&t, &tm);
+	strftime(line->time, LMC_TIME_SIZE, LMC_TIME_FORMAT, &tm);
+}
+
+static void generate(struct lmc_client_logline *line, long i, time_t base)
+{
+	set_time(line, base + i / 50);
+	snprintf(line->logline, LMC_LOGLINE_SIZE,
+		 "%s [worker-%ld] %s GET %s user=%d status=%d latency=%ldms req=%08lx",
+		 levels[rand() % nitems(levels)], i % 8, events[rand() % nitems(events)],
+		 paths[rand() % nitems(paths)], 1000 + rand() % 5000, rand() % 10 ? 200 : 503,
+		 (long)(rand() % 300), (unsigned long)rand());
+}
+
+static long load(struct lmc_client_logline *lines, const char *corpus, time_t base)
+{
+	char buf[4096];
+	FILE *file;
+	long count = 0;
+
+	if (corpus == NULL) {
+		srand(1);
+		for (; count < max_lines; count++)
+			generate(&lines[count], count, base);
+		return count;
+	}
+
+	file = fopen(corpus, "r");
+	if (file == NULL) {
+		perror(corpus);
+		exit(EXIT_FAILURE);
+	}
+	while (count < max_lines && fgets(buf, sizeof(buf), file) != NULL) {
+		buf[strcspn(buf, "\n")] = '\0';
+		set_time(&lines[count], base + count / 50);
+		snprintf(lines[count].logline, LMC_LOGLINE_SIZE, "%.*s", LMC_LOGLINE_SIZE - 1, buf);
+		count++;
+	}
+	fclose(file);
+	return count;
+}
+
+static long read_all(const char *path, time_t from, time_t to, long *blocks)
+{
+	struct lmc_segment_reader reader;
+	struct lmc_client_logline line;
+	long count = 0;
+
+	if (lmc_segment_open(&reader, path) != 0) {
+		perror("open segment");
+		exit(EXIT_FAILURE);
+	}
+	lmc_segment_range(&reader, from, to);
+	while (lmc_segment_next(&reader, &line) > 0)
+		count++;
+	*blocks = reader.blocks;
+	lmc_segment_close(&reader);
+	return count;
+}
+
+int main(int argc, char *argv[])
+{
+	struct lmc_segment_writer writer;
+	struct lmc_client_logline *lines;
+	char path[] = "bench_codec.seg";
+	double t0, t1, text = 0, decoded;
+	time_t base = 1600000000;
+	long count, i, n, blocks, rounds = 5;
+	FILE *file;
+	long size;
+
+	if (argc > 2)
+		max_lines = atol(argv[2]);
+
+	lines = calloc(max_lines, sizeof(*lines));
+	count = load(lines, argc > 1 ? argv[1] : NULL, base);
+	for (i = 0; i < count; i++)
+		text += strlen(lines[i].time) + 1 + strlen(lines[i].logline) + 1;
+
+	t0 = bench_now();
+	lmc_segment_create(&writer, path);
+	for (i = 0; i < count; i++)
+		lmc_segment_append(&writer, &lines[i]);
+	lmc_segment_finish(&writer);
+	t1 = bench_now();
+
+	file = fopen(path, "rb");
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fclose(file);
+
+	printf("corpus: %s, %ld lines\n", argc > 1 ? argv[1] : "generated", count);
+	printf("padded records: %12.0f bytes\n", (double)count * sizeof(*lines));
+	printf("text:           %12.0f bytes\n", text);
+	printf("segment:        %12ld bytes, ratio %.2fx vs padded, %.2fx vs text\n", size,
+	       (double)count * sizeof(*lines) / size, text / size);
+	printf("encode:         %8.1f MB/s of text\n", text / (t1 - t0) / 1e6);
+
+	t0 = bench_now();
+	for (i = 0; i < rounds; i++)
+		n = read_all(path, 0, 0x7fffffff, &blocks);
+	t1 = bench_now();
+	decoded = text * rounds;
+	printf("decode:         %8.1f MB/s of text, %.1f M lines/s (%ld lines, %ld blocks)\n",
+	       decoded / (t1 - t0) / 1e6, n * rounds / (t1 - t0) / 1e6, n, blocks);
+
+	/* a tenth of the time span, in the middle of the segment */
+	t0 = bench_now();
+	for (i = 0; i < rounds; i++)
+		n = read_all(path, base + count / 50 * 45 / 100, base + count / 50 * 55 / 100, &blocks);
+	t1 = bench_now();
+	printf("range query:    %8.2f ms for %ld lines of the tenth in the middle\n",
+	       (t1 - t0) * 1e3 / rounds, n);
+
+	unlink(path);
+	free(lines);
+	return 0;
+}
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/lmc.h"
+#include "bench.h"
+
+/*
+ * Volume over time, the way a dashboard plots it: with getlogs, counting
+ * the lines on the client, against count and histogram, which only send the
+ * numbers. A service gets a day of lines, at a steady rate, then the counts
+ * are taken while its lines are hot, once the tier pass compressed them
+ * (warm) and, with a budget, once they went to disk (cold). Both ways must
+ * give the same numbers. The server has to run with the same budget:
+ *     lmcd <logdir> <budget_mb * 1048576>
+ * Usage: bench_count [lines [budget_mb]]
+ */
+#define DAY (24 * 3600)
+
+static long lines = 500000;
+static long budget_mb;
+static int rounds = 3;
+static int wait_seconds = 30;
+static const time_t day_start = 1600000000 - 1600000000 % DAY;
+
+/* add a line with a time of the day, as lmc_send_log does with the current time */
+static void send_line(struct lmc_conn *conn, long i, time_t t)
+{
+	char buffer[LMC_COMMAND_SIZE], response[LMC_LINE_SIZE], time[LMC_TIME_SIZE];
+	size_t len;
+
+	lmc_time_to_str(time, sizeof(time), LMC_TIME_FORMAT, t);
+	len = snprintf(buffer, sizeof(buffer), "add %s:%s [worker-%ld] GET /api/v1/orders status=%d latency=%ldms",
+		       time, i % 7 ? "INFO" : "WARN", i % 8, i % 10 ? 200 : 503, i % 300);
+	if (lmc_send(conn->socket, buffer, len, 0) < 0 || lmc_recv(conn->socket, response, sizeof(response), 0) < 0)
+		exit(EXIT_FAILURE);
+}
+
+/**
+ * Count the lines per bucket on the client, from all the lines, as a
+ * dashboard does without count and histogram. getlogs sends all the lines,
+ * the interval is filtered here too.
+ */
+static uint64_t client_histogram(struct lmc_conn *conn, uint64_t width, const char *pattern, time_t t1, time_t t2,
+				 uint64_t *buckets)
+{
+	struct lmc_client_logline **logs;
+	uint64_t count, i, hits = 0;
+	time_t t, last = -1;
+
+	*buckets = 0;
+	logs = lmc_get_logs(conn, 0, 0, &count);
+	for (i = 0; i < count; i++) {
+		if (pattern != NULL && strstr(logs[i]->logline, pattern) == NULL) {
+			free(logs[i]);
+			continue;
+		}
+		if (lmc_str_to_time(logs[i]->time, &t) == 0 && (t1 == 0 || t >= t1) && (t2 == 0 || t <= t2)) {
+			hits++;
+			if (width != 0 && t - t % width != last) {
+				last = t - t % width;
+				(*buckets)++;
+			}
+		}
+		free(logs[i]);
+	}
+	free(logs);
+
+	return hits;
+}
+
+static uint64_t server_histogram(struct lmc_conn *conn, uint64_t width, const char *pattern, time_t t1, time_t t2,
+				 uint64_t *buckets)
+{
+	struct lmc_count_bucket *list;
+	uint64_t count = 0, i;
+
+	*buckets = 0;
+	if (width == 0) {
+		lmc_count_logs(conn, pattern, t1, t2, &count);
+		return count;
+	}
+
+	list = lmc_get_histogram(conn, width, pattern, t1, t2, buckets);
+	for (i = 0; i < *buckets; i++)
+		count += list[i].logs;
+	lmc_free_buf(list);
+	return count;
+}
+
+static void bench_queries(struct lmc_conn *conn, const char *what)
+{
+	static const struct {
+		const char *name;
+		uint64_t width;
+		const char *pattern;
+		time_t t1, t2;
+	} queries[] = {
+		{ "count", 0, NULL, 0, 0 },
+		{ "count 2 hours", 0, NULL, day_start + 10 * 3600, day_start + 12 * 3600 - 1 },
+		{ "histogram 1 minute", 60, NULL, 0, 0 },
+		{ "histogram 1 hour", 3600, NULL, 0, 0 },
+		{ "histogram 10s, 2 hours", 10, NULL, day_start + 10 * 3600, day_start + 12 * 3600 - 1 },
+		{ "histogram 1 hour status=503", 3600, "status=503", 0, 0 },
+	};
+	uint64_t count[2], buckets[2];
+	double t0, t, best[2];
+	size_t q;
+	int r;
+
+	for (q = 0; q < nitems(queries); q++) {
+		best[0] = best[1] = 1e9;
+		for (r = 0; r < rounds; r++) {
+			t0 = bench_now();
+			count[0] = client_histogram(conn, queries[q].width, queries[q].pattern, queries[q].t1, queries[q].t2,
+						    &buckets[0]);
+			t = bench_now() - t0;
+			if (t < best[0])
+				best[0] = t;
+			t0 = bench_now();
+			count[1] = server_histogram(conn, queries[q].width, queries[q].pattern, queries[q].t1, queries[q].t2,
+						    &buckets[1]);
+			t = bench_now() - t0;
+			if (t < best[1])
+				best[1] = t;
+		}
+		fprintf(stderr, "%-5s %-28s getlogs %8.2f ms, on the server %8.3f ms (%7.1fx), " UINT64_FMT
+			" lines in " UINT64_FMT " buckets%s\n", what, queries[q].name, best[0] * 1e3, best[1] * 1e3,
+			best[0] / best[1], count[1], buckets[1],
+			count[0] == count[1] && buckets[0] == buckets[1] ? "" : ", DIFFERENT");
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	char name[LMC_CLIENT_MAX_NAME], fill_name[LMC_CLIENT_MAX_NAME];
+	struct lmc_conn *conn, *fill;
+	long i, n;
+
+	if (argc > 1)
+		lines = atol(argv[1]);
+	if (argc > 2)
+		budget_mb = atol(argv[2]);
+
+	/* the library echoes every reply */
+	freopen("/dev/null", "w", stdout);
+
+	snprintf(name, sizeof(name), "bcount%d", (int)getpid() % 10000);
+	conn = lmc_connect(name);
+	if (conn == NULL)
+		exit(EXIT_FAILURE);
+	for (i = 0; i < lines; i++)
+		send_line(conn, i, day_start + (time_t)(i * (long long)DAY / lines));
+	if (lmc_flush(conn) < 0)
+		exit(EXIT_FAILURE);
+
+	bench_queries(conn, "hot");
+	bench_print_stat(conn, "Tiers:");
+
+	/* the tier pass runs with the compaction pass */
+	bench_wait_tier(conn, "warm", wait_seconds);
+	bench_queries(conn, "warm");
+	bench_print_stat(conn, "Tiers:");
+
+	if (budget_mb != 0) {
+		/* fill memory past the pressure threshold, not past the budget */
+		snprintf(fill_name, sizeof(fill_name), "bcfill%d", (int)getpid() % 10000);
+		fill = lmc_connect(fill_name);
+		if (fill == NULL)
+			exit(EXIT_FAILURE);
+		n = (budget_mb << 20) / 100 * 85 / LMC_LINE_SIZE;
+		for (i = 0; i < n; i++)
+			lmc_send_log(fill, "filler line of another service");
+		lmc_flush(fill);
+		bench_wait_tier(conn, "cold", wait_seconds);
+		bench_queries(conn, "cold");
+		bench_print_stat(conn, "Tiers:");
+		lmc_unsubscribe(fill);
+		lmc_free(fill);
+	}
+
+	lmc_unsubscribe(conn);
+	lmc_free(conn);
+	return 0;
+}
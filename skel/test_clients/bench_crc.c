@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/crc32c.h"
+#include "../include/segment.h"
+#include "bench.h"
+
+/*
+ * Speed of the block checksums against memcpy, on one block (in cache) and
+ * on a large buffer (in memory), then the time startup recovery takes to
+ * verify an active log file, against just reading it.
+ * Usage: bench_crc [file_mb]
+ */
+static long file_mb = 64;
+
+static volatile uint32_t sink;
+
+static void measure(const char *name, char *src, char *dst, size_t len, size_t total)
+{
+	double t0, t_copy, t_hw, t_sw;
+	size_t done;
+
+	t0 = bench_now();
+	for (done = 0; done < total; done += len) {
+		memcpy(dst, src, len);
+		sink += dst[done % len];
+	}
+	t_copy = bench_now() - t0;
+
+	t0 = bench_now();
+	for (done = 0; done < total; done += len)
+		sink += lmc_crc32c(0, src, len);
+	t_hw = bench_now() - t0;
+
+	t0 = bench_now();
+	for (done = 0; done < total; done += len)
+		sink += lmc_crc32c_sw(0, src, len);
+	t_sw = bench_now() - t0;
+
+	printf("%-14s memcpy %6.2f GB/s, crc32c %s %6.2f GB/s, table %6.2f GB/s\n", name, total / t_copy / 1e9,
+	       lmc_crc32c_hw() ? "sse4.2" : "table ", total / t_hw / 1e9, total / t_sw / 1e9);
+}
+
+int main(int argc, char *argv[])
+{
+	struct lmc_segment_writer writer;
+	struct lmc_client_logline line;
+	char path[] = "bench_crc.log";
+	size_t big = 256 << 20;
+	char *src, *dst, buf[1 << 16];
+	double t0, t_read, t_recover;
+	uint64_t size;
+	FILE *file;
+	long i;
+
+	if (argc > 1)
+		file_mb = atol(argv[1]);
+
+	src = malloc(big);
+	dst = malloc(big);
+	for (i = 0; i < (long)big; i++)
+		src[i] = (char)(i * 2654435761U >> 24);
+	memset(dst, 0, big);
+
+	measure("64 KiB block:", src, dst, LMC_BLOCK_SIZE, 4UL << 30);
+	measure("256 MiB:", src, dst, big, 4 * big);
+	free(src);
+	free(dst);
+
+	/* an active log file, as written by flushes of 64 lines */
+	unlink(path);
+	memset(&line, 0, sizeof(line));
+	strcpy(line.time, "2021/01/01-00:00:00");
+	size = 0;
+	for (i = 0; size < (uint64_t)file_mb << 20; i++) {
+		if (i % 64 == 0 && lmc_segment_open_active(&writer, path) != 0) {
+			perror("open");
+			return EXIT_FAILURE;
+		}
+		snprintf(line.logline, sizeof(line.logline), "worker %ld request %08lx served in %ld ms", i % 8,
+			 (unsigned long)rand(), (long)(rand() % 300));
+		lmc_segment_append(&writer, &line);
+		if (i % 64 == 63) {
+			lmc_segment_close_active(&writer, 0);
+			size = writer.offset;
+		}
+	}
+
+	t0 = bench_now();
+	file = fopen(path, "rb");
+	while (fread(buf, 1, sizeof(buf), file) != 0)
+		;
+	fclose(file);
+	t_read = bench_now() - t0;
+
+	t0 = bench_now();
+	if (lmc_segment_recover(path, &size) != 0)
+		printf("recovery failed\n");
+	t_recover = bench_now() - t0;
+
+	printf("recovery of a %ld MiB active file: %.1f ms (%.2f GB/s), reading it: %.1f ms\n", file_mb,
+	       t_recover * 1e3, size / t_recover / 1e9, t_read * 1e3);
+
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/lmc.h"
+#include "bench.h"
+
+/*
+ * Cost of a poll as the cache grows: a service adds lines in rounds, and
+ * after every round one reader fetches all the logs with getlogs, the way
+ * pollers did, while another one only fetches the new lines with a cursor,
+ * a page of lines at a time. Bytes received and time taken per poll.
+ * Usage: bench_cursor [lines_per_round [rounds [page]]]
+ */
+static long lines = 5000;
+static long rounds = 10;
+static uint64_t page = 1000;
+
+int main(int argc, char *argv[])
+{
+	struct lmc_conn *conn, *full, *cursor;
+	struct lmc_client_logline **logs, *batch;
+	uint64_t count, received, total, skipped, pos = 0, polls, seen = 0, i;
+	char name[LMC_CLIENT_MAX_NAME], log[LMC_LOGLINE_SIZE];
+	double t, t_full, t_cursor;
+	long r, l;
+
+	if (argc > 1)
+		lines = atol(argv[1]);
+	if (argc > 2)
+		rounds = atol(argv[2]);
+	if (argc > 3)
+		page = strtoull(argv[3], NULL, 10);
+
+	/* the library echoes every reply */
+	freopen("/dev/null", "w", stdout);
+
+	snprintf(name, sizeof(name), "bcur%d", (int)getpid() % 10000);
+	conn = lmc_connect(name);
+	full = lmc_connect(name);
+	cursor = lmc_connect(name);
+	if (conn == NULL || full == NULL || cursor == NULL)
+		exit(EXIT_FAILURE);
+
+	fprintf(stderr, "%10s %14s %12s %14s %12s %8s\n", "cached", "getlogs bytes", "getlogs ms", "cursor bytes",
+		"cursor ms", "pages");
+	for (r = 0; r < rounds; r++) {
+		for (l = 0; l < lines; l++) {
+			snprintf(log, sizeof(log), "seq=%ld GET /api/v1/orders/%ld status=200", r * lines + l, l % 97);
+			if (lmc_send_log(conn, log) < 0)
+				exit(EXIT_FAILURE);
+		}
+
+		t = bench_now();
+		logs = lmc_get_logs(full, 0, 0, &count);
+		t_full = bench_now() - t;
+		received = count;
+		for (i = 0; i < count; i++)
+			free(logs[i]);
+		free(logs);
+
+		t = bench_now();
+		total = 0;
+		polls = 0;
+		do {
+			batch = lmc_get_logs_since(cursor, &pos, page, &count, &skipped);
+			if (batch == NULL && count != 0)
+				exit(EXIT_FAILURE);
+			total += count;
+			seen += skipped;
+			polls++;
+			lmc_free_buf(batch);
+		} while (count != 0);
+		t_cursor = bench_now() - t;
+		seen += total;
+
+		fprintf(stderr, "%10ld %14lu %12.2f %14lu %12.2f %8lu\n", (r + 1) * lines,
+			(unsigned long)(received * sizeof(struct lmc_client_logline)), t_full * 1e3,
+			(unsigned long)(total * sizeof(struct lmc_client_logline)), t_cursor * 1e3, (unsigned long)polls);
+	}
+	fprintf(stderr, "cursor reader got " UINT64_FMT " of %ld lines\n", seen, rounds * lines);
+
+	lmc_unsubscribe(conn);
+	lmc_free(conn);
+	lmc_free(full);
+	lmc_free(cursor);
+	return 0;
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/lmc.h"
+#include "bench.h"
+
+/*
+ * Storm of repeated lines, like a crash-looping service sends: runs of the
+ * same line, a different line every few thousand. The same storm goes to a
+ * service with dedup and to one without. Reports how fast the lines were
+ * added and what the services keep, from stat, then reads the lines back
+ * with repeats expanded, checking every line, and collapsed.
+ * Usage: bench_dedup [lines [run]]
+ */
+static long lines = 200000;
+static long run = 5000;
+
+static void make_line(long i, char *buf, size_t len)
+{
+	long n = i / run;
+
+	if (i % run == 0)
+		snprintf(buf, len, "worker %ld restarted, exit status 139", n);
+	else
+		snprintf(buf, len, "FATAL: cannot open /var/lib/app/state.db: permission denied (run %ld)", n);
+}
+
+static void get_stats(struct lmc_conn *conn, unsigned long *memory, unsigned long *stored, unsigned long *collapsed)
+{
+	*memory = *stored = *collapsed = 0;
+	bench_get_stat(conn, "Memory:", "%luKB\nLoglines: %lu", memory, stored);
+	if (bench_get_stat(conn, "Repeats:", "%lu", collapsed) != 1)
+		fprintf(stderr, "no repeats in stat\n");
+}
+
+static struct lmc_conn *add_storm(const char *name, const char *opts)
+{
+	unsigned long memory, stored, collapsed;
+	char log[LMC_LOGLINE_SIZE];
+	struct lmc_conn *conn;
+	double t0, t;
+	long i;
+
+	conn = lmc_connect_opts((char *)name, opts);
+	if (conn == NULL)
+		exit(EXIT_FAILURE);
+
+	t0 = bench_now();
+	for (i = 0; i < lines; i++) {
+		make_line(i, log, sizeof(log));
+		if (lmc_send_log(conn, log) < 0)
+			exit(EXIT_FAILURE);
+	}
+	t = bench_now() - t0;
+
+	get_stats(conn, &memory, &stored, &collapsed);
+	fprintf(stderr, "%-13s %ld lines in %.2fs (%.0f lines/s): %lu stored, %lu collapsed, %lu KB\n",
+		opts, lines, t, lines / t, stored, collapsed, memory);
+	return conn;
+}
+
+static void read_back(struct lmc_conn *conn, int collapse, const char *what)
+{
+	struct lmc_client_logline **logs;
+	char expected[LMC_LOGLINE_SIZE];
+	uint64_t count, i, bad = 0;
+	double t0, t;
+
+	t0 = bench_now();
+	if (collapse)
+		logs = lmc_get_logs_collapsed(conn, 0, 0, &count);
+	else
+		logs = lmc_get_logs(conn, 0, 0, &count);
+	t = bench_now() - t0;
+
+	for (i = 0; i < count; i++) {
+		make_line((long)i, expected, sizeof(expected));
+		if (!collapse && strcmp(logs[i]->logline, expected) != 0)
+			bad++;
+		if (collapse && i < 3)
+			fprintf(stderr, "  %s %s\n", logs[i]->time, logs[i]->logline);
+		free(logs[i]);
+	}
+	free(logs);
+
+	fprintf(stderr, "getlogs %-20s " UINT64_FMT " lines in %4.0f ms", what, count, t * 1e3);
+	if (!collapse)
+		fprintf(stderr, ", " UINT64_FMT " wrong", bad + (uint64_t)lines - count);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+	char name[2][LMC_CLIENT_MAX_NAME];
+	struct lmc_conn *conns[2];
+	int i;
+
+	if (argc > 1)
+		lines = atol(argv[1]);
+	if (argc > 2)
+		run = atol(argv[2]);
+
+	/* the library echoes every reply */
+	freopen("/dev/null", "w", stdout);
+
+	snprintf(name[0], sizeof(name[0]), "bdup%d", (int)getpid() % 10000);
+	snprintf(name[1], sizeof(name[1]), "bnodup%d", (int)getpid() % 10000);
+	conns[1] = add_storm(name[1], "dedup=0");
+	conns[0] = add_storm(name[0], "dedup=60");
+
+	read_back(conns[1], 0, "without dedup");
+	read_back(conns[0], 0, "dedup, expanded");
+	read_back(conns[0], 1, "dedup, collapsed");
+
+	for (i = 0; i < 2; i++) {
+		lmc_unsubscribe(conns[i]);
+		lmc_free(conns[i]);
+	}
+	return 0;
+}
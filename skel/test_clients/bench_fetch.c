@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "../include/lmc.h"
+#include "bench.h"
+
+/*
+ * Fetching all the logs of a service: with lmc_get_logs, one allocation per
+ * line, then with lmc_get_logs_into, into one array allocated by the library
+ * and into an array of the caller reused by every fetch. Every way runs in
+ * a child of its own, so its peak RSS and the CPU time it used, per fetch,
+ * are its own.
+ * Usage: bench_fetch [lines [fetches]]
+ */
+static long lines = 200000;
+static int fetches = 5;
+static char name[LMC_CLIENT_MAX_NAME];
+
+enum fetch_way { FETCH_NONE, FETCH_LINES, FETCH_ARRAY, FETCH_CALLER };
+
+static const char *ways[] = { "connect only", "lmc_get_logs", "lmc_get_logs_into", "lmc_get_logs_into, caller" };
+
+/* fetch the logs a few times, write the best time and the logs received */
+static void fetch(enum fetch_way way, int fd)
+{
+	struct lmc_client_logline **logs, *buf = NULL;
+	struct lmc_logs view;
+	struct lmc_conn *conn;
+	uint64_t count = 0, i;
+	double best = 0, t;
+	int f;
+
+	conn = lmc_connect(name);
+	if (conn == NULL)
+		exit(EXIT_FAILURE);
+	if (way == FETCH_CALLER)
+		buf = malloc(lines * sizeof(*buf));
+
+	for (f = 0; way != FETCH_NONE && f < fetches; f++) {
+		t = bench_now();
+		if (way == FETCH_LINES) {
+			logs = lmc_get_logs(conn, 0, 0, &count);
+			for (i = 0; i < count; i++)
+				lmc_free_buf(logs[i]);
+			lmc_free_buf(logs);
+		} else {
+			if (lmc_get_logs_into(conn, 0, buf, buf != NULL ? lines : 0, &view) != 0)
+				exit(EXIT_FAILURE);
+			count = view.count;
+			lmc_free_logs(&view);
+		}
+		t = bench_now() - t;
+		if (f == 0 || t < best)
+			best = t;
+	}
+
+	free(buf);
+	lmc_free(conn);
+	if (write(fd, &best, sizeof(best)) != sizeof(best) || write(fd, &count, sizeof(count)) != sizeof(count))
+		exit(EXIT_FAILURE);
+	exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char *argv[])
+{
+	struct lmc_conn *conn;
+	struct rusage ru;
+	char log[LMC_LOGLINE_SIZE];
+	uint64_t count;
+	double best;
+	size_t w;
+	int fds[2], status;
+	long l;
+
+	if (argc > 1)
+		lines = atol(argv[1]);
+	if (argc > 2)
+		fetches = atoi(argv[2]);
+
+	/* the library echoes every reply */
+	freopen("/dev/null", "w", stdout);
+
+	snprintf(name, sizeof(name), "bfet%d", (int)getpid() % 10000);
+	conn = lmc_connect(name);
+	if (conn == NULL)
+		exit(EXIT_FAILURE);
+	for (l = 0; l < lines; l++) {
+		snprintf(log, sizeof(log), "GET /api/v1/orders/%ld status=200 bytes=%ld", l, l % 4096);
+		if (lmc_send_log(conn, log) < 0)
+			exit(EXIT_FAILURE);
+	}
+
+	for (w = 0; w < nitems(ways); w++) {
+		if (pipe(fds) != 0)
+			exit(EXIT_FAILURE);
+		if (fork() == 0)
+			fetch(w, fds[1]);
+		if (wait4(-1, &status, 0, &ru) < 0 || read(fds[0], &best, sizeof(best)) != sizeof(best) ||
+		    read(fds[0], &count, sizeof(count)) != sizeof(count))
+			exit(EXIT_FAILURE);
+		close(fds[0]);
+		close(fds[1]);
+
+		if (w == FETCH_NONE)
+			fprintf(stderr, "%-28s peak RSS %7.1f MB\n", ways[w], ru.ru_maxrss / 1024.0);
+		else
+			fprintf(stderr, "%-28s %8.1f ms  %10.0f lines/s  %7.1f MB/s  client CPU %7.1f ms  peak RSS %7.1f MB  "
+				UINT64_FMT " lines\n", ways[w], best * 1e3, count / best,
+				count * sizeof(struct lmc_client_logline) / best / 1e6,
+				(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6) *
+				1e3 / fetches, ru.ru_maxrss / 1024.0, count);
+	}
+
+	lmc_unsubscribe(conn);
+	lmc_free(conn);
+	return 0;
+}
@@ -0,0 +1,78 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/lmc.h"
+
+/*
+ * Flush throughput: every service adds a line and flushes, in a loop.
+ * Usage: bench_flush [services [seconds [none|periodic|flush]]]
+ */
+static int services = 500;
+static int seconds = 5;
+static char opts[64] = "durability=flush";
+static volatile int running = 1;
+static uint64_t *flushes;
+
+static void *service(void *arg)
+{
+	char name[LMC_CLIENT_MAX_NAME];
+	struct lmc_conn *conn;
+	int idx = (int)(intptr_t)arg;
+
+	snprintf(name, sizeof(name), "bflush%d", idx);
+	conn = lmc_connect_opts(name, opts);
+	if (conn == NULL)
+		return NULL;
+
+	while (running) {
+		if (lmc_send_log(conn, "a log line that is about to be flushed") < 0)
+			break;
+		if (lmc_flush(conn) < 0)
+			break;
+		flushes[idx]++;
+	}
+
+	lmc_disconnect(conn);
+	lmc_free(conn);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t *tids;
+	uint64_t total;
+	int i;
+
+	if (argc > 1)
+		services = atoi(argv[1]);
+	if (argc > 2)
+		seconds = atoi(argv[2]);
+	if (argc > 3)
+		snprintf(opts, sizeof(opts), "durability=%s", argv[3]);
+
+	/* the library echoes every reply */
+	freopen("/dev/null", "w", stdout);
+
+	tids = calloc(services, sizeof(*tids));
+	flushes = calloc(services, sizeof(*flushes));
+
+	for (i = 0; i < services; i++)
+		pthread_create(&tids[i], NULL, service, (void *)(intptr_t)i);
+
+	sleep(seconds);
+	running = 0;
+
+	total = 0;
+	for (i = 0; i < services; i++) {
+		pthread_join(tids[i], NULL);
+		total += flushes[i];
+	}
+
+	fprintf(stderr, "%d services, %s: " UINT64_FMT " flushes in %ds, %.0f flushes/sec\n",
+		services, opts, total, seconds, (double)total / seconds);
+
+	return 0;
+}
@@ -0,0 +1,280 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/lmc.h"
+
+/*
+ * End-to-end tail latency on loopback: a service adds lines stamped with the
+ * time they were sent, at a few rates, while another connection follows the
+ * service and notes when every line arrives. The same is then done by
+ * polling getlogs every 100 ms, the way readers did before follow. Last, a
+ * follower that stops reading: the service must add lines as fast as with
+ * no follower at all.
+ * Usage: bench_follow [lines_per_rate]
+ */
+#define POLL_MS 100
+
+static long lines = 20000;
+static const long rates[] = { 1000, 10000, 0 }; /* lines/s, 0 as fast as possible */
+static long total;
+static int64_t *latency;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_until(int64_t ns)
+{
+	struct timespec ts = { ns / 1000000000LL, ns % 1000000000LL };
+
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static int cmp_i64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* note the latency of a received line, if it is one of the stamped ones */
+static int note_line(const struct lmc_client_logline *line, int64_t now)
+{
+	long seq;
+	long long sent;
+
+	if (sscanf(line->logline, "seq=%ld sent=%lld", &seq, &sent) != 2 || seq < 0 || seq >= total)
+		return 0;
+	if (latency[seq] < 0)
+		latency[seq] = now - sent;
+	return 1;
+}
+
+static void report(const char *what, long from, long count, double rate, const char *extra)
+{
+	int64_t *sorted = malloc(count * sizeof(*sorted));
+	long i, n = 0;
+
+	for (i = 0; i < count; i++)
+		if (latency[from + i] >= 0)
+			sorted[n++] = latency[from + i];
+	qsort(sorted, n, sizeof(*sorted), cmp_i64);
+	if (n == 0) {
+		fprintf(stderr, "%-28s no line received\n", what);
+	} else {
+		fprintf(stderr, "%-28s %8.0f lines/s  p50 %8.1f us  p99 %8.1f us  max %8.1f us  %ld/%ld lines%s\n", what,
+			rate, sorted[n / 2] / 1e3, sorted[n * 99 / 100] / 1e3, sorted[n - 1] / 1e3, n, count, extra);
+	}
+	free(sorted);
+}
+
+/* add lines seq from..from+count-1, at a rate, or as fast as possible */
+static double send_lines(struct lmc_conn *conn, long from, long count, long rate)
+{
+	char log[LMC_LOGLINE_SIZE];
+	int64_t start = now_ns(), t;
+	long i;
+
+	for (i = 0; i < count; i++) {
+		if (rate != 0)
+			sleep_until(start + i * 1000000000LL / rate);
+		t = now_ns();
+		snprintf(log, sizeof(log), "seq=%ld sent=%lld GET /api/v1/orders status=200", from + i, (long long)t);
+		if (lmc_send_log(conn, log) < 0)
+			exit(EXIT_FAILURE);
+	}
+
+	return count / ((now_ns() - start) / 1e9);
+}
+
+struct follower {
+	struct lmc_conn *conn;
+	long expected;
+	long received;
+	uint64_t batches;
+	uint64_t skipped;
+};
+
+static void *follow(void *arg)
+{
+	struct follower *f = arg;
+	struct lmc_client_logline *batch;
+	uint64_t count, skipped, i;
+	int64_t now;
+
+	while (f->received + (long)f->skipped < f->expected) {
+		if (lmc_follow_next(f->conn, &batch, &count, &skipped) <= 0)
+			break;
+		now = now_ns();
+		for (i = 0; i < count; i++)
+			f->received += note_line(&batch[i], now);
+		f->batches += count != 0;
+		f->skipped += skipped;
+		free(batch);
+	}
+
+	lmc_unfollow(f->conn);
+	return NULL;
+}
+
+static void bench_follow(const char *name)
+{
+	struct lmc_conn *conn;
+	struct follower f;
+	pthread_t tid;
+	double rate[nitems(rates)];
+	char extra[128];
+	size_t r;
+
+	conn = lmc_connect((char *)name);
+	memset(&f, 0, sizeof(f));
+	f.conn = lmc_connect((char *)name);
+	if (conn == NULL || f.conn == NULL || lmc_follow(f.conn, 0) != 0)
+		exit(EXIT_FAILURE);
+	f.expected = nitems(rates) * lines;
+	pthread_create(&tid, NULL, follow, &f);
+	/* the follow starts once the server got the request */
+	usleep(100000);
+
+	for (r = 0; r < nitems(rates); r++)
+		rate[r] = send_lines(conn, r * lines, lines, rates[r]);
+	pthread_join(tid, NULL);
+
+	for (r = 0; r < nitems(rates); r++) {
+		snprintf(extra, sizeof(extra), r == nitems(rates) - 1 ? ", " UINT64_FMT " batches, " UINT64_FMT
+			 " skipped in all" : "", f.batches, f.skipped);
+		report(r == nitems(rates) - 1 ? "follow, unpaced" : "follow", r * lines, lines, rate[r], extra);
+	}
+
+	lmc_unsubscribe(conn);
+	lmc_free(conn);
+	lmc_free(f.conn);
+}
+
+struct poller {
+	struct lmc_conn *conn;
+	volatile int running;
+	uint64_t bytes;
+};
+
+static void *poll_logs(void *arg)
+{
+	struct poller *p = arg;
+	struct lmc_client_logline **logs;
+	uint64_t count, i;
+	int64_t now;
+
+	while (p->running) {
+		logs = lmc_get_logs(p->conn, 0, 0, &count);
+		now = now_ns();
+		for (i = 0; i < count; i++) {
+			note_line(logs[i], now);
+			free(logs[i]);
+		}
+		free(logs);
+		p->bytes += count * sizeof(struct lmc_client_logline);
+		usleep(POLL_MS * 1000);
+	}
+
+	return NULL;
+}
+
+static void bench_poll(const char *name, long from)
+{
+	struct lmc_conn *conn;
+	struct poller p;
+	pthread_t tid;
+	char extra[128];
+	double rate;
+
+	conn = lmc_connect((char *)name);
+	memset(&p, 0, sizeof(p));
+	p.conn = lmc_connect((char *)name);
+	if (conn == NULL || p.conn == NULL)
+		exit(EXIT_FAILURE);
+	p.running = 1;
+	pthread_create(&tid, NULL, poll_logs, &p);
+
+	rate = send_lines(conn, from, lines, rates[0]);
+	usleep(2 * POLL_MS * 1000);
+	p.running = 0;
+	pthread_join(tid, NULL);
+
+	snprintf(extra, sizeof(extra), ", %.1f MB received", p.bytes / 1e6);
+	report("getlogs every 100 ms", from, lines, rate, extra);
+
+	lmc_unsubscribe(conn);
+	lmc_free(conn);
+	lmc_free(p.conn);
+}
+
+/* ingest with no follower, then with one that stopped reading */
+static void bench_stalled(const char *name, long from)
+{
+	struct lmc_conn *conn, *stalled;
+	struct follower f;
+	char alone[LMC_CLIENT_MAX_NAME];
+	double rate[2];
+
+	snprintf(alone, sizeof(alone), "%.14sa", name);
+	conn = lmc_connect(alone);
+	if (conn == NULL)
+		exit(EXIT_FAILURE);
+	rate[0] = send_lines(conn, from, lines, 0);
+	lmc_unsubscribe(conn);
+	lmc_free(conn);
+
+	conn = lmc_connect((char *)name);
+	stalled = lmc_connect((char *)name);
+	if (conn == NULL || stalled == NULL || lmc_follow(stalled, 0) != 0)
+		exit(EXIT_FAILURE);
+	usleep(100000);
+	rate[1] = send_lines(conn, from, lines, 0);
+
+	/* then it reads what the server kept for it */
+	memset(&f, 0, sizeof(f));
+	f.conn = stalled;
+	f.expected = lines;
+	follow(&f);
+	fprintf(stderr, "%-28s %8.0f lines/s alone, %8.0f lines/s with a follower not reading; it got %ld lines, "
+		UINT64_FMT " skipped\n", "stalled follower", rate[0], rate[1], f.received, f.skipped);
+
+	lmc_unsubscribe(conn);
+	lmc_free(conn);
+	lmc_free(stalled);
+}
+
+int main(int argc, char *argv[])
+{
+	char name[LMC_CLIENT_MAX_NAME];
+	long i;
+
+	if (argc > 1)
+		lines = atol(argv[1]);
+
+	/* the library echoes every reply */
+	freopen("/dev/null", "w", stdout);
+
+	total = (nitems(rates) + 2) * lines;
+	latency = malloc(total * sizeof(*latency));
+	for (i = 0; i < total; i++)
+		latency[i] = -1;
+
+	snprintf(name, sizeof(name), "bfol%d", (int)getpid() % 10000);
+	bench_follow(name);
+	snprintf(name, sizeof(name), "bpol%d", (int)getpid() % 10000);
+	bench_poll(name, nitems(rates) * lines);
+	snprintf(name, sizeof(name), "bsta%d", (int)getpid() % 10000);
+	bench_stalled(name, (nitems(rates) + 1) * lines);
+
+	free(latency);
+	return 0;
+}
@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/server.h"
+#include "bench.h"
+
+/*
+ * Ingest and scan speed of a cache backed by regular pages, transparent huge
+ * pages and huge pages from the hugetlb pool, mapped and grown like the
+ * server does it. Ingest adds lines one by one, growing the array by half
+ * when it is full; the scans go over all the lines like getlogs with a time
+ * interval, in order and in a shuffled order (lookups by position).
+ * Usage: bench_hugepage [lines [off|thp|hugetlb]]
+ */
+static long lines = 4 << 20;
+
+static const char *modes[] = { "off", "thp", "hugetlb" };
+
+static long rss_kb(const char *field)
+{
+	char buf[256];
+	FILE *file;
+	long kb = 0;
+	size_t len = strlen(field);
+
+	file = fopen("/proc/self/smaps_rollup", "r");
+	if (file == NULL)
+		return -1;
+	while (fgets(buf, sizeof(buf), file) != NULL)
+		if (strncmp(buf, field, len) == 0 && sscanf(buf + len, "%ld", &kb) == 1)
+			break;
+	fclose(file);
+	return kb;
+}
+
+/* as lmc_map_lines_os */
+static char *map_lines(int mode, size_t size, int *hugetlb)
+{
+	int flags = MAP_ANON | MAP_PRIVATE;
+	char *addr, *start;
+	size_t lead;
+
+	*hugetlb = 0;
+	if (mode == LMC_HUGE_HUGETLB) {
+		addr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+		if (addr != MAP_FAILED) {
+			*hugetlb = 1;
+			return addr;
+		}
+	}
+
+	flags |= MAP_NORESERVE;
+	if (mode == LMC_HUGE_OFF)
+		return mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+	addr = mmap(NULL, size + LMC_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (addr == MAP_FAILED)
+		return addr;
+	start = (char *)(((uintptr_t)addr + LMC_HUGE_PAGE_SIZE - 1) & ~((uintptr_t)LMC_HUGE_PAGE_SIZE - 1));
+	lead = start - addr;
+	if (lead != 0)
+		munmap(addr, lead);
+	munmap(start + size, LMC_HUGE_PAGE_SIZE - lead);
+	madvise(start, size, MADV_HUGEPAGE);
+	return start;
+}
+
+/* as lmc_add_log_os and lmc_grow_lines_os */
+static struct lmc_client_logline *ingest(int mode, struct lmc_client_logline *line, size_t *size, int *hugetlb)
+{
+	struct lmc_client_logline *array = NULL;
+	size_t page_size = getpagesize(), pages = 0, grown;
+	char *addr;
+	long i;
+
+	for (i = 0; i < lines; i++) {
+		if ((i + 1) * sizeof(*line) > pages * page_size) {
+			grown = pages + pages / 2;
+			if (grown < LMC_CACHE_MIN_PAGES)
+				grown = LMC_CACHE_MIN_PAGES;
+			if (mode != LMC_HUGE_OFF)
+				grown = (grown * page_size + LMC_HUGE_PAGE_SIZE - 1) / LMC_HUGE_PAGE_SIZE *
+					LMC_HUGE_PAGE_SIZE / page_size;
+
+			if (pages == 0)
+				addr = map_lines(mode, grown * page_size, hugetlb);
+			else if (mode == LMC_HUGE_OFF)
+				addr = mremap(array, pages * page_size, grown * page_size, MREMAP_MAYMOVE);
+			else {
+				addr = map_lines(mode, grown * page_size, hugetlb);
+				if (addr != MAP_FAILED && mremap(array, pages * page_size, pages * page_size,
+								 MREMAP_MAYMOVE | MREMAP_FIXED, addr) == MAP_FAILED) {
+					memcpy(addr, array, pages * page_size);
+					munmap(array, pages * page_size);
+				}
+			}
+			if (addr == MAP_FAILED) {
+				perror("mmap");
+				exit(EXIT_FAILURE);
+			}
+			array = (struct lmc_client_logline *)addr;
+			pages = grown;
+		}
+
+		line->time[18] = '0' + i % 10;
+		memcpy(&array[i], line, sizeof(*line));
+	}
+
+	*size = pages * page_size;
+	return array;
+}
+
+int main(int argc, char *argv[])
+{
+	struct lmc_client_logline line, *array;
+	double t0, t_ingest, t_scan, t_random;
+	long i, matched = 0, anon, huge, rounds = 3, r;
+	uint32_t *order, swap;
+	size_t size;
+	int mode, first = LMC_HUGE_OFF, last = LMC_HUGE_HUGETLB, hugetlb;
+
+	if (argc > 1)
+		lines = atol(argv[1]);
+	for (mode = first; argc > 2 && mode <= last; mode++)
+		if (strcmp(argv[2], modes[mode]) == 0)
+			first = last = mode;
+
+	memset(&line, 0, sizeof(line));
+	strcpy(line.time, "2021/01/01-00:00:00");
+	strcpy(line.logline, "worker 3 request 0001f00d served in 12 ms");
+
+	order = malloc(lines * sizeof(*order));
+	for (i = 0; i < lines; i++)
+		order[i] = i;
+	srand(1);
+	for (i = lines - 1; i > 0; i--) {
+		r = ((long)rand() << 16 ^ rand()) % (i + 1);
+		swap = order[i];
+		order[i] = order[r];
+		order[r] = swap;
+	}
+
+	printf("%ld lines (%ld MiB)\n", lines, lines * (long)sizeof(line) >> 20);
+	for (mode = first; mode <= last; mode++) {
+		anon = rss_kb("AnonHugePages:");
+
+		t0 = bench_now();
+		array = ingest(mode, &line, &size, &hugetlb);
+		t_ingest = bench_now() - t0;
+		huge = rss_kb("AnonHugePages:") - anon;
+
+		t0 = bench_now();
+		for (r = 0; r < rounds; r++)
+			for (i = 0; i < lines; i++)
+				if (strcmp(array[i].time, "2021/01/01-00:00:05") >= 0 &&
+				    strcmp(array[i].time, "2021/01/01-00:00:07") <= 0)
+					matched++;
+		t_scan = (bench_now() - t0) / rounds;
+
+		t0 = bench_now();
+		for (r = 0; r < rounds; r++)
+			for (i = 0; i < lines; i++)
+				if (strcmp(array[order[i]].time, "2021/01/01-00:00:05") >= 0 &&
+				    strcmp(array[order[i]].time, "2021/01/01-00:00:07") <= 0)
+					matched++;
+		t_random = (bench_now() - t0) / rounds;
+
+		printf("%-7s %-14s ingest %5.1f M lines/s, scan %5.1f M lines/s, shuffled %5.1f M lines/s, "
+		       "%ld MiB in huge pages\n",
+		       modes[mode], hugetlb ? "(pool)" : mode == LMC_HUGE_HUGETLB ? "(no pool, thp)" : "",
+		       lines / t_ingest / 1e6, lines / t_scan / 1e6, lines / t_random / 1e6,
+		       hugetlb ? (long)(size >> 20) : huge >> 10);
+
+		munmap(array, size);
+	}
+
+	free(order);
+	return matched == 0;
+}
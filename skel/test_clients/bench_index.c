@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/index.h"
+#include "../include/lmc.h"
+#include "../include/search.h"
+#include "bench.h"
+
+/*
+ * Keyword lookups over log lines. First the index alone, in this process:
+ * how fast lines are indexed and how much memory it takes per line, then
+ * searches that look their pattern up in the index and only search the
+ * candidates, against searching every line. Then the same searches done by a
+ * service that indexes its lines and by one that does not, with the index
+ * line of stat.
+ * Usage: bench_index [lines [server_lines]]
+ */
+static long lines = 1000000;
+static long server_lines = 200000;
+static int rounds = 5;
+
+static const char *levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+static const char *paths[] = { "/api/v1/users", "/api/v1/orders", "/api/v1/cart", "/health", "/static/app.js" };
+static const char *patterns[] = {
+	"request_id=r0004242",  /* one line, no whole token */
+	" user=1042 ",          /* a few hundred lines */
+	"path=/api/v1/orders ", /* a fifth of the lines */
+	"status=503",           /* a tenth, no whole token */
+	"payment gateway",      /* ten lines, not rare words */
+};
+
+static void make_line(long i, char *buf, size_t len)
+{
+	snprintf(buf, len, "%s [worker-%ld] GET path=%s user=%d status=%d latency=%ldms request_id=r%07ld",
+		 levels[rand() % nitems(levels)], i % 8, paths[rand() % nitems(paths)], 1000 + rand() % 5000,
+		 rand() % 10 ? 200 : 503, (long)(rand() % 300), i);
+	if (i % 100000 == 77)
+		snprintf(buf, len, "ERROR [worker-%ld] payment gateway timeout request_id=r%07ld", i % 8, i);
+}
+
+static long search_all(struct lmc_client_logline *logs, const struct lmc_search *s)
+{
+	long i, hits = 0;
+
+	for (i = 0; i < lines; i++)
+		hits += lmc_search_line(s, logs[i].logline);
+	return hits;
+}
+
+static long search_index(struct lmc_client_logline *logs, const struct lmc_search *s, struct lmc_index *index,
+			 size_t *candidates)
+{
+	struct lmc_index_hits hits;
+	long found = 0;
+	size_t k;
+
+	if (lmc_index_query(index, s->pattern, s->len, &hits) != 0) {
+		*candidates = lines;
+		return search_all(logs, s);
+	}
+	for (k = 0; k < hits.count; k++)
+		found += lmc_search_line(s, logs[hits.base + hits.lines[k]].logline);
+	*candidates = hits.count;
+	free(hits.lines);
+	return found;
+}
+
+static void bench_local(void)
+{
+	struct lmc_client_logline *logs;
+	struct lmc_search s;
+	struct lmc_index index;
+	double t0, t, scan, lookup;
+	size_t p, candidates;
+	long i, hits[2];
+	int r;
+
+	logs = calloc(lines, sizeof(*logs));
+	if (logs == NULL)
+		exit(EXIT_FAILURE);
+	srand(1);
+	for (i = 0; i < lines; i++)
+		make_line(i, logs[i].logline, sizeof(logs[i].logline));
+
+	lmc_index_init(&index, UINT64_MAX);
+	t0 = bench_now();
+	for (i = 0; i < lines; i++)
+		lmc_index_add(&index, i, logs[i].logline);
+	t = bench_now() - t0;
+	printf("%ld lines indexed in %.2fs (%.2f M lines/s): %lu keys, %.1f MB, %.1f bytes per line\n", lines, t,
+	       lines / t / 1e6, (unsigned long)index.keys, index.bytes / 1e6, (double)index.bytes / lines);
+
+	for (p = 0; p < nitems(patterns); p++) {
+		lmc_search_init(&s, patterns[p], strlen(patterns[p]));
+		scan = lookup = 1e9;
+		for (r = 0; r < rounds; r++) {
+			t0 = bench_now();
+			hits[0] = search_all(logs, &s);
+			t = bench_now() - t0;
+			if (t < scan)
+				scan = t;
+			t0 = bench_now();
+			hits[1] = search_index(logs, &s, &index, &candidates);
+			t = bench_now() - t0;
+			if (t < lookup)
+				lookup = t;
+		}
+		printf("%-22s scan %8.2f ms, index %8.3f ms (%6.1fx), %8lu candidates, %ld hits%s\n", patterns[p],
+		       scan * 1e3, lookup * 1e3, scan / lookup, (unsigned long)candidates, hits[0],
+		       hits[0] == hits[1] ? "" : ", MISMATCH");
+	}
+
+	lmc_index_free(&index);
+	free(logs);
+}
+
+static void bench_server(void)
+{
+	char name[2][LMC_CLIENT_MAX_NAME], log[LMC_LOGLINE_SIZE];
+	static const char *opts[] = { "index=0", "index=67108864" };
+	struct lmc_client_logline **logs;
+	struct lmc_conn *conn[2];
+	uint64_t count[2], i;
+	double t0, t[2];
+	size_t p;
+	long n;
+	int c;
+
+	for (c = 0; c < 2; c++) {
+		snprintf(name[c], sizeof(name[c]), "bindex%d%d", c, (int)getpid() % 10000);
+		conn[c] = lmc_connect_opts(name[c], opts[c]);
+		if (conn[c] == NULL)
+			exit(EXIT_FAILURE);
+
+		srand(2);
+		t0 = bench_now();
+		for (n = 0; n < server_lines; n++) {
+			make_line(n, log, sizeof(log));
+			if (lmc_send_log(conn[c], log) < 0)
+				exit(EXIT_FAILURE);
+		}
+		fprintf(stderr, "%-15s %ld lines added at %.0f lines/s\n", opts[c], server_lines,
+			server_lines / (bench_now() - t0));
+	}
+	bench_print_stat(conn[1], "Index:");
+
+	for (p = 0; p < nitems(patterns); p++) {
+		for (c = 0; c < 2; c++) {
+			t0 = bench_now();
+			logs = lmc_search(conn[c], patterns[p], 0, 0, &count[c]);
+			t[c] = bench_now() - t0;
+			for (i = 0; i < count[c]; i++)
+				free(logs[i]);
+			free(logs);
+		}
+		fprintf(stderr, "%-22s search %7.2f ms, with index %7.2f ms, " UINT64_FMT " hits%s\n", patterns[p],
+			t[0] * 1e3, t[1] * 1e3, count[1], count[0] == count[1] ? "" : ", DIFFERENT hits");
+	}
+
+	for (c = 0; c < 2; c++) {
+		lmc_unsubscribe(conn[c]);
+		lmc_free(conn[c]);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1)
+		lines = atol(argv[1]);
+	if (argc > 2)
+		server_lines = atol(argv[2]);
+
+	bench_local();
+	fflush(stdout);
+
+	/* the library echoes every reply */
+	freopen("/dev/null", "w", stdout);
+	bench_server();
+	return 0;
+}
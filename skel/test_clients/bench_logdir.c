@@ -0,0 +1,124 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+/*
+ * Cost of the directory operations done by flush and startup, in a log
+ * directory holding one rotated file per flush versus one holding only what
+ * size-based rotation and retention leave behind.
+ * Usage: bench_logdir [old_files [new_files [ops]]]
+ */
+static long old_files = 1000000;
+static long new_files = 20 * 64; /* 20 services, 1GB retained in 16MB files */
+static long ops = 100000;
+
+static void fill(const char *dir, long files)
+{
+	char path[256];
+	long i;
+	int fd;
+
+	mkdir(dir, 0755);
+	for (i = 0; i < files; i++) {
+		snprintf(path, sizeof(path), "%s/svc%ld.log.2021.01.01-00.00.00-%ld", dir, i % 20, i);
+		fd = open(path, O_WRONLY | O_CREAT, 0644);
+		if (fd >= 0)
+			close(fd);
+	}
+	snprintf(path, sizeof(path), "%s/svc0.log", dir);
+	close(open(path, O_WRONLY | O_CREAT, 0644));
+}
+
+static void empty(const char *dir, long files)
+{
+	char path[256];
+	long i;
+
+	for (i = 0; i < files; i++) {
+		snprintf(path, sizeof(path), "%s/svc%ld.log.2021.01.01-00.00.00-%ld", dir, i % 20, i);
+		unlink(path);
+	}
+	snprintf(path, sizeof(path), "%s/svc0.log", dir);
+	unlink(path);
+	rmdir(dir);
+}
+
+static void measure(const char *dir, long files)
+{
+	char path[256], rotated[256];
+	struct dirent *entry;
+	struct stat st;
+	double start;
+	long i, found;
+	DIR *d;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/svc0.log", dir);
+
+	start = bench_now();
+	for (i = 0; i < ops; i++)
+		stat(path, &st);
+	fprintf(stderr, "%8ld files: stat active log       %8.2f us/op\n", files, (bench_now() - start) * 1e6 / ops);
+
+	start = bench_now();
+	for (i = 0; i < ops; i++) {
+		fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+		close(fd);
+	}
+	fprintf(stderr, "%8ld files: open+close active log %8.2f us/op\n", files, (bench_now() - start) * 1e6 / ops);
+
+	/* what every flush used to do: move the old file away, create a new one */
+	start = bench_now();
+	for (i = 0; i < ops / 10; i++) {
+		snprintf(rotated, sizeof(rotated), "%s/svc0.log.bench-%ld", dir, i);
+		rename(path, rotated);
+		close(open(path, O_WRONLY | O_CREAT, 0644));
+	}
+	fprintf(stderr, "%8ld files: rotate+create         %8.2f us/op\n", files, (bench_now() - start) * 1e6 / (ops / 10));
+	for (i = 0; i < ops / 10; i++) {
+		snprintf(rotated, sizeof(rotated), "%s/svc0.log.bench-%ld", dir, i);
+		unlink(rotated);
+	}
+
+	/* what startup does to find the files of a service */
+	start = bench_now();
+	found = 0;
+	d = opendir(dir);
+	while ((entry = readdir(d)) != NULL)
+		if (strncmp(entry->d_name, "svc0.log.", 9) == 0)
+			found++;
+	closedir(d);
+	fprintf(stderr, "%8ld files: scan for one service  %8.2f ms (%ld files)\n", files, (bench_now() - start) * 1e3, found);
+}
+
+int main(int argc, char *argv[])
+{
+	double start;
+
+	if (argc > 1)
+		old_files = atol(argv[1]);
+	if (argc > 2)
+		new_files = atol(argv[2]);
+	if (argc > 3)
+		ops = atol(argv[3]);
+
+	start = bench_now();
+	fill("bench_logdir_old", old_files);
+	fprintf(stderr, "created %ld files in %.1fs\n", old_files, bench_now() - start);
+	fill("bench_logdir_new", new_files);
+
+	measure("bench_logdir_old", old_files);
+	measure("bench_logdir_new", new_files);
+
+	empty("bench_logdir_old", old_files);
+	empty("bench_logdir_new", new_files);
+
+	return 0;
+}
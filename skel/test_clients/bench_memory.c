@@ -0,0 +1,169 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/lmc.h"
+#include "bench.h"
+
+/*
+ * Memory budget: the services add three times as many lines as the budget
+ * of the server holds, while the resident size of the server is sampled.
+ * Then the logs of the service evicted first and of the one added last are
+ * read back. The server has to run with the same budget:
+ *     lmcd <logdir> <budget_mb * 1048576>
+ * Usage: bench_memory <lmcd_pid> [budget_mb [services]]
+ */
+static int services = 8;
+static long budget_mb = 64;
+static long lines_per_service;
+static volatile int running = 1;
+static char status_path[64];
+static uint64_t *added;
+
+static long rss_kb(void)
+{
+	char buf[256];
+	FILE *file;
+	long kb = -1;
+
+	file = fopen(status_path, "r");
+	if (file == NULL)
+		return -1;
+	while (fgets(buf, sizeof(buf), file) != NULL)
+		if (sscanf(buf, "VmRSS: %ld kB", &kb) == 1)
+			break;
+	fclose(file);
+	return kb;
+}
+
+static void *sampler(void *arg)
+{
+	long *peak = arg, kb, total, step, next;
+	int i;
+
+	step = (long)services * lines_per_service / 10;
+	next = step;
+	while (running) {
+		kb = rss_kb();
+		if (kb > *peak)
+			*peak = kb;
+
+		total = 0;
+		for (i = 0; i < services; i++)
+			total += added[i];
+		if (total >= next) {
+			fprintf(stderr, "%3ld%% added (%6ld MiB of lines): rss %6ld MiB\n", total * 100 / (services * lines_per_service),
+				total * LMC_LINE_SIZE >> 20, kb >> 10);
+			next += step;
+		}
+		usleep(10000);
+	}
+	return NULL;
+}
+
+static void *service(void *arg)
+{
+	char name[LMC_CLIENT_MAX_NAME], log[128];
+	struct lmc_conn *conn;
+	int idx = (int)(intptr_t)arg;
+	long i;
+
+	snprintf(name, sizeof(name), "bmem%d", idx);
+	conn = lmc_connect(name);
+	if (conn == NULL)
+		return NULL;
+
+	for (i = 0; i < lines_per_service; i++) {
+		snprintf(log, sizeof(log), "service %d request %08lx served in %ld ms", idx, (unsigned long)rand(),
+			 (long)(rand() % 300));
+		if (lmc_send_log(conn, log) < 0)
+			break;
+		added[idx]++;
+	}
+
+	lmc_disconnect(conn);
+	lmc_free(conn);
+	return NULL;
+}
+
+static void read_back(int idx)
+{
+	char name[LMC_CLIENT_MAX_NAME];
+	struct lmc_client_logline **lines;
+	struct lmc_conn *conn;
+	uint64_t logs, i;
+	double t0;
+
+	snprintf(name, sizeof(name), "bmem%d", idx);
+	conn = lmc_connect(name);
+	if (conn == NULL)
+		return;
+
+	t0 = bench_now();
+	lines = lmc_get_logs(conn, 0, 0, &logs);
+	fprintf(stderr, "getlogs of %s: " UINT64_FMT " lines in %.0f ms\n", name, logs, (bench_now() - t0) * 1e3);
+
+	for (i = 0; i < logs; i++)
+		free(lines[i]);
+	free(lines);
+	lmc_unsubscribe(conn);
+	lmc_free(conn);
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t *tids, tid;
+	long peak = 0, before;
+	uint64_t total;
+	double t0, t1;
+	int i;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <lmcd_pid> [budget_mb [services]]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	snprintf(status_path, sizeof(status_path), "/proc/%s/status", argv[1]);
+	if (argc > 2)
+		budget_mb = atol(argv[2]);
+	if (argc > 3)
+		services = atoi(argv[3]);
+	lines_per_service = (3 * budget_mb << 20) / LMC_LINE_SIZE / services;
+
+	/* the library echoes every reply */
+	freopen("/dev/null", "w", stdout);
+
+	before = rss_kb();
+	if (before < 0) {
+		perror(status_path);
+		return EXIT_FAILURE;
+	}
+
+	tids = calloc(services, sizeof(*tids));
+	added = calloc(services, sizeof(*added));
+	pthread_create(&tid, NULL, sampler, &peak);
+
+	t0 = bench_now();
+	for (i = 0; i < services; i++)
+		pthread_create(&tids[i], NULL, service, (void *)(intptr_t)i);
+
+	total = 0;
+	for (i = 0; i < services; i++) {
+		pthread_join(tids[i], NULL);
+		total += added[i];
+	}
+	t1 = bench_now();
+	running = 0;
+	pthread_join(tid, NULL);
+
+	fprintf(stderr, "%d services, budget %ld MiB: " UINT64_FMT " lines (" UINT64_FMT " MiB) in %.1fs, %.0f lines/sec\n",
+		services, budget_mb, total, total * LMC_LINE_SIZE >> 20, t1 - t0, total / (t1 - t0));
+	fprintf(stderr, "rss before %ld MiB, peak %ld MiB, after %ld MiB\n", before >> 10, peak >> 10, rss_kb() >> 10);
+
+	read_back(0);
+	read_back(services - 1);
+
+	return 0;
+}
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/lmc.h"
+#include "bench.h"
+
+/*
+ * Correlating services by time: a few services get a day of lines each, at
+ * uneven steps, then all their lines, and those of an hour, are taken in
+ * time order twice: with getlogs per service, sorted on the client, and
+ * with one getlogs_multi, merged on the server. Both must give the same
+ * lines in the same order.
+ * Usage: bench_multi [services [lines_per_service]]
+ */
+#define DAY (24 * 3600)
+
+static int services = 8;
+static long lines = 25000;
+static const time_t day_start = 1600000000 - 1600000000 % DAY;
+
+/* add a line with a time of the day, as lmc_send_log does with the current time */
+static void send_line(struct lmc_conn *conn, int s, long i, time_t t)
+{
+	char buffer[LMC_COMMAND_SIZE], response[LMC_LINE_SIZE], time[LMC_TIME_SIZE];
+	size_t len;
+
+	lmc_time_to_str(time, sizeof(time), LMC_TIME_FORMAT, t);
+	len = snprintf(buffer, sizeof(buffer), "add %s:svc-%d seq=%ld GET /api/v1/orders status=%d", time, s, i,
+		       i % 10 ? 200 : 503);
+	if (lmc_send(conn->socket, buffer, len, 0) < 0 || lmc_recv(conn->socket, response, sizeof(response), 0) < 0)
+		exit(EXIT_FAILURE);
+}
+
+struct tagged {
+	struct lmc_client_service_logline line;
+	int service;
+	uint64_t pos;
+};
+
+static int cmp_tagged(const void *a, const void *b)
+{
+	const struct tagged *x = a, *y = b;
+	int c = strcmp(x->line.line.time, y->line.line.time);
+
+	if (c != 0)
+		return c;
+	if (x->service != y->service)
+		return x->service - y->service;
+	return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+/* getlogs for every service, filtered and sorted by time here */
+static struct tagged *client_merge(struct lmc_conn **conns, char names[][LMC_CLIENT_MAX_NAME], const char *t1,
+				   const char *t2, uint64_t *count, uint64_t *received)
+{
+	struct lmc_client_logline **logs;
+	struct tagged *all = NULL;
+	uint64_t n, i, max = 0;
+	int s;
+
+	*count = *received = 0;
+	for (s = 0; s < services; s++) {
+		logs = lmc_get_logs(conns[s], 0, 0, &n);
+		*received += n;
+		for (i = 0; i < n; i++) {
+			if (t1 == NULL || (strcmp(logs[i]->time, t1) >= 0 && strcmp(logs[i]->time, t2) <= 0)) {
+				if (*count == max) {
+					max = max ? 2 * max : 1024;
+					all = realloc(all, max * sizeof(*all));
+				}
+				memcpy(all[*count].line.service, names[s], LMC_CLIENT_MAX_NAME);
+				memcpy(&all[*count].line.line, logs[i], sizeof(*logs[i]));
+				all[*count].service = s;
+				all[*count].pos = i;
+				(*count)++;
+			}
+			free(logs[i]);
+		}
+		free(logs);
+	}
+	qsort(all, *count, sizeof(*all), cmp_tagged);
+
+	return all;
+}
+
+static void bench(struct lmc_conn **conns, char names[][LMC_CLIENT_MAX_NAME], const char *list, time_t t1,
+		  time_t t2, const char *what)
+{
+	struct lmc_client_service_logline *merged;
+	char from[LMC_TIME_SIZE], to[LMC_TIME_SIZE];
+	struct tagged *sorted;
+	uint64_t count, received, n, i, diff = 0;
+	double t_client, t_server;
+
+	lmc_time_to_str(from, sizeof(from), LMC_TIME_FORMAT, t1);
+	lmc_time_to_str(to, sizeof(to), LMC_TIME_FORMAT, t2);
+
+	t_client = bench_now();
+	sorted = client_merge(conns, names, t1 != 0 ? from : NULL, to, &count, &received);
+	t_client = bench_now() - t_client;
+
+	t_server = bench_now();
+	merged = lmc_get_logs_multi(conns[0], list, t1, t2, &n);
+	t_server = bench_now() - t_server;
+
+	for (i = 0; i < n && i < count; i++)
+		if (strcmp(merged[i].service, sorted[i].line.service) != 0 ||
+		    strcmp(merged[i].line.time, sorted[i].line.line.time) != 0 ||
+		    strcmp(merged[i].line.logline, sorted[i].line.line.logline) != 0) {
+			if (diff++ == 0)
+				fprintf(stderr, "first difference at " UINT64_FMT ": %s %s %s / %s %s %s\n", i,
+					merged[i].service, merged[i].line.time, merged[i].line.logline,
+					sorted[i].line.service, sorted[i].line.line.time, sorted[i].line.line.logline);
+		}
+	fprintf(stderr, "%-10s getlogs + sort %8.1f ms, " UINT64_FMT " lines received   getlogs_multi %8.1f ms, "
+		UINT64_FMT " lines   %s\n", what, t_client * 1e3, received, t_server * 1e3, n,
+		n == count && diff == 0 ? "same order" : "DIFFERENT");
+
+	free(sorted);
+	lmc_free_buf(merged);
+}
+
+int main(int argc, char *argv[])
+{
+	char names[64][LMC_CLIENT_MAX_NAME], list[LMC_COMMAND_SIZE];
+	struct lmc_conn *conns[64];
+	unsigned int seed = 1;
+	time_t t;
+	size_t len = 0;
+	long i;
+	int s;
+
+	if (argc > 1)
+		services = atoi(argv[1]);
+	if (argc > 2)
+		lines = atol(argv[2]);
+	if (services < 1 || services > 32)
+		services = 8;
+
+	/* the library echoes every reply */
+	freopen("/dev/null", "w", stdout);
+
+	for (s = 0; s < services; s++) {
+		snprintf(names[s], sizeof(names[s]), "bmul%d-%d", (int)getpid() % 10000, s);
+		len += snprintf(list + len, sizeof(list) - len, "%s%s", s ? "," : "", names[s]);
+		conns[s] = lmc_connect(names[s]);
+		if (conns[s] == NULL)
+			exit(EXIT_FAILURE);
+
+		/* steps of 0 to 2 average steps, so the services interleave unevenly */
+		t = day_start;
+		for (i = 0; i < lines; i++) {
+			t += rand_r(&seed) % (2 * DAY / lines + 1);
+			send_line(conns[s], s, i, t < day_start + DAY ? t : day_start + DAY - 1);
+		}
+	}
+
+	bench(conns, names, list, 0, 0, "all");
+	bench(conns, names, list, day_start + 12 * 3600, day_start + 13 * 3600 - 1, "one hour");
+
+	for (s = 0; s < services; s++) {
+		lmc_unsubscribe(conns[s]);
+		lmc_free(conns[s]);
+	}
+	return 0;
+}
@@ -0,0 +1,182 @@
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/dfa.h"
+#include "../include/lmc.h"
+#include "bench.h"
+
+/*
+ * Regular expressions over log lines. First the matchers alone, in this
+ * process, over lines laid out like the log line array of a cache: the DFA
+ * the server builds and POSIX regexec, in M lines/s on one core. The last
+ * patterns need more DFA states than are held at once, so their DFA is built
+ * while matching, and emptied when full. Then a regex getlogs done by the
+ * server, against getting all the lines with getlogs and matching them here.
+ * Usage: bench_regex [lines [server_lines]]
+ */
+static long lines = 200000;
+static long server_lines = 200000;
+static int rounds = 3;
+
+static const char *levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+static const char *methods[] = { "GET", "GET", "GET", "POST", "PUT", "DELETE" };
+static const char *paths[] = { "/api/v1/users", "/api/v1/orders", "/api/v1/cart", "/health", "/static/app.js" };
+
+static void make_line(long i, char *buf, size_t len)
+{
+	snprintf(buf, len, "%s [worker-%ld] %s %s user=%d status=%d latency=%ldms req=%08lx",
+		 levels[rand() % nitems(levels)], i % 8, methods[rand() % nitems(methods)],
+		 paths[rand() % nitems(paths)], 1000 + rand() % 5000, rand() % 10 ? 200 : 503,
+		 (long)(rand() % 300), (unsigned long)rand());
+	if (i % 1000 == 7)
+		snprintf(buf, len, "ERROR [worker-%ld] upstream timeout after %dms req=%08lx", i % 8,
+			 1000 + rand() % 9000, (unsigned long)i);
+}
+
+static long scan(struct lmc_client_logline *logs, struct lmc_dfa *dfa, regex_t *re)
+{
+	long i, hits = 0;
+
+	for (i = 0; i < lines; i++) {
+		if (re != NULL)
+			hits += regexec(re, logs[i].logline, 0, NULL, 0) == 0;
+		else
+			hits += lmc_dfa_match(dfa, logs[i].logline, LMC_LOGLINE_SIZE);
+	}
+	return hits;
+}
+
+static double best_of(struct lmc_client_logline *logs, struct lmc_dfa *dfa, regex_t *re, long *hits)
+{
+	double t0, t, best = 1e9;
+	int r;
+
+	for (r = 0; r < rounds; r++) {
+		t0 = bench_now();
+		*hits = scan(logs, dfa, re);
+		t = bench_now() - t0;
+		if (t < best)
+			best = t;
+	}
+	return best;
+}
+
+static void bench_matchers(void)
+{
+	static const char *patterns[] = {
+		"timeout after [0-9]+ms",
+		"(POST|PUT) /api/v1/(users|orders) .*status=503",
+		"^ERROR .*latency=2[0-9][0-9]ms",
+		"req=[0-9a-f]*(a|b)[0-9a-f]{6}$",
+		"(a|b|c|d|e|f)*(a|b)(a|b|c|d|e|f){10}$",
+		"[0-9a-f]*[ab][0-9a-f]{7} ",
+	};
+	struct lmc_client_logline *logs;
+	struct lmc_dfa dfa;
+	const char *error;
+	double t0, compile, t[2];
+	long i, hits[2];
+	size_t p;
+	regex_t re;
+
+	logs = calloc(lines, sizeof(*logs));
+	if (logs == NULL)
+		exit(EXIT_FAILURE);
+	srand(1);
+	for (i = 0; i < lines; i++)
+		make_line(i, logs[i].logline, sizeof(logs[i].logline));
+	printf("%ld lines, M lines/s\n", lines);
+
+	for (p = 0; p < nitems(patterns); p++) {
+		t0 = bench_now();
+		if (lmc_dfa_compile(&dfa, patterns[p], strlen(patterns[p]), &error) != 0) {
+			printf("%s: %s\n", patterns[p], error);
+			continue;
+		}
+		compile = bench_now() - t0;
+		regcomp(&re, patterns[p], REG_EXTENDED | REG_NOSUB);
+
+		t[0] = best_of(logs, &dfa, NULL, &hits[0]);
+		t[1] = best_of(logs, NULL, &re, &hits[1]);
+		printf("%s\n  %3d states%s, compiled in %5.2f ms: dfa %6.2f, regexec %6.2f, %ld hits%s\n",
+		       patterns[p], dfa.states, dfa.complete ? "" : " (lazy)", compile * 1e3, lines / t[0] / 1e6,
+		       lines / t[1] / 1e6, hits[0], hits[0] == hits[1] ? "" : ", MISMATCH");
+		if (!dfa.complete)
+			printf("  emptied %lu times in %d rounds\n", (unsigned long)dfa.flushes, rounds);
+
+		regfree(&re);
+		lmc_dfa_free(&dfa);
+	}
+
+	free(logs);
+}
+
+static void bench_server(void)
+{
+	const char *pattern = "timeout after [0-9]+ms";
+	struct lmc_client_logline **logs;
+	char name[LMC_CLIENT_MAX_NAME], log[LMC_LOGLINE_SIZE];
+	struct lmc_conn *conn;
+	uint64_t count, i, hits;
+	double t0, t;
+	regex_t re;
+	long n;
+
+	snprintf(name, sizeof(name), "bregex%d", (int)getpid() % 10000);
+	conn = lmc_connect(name);
+	if (conn == NULL)
+		exit(EXIT_FAILURE);
+
+	srand(2);
+	for (n = 0; n < server_lines; n++) {
+		make_line(n, log, sizeof(log));
+		if (lmc_send_log(conn, log) < 0)
+			exit(EXIT_FAILURE);
+	}
+
+	t0 = bench_now();
+	regcomp(&re, pattern, REG_EXTENDED | REG_NOSUB);
+	logs = lmc_get_logs(conn, 0, 0, &count);
+	hits = 0;
+	for (i = 0; i < count; i++) {
+		hits += regexec(&re, logs[i]->logline, 0, NULL, 0) == 0;
+		free(logs[i]);
+	}
+	free(logs);
+	regfree(&re);
+	t = bench_now() - t0;
+	fprintf(stderr, "getlogs + regexec here: %7.1f ms, " UINT64_FMT " lines moved (%.1f MB), " UINT64_FMT " hits\n",
+		t * 1e3, count, count * sizeof(struct lmc_client_logline) / 1e6, hits);
+
+	t0 = bench_now();
+	logs = lmc_get_logs_regex(conn, pattern, 0, 0, &count);
+	t = bench_now() - t0;
+	for (i = 0; i < count; i++)
+		free(logs[i]);
+	free(logs);
+	fprintf(stderr, "getlogs regex:          %7.1f ms, " UINT64_FMT " lines moved, %s\n", t * 1e3, count,
+		count == hits ? "same hits" : "DIFFERENT hits");
+
+	lmc_unsubscribe(conn);
+	lmc_free(conn);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1)
+		lines = atol(argv[1]);
+	if (argc > 2)
+		server_lines = atol(argv[2]);
+
+	bench_matchers();
+	fflush(stdout);
+
+	/* the library echoes every reply */
+	freopen("/dev/null", "w", stdout);
+	bench_server();
+	return 0;
+}
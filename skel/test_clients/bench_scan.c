@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/column.h"
+#include "../include/utils.h"
+#include "bench.h"
+
+/*
+ * Interval scans over the log lines held in memory, the way getlogs with an
+ * interval filters them: by comparing the time string of every line, which
+ * reads each whole 256 byte line, or by scanning the time column first and
+ * only reading the lines in the interval. Lines in the interval are copied
+ * out, like getlogs sends them. Both scans must find the same lines.
+ * Usage: bench_scan [lines]
+ */
+static long lines = 500000;
+static int rounds = 5;
+
+/* lines found are copied here, like into a socket buffer */
+static char out[64 << 10];
+static size_t out_pos;
+
+static void copy_out(struct lmc_client_logline *line)
+{
+	if (out_pos + sizeof(*line) > sizeof(out))
+		out_pos = 0;
+	memcpy(out + out_pos, line, sizeof(*line));
+	out_pos += sizeof(*line);
+}
+
+/* same as the filter of the server */
+static int is_in_interval(char *time, char *start, char *end)
+{
+	if (end[0] == '\0')
+		return strcmp(time, start) >= 0;
+	return strcmp(time, start) >= 0 && strcmp(time, end) <= 0;
+}
+
+static void time_of(long i, char *buf)
+{
+	time_t t = 1600000000 + i / 50;
+	struct tm tm;
+
+	gmtime_r(&t, &tm);
+	strftime(buf, LMC_TIME_SIZE, LMC_TIME_FORMAT, &tm);
+}
+
+static uint64_t scan_rows(struct lmc_client_logline *logs, char *start, char *end)
+{
+	uint64_t found = 0;
+	long i;
+
+	for (i = 0; i < lines; i++) {
+		if (!is_in_interval(logs[i].time, start, end))
+			continue;
+		copy_out(&logs[i]);
+		found++;
+	}
+	return found;
+}
+
+static uint64_t scan_column(struct lmc_client_logline *logs, struct lmc_time_column *col, char *start, char *end)
+{
+	struct lmc_time_range range;
+	uint64_t found = 0;
+	long i;
+	int in;
+
+	lmc_time_range(&range, start, end);
+	for (i = 0; i < lines; i++) {
+		in = lmc_time_range_test(&range, lmc_column_get(col, i));
+		if (in == 0 || (in < 0 && !is_in_interval(logs[i].time, start, end)))
+			continue;
+		copy_out(&logs[i]);
+		found++;
+	}
+	return found;
+}
+
+int main(int argc, char *argv[])
+{
+	static const int percents[] = { 1, 10, 100 };
+	struct lmc_client_logline *logs;
+	struct lmc_time_column col;
+	char start[LMC_TIME_SIZE], end[LMC_TIME_SIZE];
+	unsigned int check = 0;
+	uint64_t found_rows = 0, found_col = 0;
+	double t0, t, best_rows, best_col;
+	long i, span;
+	size_t p;
+	int r;
+
+	if (argc > 1)
+		lines = atol(argv[1]);
+
+	logs = calloc(lines, sizeof(*logs));
+	memset(&col, 0, sizeof(col));
+	if (logs == NULL)
+		return EXIT_FAILURE;
+
+	for (i = 0; i < lines; i++) {
+		time_of(i, logs[i].time);
+		snprintf(logs[i].logline, sizeof(logs[i].logline), "INFO request %ld served in %ld ms", i, i % 300);
+	}
+	t = bench_now();
+	for (i = 0; i < lines; i++)
+		if (lmc_column_set(&col, i, 0, lmc_time_key(logs[i].time)) != 0)
+			return EXIT_FAILURE;
+	fprintf(stderr, "%ld lines, %ld MB of lines, %ld MB of time keys, %.1f ns to key a line\n", lines,
+		lines * (long)sizeof(*logs) >> 20, lines * (long)sizeof(uint64_t) >> 20, (bench_now() - t) * 1e9 / lines);
+
+	for (p = 0; p < sizeof(percents) / sizeof(*percents); p++) {
+		/* an interval in the middle of the lines, both bounds included */
+		span = lines / 100 * percents[p];
+		time_of((lines - span) / 2, start);
+		time_of((lines - span) / 2 + span - 1, end);
+		if (percents[p] == 100)
+			end[0] = '\0';
+
+		best_rows = best_col = 1e9;
+		for (r = 0; r < rounds; r++) {
+			t0 = bench_now();
+			found_rows = scan_rows(logs, start, end);
+			t = bench_now() - t0;
+			if (t < best_rows)
+				best_rows = t;
+
+			t0 = bench_now();
+			found_col = scan_column(logs, &col, start, end);
+			t = bench_now() - t0;
+			if (t < best_col)
+				best_col = t;
+		}
+
+		fprintf(stderr, "interval %3d%%: " UINT64_FMT " lines; rows %6.1f ms (%6.1f M lines/s), "
+			"column %6.1f ms (%6.1f M lines/s), %.1fx%s\n",
+			percents[p], found_rows, best_rows * 1e3, lines / best_rows / 1e6, best_col * 1e3,
+			lines / best_col / 1e6, best_rows / best_col, found_rows == found_col ? "" : ", MISMATCH");
+	}
+
+	/* the copies have to be made */
+	for (i = 0; i < (long)sizeof(out); i++)
+		check += (unsigned char)out[i];
+	fprintf(stderr, "(checksum %u)\n", check);
+
+	lmc_column_free(&col);
+	free(logs);
+	return 0;
+}
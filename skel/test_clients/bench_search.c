@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/lmc.h"
+#include "../include/search.h"
+#include "bench.h"
+
+/*
+ * Substring search over log lines. First the kernels alone, in this process,
+ * over lines laid out like the log line array of a cache: the kernel the
+ * server uses, memchr on the first byte and strstr, in GB/s of log text on
+ * one core. Then a search for a rare token done by the server with search,
+ * against getting all the lines with getlogs and searching them here.
+ * Usage: bench_search [lines [server_lines]]
+ */
+static long lines = 1000000;
+static long server_lines = 200000;
+static int rounds = 5;
+
+static const char *levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+static const char *paths[] = { "/api/v1/users", "/api/v1/orders", "/api/v1/cart", "/health", "/static/app.js" };
+
+static void make_line(long i, char *buf, size_t len)
+{
+	snprintf(buf, len, "%s [worker-%ld] GET %s user=%d status=%d latency=%ldms req=%08lx",
+		 levels[rand() % nitems(levels)], i % 8, paths[rand() % nitems(paths)], 1000 + rand() % 5000,
+		 rand() % 10 ? 200 : 503, (long)(rand() % 300), (unsigned long)rand());
+	/* the rare token */
+	if (i % 100000 == 77)
+		snprintf(buf, len, "ERROR [worker-%ld] payment gateway timeout req=%08lx", i % 8, (unsigned long)i);
+}
+
+static long scan(struct lmc_client_logline *logs, const struct lmc_search *s, int kernel)
+{
+	long i, hits = 0;
+	size_t len;
+
+	for (i = 0; i < lines; i++) {
+		switch (kernel) {
+		case 0:
+			hits += lmc_search_line(s, logs[i].logline);
+			break;
+		case 1:
+			len = strnlen(logs[i].logline, LMC_LOGLINE_SIZE);
+			hits += lmc_search_find_sw(s, logs[i].logline, len) != NULL;
+			break;
+		default:
+			hits += strstr(logs[i].logline, s->pattern) != NULL;
+			break;
+		}
+	}
+	return hits;
+}
+
+static void bench_kernels(void)
+{
+	static const char *patterns[] = { "payment gateway", "status=503", "ms", "zq" };
+	static const char *kernels[] = { NULL, "memchr", "strstr" };
+	struct lmc_client_logline *logs;
+	struct lmc_search s;
+	double text = 0, t0, t, best;
+	long i, hits[3];
+	size_t p;
+	int k, r;
+
+	logs = calloc(lines, sizeof(*logs));
+	if (logs == NULL)
+		exit(EXIT_FAILURE);
+	srand(1);
+	for (i = 0; i < lines; i++) {
+		make_line(i, logs[i].logline, sizeof(logs[i].logline));
+		text += strlen(logs[i].logline);
+	}
+	kernels[0] = lmc_search_kernel();
+	printf("%ld lines, %.0f MB of text, %.1f bytes per line\n", lines, text / 1e6, text / lines);
+
+	for (p = 0; p < nitems(patterns); p++) {
+		lmc_search_init(&s, patterns[p], strlen(patterns[p]));
+		printf("%-16s", patterns[p]);
+		for (k = 0; k < 3; k++) {
+			best = 1e9;
+			for (r = 0; r < rounds; r++) {
+				t0 = bench_now();
+				hits[k] = scan(logs, &s, k);
+				t = bench_now() - t0;
+				if (t < best)
+					best = t;
+			}
+			printf(" %s %5.2f GB/s", kernels[k], text / best / 1e9);
+		}
+		printf(", %ld hits%s\n", hits[0], hits[0] == hits[1] && hits[0] == hits[2] ? "" : ", MISMATCH");
+	}
+
+	free(logs);
+}
+
+static void bench_server(void)
+{
+	struct lmc_client_logline **logs;
+	char name[LMC_CLIENT_MAX_NAME], log[LMC_LOGLINE_SIZE];
+	const char *pattern = "payment gateway";
+	struct lmc_conn *conn;
+	uint64_t count, i, hits;
+	double t0, t;
+	long n;
+
+	snprintf(name, sizeof(name), "bsearch%d", (int)getpid() % 10000);
+	conn = lmc_connect(name);
+	if (conn == NULL)
+		exit(EXIT_FAILURE);
+
+	srand(2);
+	for (n = 0; n < server_lines; n++) {
+		make_line(n, log, sizeof(log));
+		if (lmc_send_log(conn, log) < 0)
+			exit(EXIT_FAILURE);
+	}
+
+	t0 = bench_now();
+	logs = lmc_get_logs(conn, 0, 0, &count);
+	hits = 0;
+	for (i = 0; i < count; i++) {
+		hits += strstr(logs[i]->logline, pattern) != NULL;
+		free(logs[i]);
+	}
+	free(logs);
+	t = bench_now() - t0;
+	fprintf(stderr, "getlogs + strstr here: %7.1f ms, " UINT64_FMT " lines moved (%.1f MB), " UINT64_FMT " hits\n",
+		t * 1e3, count, count * sizeof(struct lmc_client_logline) / 1e6, hits);
+
+	t0 = bench_now();
+	logs = lmc_search(conn, pattern, 0, 0, &count);
+	t = bench_now() - t0;
+	for (i = 0; i < count; i++)
+		free(logs[i]);
+	free(logs);
+	fprintf(stderr, "search on the server:  %7.1f ms, " UINT64_FMT " lines moved, %s\n", t * 1e3, count,
+		count == hits ? "same hits" : "DIFFERENT hits");
+
+	lmc_unsubscribe(conn);
+	lmc_free(conn);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1)
+		lines = atol(argv[1]);
+	if (argc > 2)
+		server_lines = atol(argv[2]);
+
+	bench_kernels();
+	fflush(stdout);
+
+	/* the library echoes every reply */
+	freopen("/dev/null", "w", stdout);
+	bench_server();
+	return 0;
+}
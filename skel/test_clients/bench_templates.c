@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/lmc.h"
+#include "bench.h"
+
+/*
+ * Log templates: two services add the same lines, built from 50 message
+ * formats, one with templates mined and one without. Once the tier pass
+ * compressed their old lines, reports the warm memory of both from stat,
+ * checks every line read back, and compares the templates query against
+ * grouping the lines read with getlogs on the client side.
+ * Usage: bench_templates [lines]
+ */
+static long lines = 200000;
+static int wait_seconds = 30;
+
+static const char *subsystems[] = { "auth:", "billing:", "cart:", "search:", "gateway:",
+				    "storage:", "mailer:", "scheduler:", "metrics:", "profile:" };
+
+static void make_line(long i, char *buf, size_t len)
+{
+	unsigned long r = (unsigned long)i * 2654435761UL;
+	const char *sub = subsystems[r % 10];
+
+	switch ((r >> 8) % 5) {
+	case 0:
+		snprintf(buf, len, "%s connection from 10.0.%lu.%lu port %lu accepted", sub, (r >> 12) % 8,
+			 (r >> 16) % 256, 1024 + (r >> 4) % 60000);
+		break;
+	case 1:
+		snprintf(buf, len, "%s request %08lx served in %lu ms status %d", sub, r & 0xffffffffUL,
+			 (r >> 20) % 300, (r >> 12) % 10 ? 200 : 503);
+		break;
+	case 2:
+		snprintf(buf, len, "%s cache miss for key user:%lu, loading from backend shard %lu", sub,
+			 (r >> 10) % 100000, (r >> 14) % 16);
+		break;
+	case 3:
+		snprintf(buf, len, "%s retrying write of %lu bytes to replica %lu, attempt %lu of 5", sub,
+			 (r >> 6) % 65536, (r >> 18) % 3, 1 + (r >> 22) % 5);
+		break;
+	default:
+		snprintf(buf, len, "%s session %08lx of user %lu expired after %lu s idle", sub,
+			 (r >> 3) & 0xffffffffUL, (r >> 11) % 100000, 60 + (r >> 24) % 3600);
+		break;
+	}
+}
+
+static struct lmc_conn *add_lines(const char *name, const char *opts)
+{
+	char log[LMC_LOGLINE_SIZE];
+	struct lmc_conn *conn;
+	long i;
+
+	conn = lmc_connect_opts((char *)name, opts);
+	if (conn == NULL)
+		exit(EXIT_FAILURE);
+	for (i = 0; i < lines; i++) {
+		make_line(i, log, sizeof(log));
+		if (lmc_send_log(conn, log) < 0)
+			exit(EXIT_FAILURE);
+	}
+	if (lmc_flush(conn) < 0)
+		exit(EXIT_FAILURE);
+	return conn;
+}
+
+/**
+ * Group lines like the server does without its miner: replace the tokens
+ * holding digits, then count the distinct results.
+ */
+static unsigned long group_lines(struct lmc_client_logline **logs, uint64_t count)
+{
+	static char keys[4096][LMC_LOGLINE_SIZE];
+	char line[LMC_LOGLINE_SIZE], key[LMC_LOGLINE_SIZE], *tok, *save;
+	unsigned long groups = 0, h;
+	uint64_t i;
+	size_t len, n;
+	const char *c;
+
+	memset(keys, 0, sizeof(keys));
+	for (i = 0; i < count; i++) {
+		strcpy(line, logs[i]->logline);
+		len = 0;
+		for (tok = strtok_r(line, " ", &save); tok != NULL; tok = strtok_r(NULL, " ", &save))
+			len += snprintf(key + len, sizeof(key) - len, "%s ", strpbrk(tok, "0123456789") ? "<*>" : tok);
+
+		for (h = 5381, c = key; *c; c++)
+			h = h * 33 + (unsigned char)*c;
+		for (n = h % 4096; keys[n][0] != '\0' && strcmp(keys[n], key) != 0; n = (n + 1) % 4096)
+			;
+		if (keys[n][0] == '\0') {
+			strcpy(keys[n], key);
+			groups++;
+		}
+	}
+
+	return groups;
+}
+
+static void read_back(struct lmc_conn *conn, const char *what)
+{
+	struct lmc_client_logline **logs;
+	char expected[LMC_LOGLINE_SIZE];
+	uint64_t count, i, bad = 0;
+	unsigned long groups;
+	double t0, t_get, t_group;
+
+	t0 = bench_now();
+	logs = lmc_get_logs(conn, 0, 0, &count);
+	t_get = bench_now() - t0;
+	t0 = bench_now();
+	groups = group_lines(logs, count);
+	t_group = bench_now() - t0;
+
+	for (i = 0; i < count; i++) {
+		make_line((long)i, expected, sizeof(expected));
+		if (strcmp(logs[i]->logline, expected) != 0)
+			bad++;
+		free(logs[i]);
+	}
+	free(logs);
+
+	fprintf(stderr, "%-13s getlogs " UINT64_FMT " lines in %4.0f ms, " UINT64_FMT " wrong; "
+		"grouped by the client in %4.0f ms: %lu groups\n",
+		what, count, t_get * 1e3, bad + (uint64_t)lines - count, t_group * 1e3, groups);
+}
+
+int main(int argc, char *argv[])
+{
+	char name[2][LMC_CLIENT_MAX_NAME];
+	struct bench_tiers tiers;
+	struct lmc_conn *conns[2];
+	char **templates;
+	uint64_t count, i;
+	double t0, t;
+
+	if (argc > 1)
+		lines = atol(argv[1]);
+
+	/* the library echoes every reply */
+	freopen("/dev/null", "w", stdout);
+
+	snprintf(name[0], sizeof(name[0]), "btpl%d", (int)getpid() % 10000);
+	snprintf(name[1], sizeof(name[1]), "braw%d", (int)getpid() % 10000);
+	conns[0] = add_lines(name[0], "templates=on");
+	conns[1] = add_lines(name[1], "templates=off");
+	fprintf(stderr, "%ld lines added to both services\n", lines);
+
+	/* the tier pass runs with the compaction pass */
+	bench_wait_tier(conns[0], "warm", wait_seconds);
+	bench_wait_tier(conns[1], "warm", wait_seconds);
+	bench_get_tiers(conns[1], &tiers);
+	fprintf(stderr, "templates off: %lu warm lines in %lu KB of %lu KB (%.1fx)\n", tiers.warm, tiers.warm_kb,
+		tiers.warm_raw_kb, tiers.warm_kb ? (double)tiers.warm_raw_kb / tiers.warm_kb : 0.0);
+	bench_get_tiers(conns[0], &tiers);
+	fprintf(stderr, "templates on:  %lu warm lines in %lu KB of %lu KB (%.1fx)\n", tiers.warm, tiers.warm_kb,
+		tiers.warm_raw_kb, tiers.warm_kb ? (double)tiers.warm_raw_kb / tiers.warm_kb : 0.0);
+
+	read_back(conns[1], "templates off");
+	read_back(conns[0], "templates on");
+
+	t0 = bench_now();
+	templates = lmc_get_templates(conns[0], &count);
+	t = bench_now() - t0;
+	fprintf(stderr, "templates query: " UINT64_FMT " templates in %.2f ms\n", count, t * 1e3);
+	for (i = 0; i < count; i++) {
+		if (i < 5)
+			fprintf(stderr, "  %s\n", templates[i]);
+		lmc_free_buf(templates[i]);
+	}
+	lmc_free_buf(templates);
+
+	for (i = 0; i < 2; i++) {
+		lmc_unsubscribe(conns[i]);
+		lmc_free(conns[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/lmc.h"
+#include "bench.h"
+
+/*
+ * Storage tiers: a service adds lines and flushes them, then the tier pass
+ * of the server compresses the old ones (warm). With a budget, a second
+ * service then fills memory past the pressure threshold, and the warm lines
+ * of the first one go to disk (cold). Reports the tiers of the first
+ * service from stat and how long getlogs takes in every state; every line
+ * read back is checked against the one that was added. The server has to
+ * run with the same budget:
+ *     lmcd <logdir> <budget_mb * 1048576>
+ * Usage: bench_tiers [lines [budget_mb]]
+ */
+static long lines = 200000;
+static long budget_mb;
+static int wait_seconds = 30;
+
+static const char *paths[] = { "/v1/items", "/v1/users/login", "/v1/cart", "/healthz", "/v2/search" };
+static const char *levels[] = { "INFO", "INFO", "INFO", "WARN", "DEBUG" };
+
+static void make_line(long i, char *buf, size_t len)
+{
+	unsigned long r = (unsigned long)i * 2654435761UL;
+
+	snprintf(buf, len, "%s api-%lu request %08lx from 10.0.%lu.%lu GET %s?page=%lu status %d in %lu ms",
+		 levels[r % 5], r % 4, r & 0xffffffffUL, (r >> 8) % 8, (r >> 16) % 256, paths[(r >> 4) % 5],
+		 (r >> 12) % 20, (r >> 20) % 10 ? 200 : 404, (r >> 24) % 300);
+}
+
+static void print_tiers(struct lmc_conn *conn)
+{
+	bench_print_stat(conn, "Tiers:");
+	bench_print_stat(conn, "Migrations:");
+}
+
+static void read_back(struct lmc_conn *conn, const char *what)
+{
+	struct lmc_client_logline **logs;
+	char expected[LMC_LOGLINE_SIZE];
+	uint64_t count, i, bad = 0;
+	double t0, t;
+
+	t0 = bench_now();
+	logs = lmc_get_logs(conn, 0, 0, &count);
+	t = bench_now() - t0;
+
+	for (i = 0; i < count; i++) {
+		make_line((long)i, expected, sizeof(expected));
+		if (strcmp(logs[i]->logline, expected) != 0)
+			bad++;
+		free(logs[i]);
+	}
+	free(logs);
+
+	fprintf(stderr, "getlogs %-5s " UINT64_FMT " lines in %4.0f ms (%.2f M lines/s), " UINT64_FMT " wrong\n",
+		what, count, t * 1e3, count / t / 1e6, bad + (uint64_t)lines - count);
+}
+
+static struct lmc_conn *add_lines(const char *name, long count, int check)
+{
+	char log[LMC_LOGLINE_SIZE];
+	struct lmc_conn *conn;
+	long i;
+
+	conn = lmc_connect((char *)name);
+	if (conn == NULL)
+		exit(EXIT_FAILURE);
+	for (i = 0; i < count; i++) {
+		make_line(check ? i : i * 7 + 3, log, sizeof(log));
+		if (lmc_send_log(conn, log) < 0)
+			exit(EXIT_FAILURE);
+	}
+	if (lmc_flush(conn) < 0)
+		exit(EXIT_FAILURE);
+	return conn;
+}
+
+int main(int argc, char *argv[])
+{
+	char name[LMC_CLIENT_MAX_NAME], filler_name[LMC_CLIENT_MAX_NAME];
+	struct lmc_conn *conn, *filler;
+	struct bench_tiers t;
+
+	if (argc > 1)
+		lines = atol(argv[1]);
+	if (argc > 2)
+		budget_mb = atol(argv[2]);
+
+	/* the library echoes every reply */
+	freopen("/dev/null", "w", stdout);
+
+	snprintf(name, sizeof(name), "btier%d", (int)getpid() % 10000);
+	snprintf(filler_name, sizeof(filler_name), "bfill%d", (int)getpid() % 10000);
+
+	conn = add_lines(name, lines, 1);
+	fprintf(stderr, "%ld lines added\n", lines);
+	print_tiers(conn);
+	read_back(conn, "hot");
+
+	/* the tier pass runs with the compaction pass */
+	bench_wait_tier(conn, "warm", wait_seconds);
+	bench_get_tiers(conn, &t);
+	print_tiers(conn);
+	fprintf(stderr, "warm: %lu KB instead of %lu KB (%.1fx), %lu KB in memory\n", t.warm_kb, t.warm_raw_kb,
+		t.warm_kb ? (double)t.warm_raw_kb / t.warm_kb : 0.0, t.memory);
+	read_back(conn, "warm");
+
+	if (budget_mb != 0) {
+		/* fill memory past the pressure threshold, not past the budget */
+		filler = add_lines(filler_name, (budget_mb << 20) / 100 * 85 / LMC_LINE_SIZE, 0);
+		bench_wait_tier(conn, "cold", wait_seconds);
+		bench_get_tiers(conn, &t);
+		print_tiers(conn);
+		fprintf(stderr, "cold: %lu lines on disk, %lu KB in memory\n", t.cold, t.memory);
+		read_back(conn, "cold");
+		lmc_unsubscribe(filler);
+		lmc_free(filler);
+	}
+
+	lmc_unsubscribe(conn);
+	lmc_free(conn);
+	return 0;
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/segment.h"
+#include "bench.h"
+
+/*
+ * Size and decode speed of the timestamps of segment blocks stored as
+ * delta-of-delta varints (LMC_BLOCK_TIMES), for a few ways services log:
+ * at a steady rate, in bursts and sparsely. Sizes are compared with the
+ * timestamp strings and with plain 8 byte time values. Decoding is compared
+ * with a plain varint loop, one byte at a time; both must give the times
+ * back.
+ * Usage: bench_times [lines]
+ */
+static long lines = 3000000;
+static int rounds = 5;
+
+static void generate(int64_t *times, int kind)
+{
+	int64_t t = 1600000000;
+	long i;
+
+	srand(kind + 1);
+	for (i = 0; i < lines; i++) {
+		switch (kind) {
+		case 0: /* 50 lines per second */
+			t = 1600000000 + i / 50;
+			break;
+		case 1: /* bursts of lines, quiet for up to ten minutes in between */
+			if (rand() % 200 == 0)
+				t += rand() % 600;
+			else if (rand() % 20 == 0)
+				t++;
+			break;
+		default: /* a line every few seconds */
+			t += 1 + rand() % 10;
+			break;
+		}
+		times[i] = t;
+	}
+}
+
+/* same format, without the fast path */
+static long decode_plain(const char *data, uint32_t count, int64_t *times)
+{
+	const unsigned char *in = (const unsigned char *)data;
+	uint64_t v, delta = 0, t;
+	uint32_t i;
+	int shift;
+
+	memcpy(&times[0], in, sizeof(times[0]));
+	in += sizeof(times[0]);
+	t = (uint64_t)times[0];
+	for (i = 1; i < count; i++) {
+		v = 0;
+		for (shift = 0;; shift += 7) {
+			v |= (uint64_t)(*in & 0x7f) << shift;
+			if ((*in++ & 0x80) == 0)
+				break;
+		}
+		delta += (uint64_t)((int64_t)(v >> 1) ^ -(int64_t)(v & 1));
+		t += delta;
+		times[i] = (int64_t)t;
+	}
+	return (const char *)in - data;
+}
+
+int main(int argc, char *argv[])
+{
+	static const char *kinds[] = { "steady", "bursts", "sparse" };
+	/* records of a block full of lines of about 80 characters */
+	uint32_t block = LMC_BLOCK_SIZE / (LMC_TIME_SIZE + 80), count;
+	int64_t *times, *out;
+	char *enc;
+	size_t len, *offsets;
+	long b, blocks;
+	double t0, t, best_fast, best_plain;
+	int kind, r, bad;
+
+	if (argc > 1)
+		lines = atol(argv[1]);
+
+	blocks = (lines + block - 1) / block;
+	times = malloc(lines * sizeof(*times));
+	out = malloc(lines * sizeof(*out));
+	enc = malloc(8 * blocks + 10 * lines);
+	offsets = malloc((blocks + 1) * sizeof(*offsets));
+	if (times == NULL || out == NULL || enc == NULL || offsets == NULL)
+		return EXIT_FAILURE;
+
+	printf("%ld lines, blocks of %u records\n", lines, block);
+	for (kind = 0; kind < (int)nitems(kinds); kind++) {
+		generate(times, kind);
+
+		len = 0;
+		for (b = 0; b < blocks; b++) {
+			count = (uint32_t)(lines - b * block < block ? lines - b * block : block);
+			offsets[b] = len;
+			len += lmc_times_encode(times + b * block, count, enc + len);
+		}
+		offsets[blocks] = len;
+
+		best_fast = best_plain = 1e9;
+		bad = 0;
+		for (r = 0; r < rounds; r++) {
+			t0 = bench_now();
+			for (b = 0; b < blocks; b++) {
+				count = (uint32_t)(lines - b * block < block ? lines - b * block : block);
+				if (lmc_times_decode(enc + offsets[b], offsets[b + 1] - offsets[b], count,
+						     out + b * block) < 0)
+					bad = 1;
+			}
+			t = bench_now() - t0;
+			if (t < best_fast)
+				best_fast = t;
+			if (memcmp(out, times, lines * sizeof(*times)) != 0)
+				bad = 1;
+
+			memset(out, 0, lines * sizeof(*out));
+			t0 = bench_now();
+			for (b = 0; b < blocks; b++) {
+				count = (uint32_t)(lines - b * block < block ? lines - b * block : block);
+				decode_plain(enc + offsets[b], count, out + b * block);
+			}
+			t = bench_now() - t0;
+			if (t < best_plain)
+				best_plain = t;
+			if (memcmp(out, times, lines * sizeof(*times)) != 0)
+				bad = 1;
+		}
+
+		printf("%-7s %5.2f bytes per line, %4.1fx smaller than strings, %4.1fx than time values; "
+		       "decode %6.0f M lines/s (%4.1f GB/s of time values), plain loop %6.0f M lines/s%s\n",
+		       kinds[kind], (double)len / lines, (double)(LMC_TIME_SIZE * lines) / len,
+		       (double)(sizeof(*times) * lines) / len, lines / best_fast / 1e6,
+		       lines * sizeof(*times) / best_fast / 1e9, lines / best_plain / 1e6,
+		       bad ? ", MISMATCH" : "");
+	}
+
+	free(offsets);
+	free(enc);
+	free(out);
+	free(times);
+	return 0;
+}
@@ -15,6 +15,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <limits.h>
 #include <unistd.h>
 
 #elif defined(_WIN32)
@@ -36,6 +37,13 @@ const struct lmc_op lmc_ops[] = {
     {LMC_DISCONNECT, "disconnect", "client disconnected", 1},
     {LMC_UNSUBSCRIBE, "unsubcribe", "client unsubscribed", 1},
     {LMC_GETLOGS, "getlogs", "logs received", 1},
+    {LMC_TEMPLATES, "templates", "templates received", 1},
+    {LMC_SEARCH, "search", "search done", 1},
+    {LMC_COUNT, "count", "logs counted", 1},
+    {LMC_HISTOGRAM, "histogram", "histogram received", 1},
+    {LMC_FOLLOW, "follow", "follow ended", 1},
+    {LMC_UNFOLLOW, "unfollow", "not following", 1},
+    {LMC_GETLOGS_MULTI, "getlogs_multi", "logs received", 1},
     {LMC_UNKNOWN, NULL, "unknown command", 0},
 };
 
@@ -175,22 +183,46 @@ ssize_t lmc_recv(SOCKET sock, void *buf, size_t len, int flags)
 	return lmc_xfer(sock, buf, pack_size, flags, 1);
 }
 
+/**
+ * Convert a timestamp in LMC_TIME_FORMAT back into a time value.
+ *
+ * @param str: Timestamp, in local time;
+ * @param result: Converted time.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_str_to_time(const char *str, time_t *result)
+{
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	if (sscanf(str, "%d/%d/%d-%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+		   &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+		return -1;
+
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	tm.tm_isdst = -1;
+
+	*result = mktime(&tm);
+	return *result == (time_t)-1 ? -1 : 0;
+}
+
 #ifdef __unix__
 /**
- * Convert the current time into a human-readable string.
+ * Convert a time value into a human-readable string, in local time.
  *
  * @param result: Buffer to write the format into;
  * @param len: Length of the buffer;
- * @param fmt: Time format string.
+ * @param fmt: Time format string;
+ * @param t: Time to convert.
  *
  * @return: 0 in case of success, or -1 otherwise.
  */
-int lmc_crttime_to_str(char *result, size_t len, const char *fmt)
+int lmc_time_to_str(char *result, size_t len, const char *fmt, time_t t)
 {
-	time_t t;
 	struct tm tm;
 
-	t = time(NULL);
 	if (localtime_r(&t, &tm) == NULL)
 		return -1;
 
@@ -200,34 +232,62 @@ int lmc_crttime_to_str(char *result, size_t len, const char *fmt)
 	return 0;
 }
 
+/**
+ * Convert the current time into a human-readable string.
+ *
+ * @param result: Buffer to write the format into;
+ * @param len: Length of the buffer;
+ * @param fmt: Time format string.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_crttime_to_str(char *result, size_t len, const char *fmt)
+{
+	return lmc_time_to_str(result, len, fmt, time(NULL));
+}
+
 /**
  * Deprecate an old log file. If the file indicated by filepath already exists,
- * move it so a new log file can be created.
+ * move it so a new log file can be created. The file is renamed to
+ * "<filepath>.<time>", adding a "-<n>" suffix if the name is already taken.
  *
- * @param filepath: Path to the file to deprecate.
+ * @param filepath: Path to the file to deprecate;
+ * @param rotated: Buffer receiving the new name of the file, or NULL. Set to
+ *                 an empty string if the file did not exist;
+ * @param len: Length of the rotated buffer.
  *
  * @return: 0 in case of success, or -1 otherwise.
  */
-int lmc_rotate_logfile(char *filepath)
+int lmc_rotate_logfile(char *filepath, char *rotated, size_t len)
 {
 	struct stat s;
-	int rc;
+	int rc, i;
 	char timeap[LMC_TIME_SIZE];
-	char new_name[LMC_CLIENT_MAX_NAME * 4 + LMC_TIME_SIZE + 2];
+	char new_name[PATH_MAX];
+
+	if (rotated != NULL && len > 0)
+		rotated[0] = '\0';
 
 	rc = stat(filepath, &s);
 	/* file does not exist */
 	if (rc != 0)
 		return 0;
 
-	if (s.st_mode & S_IFREG) {
+	if (S_ISREG(s.st_mode)) {
 		/* file exists and is a regular file */
 		if (lmc_crttime_to_str(timeap, LMC_TIME_SIZE, LMC_FTIME_FORMAT))
 			return -1;
 
-		sprintf(new_name, "%s.%s", filepath, timeap);
-		rename(filepath, new_name);
+		snprintf(new_name, sizeof(new_name), "%s.%s", filepath, timeap);
+		for (i = 1; stat(new_name, &s) == 0; i++)
+			snprintf(new_name, sizeof(new_name), "%s.%s-%d", filepath, timeap, i);
+
+		if (rename(filepath, new_name) != 0)
+			return -1;
 		fprintf(stderr, "File %s was renamed to %s\n", filepath, new_name);
+
+		if (rotated != NULL)
+			snprintf(rotated, len, "%s", new_name);
 	} else {
 		/* file exists, but is not regular file */
 		return -1;
@@ -257,20 +317,19 @@ int lmc_init_logdir(char *logfile_path)
 
 #elif defined(_WIN32)
 /**
- * Convert the current time into a human-readable string.
+ * Convert a time value into a human-readable string, in local time.
  *
  * @param result: Buffer to write the format into;
  * @param len: Length of the buffer;
- * @param fmt: Time format string.
+ * @param fmt: Time format string;
+ * @param t: Time to convert.
  *
  * @return: 0 in case of success, or -1 otherwise.
  */
-int lmc_crttime_to_str(char *result, size_t len, const char *fmt)
+int lmc_time_to_str(char *result, size_t len, const char *fmt, time_t t)
 {
-	time_t t;
 	struct tm tm;
 
-	t = time(NULL);
 	if (localtime_s(&tm, &t) != 0)
 		return -1;
 
@@ -280,34 +339,63 @@ int lmc_crttime_to_str(char *result, size_t len, const char *fmt)
 	return 0;
 }
 
+/**
+ * Convert the current time into a human-readable string.
+ *
+ * @param result: Buffer to write the format into;
+ * @param len: Length of the buffer;
+ * @param fmt: Time format string.
+ *
+ * @return: 0 in case of success, or -1 otherwise.
+ */
+int lmc_crttime_to_str(char *result, size_t len, const char *fmt)
+{
+	return lmc_time_to_str(result, len, fmt, time(NULL));
+}
+
 /**
  * Deprecate an old log file. If the file indicated by filepath already exists,
- * move it so a new log file can be created.
+ * move it so a new log file can be created. The file is renamed to
+ * "<filepath>.<time>", adding a "-<n>" suffix if the name is already taken.
  *
- * @param filepath: Path to the file to deprecate.
+ * @param filepath: Path to the file to deprecate;
+ * @param rotated: Buffer receiving the new name of the file, or NULL. Set to
+ *                 an empty string if the file did not exist;
+ * @param len: Length of the rotated buffer.
  *
  * @return: 0 in case of success, or -1 otherwise.
  */
-int lmc_rotate_logfile(char *filepath)
+int lmc_rotate_logfile(char *filepath, char *rotated, size_t len)
 {
 	DWORD fileAttribute;
 	char timeap[LMC_TIME_SIZE];
-	char new_name[LMC_CLIENT_MAX_NAME * 4 + LMC_TIME_SIZE + 2];
+	char new_name[MAX_PATH];
+	int i;
+
+	if (rotated != NULL && len > 0)
+		rotated[0] = '\0';
 
 	fileAttribute = GetFileAttributes(filepath);
 
-	if (fileAttribute != INVALID_FILE_ATTRIBUTES)
+	if (fileAttribute == INVALID_FILE_ATTRIBUTES)
 		/* file does not exist */
 		return 0;
 
-	if (fileAttribute & FILE_ATTRIBUTE_NORMAL) {
+	if (!(fileAttribute & FILE_ATTRIBUTE_DIRECTORY)) {
 		/* file exist, must be renamed */
-		if (lmc_crttime_to_str(timeap, LMC_TIME_SIZE, LMC_TIME_FORMAT))
+		if (lmc_crttime_to_str(timeap, LMC_TIME_SIZE, LMC_FTIME_FORMAT))
 			return -1;
 
 		snprintf(new_name, MAX_PATH, "%s.%s", filepath, timeap);
-		MoveFile(filepath, new_name);
+		for (i = 1; GetFileAttributes(new_name) != INVALID_FILE_ATTRIBUTES; i++)
+			snprintf(new_name, MAX_PATH, "%s.%s-%d", filepath, timeap, i);
+
+		if (!MoveFile(filepath, new_name))
+			return -1;
 		fprintf(stderr, "File %s was renamed to %s\n", filepath, new_name);
+
+		if (rotated != NULL)
+			snprintf(rotated, len, "%s", new_name);
 	} else {
 		/* file exist, but is not regular file */
 		return -1;